@@ -18,8 +18,21 @@ LOCAL_CFLAGS := -std=c11 -DNDEBUG -O3 -ffast-math
 LOCAL_C_INCLUDES := $(LOCAL_PATH)/src
 LOCAL_SRC_FILES := \
 $(LOCAL_PATH)/src/m4aPlayer.c \
+$(LOCAL_PATH)/src/m4aPeaks.c \
+$(LOCAL_PATH)/src/m4aConvert.c \
+$(LOCAL_PATH)/src/m4aProbe.c \
+$(LOCAL_PATH)/src/m4aIndex.c \
 $(LOCAL_PATH)/src/HvLightPipe.c
-LOCAL_LDLIBS := -llog -lOpenSLES
+LOCAL_LDLIBS := -llog -landroid
+# build with M4APLAYER_BACKEND=codec to decode with AMediaExtractor/AMediaCodec
+# instead of OpenSLES (needs APP_PLATFORM android-21 or later)
+ifeq ($(M4APLAYER_BACKEND),codec)
+LOCAL_CFLAGS += -DM4APLAYER_BACKEND_CODEC=1
+LOCAL_SRC_FILES += $(LOCAL_PATH)/src/m4aDecoder_ndk.c
+LOCAL_LDLIBS += -lmediandk
+else
+LOCAL_LDLIBS += -lOpenSLES
+endif
 LOCAL_SHARED_LIBRARIES = pd
 TARGET_PLATFORM := android-9
 TARGET_ARCH_ABI := armeabi-v7a x86
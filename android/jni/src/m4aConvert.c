@@ -0,0 +1,152 @@
+/**
+ * Copyright (c) 2016 Enzien Audio Ltd.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <string.h>
+
+#include "m4aConvert.h"
+
+void m4aConvert_fromDecoder(void *block, bool isFloat, int numChannels,
+    const int16_t *frames, int numDecodedChannels, uint32_t numFrames) {
+  if (isFloat) {
+    float *const buffer = (float *) block;
+    for (uint32_t j = 0; j < numFrames; ++j) {
+      for (int c = 0; c < numChannels; ++c) {
+        buffer[j*numChannels+c] = ((float) frames[j*numDecodedChannels+c]) * CVT_SHORT_FLOAT;
+      }
+    }
+  } else if (numDecodedChannels == numChannels) {
+    memcpy(block, frames, numFrames*numChannels*sizeof(int16_t));
+  } else {
+    int16_t *const buffer = (int16_t *) block;
+    for (uint32_t j = 0; j < numFrames; ++j) {
+      for (int c = 0; c < numChannels; ++c) {
+        buffer[j*numChannels+c] = frames[j*numDecodedChannels+c];
+      }
+    }
+  }
+}
+
+void m4aConvert_toOutlets(const void *samples, bool isFloat, int numChannels,
+    float *outL, float *outR, int k, float gain, float gainStep) {
+  if (isFloat) {
+    const float *const buffer = (const float *) samples;
+    switch (numChannels) {
+      default: break; // WARNING: asset does not have 0, 1, or 2 channels
+      case 2: {
+        if (gain == 1.0f && gainStep == 0.0f) {
+          for (int j = 0; j < k; ++j) {
+            outL[j] = buffer[2*j];
+            outR[j] = buffer[2*j+1];
+          }
+        } else {
+          for (int j = 0; j < k; ++j) {
+            const float g = gain + j*gainStep;
+            outL[j] = buffer[2*j]   * g;
+            outR[j] = buffer[2*j+1] * g;
+          }
+        }
+        break;
+      }
+      case 1: {
+        // mono assets are fanned out to both outlets
+        if (gain == 1.0f && gainStep == 0.0f) {
+          memcpy(outL, buffer, k*sizeof(float));
+        } else {
+          for (int j = 0; j < k; ++j) {
+            outL[j] = buffer[j] * (gain + j*gainStep);
+          }
+        }
+        memcpy(outR, outL, k*sizeof(float));
+        break;
+      }
+      case 0: break;
+    }
+  } else {
+    // the conversion to float is folded into the gain
+    const int16_t *const buffer = (const int16_t *) samples;
+    gain *= CVT_SHORT_FLOAT;
+    gainStep *= CVT_SHORT_FLOAT;
+    switch (numChannels) {
+      default: break; // WARNING: asset does not have 0, 1, or 2 channels
+      case 2: {
+        // uninterleave and convert samples into output buffer
+        for (int j = 0; j < k; ++j) {
+          const float g = gain + j*gainStep;
+          outL[j] = ((float) buffer[2*j])   * g;
+          outR[j] = ((float) buffer[2*j+1]) * g;
+        }
+        break;
+      }
+      case 1: {
+        // mono assets are fanned out to both outlets
+        for (int j = 0; j < k; ++j) {
+          outL[j] = ((float) buffer[j]) * (gain + j*gainStep);
+        }
+        memcpy(outR, outL, k*sizeof(float));
+        break;
+      }
+      case 0: break;
+    }
+  }
+}
+
+void m4aConvert_addToOutlets(const void *samples, bool isFloat, int numChannels,
+    float *sumL, float *sumR, int k, float gain, float gainStep) {
+  if (!isFloat) {
+    gain *= CVT_SHORT_FLOAT;
+    gainStep *= CVT_SHORT_FLOAT;
+  }
+  switch (numChannels) {
+    default: break;
+    case 2: {
+      if (isFloat) {
+        const float *const buffer = (const float *) samples;
+        for (int j = 0; j < k; ++j) {
+          const float g = gain + j*gainStep;
+          sumL[j] += buffer[2*j]   * g;
+          sumR[j] += buffer[2*j+1] * g;
+        }
+      } else {
+        const int16_t *const buffer = (const int16_t *) samples;
+        for (int j = 0; j < k; ++j) {
+          const float g = gain + j*gainStep;
+          sumL[j] += ((float) buffer[2*j])   * g;
+          sumR[j] += ((float) buffer[2*j+1]) * g;
+        }
+      }
+      break;
+    }
+    case 1: {
+      if (isFloat) {
+        const float *const buffer = (const float *) samples;
+        for (int j = 0; j < k; ++j) {
+          const float v = buffer[j] * (gain + j*gainStep);
+          sumL[j] += v;
+          sumR[j] += v;
+        }
+      } else {
+        const int16_t *const buffer = (const int16_t *) samples;
+        for (int j = 0; j < k; ++j) {
+          const float v = ((float) buffer[j]) * (gain + j*gainStep);
+          sumL[j] += v;
+          sumR[j] += v;
+        }
+      }
+      break;
+    }
+    case 0: break;
+  }
+}
@@ -0,0 +1,47 @@
+/**
+ * Copyright (c) 2016 Enzien Audio Ltd.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _M4A_CONVERT_H_
+#define _M4A_CONVERT_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * The sample kernels of the player. Decoded frames are written into the blocks
+ * of a pipe as int16 or float, and perform reads them out of the pipe into the
+ * outlet buffers. Blocks hold one or two interleaved channels. The loops have
+ * no dependencies between frames, so that they are vectorised.
+ */
+
+#define CVT_SHORT_FLOAT 0.00003051757813f
+
+// Writes frames from the decoder into a block with numChannels channels,
+// keeping at most the first numChannels channels of the decoded ones.
+void m4aConvert_fromDecoder(void *block, bool isFloat, int numChannels,
+    const int16_t *frames, int numDecodedChannels, uint32_t numFrames);
+
+// Uninterleaves k frames of a block into the outlet buffers, applying a gain
+// which starts at gain and changes by gainStep per frame. Mono blocks are
+// fanned out to both outlets.
+void m4aConvert_toOutlets(const void *samples, bool isFloat, int numChannels,
+    float *outL, float *outR, int k, float gain, float gainStep);
+
+// like m4aConvert_toOutlets(), but adds the frames to the buffers of a mix bus
+void m4aConvert_addToOutlets(const void *samples, bool isFloat, int numChannels,
+    float *sumL, float *sumR, int k, float gain, float gainStep);
+
+#endif // _M4A_CONVERT_H_
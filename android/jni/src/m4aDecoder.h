@@ -0,0 +1,79 @@
+/**
+ * Copyright (c) 2016 Enzien Audio Ltd.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _M4A_DECODER_H_
+#define _M4A_DECODER_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * A pull decoder for the audio track of a compressed file, producing
+ * interleaved 16-bit samples. It is used by the MediaCodec backend of
+ * m4aPlayer, which decodes ahead of playback on a worker thread. A decoder is
+ * only ever used by one thread at a time.
+ *
+ * m4aDecoder_ndk.c implements it with AMediaExtractor and AMediaCodec.
+ * m4aDecoder_standin.c reads 16-bit PCM WAV files instead, so that the backend
+ * can be built and exercised on Linux.
+ */
+typedef struct m4aDecoder m4aDecoder;
+
+// opens the first audio track of the file at the given path. Returns NULL on failure.
+m4aDecoder *m4aDecoder_open(const char *path);
+
+/**
+ * Opens the first audio track of a file which is embedded in an open file
+ * descriptor, e.g. an uncompressed asset in an APK.
+ *
+ * @param fd  The file descriptor, which is owned (and closed) by the decoder,
+ *            also if opening fails.
+ * @param offset  The byte offset of the file in the descriptor.
+ * @param length  The length of the file in bytes, or -1 for the rest of the descriptor.
+ * @returns  NULL on failure.
+ */
+m4aDecoder *m4aDecoder_openFd(int fd, int64_t offset, int64_t length);
+
+void m4aDecoder_close(m4aDecoder *d);
+
+uint32_t m4aDecoder_getSampleRate(m4aDecoder *d);
+
+int m4aDecoder_getNumChannels(m4aDecoder *d);
+
+// the length of the audio track in frames, or 0 if it is not known
+uint64_t m4aDecoder_getNumFrames(m4aDecoder *d);
+
+/**
+ * Moves the decoder to the given frame. Decoding restarts at a sync sample
+ * some way before it, so that the codec's overlap with the previous frame is
+ * primed, and the frames up to the position are discarded, so the seek is
+ * sample exact and seamless.
+ *
+ * @returns  false if the position could not be reached.
+ */
+bool m4aDecoder_seek(m4aDecoder *d, uint64_t frame);
+
+/**
+ * Decodes up to numFrames interleaved frames into the buffer, which must have
+ * space for numFrames*m4aDecoder_getNumChannels() samples.
+ *
+ * @returns  The number of frames decoded. Fewer than numFrames are only
+ *           returned at the end of the track, and 0 once it has been reached.
+ *           Returns -1 on error.
+ */
+int m4aDecoder_read(m4aDecoder *d, int16_t *buffer, int numFrames);
+
+#endif // _M4A_DECODER_H_
@@ -0,0 +1,300 @@
+/**
+ * Copyright (c) 2016 Enzien Audio Ltd.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <assert.h>
+#include <fcntl.h>
+#include <media/NdkMediaCodec.h>
+#include <media/NdkMediaExtractor.h>
+#include <media/NdkMediaFormat.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "m4aDecoder.h"
+#include "m4aLog.h"
+
+#define M4ADECODER_LOG_TAG "M4aDecoder"
+#define CODEC_TIMEOUT_US 10000
+// Every AAC access unit is a sync sample, but after a flush the first unit
+// decodes without the overlap of the unit before it. Seeks therefore start
+// decoding this many frames early (four units of AAC-LC, two of HE-AAC) and
+// drop the priming output.
+#define SEEK_PREROLL_FRAMES 4096
+#define SETTLE_MAX_STEPS 200 // codec steps while opening, until the output format is known
+
+struct m4aDecoder {
+  int fd;
+  AMediaExtractor *extractor;
+  AMediaCodec *codec;
+  uint32_t sampleRate; // fixed once the decoder has been opened
+  int numChannels;     // of the frames which are read, fixed once opened
+  int numDecodedChannels; // of the codec's output, mixed to numChannels
+  uint64_t numFrames;
+  bool isSettling; // opening, the output format may still change
+  bool isInputDone;  // the end of stream has been queued with the codec
+  bool isOutputDone; // the codec has returned its last buffer
+
+  // decoded frames before this position are dropped, so that seeks are exact
+  uint64_t skipToFrame;
+
+  // frames which have been decoded but not yet read
+  int16_t *pending;
+  uint32_t pendingCapacity; // in frames
+  uint32_t pendingOffset;
+  uint32_t numPendingFrames;
+};
+
+static bool m4aDecoder_decode(m4aDecoder *d);
+
+m4aDecoder *m4aDecoder_open(const char *path) {
+  const int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    __android_log_print(ANDROID_LOG_ERROR, M4ADECODER_LOG_TAG, "Could not open %s.", path);
+    return NULL;
+  }
+  return m4aDecoder_openFd(fd, 0, -1);
+}
+
+m4aDecoder *m4aDecoder_openFd(int fd, int64_t offset, int64_t length) {
+  if (length < 0) length = (int64_t) lseek(fd, 0, SEEK_END) - offset;
+
+  m4aDecoder *d = (m4aDecoder *) calloc(1, sizeof(m4aDecoder));
+  d->fd = fd;
+  d->extractor = AMediaExtractor_new();
+  media_status_t status = AMediaExtractor_setDataSourceFd(d->extractor, fd, offset, length);
+  if (status != AMEDIA_OK) {
+    __android_log_print(ANDROID_LOG_ERROR, M4ADECODER_LOG_TAG,
+        "Could not read the container of fd %i (%i).", fd, (int) status);
+    m4aDecoder_close(d);
+    return NULL;
+  }
+
+  // select the first audio track
+  int64_t durationUs = 0;
+  const size_t numTracks = AMediaExtractor_getTrackCount(d->extractor);
+  for (size_t i = 0; i < numTracks && d->codec == NULL; ++i) {
+    AMediaFormat *format = AMediaExtractor_getTrackFormat(d->extractor, i);
+    const char *mime = NULL;
+    if (AMediaFormat_getString(format, AMEDIAFORMAT_KEY_MIME, &mime) && strncmp(mime, "audio/", 6) == 0) {
+      int32_t sampleRate = 0;
+      int32_t numChannels = 0;
+      AMediaFormat_getInt32(format, AMEDIAFORMAT_KEY_SAMPLE_RATE, &sampleRate);
+      AMediaFormat_getInt32(format, AMEDIAFORMAT_KEY_CHANNEL_COUNT, &numChannels);
+      AMediaFormat_getInt64(format, AMEDIAFORMAT_KEY_DURATION, &durationUs);
+      d->sampleRate = (uint32_t) sampleRate;
+      d->numChannels = numChannels;
+      d->numDecodedChannels = numChannels;
+
+      AMediaExtractor_selectTrack(d->extractor, i);
+      d->codec = AMediaCodec_createDecoderByType(mime);
+      if (d->codec != NULL && (AMediaCodec_configure(d->codec, format, NULL, NULL, 0) != AMEDIA_OK ||
+          AMediaCodec_start(d->codec) != AMEDIA_OK)) {
+        AMediaCodec_delete(d->codec);
+        d->codec = NULL;
+      }
+      if (d->codec == NULL) {
+        __android_log_print(ANDROID_LOG_ERROR, M4ADECODER_LOG_TAG,
+            "Could not create a decoder for fd %i (%s).", fd, mime);
+        AMediaFormat_delete(format);
+        break;
+      }
+    }
+    AMediaFormat_delete(format);
+  }
+  if (d->codec == NULL || d->sampleRate == 0 || d->numChannels <= 0) {
+    __android_log_print(ANDROID_LOG_ERROR, M4ADECODER_LOG_TAG, "fd %i has no playable audio track.", fd);
+    m4aDecoder_close(d);
+    return NULL;
+  }
+
+  // Settle the output format before the player sizes its buffers from it. E.g.
+  // HE-AAC only reports its output rate, and HE-AACv2 (parametric stereo) its
+  // stereo output, once decoding has started. The frames are decoded again
+  // after seeking back to the start.
+  d->isSettling = true;
+  for (int i = 0; i < SETTLE_MAX_STEPS && d->isSettling && !d->isOutputDone; ++i) {
+    if (!m4aDecoder_decode(d)) break;
+  }
+  d->isSettling = false;
+  d->numFrames = (durationUs > 0) ? (uint64_t) ((durationUs * d->sampleRate) / 1000000) : 0;
+  if (d->sampleRate == 0 || d->numChannels <= 0 || !m4aDecoder_seek(d, 0)) {
+    __android_log_print(ANDROID_LOG_ERROR, M4ADECODER_LOG_TAG, "fd %i could not be decoded.", fd);
+    m4aDecoder_close(d);
+    return NULL;
+  }
+  return d;
+}
+
+void m4aDecoder_close(m4aDecoder *d) {
+  if (d->codec != NULL) {
+    AMediaCodec_stop(d->codec);
+    AMediaCodec_delete(d->codec);
+  }
+  if (d->extractor != NULL) AMediaExtractor_delete(d->extractor);
+  if (d->fd >= 0) close(d->fd);
+  free(d->pending);
+  free(d);
+}
+
+uint32_t m4aDecoder_getSampleRate(m4aDecoder *d) {
+  return d->sampleRate;
+}
+
+int m4aDecoder_getNumChannels(m4aDecoder *d) {
+  return d->numChannels;
+}
+
+uint64_t m4aDecoder_getNumFrames(m4aDecoder *d) {
+  return d->numFrames;
+}
+
+bool m4aDecoder_seek(m4aDecoder *d, uint64_t frame) {
+  const uint64_t startFrame = (frame > SEEK_PREROLL_FRAMES) ? frame - SEEK_PREROLL_FRAMES : 0;
+  const int64_t positionUs = (int64_t) ((startFrame * 1000000) / d->sampleRate);
+  const media_status_t status = AMediaExtractor_seekTo(d->extractor, positionUs, AMEDIAEXTRACTOR_SEEK_PREVIOUS_SYNC);
+  AMediaCodec_flush(d->codec);
+  d->isInputDone = false;
+  d->isOutputDone = false;
+  d->skipToFrame = frame;
+  d->pendingOffset = 0;
+  d->numPendingFrames = 0;
+  if (status != AMEDIA_OK) {
+    __android_log_print(ANDROID_LOG_WARN, M4ADECODER_LOG_TAG,
+        "Could not seek to frame %llu (%i).", (unsigned long long) frame, (int) status);
+    return false;
+  }
+  return true;
+}
+
+// Keeps the part of a decoded buffer which lies after skipToFrame, with the
+// channel count which the decoder was opened with. Should the codec change its
+// output after opening, mono is mixed from the first two channels, and stereo
+// is duplicated from mono.
+static void m4aDecoder_keepFrames(m4aDecoder *d, const int16_t *samples, uint32_t numFrames, int64_t presentationTimeUs) {
+  const int numIn = d->numDecodedChannels;
+  const int numOut = d->numChannels;
+
+  // the position of the first frame of the buffer in the track
+  const int64_t frame = (presentationTimeUs * (int64_t) d->sampleRate + 500000) / 1000000;
+  if (frame < (int64_t) d->skipToFrame) {
+    const uint64_t numSkipped = d->skipToFrame - frame;
+    if (numSkipped >= numFrames) return;
+    samples += numSkipped * numIn;
+    numFrames -= (uint32_t) numSkipped;
+  }
+
+  if (numFrames > d->pendingCapacity) {
+    d->pendingCapacity = numFrames;
+    d->pending = (int16_t *) realloc(d->pending, numFrames * numOut * sizeof(int16_t));
+  }
+  if (numIn == numOut) {
+    memcpy(d->pending, samples, numFrames * numOut * sizeof(int16_t));
+  } else {
+    for (uint32_t i = 0; i < numFrames; ++i) {
+      const int16_t *const in = samples + i*numIn;
+      int16_t *const out = d->pending + i*numOut;
+      if (numOut == 1) out[0] = (numIn == 1) ? in[0] : (int16_t) (((int32_t) in[0] + (int32_t) in[1]) / 2);
+      else for (int c = 0; c < numOut; ++c) out[c] = in[(c < numIn) ? c : 0];
+    }
+  }
+  d->pendingOffset = 0;
+  d->numPendingFrames = numFrames;
+}
+
+// Queues the next sample of the track with the codec and takes back one decoded
+// buffer, if either is ready. Returns false on error.
+static bool m4aDecoder_decode(m4aDecoder *d) {
+  if (!d->isInputDone) {
+    const ssize_t index = AMediaCodec_dequeueInputBuffer(d->codec, CODEC_TIMEOUT_US);
+    if (index >= 0) {
+      size_t capacity = 0;
+      uint8_t *const buffer = AMediaCodec_getInputBuffer(d->codec, (size_t) index, &capacity);
+      const ssize_t size = AMediaExtractor_readSampleData(d->extractor, buffer, capacity);
+      if (size < 0) {
+        AMediaCodec_queueInputBuffer(d->codec, (size_t) index, 0, 0, 0, AMEDIACODEC_BUFFER_FLAG_END_OF_STREAM);
+        d->isInputDone = true;
+      } else {
+        const int64_t timeUs = AMediaExtractor_getSampleTime(d->extractor);
+        AMediaCodec_queueInputBuffer(d->codec, (size_t) index, 0, (size_t) size, (uint64_t) timeUs, 0);
+        AMediaExtractor_advance(d->extractor);
+      }
+    }
+  }
+
+  AMediaCodecBufferInfo info;
+  const ssize_t index = AMediaCodec_dequeueOutputBuffer(d->codec, &info, CODEC_TIMEOUT_US);
+  if (index >= 0) {
+    size_t size = 0;
+    const uint8_t *const buffer = AMediaCodec_getOutputBuffer(d->codec, (size_t) index, &size);
+    if (buffer != NULL && info.size > 0) {
+      m4aDecoder_keepFrames(d, (const int16_t *) (buffer + info.offset),
+          (uint32_t) info.size / (d->numDecodedChannels * sizeof(int16_t)), info.presentationTimeUs);
+      d->isSettling = false; // the output format is the one which was announced
+    }
+    AMediaCodec_releaseOutputBuffer(d->codec, (size_t) index, false);
+    if (info.flags & AMEDIACODEC_BUFFER_FLAG_END_OF_STREAM) d->isOutputDone = true;
+    return true;
+  }
+  switch (index) {
+    case AMEDIACODEC_INFO_OUTPUT_FORMAT_CHANGED: {
+      // e.g. HE-AAC, where the output format is only known once decoding has
+      // started. Callers have sized their buffers from the format once the
+      // decoder is open, so only the codec's side may change after that.
+      AMediaFormat *format = AMediaCodec_getOutputFormat(d->codec);
+      int32_t sampleRate = 0;
+      int32_t numChannels = 0;
+      AMediaFormat_getInt32(format, AMEDIAFORMAT_KEY_SAMPLE_RATE, &sampleRate);
+      AMediaFormat_getInt32(format, AMEDIAFORMAT_KEY_CHANNEL_COUNT, &numChannels);
+      AMediaFormat_delete(format);
+      if (numChannels > 0) d->numDecodedChannels = numChannels;
+      if (d->isSettling) {
+        if (sampleRate > 0) d->sampleRate = (uint32_t) sampleRate;
+        if (numChannels > 0) d->numChannels = numChannels;
+        d->isSettling = false;
+      } else if (sampleRate > 0 && (uint32_t) sampleRate != d->sampleRate) {
+        __android_log_print(ANDROID_LOG_WARN, M4ADECODER_LOG_TAG,
+            "The output rate changed to %iHz after opening, the track will play at the wrong speed.", (int) sampleRate);
+      }
+      return true;
+    }
+    case AMEDIACODEC_INFO_OUTPUT_BUFFERS_CHANGED:
+    case AMEDIACODEC_INFO_TRY_AGAIN_LATER: return true;
+    default: {
+      __android_log_print(ANDROID_LOG_ERROR, M4ADECODER_LOG_TAG, "Decoding failed (%i).", (int) index);
+      return false;
+    }
+  }
+}
+
+int m4aDecoder_read(m4aDecoder *d, int16_t *buffer, int numFrames) {
+  int numRead = 0;
+  while (numRead < numFrames) {
+    if (d->numPendingFrames > 0) {
+      uint32_t k = (uint32_t) (numFrames - numRead);
+      if (k > d->numPendingFrames) k = d->numPendingFrames;
+      memcpy(buffer + numRead * d->numChannels, d->pending + d->pendingOffset * d->numChannels,
+          k * d->numChannels * sizeof(int16_t));
+      d->pendingOffset += k;
+      d->numPendingFrames -= k;
+      numRead += (int) k;
+    } else if (d->isOutputDone) {
+      break;
+    } else if (!m4aDecoder_decode(d)) {
+      return (numRead > 0) ? numRead : -1;
+    }
+  }
+  return numRead;
+}
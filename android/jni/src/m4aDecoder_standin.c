@@ -0,0 +1,144 @@
+/**
+ * Copyright (c) 2016 Enzien Audio Ltd.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+// A stand-in for m4aDecoder_ndk.c which reads 16-bit PCM WAV files, so that the
+// MediaCodec backend of m4aPlayer can be built and run on Linux, e.g. as a Pd
+// external or in a libpd host. Samples are assumed to be little endian.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "m4aDecoder.h"
+#include "m4aLog.h"
+
+#define M4ADECODER_LOG_TAG "M4aDecoder"
+
+struct m4aDecoder {
+  FILE *file;
+  uint32_t sampleRate;
+  int numChannels;
+  uint64_t numFrames;
+  long dataOffset;   // byte offset of the first frame in the file
+  uint64_t position; // the next frame to be read
+};
+
+static uint32_t m4aDecoder_readLE(const unsigned char *bytes, int numBytes) {
+  uint32_t value = 0;
+  for (int i = numBytes-1; i >= 0; --i) value = (value << 8) | bytes[i];
+  return value;
+}
+
+// reads the header of a WAV file starting at the current position of the file
+static m4aDecoder *m4aDecoder_openFile(FILE *file, const char *name) {
+  unsigned char header[12];
+  if (fread(header, 1, 12, file) != 12 || memcmp(header, "RIFF", 4) != 0 || memcmp(header+8, "WAVE", 4) != 0) {
+    __android_log_print(ANDROID_LOG_ERROR, M4ADECODER_LOG_TAG, "%s is not a WAV file.", name);
+    fclose(file);
+    return NULL;
+  }
+
+  // walk the chunks until the data chunk, picking up the format on the way
+  m4aDecoder *d = (m4aDecoder *) calloc(1, sizeof(m4aDecoder));
+  d->file = file;
+  unsigned char chunk[8];
+  while (fread(chunk, 1, 8, file) == 8) {
+    const uint32_t chunkSize = m4aDecoder_readLE(chunk+4, 4);
+    if (memcmp(chunk, "fmt ", 4) == 0 && chunkSize >= 16) {
+      unsigned char format[16];
+      if (fread(format, 1, 16, file) != 16) break;
+      const uint32_t formatTag = m4aDecoder_readLE(format, 2);
+      const uint32_t bitsPerSample = m4aDecoder_readLE(format+14, 2);
+      if ((formatTag != 1 && formatTag != 0xFFFE) || bitsPerSample != 16) {
+        __android_log_print(ANDROID_LOG_ERROR, M4ADECODER_LOG_TAG, "%s is not 16-bit PCM.", name);
+        break;
+      }
+      d->numChannels = (int) m4aDecoder_readLE(format+2, 2);
+      d->sampleRate = m4aDecoder_readLE(format+4, 4);
+      fseek(file, (long) (chunkSize - 16 + (chunkSize & 1)), SEEK_CUR);
+    } else if (memcmp(chunk, "data", 4) == 0) {
+      if (d->numChannels > 0) {
+        d->dataOffset = ftell(file);
+        d->numFrames = chunkSize / (d->numChannels * sizeof(int16_t));
+        return d;
+      }
+      break;
+    } else {
+      fseek(file, (long) (chunkSize + (chunkSize & 1)), SEEK_CUR);
+    }
+  }
+
+  __android_log_print(ANDROID_LOG_ERROR, M4ADECODER_LOG_TAG, "%s has no playable audio.", name);
+  m4aDecoder_close(d);
+  return NULL;
+}
+
+m4aDecoder *m4aDecoder_open(const char *path) {
+  FILE *file = fopen(path, "rb");
+  if (file == NULL) {
+    __android_log_print(ANDROID_LOG_ERROR, M4ADECODER_LOG_TAG, "Could not open %s.", path);
+    return NULL;
+  }
+  return m4aDecoder_openFile(file, path);
+}
+
+// The length is not needed, as the chunks of the WAV file give its size.
+m4aDecoder *m4aDecoder_openFd(int fd, int64_t offset, int64_t length) {
+  FILE *file = fdopen(fd, "rb");
+  if (file == NULL) {
+    __android_log_print(ANDROID_LOG_ERROR, M4ADECODER_LOG_TAG, "Could not open fd %i.", fd);
+    close(fd);
+    return NULL;
+  }
+  if (fseek(file, (long) offset, SEEK_SET) != 0) {
+    __android_log_print(ANDROID_LOG_ERROR, M4ADECODER_LOG_TAG, "Could not seek fd %i to %lld.", fd, (long long) offset);
+    fclose(file);
+    return NULL;
+  }
+  return m4aDecoder_openFile(file, "fd");
+}
+
+void m4aDecoder_close(m4aDecoder *d) {
+  fclose(d->file);
+  free(d);
+}
+
+uint32_t m4aDecoder_getSampleRate(m4aDecoder *d) {
+  return d->sampleRate;
+}
+
+int m4aDecoder_getNumChannels(m4aDecoder *d) {
+  return d->numChannels;
+}
+
+uint64_t m4aDecoder_getNumFrames(m4aDecoder *d) {
+  return d->numFrames;
+}
+
+bool m4aDecoder_seek(m4aDecoder *d, uint64_t frame) {
+  if (frame > d->numFrames) return false;
+  d->position = frame;
+  return fseek(d->file, d->dataOffset + (long) (frame * d->numChannels * sizeof(int16_t)), SEEK_SET) == 0;
+}
+
+int m4aDecoder_read(m4aDecoder *d, int16_t *buffer, int numFrames) {
+  if ((uint64_t) numFrames > d->numFrames - d->position) numFrames = (int) (d->numFrames - d->position);
+  const size_t numRead = fread(buffer, d->numChannels * sizeof(int16_t), (size_t) numFrames, d->file);
+  if (numRead < (size_t) numFrames && ferror(d->file)) return -1;
+  d->position += numRead;
+  return (int) numRead;
+}
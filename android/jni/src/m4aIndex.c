@@ -0,0 +1,170 @@
+/**
+ * Copyright (c) 2016 Enzien Audio Ltd.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "m4aIndex.h"
+#include "m4aLog.h"
+
+#define M4AINDEX_LOG_TAG "M4aIndex"
+#define M4AINDEX_VERSION 1
+#define FLAG_VBR 0x1
+#define FLAG_GAPLESS 0x2
+
+// the layout of an index file, which is followed by the records in the order of their identities
+typedef struct _fileHeader {
+  char magic[4];
+  uint32_t version;
+  uint32_t numRecords;
+  uint32_t recordSize;
+} t_fileHeader;
+
+typedef struct _record {
+  uint64_t identity;
+  uint64_t numFrames;
+  uint32_t sampleRate;
+  uint32_t avgBitrate;
+  uint32_t maxBitrate;
+  uint32_t encoderDelay;
+  uint32_t numPaddingFrames;
+  uint16_t numChannels;
+  uint8_t flags;
+  uint8_t reserved;
+  char codec[4];
+  uint32_t reserved2;
+} t_record;
+
+struct m4aIndex {
+  void *map;
+  size_t numBytes;
+  const t_record *records;
+  uint32_t numRecords;
+};
+
+static int m4aIndex_compareEntries(const void *a, const void *b) {
+  const uint64_t x = ((const m4aIndexEntry *) a)->identity;
+  const uint64_t y = ((const m4aIndexEntry *) b)->identity;
+  return (x < y) ? -1 : (x > y) ? 1 : 0;
+}
+
+bool m4aIndex_write(const char *path, m4aIndexEntry *entries, int numEntries) {
+  qsort(entries, (size_t) numEntries, sizeof(m4aIndexEntry), &m4aIndex_compareEntries);
+  char tmpPath[1024];
+  if (snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", path) >= (int) sizeof(tmpPath)) return false;
+  FILE *file = fopen(tmpPath, "wb");
+  if (file == NULL) {
+    __android_log_print(ANDROID_LOG_WARN, M4AINDEX_LOG_TAG, "Could not write index %s.", path);
+    return false;
+  }
+  t_fileHeader header = {{'M', '4', 'I', 'X'}, M4AINDEX_VERSION, 0, sizeof(t_record)};
+  for (int i = 0; i < numEntries; ++i) {
+    // a file which is listed twice, e.g. through a link, is only kept once
+    if (i > 0 && entries[i].identity == entries[i-1].identity) continue;
+    ++header.numRecords;
+  }
+  bool isWritten = fwrite(&header, sizeof(header), 1, file) == 1;
+  for (int i = 0; i < numEntries && isWritten; ++i) {
+    if (i > 0 && entries[i].identity == entries[i-1].identity) continue;
+    const m4aProbeInfo *const info = &entries[i].info;
+    t_record r;
+    memset(&r, 0, sizeof(t_record));
+    r.identity = entries[i].identity;
+    r.numFrames = info->numFrames;
+    r.sampleRate = info->sampleRate;
+    r.avgBitrate = info->avgBitrate;
+    r.maxBitrate = info->maxBitrate;
+    r.encoderDelay = info->encoderDelay;
+    r.numPaddingFrames = info->numPaddingFrames;
+    r.numChannels = (uint16_t) info->numChannels;
+    r.flags = (info->isVbr ? FLAG_VBR : 0) | (info->hasGapless ? FLAG_GAPLESS : 0);
+    memcpy(r.codec, info->codec, 4);
+    isWritten = fwrite(&r, sizeof(t_record), 1, file) == 1;
+  }
+  isWritten = (fclose(file) == 0) && isWritten;
+  if (!isWritten || rename(tmpPath, path) != 0) {
+    __android_log_print(ANDROID_LOG_WARN, M4AINDEX_LOG_TAG, "Could not write index %s.", path);
+    remove(tmpPath);
+    return false;
+  }
+  return true;
+}
+
+m4aIndex *m4aIndex_open(const char *path) {
+  const int fd = open(path, O_RDONLY);
+  if (fd < 0) return NULL;
+  struct stat s;
+  void *map = MAP_FAILED;
+  if (fstat(fd, &s) == 0 && s.st_size >= (off_t) sizeof(t_fileHeader)) {
+    map = mmap(NULL, (size_t) s.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  }
+  close(fd); // the mapping keeps the file
+  if (map == MAP_FAILED) return NULL;
+
+  const t_fileHeader *const header = (const t_fileHeader *) map;
+  if (memcmp(header->magic, "M4IX", 4) != 0 || header->version != M4AINDEX_VERSION ||
+      header->recordSize != sizeof(t_record) ||
+      (uint64_t) s.st_size < sizeof(t_fileHeader) + (uint64_t) header->numRecords * sizeof(t_record)) {
+    __android_log_print(ANDROID_LOG_WARN, M4AINDEX_LOG_TAG, "Index %s is damaged.", path);
+    munmap(map, (size_t) s.st_size);
+    return NULL;
+  }
+  m4aIndex *index = (m4aIndex *) malloc(sizeof(m4aIndex));
+  index->map = map;
+  index->numBytes = (size_t) s.st_size;
+  index->records = (const t_record *) (header+1);
+  index->numRecords = header->numRecords;
+  return index;
+}
+
+void m4aIndex_close(m4aIndex *index) {
+  if (index == NULL) return;
+  munmap(index->map, index->numBytes);
+  free(index);
+}
+
+int m4aIndex_getNumEntries(const m4aIndex *index) {
+  return (int) index->numRecords;
+}
+
+bool m4aIndex_find(const m4aIndex *index, uint64_t identity, m4aProbeInfo *info) {
+  uint32_t lo = 0;
+  uint32_t hi = index->numRecords;
+  while (lo < hi) {
+    const uint32_t mid = lo + (hi - lo) / 2;
+    if (index->records[mid].identity < identity) lo = mid + 1;
+    else hi = mid;
+  }
+  if (lo == index->numRecords || index->records[lo].identity != identity) return false;
+  const t_record *const r = index->records + lo;
+  memset(info, 0, sizeof(m4aProbeInfo));
+  memcpy(info->codec, r->codec, 4);
+  info->sampleRate = r->sampleRate;
+  info->numChannels = r->numChannels;
+  info->numFrames = r->numFrames;
+  info->avgBitrate = r->avgBitrate;
+  info->maxBitrate = r->maxBitrate;
+  info->isVbr = (r->flags & FLAG_VBR) != 0;
+  info->hasGapless = (r->flags & FLAG_GAPLESS) != 0;
+  info->encoderDelay = r->encoderDelay;
+  info->numPaddingFrames = r->numPaddingFrames;
+  return true;
+}
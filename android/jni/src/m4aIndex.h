@@ -0,0 +1,54 @@
+/**
+ * Copyright (c) 2016 Enzien Audio Ltd.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _M4A_INDEX_H_
+#define _M4A_INDEX_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "m4aProbe.h"
+
+/*
+ * A persistent index of the probed properties of many files, e.g. of a whole
+ * content directory, keyed by the identity of each file (see
+ * m4aPeaks_getFileIdentity()), so that a changed file is not found. The index
+ * file is a sorted table of fixed size records, which is mapped into memory
+ * and searched in place, so opening an index of any size costs a single mmap.
+ * An open index is read only and may be searched from any thread.
+ */
+typedef struct m4aIndex m4aIndex;
+
+typedef struct m4aIndexEntry {
+  uint64_t identity;
+  m4aProbeInfo info;
+} m4aIndexEntry;
+
+// Sorts the entries and writes them to an index file, through a temporary
+// file so that readers never see a partial one. Returns false on failure.
+bool m4aIndex_write(const char *path, m4aIndexEntry *entries, int numEntries);
+
+// maps an index file into memory. Returns NULL if it is missing or damaged.
+m4aIndex *m4aIndex_open(const char *path);
+
+void m4aIndex_close(m4aIndex *index);
+
+int m4aIndex_getNumEntries(const m4aIndex *index);
+
+// looks up the properties of a file by its identity. Returns false if the file is not in the index.
+bool m4aIndex_find(const m4aIndex *index, uint64_t identity, m4aProbeInfo *info);
+
+#endif // _M4A_INDEX_H_
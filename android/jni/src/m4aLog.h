@@ -0,0 +1,48 @@
+/**
+ * Copyright (c) 2016 Enzien Audio Ltd.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _M4A_LOG_H_
+#define _M4A_LOG_H_
+
+#ifdef __ANDROID__
+#include <android/log.h>
+#else
+// Outside of Android (i.e. the Linux stand-in) log messages are written to
+// stderr. Verbose and debug messages are dropped.
+#include <stdarg.h>
+#include <stdio.h>
+
+enum {
+  ANDROID_LOG_VERBOSE = 2,
+  ANDROID_LOG_DEBUG,
+  ANDROID_LOG_INFO,
+  ANDROID_LOG_WARN,
+  ANDROID_LOG_ERROR
+};
+
+static inline int __android_log_print(int prio, const char *tag, const char *fmt, ...) {
+  if (prio < ANDROID_LOG_INFO) return 0;
+  va_list args;
+  va_start(args, fmt);
+  fprintf(stderr, "%s: ", tag);
+  const int n = vfprintf(stderr, fmt, args);
+  fputc('\n', stderr);
+  va_end(args);
+  return n;
+}
+#endif
+
+#endif // _M4A_LOG_H_
@@ -0,0 +1,290 @@
+/**
+ * Copyright (c) 2016 Enzien Audio Ltd.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "m4aLog.h"
+#include "m4aPeaks.h"
+
+#define M4APEAKS_LOG_TAG "M4aPeaks"
+#define M4APEAKS_VERSION 1
+#define MAX_LEVELS 40 // enough for 2^32 pairs in the finest level
+#define FNV_OFFSET 1469598103934665603ULL
+#define FNV_PRIME 1099511628211ULL
+
+struct m4aPeaks {
+  uint64_t identity;
+  uint64_t numFrames;
+  bool isComplete;
+  int16_t *pairs;       // min/max pairs of every level, the finest first
+  uint32_t numPairs;    // pairs in use, i.e. only those of the finest level until the pyramid is complete
+  uint32_t maxPairs;    // pairs allocated
+  uint32_t numLevels;
+  uint32_t levelOffsets[MAX_LEVELS]; // the first pair of each level
+  uint32_t levelSizes[MAX_LEVELS];   // the number of pairs in each level
+
+  // the pair of the finest level which is being accumulated
+  int16_t min;
+  int16_t max;
+  uint32_t numBucketFrames;
+};
+
+// the layout of a pyramid file, which is followed by the pairs of every level
+typedef struct _fileHeader {
+  char magic[4];
+  uint32_t version;
+  uint64_t identity;
+  uint64_t numFrames;
+  uint32_t numFinestPairs;
+  uint32_t numPairs;
+} t_fileHeader;
+
+m4aPeaks *m4aPeaks_new(uint64_t identity) {
+  m4aPeaks *p = (m4aPeaks *) calloc(1, sizeof(m4aPeaks));
+  p->identity = identity;
+  p->min = INT16_MAX;
+  p->max = INT16_MIN;
+  return p;
+}
+
+void m4aPeaks_free(m4aPeaks *p) {
+  if (p == NULL) return;
+  free(p->pairs);
+  free(p);
+}
+
+static void m4aPeaks_appendPair(m4aPeaks *p, int16_t min, int16_t max) {
+  if (p->numPairs == p->maxPairs) {
+    p->maxPairs = (p->maxPairs == 0) ? 1024 : 2*p->maxPairs;
+    p->pairs = (int16_t *) realloc(p->pairs, 2 * p->maxPairs * sizeof(int16_t));
+  }
+  p->pairs[2*p->numPairs] = min;
+  p->pairs[2*p->numPairs+1] = max;
+  ++p->numPairs;
+}
+
+// accumulates one frame, whose extremes over all channels have been found
+static inline void m4aPeaks_addFrame(m4aPeaks *p, int16_t min, int16_t max) {
+  if (min < p->min) p->min = min;
+  if (max > p->max) p->max = max;
+  if (++p->numBucketFrames == M4APEAKS_FRAMES) {
+    m4aPeaks_appendPair(p, p->min, p->max);
+    p->min = INT16_MAX;
+    p->max = INT16_MIN;
+    p->numBucketFrames = 0;
+  }
+}
+
+void m4aPeaks_addInt16(m4aPeaks *p, const int16_t *frames, int numChannels, uint32_t numFrames) {
+  if (p->isComplete) return;
+  for (uint32_t i = 0; i < numFrames; ++i, frames += numChannels) {
+    int16_t min = frames[0];
+    int16_t max = frames[0];
+    for (int c = 1; c < numChannels; ++c) {
+      if (frames[c] < min) min = frames[c];
+      if (frames[c] > max) max = frames[c];
+    }
+    m4aPeaks_addFrame(p, min, max);
+  }
+  p->numFrames += numFrames;
+}
+
+static inline int16_t m4aPeaks_quantise(float f) {
+  if (f >= 1.0f) return INT16_MAX;
+  if (f <= -1.0f) return -INT16_MAX;
+  return (int16_t) (f * 32767.0f);
+}
+
+void m4aPeaks_addFloat(m4aPeaks *p, const float *frames, int numChannels, uint32_t numFrames) {
+  if (p->isComplete) return;
+  for (uint32_t i = 0; i < numFrames; ++i, frames += numChannels) {
+    float min = frames[0];
+    float max = frames[0];
+    for (int c = 1; c < numChannels; ++c) {
+      if (frames[c] < min) min = frames[c];
+      if (frames[c] > max) max = frames[c];
+    }
+    m4aPeaks_addFrame(p, m4aPeaks_quantise(min), m4aPeaks_quantise(max));
+  }
+  p->numFrames += numFrames;
+}
+
+// lays out the levels above the finest one, which holds numFinestPairs pairs
+static uint32_t m4aPeaks_layOutLevels(m4aPeaks *p, uint32_t numFinestPairs) {
+  uint32_t numPairs = 0;
+  uint32_t size = numFinestPairs;
+  p->numLevels = 0;
+  while (size > 0 && p->numLevels < MAX_LEVELS) {
+    p->levelOffsets[p->numLevels] = numPairs;
+    p->levelSizes[p->numLevels] = size;
+    ++p->numLevels;
+    numPairs += size;
+    if (size == 1) break;
+    size = (size + 1) / 2;
+  }
+  return numPairs;
+}
+
+void m4aPeaks_finish(m4aPeaks *p) {
+  if (p->isComplete) return;
+  if (p->numBucketFrames > 0) m4aPeaks_appendPair(p, p->min, p->max);
+  const uint32_t numPairs = m4aPeaks_layOutLevels(p, p->numPairs);
+  if (numPairs > 0) p->pairs = (int16_t *) realloc(p->pairs, 2 * numPairs * sizeof(int16_t));
+  p->maxPairs = numPairs;
+
+  // each pair is the extremes of the two pairs below it
+  for (uint32_t l = 1; l < p->numLevels; ++l) {
+    const int16_t *below = p->pairs + 2*p->levelOffsets[l-1];
+    int16_t *level = p->pairs + 2*p->levelOffsets[l];
+    const uint32_t numBelow = p->levelSizes[l-1];
+    for (uint32_t i = 0; i < p->levelSizes[l]; ++i) {
+      const uint32_t j = 2*i;
+      int16_t min = below[2*j];
+      int16_t max = below[2*j+1];
+      if (j+1 < numBelow) {
+        if (below[2*j+2] < min) min = below[2*j+2];
+        if (below[2*j+3] > max) max = below[2*j+3];
+      }
+      level[2*i] = min;
+      level[2*i+1] = max;
+    }
+  }
+  p->numPairs = numPairs;
+  p->isComplete = true;
+}
+
+bool m4aPeaks_isComplete(const m4aPeaks *p) {
+  return p->isComplete;
+}
+
+uint64_t m4aPeaks_getNumFrames(const m4aPeaks *p) {
+  return p->numFrames;
+}
+
+uint64_t m4aPeaks_getIdentity(const m4aPeaks *p) {
+  return p->identity;
+}
+
+size_t m4aPeaks_getNumBytes(const m4aPeaks *p) {
+  return sizeof(m4aPeaks) + 2 * p->maxPairs * sizeof(int16_t);
+}
+
+void m4aPeaks_getColumn(const m4aPeaks *p, int column, int numColumns, float *min, float *max) {
+  *min = 0.0f;
+  *max = 0.0f;
+  if (p->numLevels == 0 || numColumns <= 0) return;
+
+  // the coarsest level with at least one pair per column, so that each column reads one or two pairs
+  uint32_t l = 0;
+  while (l+1 < p->numLevels && p->levelSizes[l+1] >= (uint32_t) numColumns) ++l;
+
+  // the frames of the column, and the pairs which cover them
+  const uint64_t start = (p->numFrames * (uint64_t) column) / (uint64_t) numColumns;
+  uint64_t end = (p->numFrames * (uint64_t) (column+1)) / (uint64_t) numColumns;
+  if (end <= start) end = start+1;
+  const uint64_t framesPerPair = (uint64_t) M4APEAKS_FRAMES << l;
+  uint32_t first = (uint32_t) (start / framesPerPair);
+  uint32_t last = (uint32_t) ((end-1) / framesPerPair);
+  if (last >= p->levelSizes[l]) last = p->levelSizes[l] - 1;
+  if (first > last) first = last;
+
+  const int16_t *pairs = p->pairs + 2*p->levelOffsets[l];
+  int16_t lo = pairs[2*first];
+  int16_t hi = pairs[2*first+1];
+  for (uint32_t i = first+1; i <= last; ++i) {
+    if (pairs[2*i] < lo) lo = pairs[2*i];
+    if (pairs[2*i+1] > hi) hi = pairs[2*i+1];
+  }
+  *min = lo / 32767.0f;
+  *max = hi / 32767.0f;
+}
+
+bool m4aPeaks_write(const m4aPeaks *p, const char *path) {
+  if (!p->isComplete) return false;
+  char tempPath[1024];
+  if (snprintf(tempPath, sizeof(tempPath), "%s.tmp", path) >= (int) sizeof(tempPath)) return false;
+  FILE *file = fopen(tempPath, "wb");
+  if (file == NULL) {
+    __android_log_print(ANDROID_LOG_WARN, M4APEAKS_LOG_TAG, "Could not write peaks to %s.", tempPath);
+    return false;
+  }
+  t_fileHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, "M4PK", 4);
+  header.version = M4APEAKS_VERSION;
+  header.identity = p->identity;
+  header.numFrames = p->numFrames;
+  header.numFinestPairs = (p->numLevels > 0) ? p->levelSizes[0] : 0;
+  header.numPairs = p->numPairs;
+  bool isOk = fwrite(&header, sizeof(header), 1, file) == 1;
+  if (isOk && p->numPairs > 0) isOk = fwrite(p->pairs, 2*sizeof(int16_t), p->numPairs, file) == p->numPairs;
+  isOk &= (fclose(file) == 0);
+  if (!isOk || rename(tempPath, path) != 0) {
+    __android_log_print(ANDROID_LOG_WARN, M4APEAKS_LOG_TAG, "Could not write peaks to %s.", path);
+    remove(tempPath);
+    return false;
+  }
+  return true;
+}
+
+m4aPeaks *m4aPeaks_read(const char *path, uint64_t identity) {
+  FILE *file = fopen(path, "rb");
+  if (file == NULL) return NULL;
+  t_fileHeader header;
+  m4aPeaks *p = NULL;
+  if (fread(&header, sizeof(header), 1, file) == 1 && memcmp(header.magic, "M4PK", 4) == 0 &&
+      header.version == M4APEAKS_VERSION && header.identity == identity) {
+    p = m4aPeaks_new(identity);
+    p->numFrames = header.numFrames;
+    const uint32_t numPairs = m4aPeaks_layOutLevels(p, header.numFinestPairs);
+    p->pairs = (int16_t *) malloc(2 * (numPairs > 0 ? numPairs : 1) * sizeof(int16_t));
+    p->numPairs = p->maxPairs = numPairs;
+    p->isComplete = true;
+    if (numPairs != header.numPairs || fread(p->pairs, 2*sizeof(int16_t), numPairs, file) != numPairs) {
+      __android_log_print(ANDROID_LOG_WARN, M4APEAKS_LOG_TAG, "Peaks in %s are damaged.", path);
+      m4aPeaks_free(p);
+      p = NULL;
+    }
+  }
+  fclose(file);
+  return p;
+}
+
+static uint64_t m4aPeaks_hashBytes(uint64_t hash, const void *bytes, size_t numBytes) {
+  for (size_t i = 0; i < numBytes; ++i) {
+    hash = (hash ^ ((const unsigned char *) bytes)[i]) * FNV_PRIME;
+  }
+  return hash;
+}
+
+uint64_t m4aPeaks_hashString(const char *s) {
+  const uint64_t hash = m4aPeaks_hashBytes(FNV_OFFSET, s, strlen(s));
+  return (hash != 0) ? hash : 1;
+}
+
+uint64_t m4aPeaks_getFileIdentity(const char *path) {
+  struct stat info;
+  if (stat(path, &info) != 0) return 0;
+  const int64_t size = (int64_t) info.st_size;
+  const int64_t modified = (int64_t) info.st_mtime;
+  uint64_t hash = m4aPeaks_hashBytes(FNV_OFFSET, path, strlen(path));
+  hash = m4aPeaks_hashBytes(hash, &size, sizeof(size));
+  hash = m4aPeaks_hashBytes(hash, &modified, sizeof(modified));
+  return (hash != 0) ? hash : 1;
+}
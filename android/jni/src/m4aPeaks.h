@@ -0,0 +1,84 @@
+/**
+ * Copyright (c) 2016 Enzien Audio Ltd.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _M4A_PEAKS_H_
+#define _M4A_PEAKS_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * A min/max peak pyramid of an asset, for drawing its waveform without
+ * decoding it. The finest level holds the minimum and maximum sample (over all
+ * channels) of every M4APEAKS_FRAMES frames, and each level above it halves
+ * the one below, down to a single pair.
+ *
+ * A pyramid is built by adding every frame of the asset in order and then
+ * finishing it. It can then be written to a file and read back in a later
+ * session, keyed by the identity of the asset so that a changed file is not
+ * drawn with stale peaks. A pyramid is only used by one thread at a time.
+ */
+typedef struct m4aPeaks m4aPeaks;
+
+#define M4APEAKS_FRAMES 256
+
+// starts an empty pyramid for the asset with the given identity
+m4aPeaks *m4aPeaks_new(uint64_t identity);
+
+void m4aPeaks_free(m4aPeaks *p);
+
+// adds the next frames of the asset, with the given number of interleaved channels
+void m4aPeaks_addInt16(m4aPeaks *p, const int16_t *frames, int numChannels, uint32_t numFrames);
+void m4aPeaks_addFloat(m4aPeaks *p, const float *frames, int numChannels, uint32_t numFrames);
+
+// Builds the levels above the finest one, once every frame has been added.
+// Frames which are added afterwards are ignored.
+void m4aPeaks_finish(m4aPeaks *p);
+
+bool m4aPeaks_isComplete(const m4aPeaks *p);
+
+// the number of frames which have been added
+uint64_t m4aPeaks_getNumFrames(const m4aPeaks *p);
+
+uint64_t m4aPeaks_getIdentity(const m4aPeaks *p);
+
+// the memory which the pyramid occupies, in bytes
+size_t m4aPeaks_getNumBytes(const m4aPeaks *p);
+
+/**
+ * Reads the minimum and maximum of one of numColumns equal stretches of the
+ * asset, from the coarsest level which still has a pair for every column.
+ * Samples are between -1 and 1. The pyramid must be complete.
+ */
+void m4aPeaks_getColumn(const m4aPeaks *p, int column, int numColumns, float *min, float *max);
+
+// Writes a complete pyramid to a file, through a temporary file so that
+// readers never see a partial one. Returns false on failure.
+bool m4aPeaks_write(const m4aPeaks *p, const char *path);
+
+// reads a pyramid which was written for the given identity. Returns NULL if
+// there is none, or if the file was written for another identity.
+m4aPeaks *m4aPeaks_read(const char *path, uint64_t identity);
+
+// Identifies the contents of a file by its path, size and modification time.
+// Returns 0 if the file cannot be found.
+uint64_t m4aPeaks_getFileIdentity(const char *path);
+
+// a hash of a string, e.g. to identify assets which cannot be stat()ed
+uint64_t m4aPeaks_hashString(const char *s);
+
+#endif // _M4A_PEAKS_H_
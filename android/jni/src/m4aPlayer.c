@@ -14,28 +14,332 @@
  * PERFORMANCE OF THIS SOFTWARE.
  */
 
-#include <android/log.h>
 #include <assert.h>
+#include <dirent.h>
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
-#include <SLES/OpenSLES.h>
-#include <SLES/OpenSLES_Android.h>
 #include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
 #include <time.h>
+#include <unistd.h>
+
+#ifdef __ANDROID__
+#include <android/asset_manager.h>
+#endif
+
+// Assets are decoded by OpenSLES uri players by default. When built with
+// M4APLAYER_BACKEND_CODEC=1 they are decoded by m4aDecoder (AMediaExtractor and
+// AMediaCodec, or the WAV stand-in on Linux) on a worker thread per track.
+// Simulations (see m4aSim.h) always use the codec backend.
+#if M4APLAYER_SIMULATION && !defined(M4APLAYER_BACKEND_CODEC)
+#define M4APLAYER_BACKEND_CODEC 1
+#endif
+
+#if M4APLAYER_BACKEND_CODEC
+#include "m4aDecoder.h"
+#if M4APLAYER_SIMULATION
+#include "m4aSim.h"
+#endif
+#else
+#include <SLES/OpenSLES.h>
+#include <SLES/OpenSLES_Android.h>
+#include <sys/system_properties.h>
+#endif
 
 #include "HvLightPipe.h"
+#include "m4aConvert.h"
+#include "m4aIndex.h"
+#include "m4aLog.h"
+#include "m4aPeaks.h"
+#include "m4aProbe.h"
 #include "m_pd.h"
 
 #define PD_BLOCK_SIZE sys_getblksize()
 #define M4APLAYER_LOG_TAG "M4aPlayer"
-#define CVT_SHORT_FLOAT 0.00003051757813f;
 #define MAX_PATH_LENGTH 128
+#define MAX_POOL_SIZE 16
+#define MAX_CACHED_PEAKS 16 // peak pyramids kept in memory for overviews
+#define PEAK_JOB_FRAMES 4096 // frames decoded per step when peaks are built for an overview
+#define MAX_READ_THREADS 8 // workers which decode a file into arrays together
+#define MIN_READ_SEGMENT_FRAMES 262144 // a worker decodes at least this many frames of a file
+#define MAX_MARKERS 64 // cue points per player
+#define MAX_PROBED_FILES 256 // probe results kept in memory
+#define MAX_INDEXES 8 // indexes of content directories which are open at once
+#define MAX_INDEX_DEPTH 8 // of the subdirectories which are indexed
+#define DEFAULT_POOL_SIZE 4
+#define DEFAULT_MEMORY_BUDGET (16*1024*1024) // bytes of pipes and cached peaks
+#define IDLE_PIPE_MS 10000.0 // a closed player keeps its pipes for this long, in case it is opened again
+#define MAX_GROUP_SIZE 16
+// the pipe sizes may be overridden, e.g. to evaluate them in simulations
+#ifndef PIPE_NUM_BLOCKS
+#define PIPE_NUM_BLOCKS 32
+#endif
+#ifndef PIPE_HIGH_WATER_BLOCKS
+#define PIPE_HIGH_WATER_BLOCKS 24 // the codec backend decodes ahead until the pipe holds this many blocks
+#endif
+#define DEFAULT_PREROLL_BLOCKS 16 // blocks decoded after an open before the decoder idles until start
+#define REVERSE_CHUNK_FRAMES 8192 // frames decoded forwards at a time for reverse playback
+#define MIN_EXP_GAIN 0.0001f // -80dB, where exponential ramps from or to silence start and end
+#define MAX_COMMANDS 64 // transport commands which can wait for a worker
+
+// what happens once a fadeout has reached silence
+#define FADE_NONE 0
+#define FADE_PAUSE 1
+#define FADE_STOP 2
+
+// block flags
+#define BLOCK_END_OF_TRACK 0x1 // the last block of the asset
+#define BLOCK_RESTARTED 0x2    // the decoder continues from the start of the asset
+
+// transport commands, which Pd sends to the worker of a track
+#define COMMAND_START 1 // decode ahead of playback
+#define COMMAND_PAUSE 2 // only keep the preroll buffered
+#define COMMAND_SEEK 3  // decode from a frame, for a new version of the transport
+
+// errors, which the thread decoding a track posts to Pd and outlet 9 sends
+#define MAX_EVENTS 16
+#define EVENT_ERROR_DECODE 1 // the asset ended before its duration, e.g. it is damaged
+#define EVENT_ERROR_SEEK 2   // the decoder could not move to a position
+#define EVENT_ERROR_PLAYER 3 // the platform player failed to change its state
 
 extern t_symbol *canvas_getcurrentdir();
 
 static t_class *m4aPlayer_class;
 
+struct _m4aPlayer;
+struct _uriPlayer;
+struct _group;
+struct _bus;
+
+// a cue point, at which perform sends the id
+typedef struct _marker {
+  uint32_t frame;
+  t_float id;
+} t_marker;
+
+// a marker which has been played, waiting for its logical time
+typedef struct _markerEvent {
+  double time;
+  t_float id;
+} t_markerEvent;
+
+// Every block in a pipe starts with this header, followed by interleaved samples.
+typedef struct _blockHeader {
+  uint32_t numFrames; // number of valid frames in the block
+  uint32_t flags;
+  uint32_t position;  // the position in the asset at the start of the block, between two frames
+  uint32_t version;   // the version of the transport which the block was decoded for
+} t_blockHeader;
+
+// Pd methods never call into the decoder, so that they return in constant
+// time. They queue commands instead, which the worker applies in order.
+typedef struct _command {
+  uint32_t type;
+  uint32_t version; // COMMAND_SEEK: the version of the blocks decoded from the frame on
+  uint64_t frame;   // COMMAND_SEEK: the position, between two frames
+  bool isReverse;   // COMMAND_SEEK: decode backwards from the frame
+} t_command;
+
+// Decoder threads never call outlets. They post events instead, which perform
+// schedules the event clock for, so they are sent within a block.
+typedef struct _event {
+  uint32_t type;
+  struct timespec postTime; // CLOCK_MONOTONIC, for measuring the latency
+} t_event;
+
+#define BYTES_PER_SAMPLE(isFloat) ((isFloat) ? sizeof(float) : sizeof(int16_t))
+#define PIPE_NUM_BYTES(isFloat) (PIPE_NUM_BLOCKS*(sizeof(t_blockHeader) + 2*PD_BLOCK_SIZE*BYTES_PER_SAMPLE(isFloat)))
+
+// An asset which is open and decoding into its own pipe. Each instance has two
+// tracks, so that a queued asset can be decoded while the current one plays.
+typedef struct _track {
+  struct _uriPlayer *uriPlayer; // NULL if nothing is open on this track
+
+  // allows thread-safe transfer of sample data from uriplayer to pd
+  HvLightPipe pipe;
+
+  t_blockHeader *writeBlock; // the block currently enqueued with the decoder
+  int numChannels;           // number of interleaved channels in each block
+  bool isFloat;              // blocks hold float samples, otherwise int16
+  uint32_t numFrames;        // length of the asset, or 0 if unknown
+  bool isReverse;            // the blocks of the current version are played backwards
+  bool isFinished;           // the end has been played and the decoder has stopped
+  bool isReady;              // the preroll has been buffered, or nothing needs to be reported
+
+  // Until the transport starts, the decoder only fills the pipe with the
+  // preroll and then idles. Afterwards it decodes ahead as far as it can.
+  volatile bool isStarted;
+  uint32_t prerollBlocks;
+
+  // Every seek increases the version of the transport. Blocks which were
+  // decoded for an older version are discarded by perform rather than played.
+  uint32_t version;
+  uint32_t seekFrame; // the position of the last seek
+#if M4APLAYER_BACKEND_CODEC
+  HvLightPipe commands; // from Pd to the worker
+#endif
+  HvLightPipe events; // from the worker (or the OpenSLES control thread) to Pd
+
+  // the transport as the worker has applied it from the commands
+  volatile uint32_t producedVersion;
+  volatile bool isDecodingAhead;
+  bool isDecodingReverse;       // producedFrames counts down
+  uint32_t producedFrames;      // position of the decoder in the asset
+  volatile bool hasProducedEnd; // the last block of the asset has been produced since the last seek
+  volatile uint32_t numSeekBlocks; // the number of blocks produced since the last seek
+
+  // the number of blocks written to and read from the pipe since the track was opened
+  volatile uint32_t numProducedBlocks;
+  volatile uint32_t numConsumedBlocks;
+
+  // the peaks of the asset, built by the producer while the asset is decoded
+  // from its start, or NULL if they are known already
+  m4aPeaks *peaks;
+} t_track;
+
+// A realized OpenSLES uri player, or with the codec backend an open decoder and
+// its worker thread. It is either owned by an m4aPlayer instance or parked in
+// the pool, ready to be borrowed again by the next instance which opens the same
+// uri. The OpenSLES callbacks are registered once with this struct as the
+// context, so that a parked player never calls into an instance.
+typedef struct _uriPlayer {
+#if M4APLAYER_BACKEND_CODEC
+  m4aDecoder *decoder;
+  pthread_t thread; // decodes into the track while the player is owned
+  bool hasThread;
+  bool isOffline;   // decoded by perform instead of the thread
+  int16_t *frames;  // decoded frames of the block being written, owned by the worker
+  bool isAtEnd;     // the whole asset has been decoded
+  bool isPastEnd;   // seeked to the end of the asset, so nothing is left to decode forwards
+
+  // For reverse playback, chunks before the position are decoded forwards
+  // and then emitted backwards from their end.
+  int16_t *chunk;
+  uint32_t numChunkFrames; // frames of the chunk which have not yet been emitted
+  uint64_t chunkStart;     // the frame at the start of the chunk
+#else
+  SLObjectItf object;
+  SLPlayItf play;
+  SLSeekItf seek;
+  SLAndroidSimpleBufferQueueItf bufferQueue;
+  int fd; // the descriptor of an asset: or fd: uri, otherwise -1
+  volatile uint32_t session; // counts the owners, 0 while parked
+  volatile uint32_t numCallbacks; // the callbacks which are running
+  volatile bool isSeeking; // the callbacks return at once while the control thread seeks
+  volatile bool isAtEnd;   // the end has been decoded, the control thread clears the last buffer
+
+  // The requests which the callbacks have posted to the control thread, with
+  // the session and the version of the transport that they were posted in.
+  volatile uint32_t requests;
+  uint32_t requestSession;
+  uint32_t requestVersion;
+  struct _uriPlayer *nextRequesting;
+
+  // The control thread never waits for space in a pipe. A player whose pipe is
+  // full when it should start decoding waits in a list, with the session and
+  // the version of the transport that it was started in, and is retried.
+  bool isWaiting;
+  uint32_t waitSession;
+  uint32_t waitVersion;
+  struct _uriPlayer *nextWaiting;
+#endif
+  struct _m4aPlayer *volatile owner; // NULL while parked
+  t_track *track; // the track of the owner which is decoded into
+  uint32_t durationMs;
+  int numChannels; // number of channels produced by the decoder
+  bool isFloat;    // the decoder produces float samples, otherwise int16
+  char uri[MAX_PATH_LENGTH];
+} t_uriPlayer;
+
+#if !M4APLAYER_BACKEND_CODEC
+// the OpenSLES engine is shared by all instances
+static SLObjectItf engineObject = NULL;
+static SLEngineItf engineEngine = NULL;
+
+// A command for a uri player. OpenSLES has no worker of its own which could
+// apply them, so the commands of every player are applied by one control
+// thread, which waits on the semaphore while the queue is empty. A command is
+// only applied if the player still has the owner which it was sent for, and
+// players are stopped and destroyed by the control thread after any commands
+// to them.
+#define COMMAND_DESTROY 4
+#define COMMAND_STOP 5
+
+// The callbacks never call into their own player. They post requests, which the
+// control thread applies before the next command.
+#define REQUEST_PAUSE 1   // the preroll is buffered and the track has not been started
+#define REQUEST_RESTART 2 // the end of the asset was decoded, continue from its start
+#define REQUEST_END 4     // the end of the asset was decoded, take back the last buffer
+
+typedef struct _control {
+  struct _uriPlayer *uriPlayer;
+  uint32_t session; // of the owner which the command was sent for
+  t_command command;
+} t_control;
+
+static HvLightPipe controlPipe;
+static sem_t controlSemaphore;
+static pthread_t controlThread;
+static sem_t stopSemaphore; // posted once a player has been stopped
+static struct _uriPlayer *volatile requestingPlayers = NULL; // the players with requests, most recent first
+static struct _uriPlayer *waitingPlayers = NULL; // the players waiting for space, only used by the control thread
+static uint32_t numSessions = 0;
+#endif
+
+#ifdef __ANDROID__
+// set by the app, so that asset: uris can be opened straight out of the APK
+static AAssetManager *assetManager = NULL;
+#endif
+
+// An asset which is read from an open file descriptor, i.e. an asset: or fd: uri.
+typedef struct _fdSource {
+  int fd;         // -1 for a file:// uri
+  int64_t offset; // the byte offset of the asset in the descriptor
+  int64_t length; // the length of the asset in bytes, or -1 for the rest of the descriptor
+} t_fdSource;
+
+// pool of parked uri players, ordered from least to most recently returned.
+// The pool is only accessed from the Pd thread.
+static t_uriPlayer *pool[MAX_POOL_SIZE];
+static int poolCount = 0;
+static int poolSize = DEFAULT_POOL_SIZE;
+
+// The indexes of content directories, most recently opened last. They answer
+// probes, and tell how many channels a file has before it is opened. Only
+// accessed from the Pd thread.
+static m4aIndex *indexes[MAX_INDEXES];
+static char indexPaths[MAX_INDEXES][MAX_PATH_LENGTH];
+static int numIndexes = 0;
+
+// looks up the properties of a file by its identity in the open indexes
+static bool m4aPlayer_findIndexed(uint64_t identity, m4aProbeInfo *info) {
+  for (int i = numIndexes-1; i >= 0 && identity != 0; --i) {
+    if (m4aIndex_find(indexes[i], identity, info)) return true;
+  }
+  return false;
+}
+
+// The memory of the pipes and the cached peaks, which is kept within the
+// budget by releasing what is not in use. The decoders and OpenSL players of
+// the pool are not measured. Only accessed from the Pd thread.
+static size_t memoryBudget = DEFAULT_MEMORY_BUDGET;
+static size_t numPipeBytes = 0;
+static size_t numPeakBytes = 0;
+
+#if M4APLAYER_BACKEND_CODEC
+// When rendering offline, files are decoded by perform itself rather than by
+// worker threads, so that they never underrun however fast the host runs.
+static bool isOffline = false;
+#endif
+
+#if !M4APLAYER_BACKEND_CODEC
 static SLuint32 toSlSamplerate(uint32_t sr) {
   switch(sr) {
     case 8000:   return SL_SAMPLINGRATE_8;
@@ -59,6 +363,7 @@ static SLuint32 toSlSamplerate(uint32_t sr) {
     }
   }
 }
+#endif
 
 typedef struct _m4aPlayer {
   // Pd structs
@@ -67,98 +372,542 @@ typedef struct _m4aPlayer {
   t_outlet *signal_right_outlet;         // outlet 1
   t_outlet *message_done_playing_outlet; // outlet 2
   t_outlet *message_done_loading_outlet; // outlet 3
+  t_outlet *message_ready_outlet;        // outlet 4
+  t_outlet *message_read_outlet;         // outlet 5
+  t_outlet *message_marker_outlet;       // outlet 6
+  t_outlet *message_probe_outlet;        // outlet 7
+  t_outlet *message_index_outlet;        // outlet 8
+  t_outlet *message_error_outlet;        // outlet 9
 
-  // OpenSLES structs
-  SLObjectItf engineObject;
-  SLEngineItf engineEngine;
-  SLObjectItf bqUriPlayerObject;
-  SLPlayItf bqUriPlayerPlay;
-  SLSeekItf bqUriPlayerSeek;
-  SLAndroidSimpleBufferQueueItf bqUriPlayerBufferQueue;
+  // the track being played and the track which is queued after it
+  t_track trackA;
+  t_track trackB;
+  t_track *currentTrack;
+  t_track *nextTrack;
+  bool hasQueuedTrack;
+  bool shouldCloseNextTrack; // the next track has finished and is waiting to be closed
+  uint32_t readFrame; // read position in the current block of the current track
 
-  // allows thread-safe transfer of sample data from uriplayer to pd
-  HvLightPipe pipe;
+  // done and ready events are sent from perform via clocks
+  t_clock *doneClock;
+  int numDonePending;
+  t_clock *readyClock;
+  t_clock *eventClock; // sends the events of both tracks
+  uint32_t prerollBlocks; // the preroll of tracks opened from now on
 
   // the path of this object in Pd, allowing samples to be loaded relatively
   char *basePath;
   char *fileuri;
 
   // state structs
-  int numChannels;
+  bool useFloat; // files are opened with float decoder output
+  bool isReverse; // files are played backwards
   bool isPlaying;
+  bool hasStartTime; // output starts at startTime rather than with the next block
+  double startTime;  // logical time
   bool shouldLoop;
   bool shouldReprimeOnFinish;
+
+  // The output gain, which is applied while the samples are converted. Ramps
+  // advance with the frames which are played.
+  float gain;
+  float gainTarget;
+  float gainStep;  // per-frame increment of a linear ramp
+  float gainRatio; // per-frame factor of an exponential ramp, or 0 for a linear one
+  uint32_t numGainRampFrames; // frames left until the ramp reaches its target
+  int fadeAction;             // applied by the fade clock once a fadeout has reached silence
+  float gainBeforeFade;       // restored after the fadeout's action
+  t_clock *fadeClock;
+
+  // the mix bus which the output is added to instead of the outlets, or NULL
+  struct _bus *bus;
+
+  // the transport group which this player belongs to, or NULL
+  struct _group *group;
+  uint64_t playedFrames; // frames played since the group started
+  uint64_t numSkipFrames; // frames which were missed before the group paused, skipped before it restarts
+
+  // an overview which waits for the peaks of the file to be built
+  struct _peakJob *peakJob;
+  t_symbol *overviewArray;
+  int numOverviewPoints;
+  t_clock *overviewClock;
+
+  // the player of a queued file which is being created, and the file which
+  // is to be queued once a player for it is available
+  struct _openJob *openJob;
+  t_clock *openClock;
+  char queuedUri[MAX_PATH_LENGTH];
+  bool hasPendingQueue;
+
+  // a file which is being read into arrays
+  struct _readJob *readJob;
+  t_clock *readClock;
+
+  // files whose headers are being parsed
+  struct _probeJob *probeJob;
+  t_clock *probeClock;
+
+  // a directory which is being indexed
+  struct _indexJob *indexJob;
+  t_clock *indexClock;
+
+  // cue points in the order of their frames, and those which have been played
+  t_marker markers[MAX_MARKERS];
+  int numMarkers;
+  t_markerEvent markerEvents[MAX_MARKERS];
+  int numMarkerEvents;
+  t_clock *markerClock;
+
+  // releases the pipes a while after the tracks have been closed
+  t_clock *idleClock;
+  struct _m4aPlayer *nextPlayer;
 } t_m4aPlayer;
 
+// every player, so that their idle pipes can be released to stay within the budget
+static t_m4aPlayer *players = NULL;
+
+// Players in a group share one transport. They prime, start and pause
+// together, start on the same sample once all of them have buffered their
+// preroll, and each member catches up with the group's timeline if it falls
+// behind, e.g. after an underrun. Groups are only accessed from the Pd thread.
+typedef struct _group {
+  t_symbol *name;
+  t_m4aPlayer *members[MAX_GROUP_SIZE];
+  int numMembers;
+  bool isStartPending; // waiting for every member to buffer its preroll
+  bool isRunning;      // the members have started playing at startTime
+  double startTime;    // logical time
+  t_clock *barrierClock;
+  struct _group *next;
+} t_group;
+
+static t_group *groups = NULL;
+
+// A mix bus sums the output of any number of players, which add to it rather
+// than to their own outlets, and is read by m4aBus objects. Players and readers
+// may run in any order in the DSP chain, so the readers output the sum of the
+// previous block. The bus swaps its buffers at the first access in every block.
+// Buses are only accessed from the Pd thread.
+typedef struct _bus {
+  t_symbol *name;
+  int numUsers; // players and readers
+  int blockSize;
+  double time; // the logical time of the block which is being summed
+  t_sample *buffers; // the four buffers below
+  t_sample *sumL; // the block which is being summed
+  t_sample *sumR;
+  t_sample *readL; // the sum of the previous block
+  t_sample *readR;
+  struct _bus *next;
+} t_bus;
+
+static t_bus *buses = NULL;
+
+// the longest time which an event has waited to be sent, since it was last taken
+static double maxEventLatencyMs = 0.0;
+
 // forward declare functions
 static void m4aPlayer_closeAndOpenAndStart(t_m4aPlayer *x, const char *path, float position);
 static void m4aPlayer_stopAndCloseIfOpen(t_m4aPlayer *x);
 static void m4aPlayer_playUriPlayer(t_m4aPlayer *x);
 static void m4aPlayer_pauseUriPlayer(t_m4aPlayer *x);
+static bool m4aPlayer_sendCommand(t_track *t, const t_command *c);
+static bool m4aPlayer_seekTrack(t_m4aPlayer *x, t_track *t, uint32_t frame);
+static uint64_t m4aPlayer_getStartFrame(t_uriPlayer *p, bool isReverse, float positionMs);
+static void m4aPlayer_closeTrack(t_track *t);
+static void m4aPlayer_initBackend();
+static bool m4aPlayer_isFloatDecodingSupported(void);
+static void m4aPlayer_onDone(t_m4aPlayer *x);
+static void m4aPlayer_onReady(t_m4aPlayer *x);
+static void m4aPlayer_onEvents(t_m4aPlayer *x);
+static void m4aPlayer_onFadeEnd(t_m4aPlayer *x);
+static void m4aPlayer_onMarker(t_m4aPlayer *x);
+static void m4aPlayer_leaveGroup(t_m4aPlayer *x);
+static int m4aPlayer_readFrames(t_m4aPlayer *x, t_sample *outL, t_sample *outR, int n, int blockFrame, bool isMixing);
+static void m4aPlayer_pollPeakJob(t_m4aPlayer *x);
+static void m4aPlayer_pollOpenJob(t_m4aPlayer *x);
+static void m4aPlayer_cancelOpenJob(t_m4aPlayer *x);
+static void m4aPlayer_cancelPeakJob(t_m4aPlayer *x);
+static void m4aPlayer_pollReadJob(t_m4aPlayer *x);
+static void m4aPlayer_cancelReadJob(t_m4aPlayer *x);
+static void m4aPlayer_pollProbeJob(t_m4aPlayer *x);
+static void m4aPlayer_cancelProbeJob(t_m4aPlayer *x);
+static void m4aPlayer_pollIndexJob(t_m4aPlayer *x);
+static void m4aPlayer_cancelIndexJob(t_m4aPlayer *x);
+static void m4aPlayer_releaseIdlePipes(t_m4aPlayer *x);
+static void m4aBus_release(t_bus *b);
 
-static void bqPlayerBufferCallback(SLAndroidSimpleBufferQueueItf bq, void *userData) {
-  t_m4aPlayer *const x = (t_m4aPlayer *) userData;
+// Confirms that the block held by the decoder has been produced. Its version
+// was stamped when it was handed to the decoder, so that a block is never
+// attributed to a seek which happened while it was being decoded.
+static void m4aPlayer_produceBlock(t_track *t, uint32_t numFrames, uint32_t flags) {
+  t->writeBlock->numFrames = numFrames;
+  t->writeBlock->flags = flags;
+  t->writeBlock->position = t->producedFrames;
+  if (t->peaks != NULL && !t->isDecodingReverse && t->producedFrames == m4aPeaks_getNumFrames(t->peaks)) {
+    // the asset has been decoded without gaps so far
+    if (t->isFloat) m4aPeaks_addFloat(t->peaks, (const float *) (t->writeBlock+1), t->numChannels, numFrames);
+    else m4aPeaks_addInt16(t->peaks, (const int16_t *) (t->writeBlock+1), t->numChannels, numFrames);
+    if (flags & BLOCK_END_OF_TRACK) m4aPeaks_finish(t->peaks);
+  }
+  if (t->isDecodingReverse) t->producedFrames -= numFrames;
+  else t->producedFrames += numFrames;
+  if (flags & BLOCK_END_OF_TRACK) t->hasProducedEnd = true;
+  hLp_produce(&t->pipe, sizeof(t_blockHeader) + t->numChannels * PD_BLOCK_SIZE * BYTES_PER_SAMPLE(t->isFloat));
+  ++t->numProducedBlocks;
+  ++t->numSeekBlocks;
+}
 
-  SLresult result;
+// consumes the blocks at the head of the pipe which were decoded before the last seek
+static void m4aPlayer_discardStaleBlocks(t_track *t) {
+  while (hLp_hasData(&t->pipe)) {
+    uint32_t numBytesAvailable = 0;
+    const t_blockHeader *const block = (const t_blockHeader *) hLp_getReadBuffer(&t->pipe, &numBytesAvailable);
+    if (block->version == t->version) return;
+    hLp_consume(&t->pipe);
+    ++t->numConsumedBlocks;
+  }
+}
+
+// Posts an event to the Pd thread. Only the thread which decodes the track
+// posts, so that the pipe has a single producer. Perform drains the pipe every
+// block, so an event is only dropped if a decoder fails many times in a row.
+static void m4aPlayer_postEvent(t_track *t, uint32_t type) {
+  t_event *const e = (t_event *) hLp_getWriteBuffer(&t->events, sizeof(t_event));
+  if (e == NULL) return;
+  e->type = type;
+  clock_gettime(CLOCK_MONOTONIC, &e->postTime);
+  hLp_produce(&t->events, sizeof(t_event));
+}
 
-  // SLAndroidSimpleBufferQueueState state;
-  // result = (*bq)->GetState(bq, &state);
+// At the end of the asset the decoder continues from the start when looping, or
+// when the current track should be reprimed and nothing is queued after it.
+static bool m4aPlayer_shouldRestartAtEnd(t_m4aPlayer *x, t_track *t) {
+  return x->shouldLoop || (x->shouldReprimeOnFinish && t == x->currentTrack && !x->hasQueuedTrack);
+}
 
-  const int numBytesToEnqueue = x->numChannels * PD_BLOCK_SIZE * sizeof(int16_t);
+#if !M4APLAYER_SIMULATION
+// waits for about the duration of one block
+static void m4aPlayer_sleepForBlock() {
+  struct timespec sleep_nano;
+  sleep_nano.tv_sec = 0;
+  sleep_nano.tv_nsec = (long) ((1000000000LL * PD_BLOCK_SIZE) / ((int64_t) sys_getsr()));
+  nanosleep(&sleep_nano, NULL);
+}
+#endif
 
-  // confirm that the previous block has been produced
-  hLp_produce(&x->pipe, numBytesToEnqueue);
+#if M4APLAYER_BACKEND_CODEC
+// decodes up to numFrames frames into p->frames, fewer only at the end of the asset
+static uint32_t m4aPlayer_readForward(t_uriPlayer *p, int numDecodedChannels, uint32_t numFrames) {
+  if (p->isPastEnd) return 0;
+  uint32_t i = 0;
+  while (i < numFrames) {
+    const int numRead = m4aDecoder_read(p->decoder, p->frames + i*numDecodedChannels, (int) (numFrames - i));
+    if (numRead <= 0) break; // the end of the asset, or an error which ends it early
+    i += (uint32_t) numRead;
+  }
+  return i;
+}
+
+// Like m4aPlayer_readForward(), but towards the start of the asset. Once the
+// chunk has been emitted, the chunk before it is decoded. The pipe holds the
+// frames emitted ahead of playback, so that a chunk can be decoded while the
+// previous one is still being played.
+static uint32_t m4aPlayer_readReverse(t_uriPlayer *p, int numDecodedChannels, uint32_t numFrames) {
+  uint32_t i = 0;
+  while (i < numFrames) {
+    if (p->numChunkFrames == 0) {
+      if (p->chunkStart == 0) break; // the start of the asset
+      const uint64_t start = (p->chunkStart > REVERSE_CHUNK_FRAMES) ? p->chunkStart - REVERSE_CHUNK_FRAMES : 0;
+      const uint32_t chunkFrames = (uint32_t) (p->chunkStart - start);
+      uint32_t numRead = 0;
+      if (m4aDecoder_seek(p->decoder, start)) {
+        while (numRead < chunkFrames) {
+          const int n = m4aDecoder_read(p->decoder, p->chunk + numRead*numDecodedChannels, (int) (chunkFrames - numRead));
+          if (n <= 0) break;
+          numRead += (uint32_t) n;
+        }
+      }
+      if (numRead < chunkFrames) {
+        // an error, which ends the asset early
+        p->chunkStart = 0;
+        break;
+      }
+      p->numChunkFrames = chunkFrames;
+      p->chunkStart = start;
+    }
+    uint32_t k = numFrames - i;
+    if (k > p->numChunkFrames) k = p->numChunkFrames;
+    for (uint32_t j = 0; j < k; ++j) {
+      memcpy(p->frames + (i+j)*numDecodedChannels, p->chunk + (p->numChunkFrames-1-j)*numDecodedChannels,
+          numDecodedChannels*sizeof(int16_t));
+    }
+    i += k;
+    p->numChunkFrames -= k;
+  }
+  return i;
+}
+
+// Decodes the next block into the track's pipe. Returns false without doing
+// anything if the pipe already holds PIPE_HIGH_WATER_BLOCKS blocks (or the
+// preroll before the track has been started), or if the whole asset has been
+// decoded.
+static bool m4aPlayer_decodeBlock(t_m4aPlayer *x, t_uriPlayer *p) {
+  t_track *const t = p->track;
+  const int numDecodedChannels = m4aDecoder_getNumChannels(p->decoder);
+  const uint32_t blockSize = (uint32_t) PD_BLOCK_SIZE;
+  const uint32_t numBlockBytes = sizeof(t_blockHeader) + t->numChannels * blockSize * BYTES_PER_SAMPLE(t->isFloat);
+
+  const uint32_t highWaterBlocks = t->isDecodingAhead ? PIPE_HIGH_WATER_BLOCKS : t->prerollBlocks;
+  if (p->isAtEnd || (t->numProducedBlocks - t->numConsumedBlocks) >= highWaterBlocks) return false;
+  char *buffer = hLp_getWriteBuffer(&t->pipe, numBlockBytes);
+  if (buffer == NULL) return false;
+  t->writeBlock = (t_blockHeader *) buffer;
+  t->writeBlock->version = t->producedVersion;
+
+  // fill the block. It is only cut short at the end of the asset.
+  const uint32_t numFrames = t->isDecodingReverse
+      ? m4aPlayer_readReverse(p, numDecodedChannels, blockSize)
+      : m4aPlayer_readForward(p, numDecodedChannels, blockSize);
+  m4aConvert_fromDecoder(t->writeBlock+1, t->isFloat, t->numChannels, p->frames, numDecodedChannels, numFrames);
+
+  // an asset which ends before its duration could not be read to the end
+  if (numFrames < blockSize && (t->isDecodingReverse
+      ? t->producedFrames > numFrames
+      : t->producedFrames + numFrames < t->numFrames)) {
+    __android_log_print(ANDROID_LOG_WARN, M4APLAYER_LOG_TAG, "%s ended early at frame %u.", p->uri,
+        t->isDecodingReverse ? t->producedFrames - numFrames : t->producedFrames + numFrames);
+    m4aPlayer_postEvent(t, EVENT_ERROR_DECODE);
+  }
+
+  if (numFrames == blockSize) {
+    m4aPlayer_produceBlock(t, numFrames, 0);
+  } else if (m4aPlayer_shouldRestartAtEnd(x, t)) {
+    // seek to the start (or the end when playing backwards) and keep decoding
+    m4aPlayer_produceBlock(t, numFrames, BLOCK_END_OF_TRACK | BLOCK_RESTARTED);
+    t->producedFrames = t->isDecodingReverse ? t->numFrames : 0;
+    if (t->isDecodingReverse) p->chunkStart = t->numFrames;
+    else m4aDecoder_seek(p->decoder, 0);
+    p->isPastEnd = false;
+  } else {
+    m4aPlayer_produceBlock(t, numFrames, BLOCK_END_OF_TRACK);
+    p->isAtEnd = true;
+  }
+  return true;
+}
+
+// Moves the decoder to the frame of the seek, in its direction, and decodes
+// the blocks from then on for the seek's version of the transport. The blocks
+// which are still in the pipe are left to perform, which discards them. At
+// the end of the asset, the end is passed on without decoding anything.
+static void m4aPlayer_seekDecoder(t_uriPlayer *p, const t_command *c) {
+  t_track *const t = p->track;
+  const uint64_t frame = (c->frame > t->numFrames && t->numFrames > 0) ? t->numFrames : c->frame;
+  t->isDecodingReverse = c->isReverse;
+  t->producedFrames = (uint32_t) frame;
+  t->hasProducedEnd = false;
+  t->numSeekBlocks = 0;
+  p->isAtEnd = false;
+  p->isPastEnd = false;
+  if (c->isReverse) {
+    // the chunk before the position is decoded by decodeBlock
+    if (p->chunk == NULL) {
+      p->chunk = (int16_t *) malloc(REVERSE_CHUNK_FRAMES * m4aDecoder_getNumChannels(p->decoder) * sizeof(int16_t));
+    }
+    p->numChunkFrames = 0;
+    p->chunkStart = frame;
+  } else if (t->numFrames > 0 && frame == t->numFrames) {
+    p->isPastEnd = true;
+  } else if (!m4aDecoder_seek(p->decoder, frame)) {
+    // seeks are sample exact, so the track starts at exactly the requested frame
+    __android_log_print(ANDROID_LOG_WARN, M4APLAYER_LOG_TAG, "Could not set seek position to frame %llu.", (unsigned long long) frame);
+    m4aPlayer_postEvent(t, EVENT_ERROR_SEEK);
+  }
+
+  // perform may only see the version once the state of the seek is visible
+  __sync_synchronize();
+  t->producedVersion = c->version;
+}
+
+// applies the commands which Pd has sent since the worker last looked
+static void m4aPlayer_applyCommands(t_uriPlayer *p) {
+  HvLightPipe *const commands = &p->track->commands;
+  while (hLp_hasData(commands)) {
+    uint32_t numBytes = 0;
+    const t_command c = *(const t_command *) hLp_getReadBuffer(commands, &numBytes);
+    hLp_consume(commands);
+    switch (c.type) {
+      case COMMAND_START: p->track->isDecodingAhead = true; break;
+      case COMMAND_PAUSE: p->track->isDecodingAhead = false; break;
+      case COMMAND_SEEK: m4aPlayer_seekDecoder(p, &c); break;
+      default: break;
+    }
+  }
+}
+
+// queues the command for the worker. Returns false if the queue is full.
+static bool m4aPlayer_sendCommand(t_track *t, const t_command *c) {
+  t_command *const d = (t_command *) hLp_getWriteBuffer(&t->commands, sizeof(t_command));
+  if (d == NULL) return false;
+  *d = *c;
+  hLp_produce(&t->commands, sizeof(t_command));
+  return true;
+}
 
-  // prepare the next buffer
-  void *buffer = hLp_getWriteBuffer(&x->pipe, numBytesToEnqueue);
-  while (buffer == NULL) {
-    // if no space is available in the pipe, wait for a bit
-    struct timespec sleep_nano;
-    sleep_nano.tv_sec = 0;
-    sleep_nano.tv_nsec = (long) ((1000000000LL * PD_BLOCK_SIZE) / ((int64_t) sys_getsr()));
-    // __android_log_print(ANDROID_LOG_VERBOSE, M4APLAYER_LOG_TAG, "Waiting %gms until pipe is clear", sleep_nano.tv_nsec/1000000.0f);
-    nanosleep(&sleep_nano, NULL);
+// With offline rendering, tops up the track's pipe before perform reads from it
+static void m4aPlayer_decodeOffline(t_m4aPlayer *x, t_track *t) {
+  t_uriPlayer *const p = t->uriPlayer;
+  if (p != NULL && p->isOffline) {
+    m4aPlayer_applyCommands(p);
+    while (m4aPlayer_decodeBlock(x, p));
+  }
+}
 
-    // ...and then retry
-    buffer = hLp_getWriteBuffer(&x->pipe, numBytesToEnqueue);
+#if M4APLAYER_SIMULATION
+static bool m4aPlayer_stepWorker(void *worker) {
+  t_uriPlayer *const p = (t_uriPlayer *) worker;
+  m4aPlayer_applyCommands(p);
+  return m4aPlayer_decodeBlock(p->owner, p);
+}
+#else
+// The worker of an owned player. It applies the commands from Pd, and decodes
+// into the track's pipe as fast as it can until the pipe holds
+// PIPE_HIGH_WATER_BLOCKS blocks (or the preroll), and then keeps it topped up
+// as perform reads from it. It exits once the player is closed.
+static void *m4aPlayer_decodeThread(void *userData) {
+  t_uriPlayer *const p = (t_uriPlayer *) userData;
+  t_m4aPlayer *const x = p->owner; // NULL if the player was closed before the thread ran
+  while (x != NULL && p->owner == x) {
+    m4aPlayer_applyCommands(p);
+    // wait if the pipe is full enough, or the whole asset has been decoded
+    if (!m4aPlayer_decodeBlock(x, p)) m4aPlayer_sleepForBlock();
   }
+  return NULL;
+}
+#endif
+#else
+
+// Prepares the next block in the track's pipe and hands it to the decoder.
+// Returns false if there is no space in the pipe.
+static bool m4aPlayer_tryEnqueueBlock(t_uriPlayer *p) {
+  t_track *const t = p->track;
+  const uint32_t numBytesToEnqueue = t->numChannels * PD_BLOCK_SIZE * BYTES_PER_SAMPLE(t->isFloat);
+  char *const buffer = hLp_getWriteBuffer(&t->pipe, sizeof(t_blockHeader) + numBytesToEnqueue);
+  if (buffer == NULL) return false;
 
   // enqueue another buffer
-  result = (*x->bqUriPlayerBufferQueue)->Enqueue(
-      x->bqUriPlayerBufferQueue, buffer, numBytesToEnqueue);
+  t->writeBlock = (t_blockHeader *) buffer;
+  t->writeBlock->version = t->producedVersion;
+  SLresult result = (*p->bufferQueue)->Enqueue(p->bufferQueue, t->writeBlock+1, numBytesToEnqueue);
   if (SL_RESULT_SUCCESS != result) {
     __android_log_print(ANDROID_LOG_ERROR, M4APLAYER_LOG_TAG, "Could not enqueue asset buffer (%u).", (uint32_t) result);
+    m4aPlayer_postEvent(t, EVENT_ERROR_PLAYER);
     assert(false);
   }
+  return true;
 }
 
-static void bqPlayerCallback(SLPlayItf caller, void *userData, SLuint32 event) {
-  t_m4aPlayer *const x = (t_m4aPlayer *) userData;
+// Enqueues the next block from the buffer callback, waiting while the pipe is
+// full. Stops waiting if the player is closed or seeked in the meantime.
+static void m4aPlayer_enqueueBlock(t_m4aPlayer *x, t_uriPlayer *p) {
+  while (!m4aPlayer_tryEnqueueBlock(p)) {
+    if (p->owner != x || p->isSeeking) return;
 
-  switch (event) {
-    case SL_PLAYEVENT_HEADATEND: {
-      if (x->shouldLoop) {
-        // if we should loop, then seek to the start
-        (*x->bqUriPlayerSeek)->SetPosition(x->bqUriPlayerSeek, 0, SL_SEEKMODE_ACCURATE);
+    // if no space is available in the pipe, wait for a bit and then retry
+    m4aPlayer_sleepForBlock();
+  }
+}
 
-        // restart playback
-        m4aPlayer_playUriPlayer(x);
-      } else {
-        if (x->shouldReprimeOnFinish) {
-          (*x->bqUriPlayerSeek)->SetPosition(x->bqUriPlayerSeek, 0, SL_SEEKMODE_ACCURATE);
+// Counts a callback as running and returns the owner of the player, or NULL
+// if the callback should return at once, because the player is parked or being
+// seeked. Only one thread produces into the track's pipe at any time, as the
+// control thread waits for the running callbacks before it seeks.
+static t_m4aPlayer *m4aPlayer_enterCallback(t_uriPlayer *p) {
+  __sync_fetch_and_add(&p->numCallbacks, 1);
+  t_m4aPlayer *const x = p->isSeeking ? NULL : p->owner;
+  if (x == NULL) __sync_fetch_and_sub(&p->numCallbacks, 1);
+  return x;
+}
 
-          // restart playback
-          m4aPlayer_playUriPlayer(x);
-        }
+static void m4aPlayer_leaveCallback(t_uriPlayer *p) {
+  __sync_fetch_and_sub(&p->numCallbacks, 1);
+}
 
-        // confirm that the last block has been produced
-        const int numBytesToEnqueue = x->numChannels * PD_BLOCK_SIZE * sizeof(int16_t);
-        hLp_produce(&x->pipe, numBytesToEnqueue);
+// waits until no callback of the player is running
+static void m4aPlayer_waitForCallbacks(t_uriPlayer *p) {
+  while (p->numCallbacks > 0) sched_yield();
+}
 
-        x->isPlaying = false;
+// Posts a request to the control thread, for the current session and version
+// of the transport. Requests which are posted before the control thread has
+// taken the previous ones are applied together with them.
+static void m4aPlayer_postRequest(t_uriPlayer *p, uint32_t request) {
+  if (__sync_fetch_and_or(&p->requests, request) != 0) return;
+  p->requestSession = p->session;
+  p->requestVersion = p->track->producedVersion;
+  do {
+    p->nextRequesting = requestingPlayers;
+  } while (!__sync_bool_compare_and_swap(&requestingPlayers, p->nextRequesting, p));
+  sem_post(&controlSemaphore);
+}
+
+static void bqPlayerBufferCallback(SLAndroidSimpleBufferQueueItf bq, void *userData) {
+  t_uriPlayer *const p = (t_uriPlayer *) userData;
+  t_m4aPlayer *const x = m4aPlayer_enterCallback(p);
+  if (x == NULL) return;
+  if (p->isAtEnd) {
+    // the last block has been produced already
+    m4aPlayer_leaveCallback(p);
+    return;
+  }
+
+  // confirm that the previous block has been produced
+  t_track *const t = p->track;
+  m4aPlayer_produceBlock(t, PD_BLOCK_SIZE, 0);
+
+  // idle once the preroll has been buffered, rather than waiting for space in
+  // the pipe, until the track is started
+  if (!t->isDecodingAhead && (t->numProducedBlocks - t->numConsumedBlocks) >= t->prerollBlocks) {
+    m4aPlayer_postRequest(p, REQUEST_PAUSE);
+  }
+
+  // prepare and enqueue the next buffer
+  m4aPlayer_enqueueBlock(x, p);
+  m4aPlayer_leaveCallback(p);
+}
+
+static void bqPlayerCallback(SLPlayItf caller, void *userData, SLuint32 event) {
+  t_uriPlayer *const p = (t_uriPlayer *) userData;
+  t_m4aPlayer *const x = m4aPlayer_enterCallback(p);
+  if (x == NULL) return;
+
+  switch (event) {
+    case SL_PLAYEVENT_HEADATEND: {
+      t_track *const t = p->track;
 
-        // indicate that the asset is done playing
-        outlet_bang(x->message_done_playing_outlet);
+      // The decoder gives no indication of how much of the last buffer has been
+      // filled. Trim it to the duration of the asset, then mark it as the end of
+      // the track. Perform decides what happens next. The duration is only known
+      // to the ms, and if it is not known at all the whole buffer is kept rather
+      // than dropping the end of the asset. The decoder writes nothing more at
+      // the end, and the control thread takes the buffer back before it decodes
+      // again.
+      p->isAtEnd = true;
+      uint32_t tailFrames = (t->numFrames == 0) ? PD_BLOCK_SIZE : 0;
+      if (t->numFrames > t->producedFrames) {
+        tailFrames = t->numFrames - t->producedFrames;
+        if (tailFrames > PD_BLOCK_SIZE) tailFrames = PD_BLOCK_SIZE;
+      }
+
+      if (m4aPlayer_shouldRestartAtEnd(x, t)) {
+        // the control thread seeks to the start and keeps decoding
+        m4aPlayer_produceBlock(t, tailFrames, BLOCK_END_OF_TRACK | BLOCK_RESTARTED);
+        t->producedFrames = 0;
+        m4aPlayer_postRequest(p, REQUEST_RESTART);
+      } else {
+        m4aPlayer_produceBlock(t, tailFrames, BLOCK_END_OF_TRACK);
+        m4aPlayer_postRequest(p, REQUEST_END);
       }
       break;
     }
@@ -168,7 +917,9 @@ static void bqPlayerCallback(SLPlayItf caller, void *userData, SLuint32 event) {
     case SL_PLAYEVENT_HEADSTALLED: break;
     default: break;
   }
+  m4aPlayer_leaveCallback(p);
 }
+#endif
 
 static void *m4aPlayer_new(t_symbol *s, int argc, t_atom *argv) {
   // initialise the Pd structs
@@ -180,6 +931,24 @@ static void *m4aPlayer_new(t_symbol *s, int argc, t_atom *argv) {
   // send a float with the total duration of the asset when done loading
   x->message_done_loading_outlet = outlet_new(&x->x_obj, &s_float);
 
+  // send a bang once an opened asset has buffered enough to start instantly
+  x->message_ready_outlet = outlet_new(&x->x_obj, &s_bang);
+
+  // send the number of frames once a file has been read into arrays
+  x->message_read_outlet = outlet_new(&x->x_obj, &s_float);
+
+  // send the id of each marker which is played
+  x->message_marker_outlet = outlet_new(&x->x_obj, &s_float);
+
+  // send the properties of each probed file as a list
+  x->message_probe_outlet = outlet_new(&x->x_obj, &s_list);
+
+  // send the number of files in an index once it has been built or opened
+  x->message_index_outlet = outlet_new(&x->x_obj, &s_float);
+
+  // send the code of each error which a decoder thread reports
+  x->message_error_outlet = outlet_new(&x->x_obj, &s_float);
+
   // copy base path
   x->basePath = (char *) malloc(MAX_PATH_LENGTH*sizeof(char));
   x->fileuri = (char *) malloc(MAX_PATH_LENGTH*sizeof(char));
@@ -187,37 +956,73 @@ static void *m4aPlayer_new(t_symbol *s, int argc, t_atom *argv) {
   __android_log_print(ANDROID_LOG_VERBOSE, M4APLAYER_LOG_TAG, "Saving base path as: %s", x->basePath);
 
   // initialise the state structs
-  x->numChannels = 2;
+  x->useFloat = m4aPlayer_isFloatDecodingSupported();
+  x->isReverse = false;
   x->isPlaying = false;
+  x->hasStartTime = false;
   x->shouldLoop = false;
   x->shouldReprimeOnFinish = true;
+  x->bus = NULL;
+  x->group = NULL;
+  x->playedFrames = 0;
+  x->numSkipFrames = 0;
 
-  // initialise pipe (32 blocks of stereo 16-bit samples)
-  hLp_init(&x->pipe, 32*2*PD_BLOCK_SIZE*sizeof(int16_t));
+  // initialise the tracks, each with a pipe of 32 blocks of stereo samples.
+  // The pipes are only allocated once something is opened or queued.
+  x->trackA.uriPlayer = NULL;
+  x->trackB.uriPlayer = NULL;
+  x->trackA.isReady = true;
+  x->trackB.isReady = true;
+  x->trackA.pipe.buffer = NULL;
+  x->trackB.pipe.buffer = NULL;
+  x->trackA.version = x->trackA.producedVersion = 0;
+  x->trackB.version = x->trackB.producedVersion = 0;
+#if M4APLAYER_BACKEND_CODEC
+  hLp_init(&x->trackA.commands, MAX_COMMANDS*(sizeof(t_command) + 2*sizeof(uint32_t)));
+  hLp_init(&x->trackB.commands, MAX_COMMANDS*(sizeof(t_command) + 2*sizeof(uint32_t)));
+#endif
+  hLp_init(&x->trackA.events, MAX_EVENTS*(sizeof(t_event) + 2*sizeof(uint32_t)));
+  hLp_init(&x->trackB.events, MAX_EVENTS*(sizeof(t_event) + 2*sizeof(uint32_t)));
+  x->currentTrack = &x->trackA;
+  x->nextTrack = &x->trackB;
+  x->hasQueuedTrack = false;
+  x->shouldCloseNextTrack = false;
+  x->readFrame = 0;
 
-  // initialise OpenSLES structs
-  x->bqUriPlayerObject = NULL;
+  x->doneClock = clock_new(x, (t_method) m4aPlayer_onDone);
+  x->numDonePending = 0;
+  x->readyClock = clock_new(x, (t_method) m4aPlayer_onReady);
+  x->eventClock = clock_new(x, (t_method) m4aPlayer_onEvents);
+  x->prerollBlocks = DEFAULT_PREROLL_BLOCKS;
 
-  // create engine
-  SLresult result = slCreateEngine(&x->engineObject, 0, NULL, 0, NULL, NULL);
-  if (result != SL_RESULT_SUCCESS) {
-    __android_log_print(ANDROID_LOG_ERROR, M4APLAYER_LOG_TAG, "Could not create engine (%u).", (uint32_t) result);
-    assert(false);
-  }
+  x->gain = 1.0f;
+  x->gainTarget = 1.0f;
+  x->numGainRampFrames = 0;
+  x->fadeAction = FADE_NONE;
+  x->fadeClock = clock_new(x, (t_method) m4aPlayer_onFadeEnd);
 
-  // realize the engine
-  result = (*x->engineObject)->Realize(x->engineObject, SL_BOOLEAN_FALSE);
-  if (result != SL_RESULT_SUCCESS) {
-    __android_log_print(ANDROID_LOG_ERROR, M4APLAYER_LOG_TAG, "Could not realize engine (%u).", (uint32_t) result);
-    assert(false);
-  }
+  x->trackA.peaks = NULL;
+  x->trackB.peaks = NULL;
+  x->peakJob = NULL;
+  x->overviewClock = clock_new(x, (t_method) m4aPlayer_pollPeakJob);
+  x->openJob = NULL;
+  x->openClock = clock_new(x, (t_method) m4aPlayer_pollOpenJob);
+  x->hasPendingQueue = false;
+  x->readJob = NULL;
+  x->readClock = clock_new(x, (t_method) m4aPlayer_pollReadJob);
+  x->probeJob = NULL;
+  x->probeClock = clock_new(x, (t_method) m4aPlayer_pollProbeJob);
+  x->indexJob = NULL;
+  x->indexClock = clock_new(x, (t_method) m4aPlayer_pollIndexJob);
+  x->numMarkers = 0;
+  x->numMarkerEvents = 0;
+  x->markerClock = clock_new(x, (t_method) m4aPlayer_onMarker);
+  x->idleClock = clock_new(x, (t_method) m4aPlayer_releaseIdlePipes);
+  x->nextPlayer = players;
+  players = x;
 
-  // get the engine interface, which is needed in order to create other objects
-  result = (*x->engineObject)->GetInterface(x->engineObject, SL_IID_ENGINE, &x->engineEngine);
-  if (result != SL_RESULT_SUCCESS) {
-    __android_log_print(ANDROID_LOG_ERROR, M4APLAYER_LOG_TAG, "Could not get engine interface (%u).", (uint32_t) result);
-    assert(false);
-  }
+  // the backend is normally initialised in m4aPlayer_setup()
+  m4aPlayer_initBackend();
 
   // if there is an argument and it is a symbol
   if (argc > 0 && argv->a_type == A_SYMBOL) {
@@ -230,14 +1035,42 @@ static void *m4aPlayer_new(t_symbol *s, int argc, t_atom *argv) {
 
 static void m4aPlayer_free(t_m4aPlayer *x) {
 
-  // destroys bqUriPlayerObject
+  // returns the uri players to the pool
   m4aPlayer_stopAndCloseIfOpen(x);
+  m4aPlayer_leaveGroup(x);
+  if (x->bus != NULL) m4aBus_release(x->bus);
+  m4aPlayer_cancelPeakJob(x);
+  m4aPlayer_cancelOpenJob(x);
+  m4aPlayer_cancelReadJob(x);
+  m4aPlayer_cancelProbeJob(x);
+  m4aPlayer_cancelIndexJob(x);
+  for (t_m4aPlayer **q = &players; *q != NULL; q = &(*q)->nextPlayer) {
+    if (*q == x) {
+      *q = x->nextPlayer;
+      break;
+    }
+  }
 
-  (*x->engineObject)->Destroy(x->engineObject);
-
+  clock_free(x->doneClock);
+  clock_free(x->readyClock);
+  clock_free(x->eventClock);
+  clock_free(x->fadeClock);
+  clock_free(x->overviewClock);
+  clock_free(x->openClock);
+  clock_free(x->readClock);
+  clock_free(x->probeClock);
+  clock_free(x->indexClock);
+  clock_free(x->markerClock);
+  clock_free(x->idleClock);
   free(x->basePath);
   free(x->fileuri);
-  hLp_free(&x->pipe);
+  m4aPlayer_releaseIdlePipes(x);
+#if M4APLAYER_BACKEND_CODEC
+  hLp_free(&x->trackA.commands);
+  hLp_free(&x->trackB.commands);
+#endif
+  hLp_free(&x->trackA.events);
+  hLp_free(&x->trackB.events);
 }
 
 static void m4aPlayer_start(t_m4aPlayer *x) {
@@ -245,38 +1078,52 @@ static void m4aPlayer_start(t_m4aPlayer *x) {
   // if so, it should be restarted
   // if the player is already playing, continue
   // if the player is stopped (i.e. == NULL), don't change state
-  if (x->bqUriPlayerObject == NULL) {
+  t_uriPlayer *const p = x->currentTrack->uriPlayer;
+  if (p == NULL) {
     __android_log_print(ANDROID_LOG_VERBOSE, M4APLAYER_LOG_TAG,
         "URI player not initialised. Won't start playing.");
+  } else if (x->currentTrack->isFinished) {
+    __android_log_print(ANDROID_LOG_VERBOSE, M4APLAYER_LOG_TAG,
+        "Track has finished. Won't start playing.");
   } else {
-    SLuint32 pState = SL_PLAYSTATE_STOPPED;
-    (*x->bqUriPlayerPlay)->GetPlayState(x->bqUriPlayerPlay, &pState);
-    switch (pState) {
-      case SL_PLAYSTATE_STOPPED: {
-        __android_log_print(ANDROID_LOG_VERBOSE, M4APLAYER_LOG_TAG,
-            "URI player stopped. Won't start playing.");
-        return;
-      }
-      case SL_PLAYSTATE_PAUSED: {
-        __android_log_print(ANDROID_LOG_VERBOSE, M4APLAYER_LOG_TAG,
-            "URI player is paused. Setting to play state.");
-        m4aPlayer_playUriPlayer(x);
-        x->isPlaying = true;
-        break;
-      }
-      case SL_PLAYSTATE_PLAYING: {
-        __android_log_print(ANDROID_LOG_VERBOSE, M4APLAYER_LOG_TAG,
-            "URI player is already playing.");
-        x->isPlaying = true;
-        break;
-      }
-      default: break;
+    // let the decoder run ahead of playback. The preroll is already buffered,
+    // so output starts with the very next block.
+    x->currentTrack->isStarted = true;
+    x->hasStartTime = false; // start now, also if startat was pending
+
+    // a fadeout which would pause or stop the player is abandoned
+    if (x->fadeAction != FADE_NONE) {
+      clock_unset(x->fadeClock);
+      x->fadeAction = FADE_NONE;
+      x->gain = x->gainTarget = x->gainBeforeFade;
+      x->numGainRampFrames = 0;
     }
+    m4aPlayer_playUriPlayer(x);
+    x->isPlaying = true;
   }
 }
 
+// Starts output at the exact sample of the logical time which is the given
+// number of milliseconds after this message, e.g. to start several players on
+// the same sample from a timebase. The samples before it are silent. Does
+// nothing if the player is already playing.
+static void m4aPlayer_startAtTime(t_m4aPlayer *x, double startTime) {
+  if (x->isPlaying) return;
+  m4aPlayer_start(x);
+  if (x->isPlaying) {
+    x->hasStartTime = true;
+    x->startTime = startTime;
+  }
+}
+
+static void m4aPlayer_startat(t_m4aPlayer *x, t_float ms) {
+  m4aPlayer_startAtTime(x, clock_getsystimeafter((ms > 0.0f) ? ms : 0.0));
+}
+
 static void m4aPlayer_pause(t_m4aPlayer *x) {
   x->isPlaying = false;
+  x->hasStartTime = false;
+  x->currentTrack->isStarted = false;
   m4aPlayer_pauseUriPlayer(x);
   __android_log_print(ANDROID_LOG_VERBOSE, M4APLAYER_LOG_TAG, "Paused.");
 }
@@ -287,291 +1134,3411 @@ static void m4aPlayer_loop(t_m4aPlayer *x, t_float f) {
       x->shouldLoop ? "Loop." : "No Loop.");
 }
 
+// Moves to the position in the file and buffers the preroll. If the file is
+// still open, its decoder seeks rather than being closed and opened again.
 static void m4aPlayer_prime(t_m4aPlayer *x, float f) {
   x->isPlaying = false;
-  m4aPlayer_closeAndOpenAndStart(x, x->fileuri, f);
+  t_track *const t = x->currentTrack;
+  t_uriPlayer *const p = t->uriPlayer;
+  if (p == NULL || p->isFloat != x->useFloat || strcmp(p->uri, x->fileuri) != 0) {
+    m4aPlayer_closeAndOpenAndStart(x, x->fileuri, f);
+    return;
+  }
+  x->hasStartTime = false;
+  x->numSkipFrames = 0;
+  x->hasQueuedTrack = false;
+  x->shouldCloseNextTrack = false;
+  x->hasPendingQueue = false;
+  m4aPlayer_closeTrack(x->nextTrack);
+  x->readFrame = 0;
+  t->isFinished = false;
+  t->isReady = false;
+  t->isStarted = false;
+  t->prerollBlocks = x->prerollBlocks;
+  m4aPlayer_pauseUriPlayer(x);
+  if (!m4aPlayer_seekTrack(x, t, (uint32_t) m4aPlayer_getStartFrame(p, x->isReverse, f))) return;
+
+  // a pending ready event belongs to the previous position
+  clock_unset(x->readyClock);
+  outlet_float(x->message_done_loading_outlet, (float) p->durationMs);
 }
 
 static void m4aPlayer_reprime(t_m4aPlayer *x, float f) {
   x->shouldReprimeOnFinish = (f != 0.0f);
 }
 
-static void m4aPlayer_pauseUriPlayer(t_m4aPlayer *x) {
-  assert(x->bqUriPlayerPlay != NULL);
-  SLresult result = (*x->bqUriPlayerPlay)->SetPlayState(x->bqUriPlayerPlay, SL_PLAYSTATE_PAUSED);
-  if (result != SL_RESULT_SUCCESS) {
-    __android_log_print(ANDROID_LOG_ERROR, M4APLAYER_LOG_TAG, "Could not pause asset player (%u).", (uint32_t) result);
-    assert(false);
-  }
+// true if the member has nothing to play, or has buffered enough to start instantly
+static bool m4aPlayer_isBuffered(t_m4aPlayer *x) {
+  t_track *const t = x->currentTrack;
+  if (t->uriPlayer == NULL || t->isFinished) return true;
+  if (x->numSkipFrames > 0 || t->producedVersion != t->version) return false;
+  m4aPlayer_discardStaleBlocks(t);
+  return (t->numProducedBlocks - t->numConsumedBlocks) >= t->prerollBlocks || t->hasProducedEnd;
 }
 
-static void m4aPlayer_playUriPlayer(t_m4aPlayer *x) {
-  assert(x->bqUriPlayerPlay != NULL);
-  SLresult result = (*x->bqUriPlayerPlay)->SetPlayState(x->bqUriPlayerPlay, SL_PLAYSTATE_PLAYING);
-  if (result != SL_RESULT_SUCCESS) {
-    __android_log_print(ANDROID_LOG_ERROR, M4APLAYER_LOG_TAG, "Could not start asset player (%u).", (uint32_t) result);
-    assert(false);
-  }
+// Skips the frames which a paused member missed before the group paused, as
+// far as they have been decoded. The decoder then tops up the preroll again.
+static void m4aPlayer_skipMissedFrames(t_m4aPlayer *x) {
+  // reading stops at the end of the track, which clears isPlaying
+  x->isPlaying = true;
+  x->numSkipFrames -= m4aPlayer_readFrames(x, NULL, NULL, (int) x->numSkipFrames, 0, false);
+  if (!x->isPlaying) x->numSkipFrames = 0;
+  x->isPlaying = false;
 }
 
-static void m4aPlayer_stopAndCloseIfOpen(t_m4aPlayer *x) {
-  if (x->bqUriPlayerObject != NULL) {
-    SLresult result = (*x->bqUriPlayerPlay)->SetPlayState(x->bqUriPlayerPlay, SL_PLAYSTATE_STOPPED);
-    if (result != SL_RESULT_SUCCESS) {
-      __android_log_print(ANDROID_LOG_ERROR, M4APLAYER_LOG_TAG, "Could not stop asset player (%u).", (uint32_t) result);
+// starts every member at the requested time, or as soon as all of them are buffered
+static void m4aPlayer_pollGroupBarrier(t_group *g) {
+  for (int i = 0; i < g->numMembers; ++i) {
+    if (g->members[i]->numSkipFrames > 0) m4aPlayer_skipMissedFrames(g->members[i]);
+  }
+  for (int i = 0; i < g->numMembers; ++i) {
+    if (!m4aPlayer_isBuffered(g->members[i])) {
+      clock_delay(g->barrierClock, (1000.0 * PD_BLOCK_SIZE) / sys_getsr());
+      return;
     }
+  }
+  g->isStartPending = false;
+  g->isRunning = true;
+  const double now = clock_getlogicaltime();
+  if (g->startTime < now) g->startTime = now;
+  for (int i = 0; i < g->numMembers; ++i) {
+    t_m4aPlayer *const x = g->members[i];
+    x->playedFrames = 0;
+    m4aPlayer_startAtTime(x, g->startTime);
+  }
+}
 
-    // clear the pipe
-    hLp_reset(&x->pipe);
+// Starts the group at the given logical time. Nothing happens while any
+// member is still playing, so that the members stay aligned, or while the
+// group is already waiting to start.
+static void m4aPlayer_startGroup(t_group *g, double startTime) {
+  if (g->isStartPending) return;
+  for (int i = 0; i < g->numMembers; ++i) {
+    if (g->members[i]->isPlaying) return;
+  }
+  g->isStartPending = true;
+  g->startTime = startTime;
+  m4aPlayer_pollGroupBarrier(g);
+}
 
-    (*x->bqUriPlayerObject)->Destroy(x->bqUriPlayerObject);
-    x->bqUriPlayerObject = NULL;
+// the number of frames which the group has played by the current logical time
+static int64_t m4aPlayer_getGroupFrames(t_group *g) {
+  return (int64_t) ((clock_gettimesince(g->startTime) * sys_getsr()) / 1000.0 + 0.5);
+}
 
-    x->isPlaying = false;
-  }
+// Drops the frames which the member has fallen behind the group by, e.g.
+// because of an underrun, as far as they have been decoded. Members can only
+// fall behind, as every frame which is played is counted.
+static void m4aPlayer_catchUpWithGroup(t_m4aPlayer *x, int64_t numGroupFrames) {
+  const int64_t numLateFrames = numGroupFrames - (int64_t) x->playedFrames;
+  if (numLateFrames > 0) x->playedFrames += m4aPlayer_readFrames(x, NULL, NULL, (int) numLateFrames, 0, false);
 }
 
-// path may be absolute or relative
-static void m4aPlayer_closeAndOpenAndStart(t_m4aPlayer *x, const char *path, float positionMs) {
+static void m4aPlayer_stopGroup(t_group *g) {
+  g->isStartPending = false;
+  g->isRunning = false;
+  clock_unset(g->barrierClock);
+}
 
-  // stop and close any active asset player
-  m4aPlayer_stopAndCloseIfOpen(x);
+static void m4aPlayer_leaveGroup(t_m4aPlayer *x) {
+  t_group *const g = x->group;
+  if (g == NULL) return;
+  x->group = NULL;
+  x->numSkipFrames = 0;
+  for (int i = 0; i < g->numMembers; ++i) {
+    if (g->members[i] == x) {
+      memmove(g->members+i, g->members+i+1, (g->numMembers-i-1)*sizeof(t_m4aPlayer *));
+      --g->numMembers;
+      break;
+    }
+  }
+  if (g->numMembers > 0) {
+    // a pending start may now be able to go ahead
+    if (g->isStartPending) m4aPlayer_pollGroupBarrier(g);
+    return;
+  }
+  for (t_group **h = &groups; *h != NULL; h = &(*h)->next) {
+    if (*h == g) {
+      *h = g->next;
+      break;
+    }
+  }
+  clock_free(g->barrierClock);
+  free(g);
+}
 
-  SLresult result;
+// Joins the named transport group, leaving any previous one. The player keeps
+// playing as it was. Without a name, the player leaves its group.
+static void m4aPlayer_group(t_m4aPlayer *x, t_symbol *s) {
+  m4aPlayer_leaveGroup(x);
+  if (s == &s_) return;
 
-  // generate the file URI (input path may be absolute or relative)
-  int n = 0;
-  if (path[0] == '/') n = snprintf(x->fileuri, MAX_PATH_LENGTH, "file://%s", path);
-  else n = snprintf(x->fileuri, MAX_PATH_LENGTH, "file://%s/%s", x->basePath, path);
-  if (n < MAX_PATH_LENGTH) {
-    __android_log_print(ANDROID_LOG_VERBOSE, M4APLAYER_LOG_TAG,
-        "m4aPlayer loading file at uri: %s", x->fileuri);
-  } else {
+  t_group *g = groups;
+  while (g != NULL && g->name != s) g = g->next;
+  if (g == NULL) {
+    g = (t_group *) calloc(1, sizeof(t_group));
+    g->name = s;
+    g->barrierClock = clock_new(g, (t_method) m4aPlayer_pollGroupBarrier);
+    g->next = groups;
+    groups = g;
+  } else if (g->numMembers == MAX_GROUP_SIZE) {
     __android_log_print(ANDROID_LOG_WARN, M4APLAYER_LOG_TAG,
-        "m4aPlayer cannot load file %s/%s because the path is longer than %i characters.",
-        x->basePath, path, MAX_PATH_LENGTH);
+        "Group %s already has %i players. Not joining.", s->s_name, MAX_GROUP_SIZE);
     return;
   }
+  g->members[g->numMembers++] = x;
+  x->group = g;
 
-  // configure audio source
-  SLDataLocator_URI loc_uri = {SL_DATALOCATOR_URI, (SLchar *) x->fileuri};
-  SLDataFormat_MIME format_mime = {SL_DATAFORMAT_MIME, NULL, SL_CONTAINERTYPE_UNSPECIFIED};
-  SLDataSource audioSrc = {&loc_uri, &format_mime};
+  // a player which is already playing continues from where the group is now
+  x->playedFrames = (g->isRunning && x->isPlaying)
+      ? (uint64_t) ((clock_gettimesince(g->startTime) * sys_getsr()) / 1000.0 + 0.5) : 0;
+}
 
-  // configure audio sink (the output buffer queue)
-  SLDataLocator_AndroidSimpleBufferQueue loc_bufq = {
-      // locator type                      num buffers
-      SL_DATALOCATOR_ANDROIDSIMPLEBUFFERQUEUE, 2};
+// finds the named bus, or creates it, and counts the caller as a user
+static t_bus *m4aBus_acquire(t_symbol *name) {
+  t_bus *b = buses;
+  while (b != NULL && b->name != name) b = b->next;
+  if (b == NULL) {
+    b = (t_bus *) calloc(1, sizeof(t_bus));
+    b->name = name;
+    b->blockSize = PD_BLOCK_SIZE;
+    b->time = -1.0;
+    b->buffers = (t_sample *) calloc(4*b->blockSize, sizeof(t_sample));
+    b->sumL = b->buffers;
+    b->sumR = b->sumL + b->blockSize;
+    b->readL = b->sumR + b->blockSize;
+    b->readR = b->readL + b->blockSize;
+    b->next = buses;
+    buses = b;
+  }
+  ++b->numUsers;
+  return b;
+}
 
-  // read file at 16-bit stereo
-  SLDataFormat_PCM format_pcm = {
-      SL_DATAFORMAT_PCM,
-      2, // 2 channels
-      toSlSamplerate((uint32_t) sys_getsr()),
-      SL_PCMSAMPLEFORMAT_FIXED_16,
-      SL_PCMSAMPLEFORMAT_FIXED_16,
-      SL_SPEAKER_FRONT_LEFT | SL_SPEAKER_FRONT_RIGHT,
-      SL_BYTEORDER_LITTLEENDIAN
-  };
+static void m4aBus_release(t_bus *b) {
+  if (--b->numUsers > 0) return;
+  for (t_bus **h = &buses; *h != NULL; h = &(*h)->next) {
+    if (*h == b) {
+      *h = b->next;
+      break;
+    }
+  }
+  free(b->buffers);
+  free(b);
+}
 
-  SLDataSink audioSnk = {&loc_bufq, &format_pcm};
+// called from perform. At the first access in a block, the sum of the previous
+// block becomes readable and summing starts again from silence.
+static void m4aBus_sync(t_bus *b) {
+  const double now = clock_getlogicaltime();
+  if (b->time == now) return;
+  b->time = now;
+  t_sample *const sumL = b->sumL;
+  t_sample *const sumR = b->sumR;
+  b->sumL = b->readL;
+  b->sumR = b->readR;
+  b->readL = sumL;
+  b->readR = sumR;
+  memset(b->sumL, 0, b->blockSize*sizeof(t_sample));
+  memset(b->sumR, 0, b->blockSize*sizeof(t_sample));
+}
 
-  // create audio player
-  const SLInterfaceID ids[2] = {SL_IID_ANDROIDSIMPLEBUFFERQUEUE, SL_IID_SEEK};
-  const SLboolean req[2] = {SL_BOOLEAN_TRUE, SL_BOOLEAN_TRUE};
-  result = (*x->engineEngine)->CreateAudioPlayer(x->engineEngine, &x->bqUriPlayerObject,
-      &audioSrc, &audioSnk, 2, ids, req);
-  switch (result) {
-    case SL_RESULT_SUCCESS: break;
-    case SL_RESULT_CONTENT_CORRUPTED: {
-      __android_log_print(ANDROID_LOG_ERROR, M4APLAYER_LOG_TAG,
-          "Could not create uri audio player: %s is corrupted.", x->fileuri);
-      return;
+// Adds the output to the named mix bus instead of the outlets, which are then
+// silent. Without a name, the player uses its outlets again.
+static void m4aPlayer_bus(t_m4aPlayer *x, t_symbol *s) {
+  if (x->bus != NULL) m4aBus_release(x->bus);
+  x->bus = (s == &s_) ? NULL : m4aBus_acquire(s);
+}
+
+/* the transport methods, which are applied to the whole group if the player is in one */
+
+static void m4aPlayer_startTransport(t_m4aPlayer *x) {
+  if (x->group != NULL) m4aPlayer_startGroup(x->group, clock_getlogicaltime());
+  else m4aPlayer_start(x);
+}
+
+static void m4aPlayer_startatTransport(t_m4aPlayer *x, t_float ms) {
+  if (x->group != NULL) m4aPlayer_startGroup(x->group, clock_getsystimeafter((ms > 0.0f) ? ms : 0.0));
+  else m4aPlayer_startat(x, ms);
+}
+
+static void m4aPlayer_pauseTransport(t_m4aPlayer *x) {
+  if (x->group == NULL) {
+    m4aPlayer_pause(x);
+    return;
+  }
+  // the frames which a member has missed and cannot skip yet are skipped before the group starts again
+  t_group *const g = x->group;
+  for (int i = 0; i < g->numMembers; ++i) {
+    t_m4aPlayer *const y = g->members[i];
+    if (g->isRunning && y->isPlaying && !y->hasStartTime) {
+      const int64_t numGroupFrames = m4aPlayer_getGroupFrames(g);
+      m4aPlayer_catchUpWithGroup(y, numGroupFrames);
+      // nothing is left to skip if the member has reached the end of its track
+      if (y->isPlaying && numGroupFrames > (int64_t) y->playedFrames) {
+        y->numSkipFrames += numGroupFrames - y->playedFrames;
+      }
+    }
+    m4aPlayer_pause(y);
+  }
+  m4aPlayer_stopGroup(g);
+}
+
+static void m4aPlayer_primeTransport(t_m4aPlayer *x, t_float f) {
+  if (x->group == NULL) {
+    m4aPlayer_prime(x, f);
+    return;
+  }
+  m4aPlayer_stopGroup(x->group);
+  for (int i = 0; i < x->group->numMembers; ++i) m4aPlayer_prime(x->group->members[i], f);
+}
+
+static void m4aPlayer_loopTransport(t_m4aPlayer *x, t_float f) {
+  if (x->group == NULL) {
+    m4aPlayer_loop(x, f);
+    return;
+  }
+  for (int i = 0; i < x->group->numMembers; ++i) m4aPlayer_loop(x->group->members[i], f);
+}
+
+static void m4aPlayer_reprimeTransport(t_m4aPlayer *x, t_float f) {
+  if (x->group == NULL) {
+    m4aPlayer_reprime(x, f);
+    return;
+  }
+  for (int i = 0; i < x->group->numMembers; ++i) m4aPlayer_reprime(x->group->members[i], f);
+}
+
+// Opens a new file descriptor for an asset: or fd: uri, which the caller takes
+// ownership of. The descriptor of a file:// uri is left at -1. Returns false if
+// the asset cannot be opened.
+static bool m4aPlayer_openFdSource(const char *uri, t_fdSource *source) {
+  source->fd = -1;
+  source->offset = 0;
+  source->length = -1;
+  if (strncmp(uri, "asset:", 6) == 0) {
+#ifdef __ANDROID__
+    if (assetManager == NULL) {
+      __android_log_print(ANDROID_LOG_ERROR, M4APLAYER_LOG_TAG,
+          "Cannot open %s before m4aPlayer_setAssetManager() has been called.", uri);
+      return false;
+    }
+    AAsset *asset = AAssetManager_open(assetManager, uri+6, AASSET_MODE_UNKNOWN);
+    if (asset == NULL) {
+      __android_log_print(ANDROID_LOG_ERROR, M4APLAYER_LOG_TAG, "Could not find %s in the APK.", uri);
+      return false;
+    }
+    off_t start = 0;
+    off_t length = 0;
+    source->fd = AAsset_openFileDescriptor(asset, &start, &length);
+    AAsset_close(asset);
+    if (source->fd < 0) {
+      __android_log_print(ANDROID_LOG_ERROR, M4APLAYER_LOG_TAG,
+          "Could not open %s. Assets must be stored uncompressed in the APK.", uri);
+      return false;
+    }
+    source->offset = (int64_t) start;
+    source->length = (int64_t) length;
+#else
+    __android_log_print(ANDROID_LOG_ERROR, M4APLAYER_LOG_TAG, "Cannot open %s. Assets are only available on Android.", uri);
+    return false;
+#endif
+  } else if (strncmp(uri, "fd:", 3) == 0) {
+    int fd = -1;
+    long long offset = 0;
+    long long length = -1;
+    if (sscanf(uri+3, "%d:%lld:%lld", &fd, &offset, &length) < 1 || fd < 0) {
+      __android_log_print(ANDROID_LOG_ERROR, M4APLAYER_LOG_TAG, "Cannot open %s. Use fd:FD:OFFSET:LENGTH.", uri);
+      return false;
+    }
+    // the player keeps its own descriptor, so that the app may close its one
+    source->fd = dup(fd);
+    if (source->fd < 0) {
+      __android_log_print(ANDROID_LOG_ERROR, M4APLAYER_LOG_TAG, "Could not duplicate file descriptor %i.", fd);
+      return false;
+    }
+    source->offset = (int64_t) offset;
+    source->length = (int64_t) length;
+  }
+  return true;
+}
+
+#if M4APLAYER_BACKEND_CODEC
+static void m4aPlayer_initBackend() {
+  // every decoder is independent, so nothing is shared
+}
+
+static void m4aPlayer_destroyUriPlayer(t_uriPlayer *p) {
+  assert(!p->hasThread);
+  m4aDecoder_close(p->decoder);
+  free(p);
+}
+
+// The decoders only produce int16 samples. Converting them to float in the
+// worker would double the space that they take in the pipe without adding
+// any precision, so perform converts them instead.
+static bool m4aPlayer_isFloatDecodingSupported(void) {
+  return false;
+}
+
+// opens a decoder for a file://, asset: or fd: uri. Returns NULL on failure.
+static m4aDecoder *m4aPlayer_openDecoder(const char *uri) {
+  t_fdSource source;
+  if (!m4aPlayer_openFdSource(uri, &source)) return NULL;
+  m4aDecoder *decoder = (source.fd >= 0)
+      ? m4aDecoder_openFd(source.fd, source.offset, source.length)
+      : m4aDecoder_open((strncmp(uri, "file://", 7) == 0) ? uri+7 : uri);
+  if (decoder == NULL) return NULL;
+
+  // the asset is not resampled, it must be encoded at the rate that Pd runs at
+  const uint32_t sampleRate = m4aDecoder_getSampleRate(decoder);
+  if (sampleRate != (uint32_t) sys_getsr()) {
+    __android_log_print(ANDROID_LOG_WARN, M4APLAYER_LOG_TAG,
+        "%s has a samplerate of %uHz but Pd runs at %uHz. It will play at the wrong speed.",
+        uri, sampleRate, (uint32_t) sys_getsr());
+  }
+  return decoder;
+}
+
+// Opens a decoder for the asset. Mono assets stay mono, and assets with more
+// than two channels are reduced to the first two. The decoder knows the number
+// of channels, so the indexed one is not needed.
+static t_uriPlayer *m4aPlayer_createUriPlayer(const char *uri, bool isFloat, int numIndexedChannels) {
+  m4aDecoder *decoder = m4aPlayer_openDecoder(uri);
+  if (decoder == NULL) return NULL;
+  const uint32_t sampleRate = m4aDecoder_getSampleRate(decoder);
+
+  t_uriPlayer *p = (t_uriPlayer *) calloc(1, sizeof(t_uriPlayer));
+  strncpy(p->uri, uri, MAX_PATH_LENGTH-1);
+  p->decoder = decoder;
+  p->numChannels = (m4aDecoder_getNumChannels(decoder) == 1) ? 1 : 2;
+  p->isFloat = isFloat;
+  p->durationMs = (uint32_t) ((m4aDecoder_getNumFrames(decoder) * 1000) / sampleRate);
+  return p;
+}
+
+// Moves the decoder to the position and starts the worker on the owner's
+// track. The position is between two frames, so when playing backwards the
+// first frame is the one before it.
+static bool m4aPlayer_startDecoding(t_m4aPlayer *x, t_uriPlayer *p, uint64_t frame) {
+  t_track *const t = p->track;
+  t->numFrames = (uint32_t) m4aDecoder_getNumFrames(p->decoder);
+  t->isDecodingAhead = false;
+  const int numDecodedChannels = m4aDecoder_getNumChannels(p->decoder);
+  p->frames = (int16_t *) malloc(PD_BLOCK_SIZE * numDecodedChannels * sizeof(int16_t));
+
+  // there is no worker yet, so the first seek is applied straight away
+  const t_command c = {COMMAND_SEEK, t->version, frame, t->isReverse};
+  t->seekFrame = (uint32_t) frame;
+  m4aPlayer_seekDecoder(p, &c);
+
+  if (isOffline) {
+    p->isOffline = true;
+    return true;
+  }
+#if M4APLAYER_SIMULATION
+  m4aSim_addWorker(p, &m4aPlayer_stepWorker);
+#else
+  if (pthread_create(&p->thread, NULL, &m4aPlayer_decodeThread, p) != 0) {
+    __android_log_print(ANDROID_LOG_ERROR, M4APLAYER_LOG_TAG, "Could not start decoder thread.");
+    free(p->frames);
+    free(p->chunk);
+    p->frames = NULL;
+    p->chunk = NULL;
+    return false;
+  }
+#endif
+  p->hasThread = true;
+  return true;
+}
+
+// the frame at the position. When playing backwards, a position of 0 is the end of the asset.
+static uint64_t m4aPlayer_getStartFrame(t_uriPlayer *p, bool isReverse, float positionMs) {
+  const uint64_t frame = (uint64_t) ((positionMs * m4aDecoder_getSampleRate(p->decoder)) / 1000.0);
+  return (isReverse && frame == 0) ? m4aDecoder_getNumFrames(p->decoder) : frame;
+}
+
+static bool m4aPlayer_startUriPlayer(t_m4aPlayer *x, t_uriPlayer *p, float positionMs) {
+  return m4aPlayer_startDecoding(x, p, m4aPlayer_getStartFrame(p, p->track->isReverse, positionMs));
+}
+
+// Waits for the worker to exit, and drops the commands which it has not
+// applied. The player must already have been detached from its owner.
+static void m4aPlayer_stopUriPlayer(t_uriPlayer *p) {
+  if (p->hasThread) {
+#if M4APLAYER_SIMULATION
+    m4aSim_removeWorker(p);
+#else
+    pthread_join(p->thread, NULL);
+#endif
+    p->hasThread = false;
+  }
+  if (p->track != NULL) hLp_reset(&p->track->commands);
+  p->track = NULL;
+  free(p->frames);
+  free(p->chunk);
+  p->frames = NULL;
+  p->chunk = NULL;
+  p->isOffline = false;
+}
+#else
+// Enqueues the first buffer on the control thread and starts decoding the
+// asset. Nothing is queued before it, so the callbacks only run again once it
+// has been decoded. If the pipe is full, the player waits in the list until
+// perform has made space, rather than holding up the commands to every other
+// player.
+static void m4aPlayer_startDecoding(t_uriPlayer *p) {
+  if (!m4aPlayer_tryEnqueueBlock(p)) {
+    if (!p->isWaiting) {
+      p->isWaiting = true;
+      p->nextWaiting = waitingPlayers;
+      waitingPlayers = p;
+    }
+    p->waitSession = p->session;
+    p->waitVersion = p->track->producedVersion;
+    return;
+  }
+  SLresult result = (*p->play)->SetPlayState(p->play, SL_PLAYSTATE_PLAYING);
+  if (result != SL_RESULT_SUCCESS) {
+    __android_log_print(ANDROID_LOG_ERROR, M4APLAYER_LOG_TAG, "Could not start asset player (%u).", (uint32_t) result);
+    m4aPlayer_postEvent(p->track, EVENT_ERROR_PLAYER);
+    assert(false);
+  }
+}
+
+// removes the player from the list of those waiting for space
+static void m4aPlayer_stopWaiting(t_uriPlayer *p) {
+  if (!p->isWaiting) return;
+  for (t_uriPlayer **q = &waitingPlayers; *q != NULL; q = &(*q)->nextWaiting) {
+    if (*q == p) {
+      *q = p->nextWaiting;
+      break;
+    }
+  }
+  p->isWaiting = false;
+}
+
+// Starts the waiting players whose pipes have space now, the others wait on.
+// Those which have been closed since are dropped.
+static void m4aPlayer_retryWaiting() {
+  t_uriPlayer *p = waitingPlayers;
+  while (p != NULL) {
+    t_uriPlayer *const next = p->nextWaiting;
+    const bool isCurrent = p->session == p->waitSession && p->track->producedVersion == p->waitVersion;
+    m4aPlayer_stopWaiting(p);
+    if (isCurrent) m4aPlayer_startDecoding(p);
+    p = next;
+  }
+}
+
+static void m4aPlayer_destroyUriPlayerNow(t_uriPlayer *p) {
+  m4aPlayer_stopWaiting(p);
+  (*p->object)->Destroy(p->object);
+  if (p->fd >= 0) close(p->fd);
+  free(p);
+}
+
+// Stops the player, moves it to the frame and starts it again on the control
+// thread. It then decodes the preroll, or further ahead once it is started.
+// The callbacks are held off until the first buffer has been enqueued, so that
+// the control thread is the only producer of the pipe in the meantime.
+static void m4aPlayer_seekUriPlayer(t_uriPlayer *p, const t_command *c) {
+  t_track *const t = p->track;
+  p->isSeeking = true;
+  __sync_synchronize();
+  m4aPlayer_waitForCallbacks(p);
+  (*p->play)->SetPlayState(p->play, SL_PLAYSTATE_STOPPED);
+  (*p->bufferQueue)->Clear(p->bufferQueue);
+  p->isAtEnd = false;
+  const SLmillisecond positionMs = (SLmillisecond) ((c->frame * 1000) / (uint64_t) sys_getsr());
+  SLresult result = (*p->seek)->SetPosition(p->seek, positionMs, SL_SEEKMODE_ACCURATE);
+  if (result != SL_RESULT_SUCCESS) {
+    __android_log_print(ANDROID_LOG_WARN, M4APLAYER_LOG_TAG, "Could not set seek position to %ums (%u).", (uint32_t) positionMs, (uint32_t) result);
+    m4aPlayer_postEvent(t, EVENT_ERROR_SEEK);
+  }
+  t->producedFrames = (uint32_t) c->frame;
+  t->hasProducedEnd = false;
+  t->numSeekBlocks = 0;
+
+  // perform may only see the version once the state of the seek is visible
+  __sync_synchronize();
+  t->producedVersion = c->version;
+
+  p->isSeeking = false;
+  m4aPlayer_startDecoding(p);
+}
+
+static void m4aPlayer_applyCommand(t_uriPlayer *p, const t_command *c) {
+  t_track *const t = p->track;
+  SLresult result = SL_RESULT_SUCCESS;
+  switch (c->type) {
+    case COMMAND_START: {
+      t->isDecodingAhead = true;
+      result = (*p->play)->SetPlayState(p->play, SL_PLAYSTATE_PLAYING);
+      break;
+    }
+    case COMMAND_PAUSE: {
+      // keep decoding until the preroll is buffered, the buffer callback then pauses the player
+      t->isDecodingAhead = false;
+      if ((t->numProducedBlocks - t->numConsumedBlocks) >= t->prerollBlocks) {
+        result = (*p->play)->SetPlayState(p->play, SL_PLAYSTATE_PAUSED);
+      }
+      break;
+    }
+    case COMMAND_SEEK: m4aPlayer_seekUriPlayer(p, c); break;
+    default: break;
+  }
+  if (result != SL_RESULT_SUCCESS) {
+    __android_log_print(ANDROID_LOG_ERROR, M4APLAYER_LOG_TAG, "Could not set play state of asset player (%u).", (uint32_t) result);
+    m4aPlayer_postEvent(t, EVENT_ERROR_PLAYER);
+    assert(false);
+  }
+}
+
+// Applies the requests which the callbacks have posted, unless the player has
+// been closed or seeked since.
+static void m4aPlayer_applyRequests() {
+  t_uriPlayer *p = __sync_lock_test_and_set(&requestingPlayers, NULL);
+  while (p != NULL) {
+    // the player may post again as soon as its requests are taken
+    t_uriPlayer *const next = p->nextRequesting;
+    const uint32_t session = p->requestSession;
+    const uint32_t version = p->requestVersion;
+    const uint32_t requests = __sync_lock_test_and_set(&p->requests, 0);
+    t_track *const t = p->track;
+    if (session != 0 && p->session == session && t->producedVersion == version) {
+      SLresult result = SL_RESULT_SUCCESS;
+      if (requests & (REQUEST_RESTART | REQUEST_END)) {
+        // take back the last buffer, which has been produced already
+        (*p->bufferQueue)->Clear(p->bufferQueue);
+      }
+      if (requests & REQUEST_RESTART) {
+        p->isAtEnd = false;
+        (*p->seek)->SetPosition(p->seek, 0, SL_SEEKMODE_ACCURATE);
+        m4aPlayer_startDecoding(p);
+      } else if ((requests & REQUEST_PAUSE) && !t->isDecodingAhead) {
+        result = (*p->play)->SetPlayState(p->play, SL_PLAYSTATE_PAUSED);
+      }
+      if (result != SL_RESULT_SUCCESS) {
+        __android_log_print(ANDROID_LOG_ERROR, M4APLAYER_LOG_TAG, "Could not set play state of asset player (%u).", (uint32_t) result);
+        m4aPlayer_postEvent(t, EVENT_ERROR_PLAYER);
+      }
+    }
+    p = next;
+  }
+}
+
+// Stops the player once any command before has been applied, and lets the
+// owner which is waiting in m4aPlayer_stopUriPlayer() continue. The player has
+// been detached, so no callback starts producing into the track, but those
+// which are running may still write into its pipe. The owner only resets or
+// releases the pipe, and the player is only parked, once they have returned.
+// Any requests which they have posted are applied before the next command, so
+// a player is never destroyed while it is waiting for its requests.
+static void m4aPlayer_stopUriPlayerNow(t_uriPlayer *p) {
+  m4aPlayer_stopWaiting(p);
+  m4aPlayer_waitForCallbacks(p);
+  SLresult result = (*p->play)->SetPlayState(p->play, SL_PLAYSTATE_STOPPED);
+  if (result != SL_RESULT_SUCCESS) {
+    __android_log_print(ANDROID_LOG_ERROR, M4APLAYER_LOG_TAG, "Could not stop asset player (%u).", (uint32_t) result);
+  }
+  (*p->bufferQueue)->Clear(p->bufferQueue);
+  p->isAtEnd = false;
+  sem_post(&stopSemaphore);
+}
+
+// Applies the commands to every uri player in the order in which they were
+// sent. While players are waiting for space in their pipes, the thread wakes
+// up every block to retry them.
+static void *m4aPlayer_controlThread(void *userData) {
+  while (true) {
+    if (waitingPlayers == NULL) {
+      if (sem_wait(&controlSemaphore) != 0) continue;
+    } else {
+      struct timespec deadline;
+      clock_gettime(CLOCK_REALTIME, &deadline);
+      deadline.tv_nsec += (long) ((1000000000LL * PD_BLOCK_SIZE) / ((int64_t) sys_getsr()));
+      if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_nsec -= 1000000000L;
+        ++deadline.tv_sec;
+      }
+      sem_timedwait(&controlSemaphore, &deadline);
+    }
+    m4aPlayer_applyRequests();
+    m4aPlayer_retryWaiting();
+    if (!hLp_hasData(&controlPipe)) continue;
+    uint32_t numBytes = 0;
+    const t_control e = *(const t_control *) hLp_getReadBuffer(&controlPipe, &numBytes);
+    hLp_consume(&controlPipe);
+    t_uriPlayer *const p = e.uriPlayer;
+    switch (e.command.type) {
+      case COMMAND_DESTROY: m4aPlayer_destroyUriPlayerNow(p); break;
+      case COMMAND_STOP: m4aPlayer_stopUriPlayerNow(p); break;
+      default: if (p->session == e.session) m4aPlayer_applyCommand(p, &e.command); break;
+    }
+  }
+  return NULL;
+}
+
+static bool m4aPlayer_sendControl(t_uriPlayer *p, const t_command *c) {
+  t_control *const e = (t_control *) hLp_getWriteBuffer(&controlPipe, sizeof(t_control));
+  if (e == NULL) return false;
+  e->uriPlayer = p;
+  e->session = p->session;
+  e->command = *c;
+  hLp_produce(&controlPipe, sizeof(t_control));
+  sem_post(&controlSemaphore);
+  return true;
+}
+
+// queues the command for the control thread. Returns false if the queue is full.
+static bool m4aPlayer_sendCommand(t_track *t, const t_command *c) {
+  return m4aPlayer_sendControl(t->uriPlayer, c);
+}
+
+// creates the shared OpenSLES engine if it does not exist yet
+static void m4aPlayer_initBackend() {
+  if (engineObject != NULL) return;
+
+  // create engine
+  SLresult result = slCreateEngine(&engineObject, 0, NULL, 0, NULL, NULL);
+  if (result != SL_RESULT_SUCCESS) {
+    __android_log_print(ANDROID_LOG_ERROR, M4APLAYER_LOG_TAG, "Could not create engine (%u).", (uint32_t) result);
+    assert(false);
+  }
+
+  // realize the engine
+  result = (*engineObject)->Realize(engineObject, SL_BOOLEAN_FALSE);
+  if (result != SL_RESULT_SUCCESS) {
+    __android_log_print(ANDROID_LOG_ERROR, M4APLAYER_LOG_TAG, "Could not realize engine (%u).", (uint32_t) result);
+    assert(false);
+  }
+
+  // get the engine interface, which is needed in order to create other objects
+  result = (*engineObject)->GetInterface(engineObject, SL_IID_ENGINE, &engineEngine);
+  if (result != SL_RESULT_SUCCESS) {
+    __android_log_print(ANDROID_LOG_ERROR, M4APLAYER_LOG_TAG, "Could not get engine interface (%u).", (uint32_t) result);
+    assert(false);
+  }
+
+  // start the control thread, which runs as long as the engine
+  hLp_init(&controlPipe, MAX_COMMANDS*(sizeof(t_control) + 2*sizeof(uint32_t)));
+  sem_init(&controlSemaphore, 0, 0);
+  sem_init(&stopSemaphore, 0, 0);
+  if (pthread_create(&controlThread, NULL, &m4aPlayer_controlThread, NULL) != 0) {
+    __android_log_print(ANDROID_LOG_ERROR, M4APLAYER_LOG_TAG, "Could not start control thread.");
+    assert(false);
+  }
+}
+
+// Queues the player to be destroyed by the control thread, after any commands
+// to it. Waits if the queue is full.
+static void m4aPlayer_destroyUriPlayer(t_uriPlayer *p) {
+  const t_command c = {COMMAND_DESTROY, 0, 0, false};
+  while (!m4aPlayer_sendControl(p, &c)) m4aPlayer_sleepForBlock();
+}
+
+// Float decoder output is available from Android 5.0 (API 21). It must also be
+// supported by the headers that the library is built against.
+static bool m4aPlayer_isFloatDecodingSupported(void) {
+#ifdef SL_ANDROID_DATAFORMAT_PCM_EX
+  static int sdkVersion = -1;
+  if (sdkVersion < 0) {
+    char value[PROP_VALUE_MAX] = "0";
+    __system_property_get("ro.build.version.sdk", value);
+    sdkVersion = atoi(value);
+  }
+  return (sdkVersion >= 21);
+#else
+  return false;
+#endif
+}
+
+// creates and realizes a new uri player which decodes to the given number of
+// channels and sample format. The player reads from the source's file
+// descriptor if it has one, but does not take ownership of it. Returns NULL on
+// failure.
+static t_uriPlayer *m4aPlayer_realizeUriPlayer(const char *uri, const t_fdSource *source,
+    int numChannels, bool isFloat) {
+  SLresult result;
+
+  t_uriPlayer *p = (t_uriPlayer *) calloc(1, sizeof(t_uriPlayer));
+  strncpy(p->uri, uri, MAX_PATH_LENGTH-1);
+  p->fd = -1;
+  p->numChannels = numChannels;
+  p->isFloat = isFloat;
+
+  // configure audio source, either the uri or a part of a file descriptor
+  SLDataLocator_URI loc_uri = {SL_DATALOCATOR_URI, (SLchar *) p->uri};
+  SLDataLocator_AndroidFD loc_fd = {
+      SL_DATALOCATOR_ANDROIDFD,
+      (SLint32) source->fd,
+      (SLAint64) source->offset,
+      (source->length < 0) ? SL_DATALOCATOR_ANDROIDFD_USE_FILE_SIZE : (SLAint64) source->length
+  };
+  SLDataFormat_MIME format_mime = {SL_DATAFORMAT_MIME, NULL, SL_CONTAINERTYPE_UNSPECIFIED};
+  SLDataSource audioSrc = {(source->fd >= 0) ? (void *) &loc_fd : (void *) &loc_uri, &format_mime};
+
+  // configure audio sink (the output buffer queue)
+  SLDataLocator_AndroidSimpleBufferQueue loc_bufq = {
+      // locator type                      num buffers
+      SL_DATALOCATOR_ANDROIDSIMPLEBUFFERQUEUE, 2};
+
+  // read file at 16-bit mono or stereo
+  SLDataFormat_PCM format_pcm = {
+      SL_DATAFORMAT_PCM,
+      (SLuint32) numChannels,
+      toSlSamplerate((uint32_t) sys_getsr()),
+      SL_PCMSAMPLEFORMAT_FIXED_16,
+      SL_PCMSAMPLEFORMAT_FIXED_16,
+      (numChannels == 1) ? SL_SPEAKER_FRONT_CENTER : (SL_SPEAKER_FRONT_LEFT | SL_SPEAKER_FRONT_RIGHT),
+      SL_BYTEORDER_LITTLEENDIAN
+  };
+
+#ifdef SL_ANDROID_DATAFORMAT_PCM_EX
+  // ...or at 32-bit float
+  SLAndroidDataFormat_PCM_EX format_pcm_ex = {
+      SL_ANDROID_DATAFORMAT_PCM_EX,
+      (SLuint32) numChannels,
+      toSlSamplerate((uint32_t) sys_getsr()),
+      SL_PCMSAMPLEFORMAT_FIXED_32,
+      SL_PCMSAMPLEFORMAT_FIXED_32,
+      format_pcm.channelMask,
+      SL_BYTEORDER_LITTLEENDIAN,
+      SL_ANDROID_PCM_REPRESENTATION_FLOAT
+  };
+  SLDataSink audioSnk = {&loc_bufq, isFloat ? (void *) &format_pcm_ex : (void *) &format_pcm};
+#else
+  assert(!isFloat);
+  SLDataSink audioSnk = {&loc_bufq, &format_pcm};
+#endif
+
+  // create audio player
+  const SLInterfaceID ids[2] = {SL_IID_ANDROIDSIMPLEBUFFERQUEUE, SL_IID_SEEK};
+  const SLboolean req[2] = {SL_BOOLEAN_TRUE, SL_BOOLEAN_TRUE};
+  result = (*engineEngine)->CreateAudioPlayer(engineEngine, &p->object,
+      &audioSrc, &audioSnk, 2, ids, req);
+  switch (result) {
+    case SL_RESULT_SUCCESS: break;
+    case SL_RESULT_CONTENT_CORRUPTED: {
+      __android_log_print(ANDROID_LOG_ERROR, M4APLAYER_LOG_TAG,
+          "Could not create uri audio player: %s is corrupted.", p->uri);
+      free(p);
+      return NULL;
     }
     case SL_RESULT_CONTENT_UNSUPPORTED: {
       __android_log_print(ANDROID_LOG_ERROR, M4APLAYER_LOG_TAG,
-          "Could not create uri audio player: %s format is unsupported.", x->fileuri);
-      return;
+          "Could not create uri audio player: %s format is unsupported.", p->uri);
+      free(p);
+      return NULL;
     }
     case SL_RESULT_CONTENT_NOT_FOUND: {
       __android_log_print(ANDROID_LOG_ERROR, M4APLAYER_LOG_TAG,
-          "Could not create uri audio player: %s could not be found.", x->fileuri);
-      return;
+          "Could not create uri audio player: %s could not be found.", p->uri);
+      free(p);
+      return NULL;
     }
     case SL_RESULT_PERMISSION_DENIED: {
       __android_log_print(ANDROID_LOG_ERROR, M4APLAYER_LOG_TAG,
-          "Could not create uri audio player, %s is corrupted.", x->fileuri);
-      return;
+          "Could not create uri audio player, %s is corrupted.", p->uri);
+      free(p);
+      return NULL;
     }
     default: {
       __android_log_print(ANDROID_LOG_ERROR, M4APLAYER_LOG_TAG, "Could not create uri audio player (%u).", (uint32_t) result);
+      free(p);
       assert(false);
-      return;
+      return NULL;
     }
   }
 
   // realize the player
-  result = (*x->bqUriPlayerObject)->Realize(x->bqUriPlayerObject, SL_BOOLEAN_FALSE);
+  result = (*p->object)->Realize(p->object, SL_BOOLEAN_FALSE);
   if (result != SL_RESULT_SUCCESS) {
     __android_log_print(ANDROID_LOG_ERROR, M4APLAYER_LOG_TAG, "Could not realise uri audio player (%u).", (uint32_t) result);
-    m4aPlayer_stopAndCloseIfOpen(x);
+    m4aPlayer_destroyUriPlayer(p);
     assert(false);
-    return;
+    return NULL;
   }
 
   // get the play interface
-  result = (*x->bqUriPlayerObject)->GetInterface(x->bqUriPlayerObject, SL_IID_PLAY, &x->bqUriPlayerPlay);
+  result = (*p->object)->GetInterface(p->object, SL_IID_PLAY, &p->play);
   if (result != SL_RESULT_SUCCESS) {
     __android_log_print(ANDROID_LOG_ERROR, M4APLAYER_LOG_TAG, "Could not get uri audio player player interface (%u).", (uint32_t) result);
-    m4aPlayer_stopAndCloseIfOpen(x);
+    m4aPlayer_destroyUriPlayer(p);
     assert(false);
-    return;
+    return NULL;
   }
 
   // register playback callback to hear about playback events
-  result = (*x->bqUriPlayerPlay)->RegisterCallback(x->bqUriPlayerPlay, &bqPlayerCallback, x);
+  result = (*p->play)->RegisterCallback(p->play, &bqPlayerCallback, p);
   if (result != SL_RESULT_SUCCESS) {
     __android_log_print(ANDROID_LOG_ERROR, M4APLAYER_LOG_TAG, "Could not register uri player callback (%u).", (uint32_t) result);
-    m4aPlayer_stopAndCloseIfOpen(x);
+    m4aPlayer_destroyUriPlayer(p);
     assert(false);
-    return;
+    return NULL;
   }
   // register to receive all callback events
-  (*x->bqUriPlayerPlay)->SetCallbackEventsMask(x->bqUriPlayerPlay,
+  (*p->play)->SetCallbackEventsMask(p->play,
       SL_PLAYEVENT_HEADATEND | SL_PLAYEVENT_HEADATMARKER |
       SL_PLAYEVENT_HEADATNEWPOS | SL_PLAYEVENT_HEADMOVING |
       SL_PLAYEVENT_HEADSTALLED);
 
   // get the seek interface
-  result = (*x->bqUriPlayerObject)->GetInterface(x->bqUriPlayerObject, SL_IID_SEEK, &x->bqUriPlayerSeek);
+  result = (*p->object)->GetInterface(p->object, SL_IID_SEEK, &p->seek);
   if (result != SL_RESULT_SUCCESS) {
     __android_log_print(ANDROID_LOG_ERROR, M4APLAYER_LOG_TAG, "Could not get uri audio player seek interface (%u).", (uint32_t) result);
-    m4aPlayer_stopAndCloseIfOpen(x);
+    m4aPlayer_destroyUriPlayer(p);
     assert(false);
-    return;
-  }
-
-  // set position of player
-  result = (*x->bqUriPlayerSeek)->SetPosition(x->bqUriPlayerSeek, (SLuint32) positionMs, SL_SEEKMODE_ACCURATE);
-  if (result != SL_RESULT_SUCCESS) {
-    __android_log_print(ANDROID_LOG_WARN, M4APLAYER_LOG_TAG, "Could not set seek position to %gms (%u).", positionMs, (uint32_t) result);
+    return NULL;
   }
 
   // get the buffer queue interface
-  result = (*x->bqUriPlayerObject)->GetInterface(x->bqUriPlayerObject,
-      SL_IID_ANDROIDSIMPLEBUFFERQUEUE, &x->bqUriPlayerBufferQueue);
+  result = (*p->object)->GetInterface(p->object,
+      SL_IID_ANDROIDSIMPLEBUFFERQUEUE, &p->bufferQueue);
   if (result != SL_RESULT_SUCCESS) {
     __android_log_print(ANDROID_LOG_ERROR, M4APLAYER_LOG_TAG, "Could not get asset buffer queue interface (%u).", (uint32_t) result);
-    m4aPlayer_stopAndCloseIfOpen(x);
+    m4aPlayer_destroyUriPlayer(p);
     assert(false);
-    return;
+    return NULL;
   }
 
   // set the buffer callback
-  result = (*x->bqUriPlayerBufferQueue)->RegisterCallback(x->bqUriPlayerBufferQueue, &bqPlayerBufferCallback, x);
+  result = (*p->bufferQueue)->RegisterCallback(p->bufferQueue, &bqPlayerBufferCallback, p);
   if (result != SL_RESULT_SUCCESS) {
     __android_log_print(ANDROID_LOG_ERROR, M4APLAYER_LOG_TAG, "Could not set asset buffer callback (%u).", (uint32_t) result);
-    m4aPlayer_stopAndCloseIfOpen(x);
+    m4aPlayer_destroyUriPlayer(p);
     assert(false);
-    return;
+    return NULL;
   }
 
-  // enqueue the first buffer
-  const uint32_t numBytesToEnqueue = x->numChannels * PD_BLOCK_SIZE * sizeof(int16_t);
-  void *buffer = hLp_getWriteBuffer(&x->pipe, numBytesToEnqueue);
-  assert(buffer != NULL);
-  result = (*x->bqUriPlayerBufferQueue)->Enqueue(x->bqUriPlayerBufferQueue, buffer, numBytesToEnqueue);
-  if (SL_RESULT_SUCCESS != result) {
-    __android_log_print(ANDROID_LOG_ERROR, M4APLAYER_LOG_TAG, "Could not enqueue asset buffer (%u).", (uint32_t) result);
-    m4aPlayer_stopAndCloseIfOpen(x);
-    assert(false);
-    return;
+  return p;
+}
+
+// Returns the number of channels which the header of the asset declares, or 0
+// if it could not be probed.
+static int m4aPlayer_probeNumChannels(const char *uri, const t_fdSource *source) {
+  m4aProbeInfo info;
+  if (source->fd >= 0) {
+    return m4aProbe_readFd(source->fd, source->offset, source->length, &info) ? info.numChannels : 0;
   }
+  if (strncmp(uri, "file://", 7) != 0) return 0;
+  return m4aProbe_readFile(uri+7, &info) ? info.numChannels : 0;
+}
 
-  // start decoding the asset
-  result = (*x->bqUriPlayerPlay)->SetPlayState(x->bqUriPlayerPlay, SL_PLAYSTATE_PLAYING);
-  if (result != SL_RESULT_SUCCESS) {
-    __android_log_print(ANDROID_LOG_ERROR, M4APLAYER_LOG_TAG, "Could not start asset player (%u).", (uint32_t) result);
-    m4aPlayer_stopAndCloseIfOpen(x);
-    assert(false);
-    return;
+// Creates a uri player for the asset. Mono assets are decoded natively rather
+// than being upmixed by the decoder, which halves the decoding and conversion
+// work and the space that they take in the pipe. The decoder only reports the
+// channel count once it has prefetched, so it is read from the header of the
+// asset before the player is realized, unless the file has been indexed.
+// Assets which cannot be probed are decoded to stereo. May be called from any
+// thread.
+static t_uriPlayer *m4aPlayer_createUriPlayer(const char *uri, bool isFloat, int numIndexedChannels) {
+  t_fdSource source;
+  if (!m4aPlayer_openFdSource(uri, &source)) return NULL;
+
+  const int numChannels = (numIndexedChannels > 0) ? numIndexedChannels : m4aPlayer_probeNumChannels(uri, &source);
+  const bool isMono = (numChannels == 1);
+  if (isMono) __android_log_print(ANDROID_LOG_INFO, M4APLAYER_LOG_TAG, "Decoding %s as mono.", uri);
+  t_uriPlayer *p = m4aPlayer_realizeUriPlayer(uri, &source, isMono ? 1 : 2, isFloat);
+
+  // the descriptor is closed with the player
+  if (p != NULL) p->fd = source.fd;
+  else if (source.fd >= 0) close(source.fd);
+  return p;
+}
+
+// the frame at the position. OpenSLES resamples to Pd's sample rate and only decodes forwards.
+static uint64_t m4aPlayer_getStartFrame(t_uriPlayer *p, bool isReverse, float positionMs) {
+  return (uint64_t) ((positionMs * sys_getsr()) / 1000.0);
+}
+
+// seeks to the position and starts decoding into the owner's track
+static bool m4aPlayer_startUriPlayer(t_m4aPlayer *x, t_uriPlayer *p, float positionMs) {
+  t_track *const t = p->track;
+  SLresult result;
+
+  // get the duration of the asset, which is remembered by pooled players
+  if (p->durationMs == 0) {
+    result = (*p->play)->GetDuration(p->play, &p->durationMs);
+    if (result != SL_RESULT_SUCCESS || p->durationMs == SL_TIME_UNKNOWN) {
+      __android_log_print(ANDROID_LOG_VERBOSE, M4APLAYER_LOG_TAG, "Could not read duration of %s.", p->uri);
+      p->durationMs = 0;
+    }
   }
+  // only accurate to the ms, or 0 if the duration is unknown
+  t->numFrames = (uint32_t) (((uint64_t) p->durationMs * (uint64_t) sys_getsr()) / 1000);
 
-  // get the duration of the asset
-  SLmillisecond durationMs = 0;
-  result = (*x->bqUriPlayerPlay)->GetDuration(x->bqUriPlayerPlay, &durationMs);
-  if (result != SL_RESULT_SUCCESS) {
-    __android_log_print(ANDROID_LOG_VERBOSE, M4APLAYER_LOG_TAG, "Could not read duration of %s.", x->fileuri);
+  // the control thread seeks and starts decoding
+  p->session = ++numSessions;
+  t->isDecodingAhead = false;
+  const t_command c = {COMMAND_SEEK, t->version+1, m4aPlayer_getStartFrame(p, false, positionMs), false};
+  if (!m4aPlayer_sendCommand(t, &c)) {
+    __android_log_print(ANDROID_LOG_ERROR, M4APLAYER_LOG_TAG, "Could not start asset player, too many commands are queued.");
+    return false;
   }
+  ++t->version;
+  t->seekFrame = (uint32_t) c.frame;
+  return true;
+}
 
-  // indicate that the asset is loaded
-  outlet_float(x->message_done_loading_outlet, (float) durationMs);
+// Stops decoding. The control thread stops the player after the command which
+// it is applying, and the Pd thread blocks until it has and no callback is
+// running any more, rather than polling. The player must already have been
+// detached from its owner.
+static void m4aPlayer_stopUriPlayer(t_uriPlayer *p) {
+  p->session = 0; // the commands which are still queued are not applied
+  const t_command c = {COMMAND_STOP, 0, 0, false};
+  while (!m4aPlayer_sendControl(p, &c)) m4aPlayer_sleepForBlock();
+  while (sem_wait(&stopSemaphore) != 0) {}
 }
+#endif
 
-static void m4aPlayer_open(t_m4aPlayer *x, t_symbol *s, t_float positionMs) {
-  m4aPlayer_closeAndOpenAndStart(x, s->s_name, positionMs);
+// starts decoding ahead of playback in the current track
+static void m4aPlayer_playUriPlayer(t_m4aPlayer *x) {
+  t_track *const t = x->currentTrack;
+  if (t->uriPlayer == NULL) return;
+  const t_command c = {COMMAND_START, t->version, 0, false};
+  if (!m4aPlayer_sendCommand(t, &c)) {
+    __android_log_print(ANDROID_LOG_ERROR, M4APLAYER_LOG_TAG, "Could not start decoding, too many commands are queued.");
+  }
 }
 
-static t_int *m4aPlayer_perform(t_int *w) {
-  t_m4aPlayer *x = (t_m4aPlayer *) w[1];
-  const int n = (int) w[2]; // number of samples that Pd wants
-  t_sample *outL = (t_sample *) w[3]; // the left outlet buffer
-  t_sample *outR = (t_sample *) w[4]; // the right outlet buffer
+// lets the decoder of the current track idle once the preroll is buffered
+static void m4aPlayer_pauseUriPlayer(t_m4aPlayer *x) {
+  t_track *const t = x->currentTrack;
+  if (t->uriPlayer == NULL) return;
+  const t_command c = {COMMAND_PAUSE, t->version, 0, false};
+  if (!m4aPlayer_sendCommand(t, &c)) {
+    __android_log_print(ANDROID_LOG_ERROR, M4APLAYER_LOG_TAG, "Could not pause decoding, too many commands are queued.");
+  }
+}
 
-  if (x->isPlaying && hLp_hasData(&x->pipe)) {
-    switch (x->numChannels) {
-      default: break; // WARNING: asset does not have 0, 1, or 2 channels
-      case 2: {
-        const uint32_t numBytesToRead = 2*n*sizeof(int16_t); // 2 channels
-        uint32_t numBytesAvailable = 0;
-        int16_t *buffer = (int16_t *) hLp_getReadBuffer(&x->pipe, &numBytesAvailable);
-        assert(numBytesToRead == numBytesAvailable);
-
-        // uninterleave and convert samples into output buffer
-        for (int i = 0; i < n; ++i) {
-          outL[i] = ((float) buffer[2*i])   * CVT_SHORT_FLOAT;
-          outR[i] = ((float) buffer[2*i+1]) * CVT_SHORT_FLOAT;
-        }
+// Moves the open track to the frame, in the player's direction, without
+// waiting for the decoder. The blocks which it has decoded before are
+// discarded as they reach the head of the pipe. Returns false if the queue of
+// commands is full, in which case the track is left as it is.
+static bool m4aPlayer_seekTrack(t_m4aPlayer *x, t_track *t, uint32_t frame) {
+  const t_command c = {COMMAND_SEEK, t->version+1, frame, x->isReverse};
+  if (!m4aPlayer_sendCommand(t, &c)) {
+    __android_log_print(ANDROID_LOG_ERROR, M4APLAYER_LOG_TAG, "Could not seek, too many commands are queued.");
+    return false;
+  }
+  ++t->version;
+  t->isReverse = x->isReverse;
+  t->seekFrame = frame;
+  m4aPlayer_discardStaleBlocks(t);
+  return true;
+}
 
-        hLp_consume(&x->pipe); // done with the buffer
-        break;
-      }
-      case 1: {
-        const uint32_t numBytesToRead = n*sizeof(int16_t); // 1 channel
-        uint32_t numBytesAvailable = 0;
-        int16_t *buffer = (int16_t *) hLp_getReadBuffer(&x->pipe, &numBytesAvailable);
-        assert(numBytesToRead == numBytesAvailable);
-        for (int i = 0; i < n; ++i) {
-          outL[i] = ((float) buffer[i]) * CVT_SHORT_FLOAT;
-        }
-        hLp_consume(&x->pipe); // done with the buffer
-        break;
-      }
-      case 0: break;
+// the number of channels of the file from the indexes, or 0 if it has not
+// been indexed. The indexes are only read on the Pd thread.
+static int m4aPlayer_getIndexedNumChannels(const char *uri) {
+  m4aProbeInfo info;
+  if (strncmp(uri, "file://", 7) != 0) return 0;
+  return m4aPlayer_findIndexed(m4aPeaks_getFileIdentity(uri+7), &info) ? info.numChannels : 0;
+}
+
+// takes a parked player for the given uri and sample format out of the pool,
+// or returns NULL if there is none
+static t_uriPlayer *m4aPlayer_takePooledUriPlayer(const char *uri, bool isFloat) {
+  for (int i = poolCount-1; i >= 0; --i) {
+    t_uriPlayer *const p = pool[i];
+    if (p->isFloat == isFloat && strcmp(p->uri, uri) == 0) {
+      memmove(pool+i, pool+i+1, (poolCount-i-1)*sizeof(t_uriPlayer *));
+      --poolCount;
+      __android_log_print(ANDROID_LOG_VERBOSE, M4APLAYER_LOG_TAG, "Reusing pooled player for %s.", uri);
+      return p;
     }
-  } else {
-    // if not playing or no data is available, output silence
-    memset(outL, 0, n*sizeof(float));
-    memset(outR, 0, n*sizeof(float));
   }
+  return NULL;
+}
 
-  return (w+5);
+// takes a parked player for the given uri and sample format out of the pool,
+// or creates a new one
+static t_uriPlayer *m4aPlayer_borrowUriPlayer(const char *uri, bool isFloat) {
+  t_uriPlayer *const p = m4aPlayer_takePooledUriPlayer(uri, isFloat);
+  return (p != NULL) ? p : m4aPlayer_createUriPlayer(uri, isFloat, m4aPlayer_getIndexedNumChannels(uri));
 }
 
-static void m4aPlayer_dsp(t_m4aPlayer *x, t_signal **sp) {
-  dsp_add(m4aPlayer_perform, 4, x, sp[0]->s_n, sp[0]->s_vec, sp[1]->s_vec);
+// stops the player and parks it in the pool, evicting the oldest player if the pool is full
+static void m4aPlayer_returnUriPlayer(t_uriPlayer *p) {
+  assert(p->owner == NULL);
+  m4aPlayer_stopUriPlayer(p);
+
+  // the app may reuse the number of a closed descriptor for another file, so
+  // players of fd: uris are never pooled
+  if (poolSize == 0 || strncmp(p->uri, "fd:", 3) == 0) {
+    m4aPlayer_destroyUriPlayer(p);
+    return;
+  }
+  if (poolCount == poolSize) {
+    m4aPlayer_destroyUriPlayer(pool[0]);
+    memmove(pool, pool+1, (poolCount-1)*sizeof(t_uriPlayer *));
+    --poolCount;
+  }
+  pool[poolCount++] = p;
 }
 
+void m4aPlayer_setPoolSize(int size) {
+  poolSize = (size < 0) ? 0 : (size > MAX_POOL_SIZE) ? MAX_POOL_SIZE : size;
+  while (poolCount > poolSize) {
+    m4aPlayer_destroyUriPlayer(pool[0]);
+    memmove(pool, pool+1, (poolCount-1)*sizeof(t_uriPlayer *));
+    --poolCount;
+  }
+}
+
+static void m4aPlayer_prewarmUri(const char *uri, bool isFloat) {
+  m4aPlayer_initBackend();
+  t_uriPlayer *p = m4aPlayer_createUriPlayer(uri, isFloat, m4aPlayer_getIndexedNumChannels(uri));
+  if (p != NULL) m4aPlayer_returnUriPlayer(p);
+}
+
+// true if the path is a file://, asset: or fd: uri rather than a plain file path
+static bool m4aPlayer_isUri(const char *path) {
+  return (strncmp(path, "file://", 7) == 0) || (strncmp(path, "asset:", 6) == 0) || (strncmp(path, "fd:", 3) == 0);
+}
+
+void m4aPlayer_prewarm(const char *path) {
+  char uri[MAX_PATH_LENGTH];
+  if (m4aPlayer_isUri(path)) snprintf(uri, MAX_PATH_LENGTH, "%s", path);
+  else snprintf(uri, MAX_PATH_LENGTH, "file://%s", path);
+  m4aPlayer_prewarmUri(uri, m4aPlayer_isFloatDecodingSupported());
+}
+
+static void m4aPlayer_allocPipe(HvLightPipe *pipe, uint32_t numBytes) {
+  hLp_init(pipe, numBytes);
+  numPipeBytes += numBytes;
+}
+
+static void m4aPlayer_releasePipe(HvLightPipe *pipe) {
+  if (pipe->buffer == NULL) return;
+  numPipeBytes -= pipe->len;
+  hLp_free(pipe);
+  pipe->buffer = NULL;
+}
+
+// releases the pipes of the tracks which are closed
+static void m4aPlayer_releaseIdlePipes(t_m4aPlayer *x) {
+  if (x->trackA.uriPlayer == NULL) m4aPlayer_releasePipe(&x->trackA.pipe);
+  if (x->trackB.uriPlayer == NULL) m4aPlayer_releasePipe(&x->trackB.pipe);
+}
+
+// Peak pyramids of the files which have been decoded from start to end, most
+// recently used first. Pyramids of files (rather than assets) are also written
+// to the cache directory, named by the identity of the file, so that a later
+// session finds them without decoding the file again. Only accessed from the
+// Pd thread.
+static m4aPeaks *cachedPeaks[MAX_CACHED_PEAKS];
+static int numCachedPeaks = 0;
+static char cacheDir[MAX_PATH_LENGTH] = ""; // nothing is written if empty
+
+void m4aPlayer_setCacheDir(const char *path) {
+  snprintf(cacheDir, MAX_PATH_LENGTH, "%s", path);
+}
+
+// Identifies the contents of a uri. fd: uris have no identity, as the number
+// of a closed descriptor may be reused for another file.
+static uint64_t m4aPlayer_getIdentity(const char *uri) {
+  if (strncmp(uri, "file://", 7) == 0) return m4aPeaks_getFileIdentity(uri+7);
+  if (strncmp(uri, "asset:", 6) == 0) return m4aPeaks_hashString(uri);
+  return 0;
+}
+
+// the path of the persisted peaks of a file, false if they are not persisted
+static bool m4aPlayer_getPeakPath(const char *uri, uint64_t identity, char *path) {
+  if (cacheDir[0] == '\0' || strncmp(uri, "file://", 7) != 0) return false;
+  return snprintf(path, MAX_PATH_LENGTH, "%s/%016llx.m4apeaks", cacheDir, (unsigned long long) identity) < MAX_PATH_LENGTH;
+}
+
+static void m4aPlayer_uncachePeaks(int i) {
+  numPeakBytes -= m4aPeaks_getNumBytes(cachedPeaks[i]);
+  m4aPeaks_free(cachedPeaks[i]);
+  memmove(cachedPeaks+i, cachedPeaks+i+1, (numCachedPeaks-i-1)*sizeof(m4aPeaks *));
+  --numCachedPeaks;
+}
+
+// Releases the pipes of closed players, which are cheap to allocate again,
+// and then the least recently used peaks, until the memory is within the
+// budget. The most recently used peaks are kept, as they may be in use.
+static void m4aPlayer_enforceBudget() {
+  for (t_m4aPlayer *x = players; x != NULL && numPipeBytes + numPeakBytes > memoryBudget; x = x->nextPlayer) {
+    clock_unset(x->idleClock);
+    m4aPlayer_releaseIdlePipes(x);
+  }
+  while (numCachedPeaks > 1 && numPipeBytes + numPeakBytes > memoryBudget) {
+    m4aPlayer_uncachePeaks(numCachedPeaks-1);
+  }
+  if (numPipeBytes + numPeakBytes > memoryBudget) {
+    __android_log_print(ANDROID_LOG_INFO, M4APLAYER_LOG_TAG,
+        "Pipes and peaks take %zu bytes, over the budget of %zu bytes.", numPipeBytes + numPeakBytes, memoryBudget);
+  }
+}
+
+void m4aPlayer_setMemoryBudget(size_t numBytes) {
+  memoryBudget = numBytes;
+  m4aPlayer_enforceBudget();
+}
+
+void m4aPlayer_setOffline(bool shouldRenderOffline) {
+#if M4APLAYER_BACKEND_CODEC
+  isOffline = shouldRenderOffline;
+#else
+  if (shouldRenderOffline) {
+    __android_log_print(ANDROID_LOG_WARN, M4APLAYER_LOG_TAG, "Offline rendering needs the codec backend.");
+  }
+#endif
+}
+
+// releases everything which is not in use, on the Pd thread
+static void m4aPlayer_flushCachesNow() {
+  while (numCachedPeaks > 0) m4aPlayer_uncachePeaks(numCachedPeaks-1);
+  while (poolCount > 0) m4aPlayer_destroyUriPlayer(pool[--poolCount]);
+  for (t_m4aPlayer *x = players; x != NULL; x = x->nextPlayer) {
+    clock_unset(x->idleClock);
+    m4aPlayer_releaseIdlePipes(x);
+  }
+}
+
+// The pool, the peaks and the pipes are only touched by the Pd thread, while
+// memory warnings arrive on the app's main thread. A flush from another thread
+// is therefore only requested, and perform schedules the flush clock for it.
+static volatile bool isFlushRequested = false;
+static t_clock *flushClock = NULL;
+
+static void m4aPlayer_onFlushRequested() {
+  isFlushRequested = false;
+  m4aPlayer_flushCachesNow();
+}
+
+void m4aPlayer_flushCaches() {
+  isFlushRequested = true;
+}
+
+// Takes the peaks, replacing any older ones of the same file, and evicting the
+// least recently used ones if the cache is full or over the budget.
+static void m4aPlayer_cachePeaks(m4aPeaks *peaks) {
+  for (int i = 0; i < numCachedPeaks; ++i) {
+    if (m4aPeaks_getIdentity(cachedPeaks[i]) == m4aPeaks_getIdentity(peaks)) {
+      m4aPlayer_uncachePeaks(i);
+      break;
+    }
+  }
+  if (numCachedPeaks == MAX_CACHED_PEAKS) m4aPlayer_uncachePeaks(numCachedPeaks-1);
+  memmove(cachedPeaks+1, cachedPeaks, numCachedPeaks*sizeof(m4aPeaks *));
+  cachedPeaks[0] = peaks;
+  ++numCachedPeaks;
+  numPeakBytes += m4aPeaks_getNumBytes(peaks);
+  m4aPlayer_enforceBudget();
+}
+
+// Finds the peaks of a uri in memory or in the cache directory. Returns NULL
+// if they have not been built yet. With shouldLoad false, persisted peaks are
+// only looked for and not read.
+static m4aPeaks *m4aPlayer_findPeaks(const char *uri, uint64_t identity, bool shouldLoad, bool *isKnown) {
+  *isKnown = false;
+  if (identity == 0) return NULL;
+  for (int i = 0; i < numCachedPeaks; ++i) {
+    m4aPeaks *const peaks = cachedPeaks[i];
+    if (m4aPeaks_getIdentity(peaks) == identity) {
+      memmove(cachedPeaks+1, cachedPeaks, i*sizeof(m4aPeaks *));
+      cachedPeaks[0] = peaks;
+      *isKnown = true;
+      return peaks;
+    }
+  }
+  char path[MAX_PATH_LENGTH];
+  if (!m4aPlayer_getPeakPath(uri, identity, path)) return NULL;
+  if (!shouldLoad) {
+    *isKnown = (access(path, R_OK) == 0);
+    return NULL;
+  }
+  m4aPeaks *const peaks = m4aPeaks_read(path, identity);
+  if (peaks != NULL) {
+    m4aPlayer_cachePeaks(peaks);
+    *isKnown = true;
+  }
+  return peaks;
+}
+
+// keeps peaks which have been built, and writes them to the cache directory
+static void m4aPlayer_keepPeaks(const char *uri, m4aPeaks *peaks) {
+  char path[MAX_PATH_LENGTH];
+  if (m4aPlayer_getPeakPath(uri, m4aPeaks_getIdentity(peaks), path)) m4aPeaks_write(peaks, path);
+  m4aPlayer_cachePeaks(peaks);
+}
+
+// closes the asset on the given track and returns its player to the pool
+static void m4aPlayer_closeTrack(t_track *t) {
+  if (t->uriPlayer != NULL) {
+    t_uriPlayer *const p = t->uriPlayer;
+    t->uriPlayer = NULL;
+    char uri[MAX_PATH_LENGTH];
+    strncpy(uri, p->uri, MAX_PATH_LENGTH);
+
+    // detach the player first so that no callback starts producing into the
+    // track. Stopping it waits for the callbacks which are running.
+    p->owner = NULL;
+    m4aPlayer_returnUriPlayer(p);
+
+    // clear the pipe, and drop the events which belong to the closed asset
+    hLp_reset(&t->pipe);
+    hLp_reset(&t->events);
+
+    // keep the peaks if the whole asset has been decoded, now that the producer
+    // has stopped. Keeping them may release the pipe to stay within the budget.
+    if (t->peaks != NULL) {
+      if (m4aPeaks_isComplete(t->peaks)) m4aPlayer_keepPeaks(uri, t->peaks);
+      else m4aPeaks_free(t->peaks);
+      t->peaks = NULL;
+    }
+  }
+}
+
+static void m4aPlayer_stopAndCloseIfOpen(t_m4aPlayer *x) {
+  x->isPlaying = false;
+  x->hasStartTime = false;
+  x->numSkipFrames = 0;
+  m4aPlayer_closeTrack(x->currentTrack);
+  m4aPlayer_closeTrack(x->nextTrack);
+  x->hasQueuedTrack = false;
+  x->shouldCloseNextTrack = false;
+  x->hasPendingQueue = false; // a running open job parks its player in the pool
+  x->readFrame = 0;
+
+  // a pending ready event belongs to the closed track
+  clock_unset(x->readyClock);
+  clock_delay(x->idleClock, IDLE_PIPE_MS);
+}
+
+#ifdef __ANDROID__
+void m4aPlayer_setAssetManager(AAssetManager *manager) {
+  assetManager = manager;
+}
+#endif
+
+// generate the file URI (input path may be absolute, relative or already a file://, asset: or fd: uri)
+static bool m4aPlayer_makeUri(const char *basePath, const char *path, char *uri) {
+  int n = 0;
+  if (m4aPlayer_isUri(path)) n = snprintf(uri, MAX_PATH_LENGTH, "%s", path);
+  else if (path[0] == '/') n = snprintf(uri, MAX_PATH_LENGTH, "file://%s", path);
+  else n = snprintf(uri, MAX_PATH_LENGTH, "file://%s/%s", basePath, path);
+  if (n < MAX_PATH_LENGTH) {
+    __android_log_print(ANDROID_LOG_VERBOSE, M4APLAYER_LOG_TAG,
+        "m4aPlayer loading file at uri: %s", uri);
+    return true;
+  } else {
+    __android_log_print(ANDROID_LOG_WARN, M4APLAYER_LOG_TAG,
+        "m4aPlayer cannot load file %s/%s because the path is longer than %i characters.",
+        basePath, path, MAX_PATH_LENGTH);
+    return false;
+  }
+}
+
+// puts the uri player on the given track and starts decoding into the track's pipe
+static bool m4aPlayer_attachUriPlayer(t_m4aPlayer *x, t_track *t, t_uriPlayer *p, float positionMs) {
+  // allocate the pipe if it has not been used yet or has been released, or if the sample format has changed
+  clock_unset(x->idleClock);
+  if (t->pipe.buffer != NULL && t->pipe.len != PIPE_NUM_BYTES(p->isFloat)) m4aPlayer_releasePipe(&t->pipe);
+  if (t->pipe.buffer == NULL) m4aPlayer_allocPipe(&t->pipe, PIPE_NUM_BYTES(p->isFloat));
+  t->uriPlayer = p;
+  t->numChannels = p->numChannels;
+  t->isFloat = p->isFloat;
+  t->isReverse = x->isReverse;
+  t->isFinished = false;
+  t->isReady = false;
+  t->isStarted = false;
+  t->prerollBlocks = x->prerollBlocks;
+  t->hasProducedEnd = false;
+  t->numProducedBlocks = 0;
+  t->numConsumedBlocks = 0;
+  p->track = t;
+  p->owner = x;
+
+  // build the peaks of the asset while it is decoded, unless they are known already
+  const uint64_t identity = m4aPlayer_getIdentity(p->uri);
+  bool hasPeaks = false;
+  m4aPlayer_findPeaks(p->uri, identity, false, &hasPeaks);
+  t->peaks = (identity != 0 && !hasPeaks && positionMs == 0.0f && !t->isReverse) ? m4aPeaks_new(identity) : NULL;
+
+  if (!m4aPlayer_startUriPlayer(x, p, positionMs)) {
+    m4aPlayer_closeTrack(t);
+    return false;
+  }
+  m4aPlayer_enforceBudget();
+  return true;
+}
+
+// opens the uri on the given track and starts decoding into the track's pipe
+static bool m4aPlayer_openTrack(t_m4aPlayer *x, t_track *t, const char *uri, float positionMs) {
+  // take a realized player from the pool if one is available for this uri
+  t_uriPlayer *const p = m4aPlayer_borrowUriPlayer(uri, x->useFloat);
+  return (p != NULL) && m4aPlayer_attachUriPlayer(x, t, p, positionMs);
+}
+
+// path may be absolute or relative
+static void m4aPlayer_closeAndOpenAndStart(t_m4aPlayer *x, const char *path, float positionMs) {
+  // path may point at x->fileuri (e.g. when repriming), so build the uri first
+  char uri[MAX_PATH_LENGTH];
+  if (!m4aPlayer_makeUri(x->basePath, path, uri)) return;
+
+  // stop and close any active asset player
+  m4aPlayer_stopAndCloseIfOpen(x);
+
+  strncpy(x->fileuri, uri, MAX_PATH_LENGTH);
+
+  if (m4aPlayer_openTrack(x, x->currentTrack, uri, positionMs)) {
+    // indicate that the asset is loaded
+    outlet_float(x->message_done_loading_outlet, (float) x->currentTrack->uriPlayer->durationMs);
+  }
+}
+
+static void m4aPlayer_open(t_m4aPlayer *x, t_symbol *s, t_float positionMs) {
+  m4aPlayer_closeAndOpenAndStart(x, s->s_name, positionMs);
+}
+
+// Creates the player of a queued file on a worker, as realizing a player or
+// opening a decoder takes tens of ms. The worker exits once it is done.
+typedef struct _openJob {
+  char uri[MAX_PATH_LENGTH];
+  bool isFloat;
+  int numIndexedChannels;
+  t_uriPlayer *uriPlayer; // NULL if the file could not be opened
+  bool hasThread;
+  pthread_t thread;
+  volatile bool isDone;
+} t_openJob;
+
+static bool m4aPlayer_stepOpenJob(void *worker) {
+  t_openJob *const j = (t_openJob *) worker;
+  if (j->isDone) return false;
+  j->uriPlayer = m4aPlayer_createUriPlayer(j->uri, j->isFloat, j->numIndexedChannels);
+  j->isDone = true;
+  return true;
+}
+
+#if !M4APLAYER_SIMULATION
+static void *m4aPlayer_openThread(void *userData) {
+  m4aPlayer_stepOpenJob(userData);
+  return NULL;
+}
+#endif
+
+static void m4aPlayer_startOpenJob(t_m4aPlayer *x) {
+  t_openJob *const j = (t_openJob *) calloc(1, sizeof(t_openJob));
+  strncpy(j->uri, x->queuedUri, MAX_PATH_LENGTH);
+  j->isFloat = x->useFloat;
+  j->numIndexedChannels = m4aPlayer_getIndexedNumChannels(j->uri);
+  x->openJob = j;
+#if M4APLAYER_SIMULATION
+  m4aSim_addWorker(j, &m4aPlayer_stepOpenJob);
+  j->hasThread = true;
+#else
+  j->hasThread = (pthread_create(&j->thread, NULL, &m4aPlayer_openThread, j) == 0);
+  if (!j->hasThread) {
+    __android_log_print(ANDROID_LOG_ERROR, M4APLAYER_LOG_TAG, "Could not start open thread. Opening on the Pd thread.");
+    m4aPlayer_stepOpenJob(j);
+  }
+#endif
+  clock_delay(x->openClock, 5.0);
+}
+
+// waits for the worker and frees the job. Returns the player which it has created.
+static t_uriPlayer *m4aPlayer_finishOpenJob(t_openJob *j) {
+#if M4APLAYER_SIMULATION
+  m4aSim_removeWorker(j);
+#else
+  if (j->hasThread) pthread_join(j->thread, NULL);
+#endif
+  t_uriPlayer *const p = j->uriPlayer;
+  free(j);
+  return p;
+}
+
+static void m4aPlayer_cancelOpenJob(t_m4aPlayer *x) {
+  clock_unset(x->openClock);
+  t_openJob *const j = x->openJob;
+  if (j == NULL) return;
+  x->openJob = NULL;
+  x->hasPendingQueue = false;
+  t_uriPlayer *const p = m4aPlayer_finishOpenJob(j);
+  if (p != NULL) m4aPlayer_returnUriPlayer(p);
+}
+
+// Puts the player of the queued file on the next track, replacing anything
+// queued previously, and sends done-loading. If the current track has finished
+// or been closed in the meantime, the file is opened on it instead, as queue
+// would have done.
+static void m4aPlayer_queueUriPlayer(t_m4aPlayer *x, t_uriPlayer *p) {
+  t_track *t = x->nextTrack;
+  if (x->currentTrack->uriPlayer == NULL || x->currentTrack->isFinished) {
+    m4aPlayer_stopAndCloseIfOpen(x);
+    strncpy(x->fileuri, p->uri, MAX_PATH_LENGTH);
+    t = x->currentTrack;
+  } else {
+    x->hasQueuedTrack = false;
+    x->shouldCloseNextTrack = false;
+    m4aPlayer_closeTrack(t);
+  }
+  if (!m4aPlayer_attachUriPlayer(x, t, p, 0.0f)) return;
+  if (t == x->nextTrack) {
+    x->hasQueuedTrack = true;
+    t->isReady = true; // it starts by itself at the end of the current track
+  }
+  outlet_float(x->message_done_loading_outlet, (float) p->durationMs);
+}
+
+// Queues the pending file with a player from the pool, or starts creating one.
+// A job which is still creating the player of an earlier file is left to
+// finish first.
+static void m4aPlayer_openQueuedUri(t_m4aPlayer *x) {
+  t_uriPlayer *const p = m4aPlayer_takePooledUriPlayer(x->queuedUri, x->useFloat);
+  if (p != NULL) {
+    x->hasPendingQueue = false;
+    m4aPlayer_queueUriPlayer(x, p);
+    return;
+  }
+#if M4APLAYER_BACKEND_CODEC
+  // when rendering offline the file is opened straight away, so that renders are repeatable
+  if (isOffline) {
+    x->hasPendingQueue = false;
+    t_uriPlayer *const q = m4aPlayer_createUriPlayer(x->queuedUri, x->useFloat, m4aPlayer_getIndexedNumChannels(x->queuedUri));
+    if (q != NULL) m4aPlayer_queueUriPlayer(x, q);
+    return;
+  }
+#endif
+  if (x->openJob == NULL) m4aPlayer_startOpenJob(x);
+}
+
+// called by the open clock on the Pd thread until the player has been created
+static void m4aPlayer_pollOpenJob(t_m4aPlayer *x) {
+  t_openJob *const j = x->openJob;
+  if (!j->isDone) {
+    clock_delay(x->openClock, 5.0);
+    return;
+  }
+  x->openJob = NULL;
+  const bool isPending = x->hasPendingQueue && j->isFloat == x->useFloat && strcmp(j->uri, x->queuedUri) == 0;
+  t_uriPlayer *const p = m4aPlayer_finishOpenJob(j);
+  if (isPending) {
+    x->hasPendingQueue = false;
+    if (p != NULL) m4aPlayer_queueUriPlayer(x, p);
+    return;
+  }
+
+  // another file has been queued meanwhile, or the queue has been cancelled
+  if (p != NULL) m4aPlayer_returnUriPlayer(p);
+  if (x->hasPendingQueue) m4aPlayer_openQueuedUri(x);
+}
+
+// Opens the file on the next track and decodes it in the background while the
+// current track plays. Playback switches over at the exact end of the current
+// track. Unless a player for the file is pooled, it is created on a worker,
+// and done-loading is sent once it has been. Until then, anything queued
+// previously stays queued, so that a track which the decoder has already
+// passed the end of without restarting still has one to switch over to. If
+// nothing is open, or the current track is finished, this is the same as open.
+static void m4aPlayer_queue(t_m4aPlayer *x, t_symbol *s) {
+  if (x->currentTrack->uriPlayer == NULL || x->currentTrack->isFinished) {
+    m4aPlayer_closeAndOpenAndStart(x, s->s_name, 0.0f);
+    return;
+  }
+
+  char uri[MAX_PATH_LENGTH];
+  if (!m4aPlayer_makeUri(x->basePath, s->s_name, uri)) return;
+  strncpy(x->queuedUri, uri, MAX_PATH_LENGTH);
+  x->hasPendingQueue = true;
+  m4aPlayer_openQueuedUri(x);
+}
+
+#if M4APLAYER_BACKEND_CODEC
+// the position of playback in the current track, between two frames
+static uint32_t m4aPlayer_getPlayPosition(t_m4aPlayer *x) {
+  t_track *const t = x->currentTrack;
+  m4aPlayer_discardStaleBlocks(t);
+  if (!hLp_hasData(&t->pipe)) return (t->producedVersion == t->version) ? t->producedFrames : t->seekFrame;
+  uint32_t numBytesAvailable = 0;
+  const t_blockHeader *const block = (const t_blockHeader *) hLp_getReadBuffer(&t->pipe, &numBytesAvailable);
+  return t->isReverse ? block->position - x->readFrame : block->position + x->readFrame;
+}
+
+#endif
+
+// Plays forwards (1) or backwards (-1). The current track turns around at the
+// sample which is being played, after a gap while the decoder refills the
+// pipe (before a start, ready is sent again once it has been refilled), and a
+// queued track starts from its other end. Neither waits for the decoder. Files which are opened
+// from now on play in the same direction, and in reverse a position of 0 is
+// the end of the file.
+static void m4aPlayer_direction(t_m4aPlayer *x, t_float f) {
+#if M4APLAYER_BACKEND_CODEC
+  const bool isReverse = (f < 0.0f);
+  if (isReverse == x->isReverse) return;
+  x->isReverse = isReverse;
+  t_track *const t = x->currentTrack;
+  if (t->uriPlayer != NULL && !t->isFinished) {
+    // at the end of the asset, the decoder passes the end on first
+    const uint32_t frame = m4aPlayer_getPlayPosition(x);
+    if (m4aPlayer_seekTrack(x, t, frame)) {
+      x->readFrame = 0;
+      if (!t->isStarted) t->isReady = false; // ready again once the preroll has been buffered
+    }
+  }
+  if (x->hasQueuedTrack && x->nextTrack->uriPlayer != NULL) {
+    m4aPlayer_seekTrack(x, x->nextTrack, isReverse ? x->nextTrack->numFrames : 0);
+  }
+#else
+  if (f < 0.0f) {
+    __android_log_print(ANDROID_LOG_WARN, M4APLAYER_LOG_TAG,
+        "Reverse playback needs the codec backend (ndk-build M4APLAYER_BACKEND=codec).");
+  }
+#endif
+}
+
+// Adds a cue point at ms in the file, at which the id is sent from outlet 6.
+// The id is sent exactly one block after the logical time at which the frame
+// is played, whatever the Pd block in which it falls. Markers apply to every
+// file which is played, in either direction, until they are cleared with
+// marker alone.
+static void m4aPlayer_marker(t_m4aPlayer *x, t_symbol *s, int argc, t_atom *argv) {
+  if (argc == 0) {
+    x->numMarkers = 0;
+    return;
+  }
+  if (argc < 2 || argv[0].a_type != A_FLOAT || argv[1].a_type != A_FLOAT) {
+    __android_log_print(ANDROID_LOG_WARN, M4APLAYER_LOG_TAG, "marker needs a position in ms and an id.");
+    return;
+  }
+  if (x->numMarkers == MAX_MARKERS) {
+    __android_log_print(ANDROID_LOG_WARN, M4APLAYER_LOG_TAG, "A player has at most %i markers.", MAX_MARKERS);
+    return;
+  }
+  const t_float ms = argv[0].a_w.w_float;
+  const uint32_t frame = (ms > 0.0f) ? (uint32_t) ((ms * sys_getsr()) / 1000.0 + 0.5) : 0;
+  int m = x->numMarkers++;
+  for (; m > 0 && x->markers[m-1].frame > frame; --m) x->markers[m] = x->markers[m-1];
+  x->markers[m].frame = frame;
+  x->markers[m].id = argv[1].a_w.w_float;
+}
+
+// Fills an array with the overview of a file for drawing its waveform. The
+// points alternate between the maximum and the minimum of each stretch of the
+// file, which Pd draws as a filled waveform with the polygon style.
+static void m4aPlayer_fillOverview(t_symbol *array, int numPoints, const m4aPeaks *peaks) {
+  t_garray *a = (t_garray *) pd_findbyclass(array, garray_class);
+  if (a == NULL) {
+    __android_log_print(ANDROID_LOG_WARN, M4APLAYER_LOG_TAG, "There is no array named %s.", array->s_name);
+    return;
+  }
+  garray_resize_long(a, numPoints);
+  int n = 0;
+  t_word *vec = NULL;
+  if (!garray_getfloatwords(a, &n, &vec)) {
+    __android_log_print(ANDROID_LOG_WARN, M4APLAYER_LOG_TAG, "%s is not a float array.", array->s_name);
+    return;
+  }
+  const int numColumns = n/2;
+  for (int i = 0; i < numColumns; ++i) {
+    float min = 0.0f;
+    float max = 0.0f;
+    m4aPeaks_getColumn(peaks, i, numColumns, &min, &max);
+    vec[2*i].w_float = max;
+    vec[2*i+1].w_float = min;
+  }
+  if (n % 2 == 1) vec[n-1].w_float = 0.0f;
+  garray_redraw(a);
+}
+
+#if M4APLAYER_BACKEND_CODEC
+// Builds the peaks of a file for an overview, on a worker with a decoder of
+// its own, if the file has not been decoded from start to end before.
+typedef struct _peakJob {
+  m4aDecoder *decoder;
+  m4aPeaks *peaks;
+  int16_t *frames;
+  pthread_t thread;
+  volatile bool isCancelled;
+  volatile bool isDone; // the peaks are complete, or the decoder has failed
+  char uri[MAX_PATH_LENGTH];
+} t_peakJob;
+
+// decodes the next frames of the file into the peaks. Returns false once the job is done.
+static bool m4aPlayer_stepPeakJob(void *worker) {
+  t_peakJob *const j = (t_peakJob *) worker;
+  if (j->isDone) return false;
+  const int numChannels = m4aDecoder_getNumChannels(j->decoder);
+  const int numRead = m4aDecoder_read(j->decoder, j->frames, PEAK_JOB_FRAMES);
+  if (numRead > 0) {
+    m4aPeaks_addInt16(j->peaks, j->frames, numChannels, (uint32_t) numRead);
+  } else {
+    if (numRead == 0) m4aPeaks_finish(j->peaks);
+    j->isDone = true;
+  }
+  return true;
+}
+
+#if !M4APLAYER_SIMULATION
+static void *m4aPlayer_peakJobThread(void *userData) {
+  t_peakJob *const j = (t_peakJob *) userData;
+  while (!j->isCancelled && m4aPlayer_stepPeakJob(j));
+  return NULL;
+}
+#endif
+
+static t_peakJob *m4aPlayer_startPeakJob(const char *uri, uint64_t identity) {
+  m4aDecoder *decoder = m4aPlayer_openDecoder(uri);
+  if (decoder == NULL) return NULL;
+  t_peakJob *j = (t_peakJob *) calloc(1, sizeof(t_peakJob));
+  j->decoder = decoder;
+  j->peaks = m4aPeaks_new(identity);
+  j->frames = (int16_t *) malloc(PEAK_JOB_FRAMES * m4aDecoder_getNumChannels(decoder) * sizeof(int16_t));
+  strncpy(j->uri, uri, MAX_PATH_LENGTH);
+#if M4APLAYER_SIMULATION
+  m4aSim_addWorker(j, &m4aPlayer_stepPeakJob);
+#else
+  if (pthread_create(&j->thread, NULL, &m4aPlayer_peakJobThread, j) != 0) {
+    __android_log_print(ANDROID_LOG_ERROR, M4APLAYER_LOG_TAG, "Could not start peak thread.");
+    m4aDecoder_close(j->decoder);
+    m4aPeaks_free(j->peaks);
+    free(j->frames);
+    free(j);
+    return NULL;
+  }
+#endif
+  return j;
+}
+
+// waits for the worker to exit and frees the job, apart from its peaks
+static void m4aPlayer_stopPeakJob(t_peakJob *j) {
+  j->isCancelled = true;
+#if M4APLAYER_SIMULATION
+  m4aSim_removeWorker(j);
+#else
+  pthread_join(j->thread, NULL);
+#endif
+  m4aDecoder_close(j->decoder);
+  free(j->frames);
+  free(j);
+}
+#endif
+
+static void m4aPlayer_cancelPeakJob(t_m4aPlayer *x) {
+  clock_unset(x->overviewClock);
+#if M4APLAYER_BACKEND_CODEC
+  if (x->peakJob != NULL) {
+    m4aPeaks_free(x->peakJob->peaks);
+    m4aPlayer_stopPeakJob(x->peakJob);
+    x->peakJob = NULL;
+  }
+#endif
+}
+
+// called by the overview clock on the Pd thread while the peaks for an overview are built
+static void m4aPlayer_pollPeakJob(t_m4aPlayer *x) {
+#if M4APLAYER_BACKEND_CODEC
+  t_peakJob *const j = x->peakJob;
+  if (j == NULL) return;
+  if (!j->isDone) {
+    clock_delay(x->overviewClock, 20.0);
+    return;
+  }
+  x->peakJob = NULL;
+  m4aPeaks *const peaks = j->peaks;
+  char uri[MAX_PATH_LENGTH];
+  strncpy(uri, j->uri, MAX_PATH_LENGTH);
+  m4aPlayer_stopPeakJob(j);
+  if (m4aPeaks_isComplete(peaks)) {
+    m4aPlayer_keepPeaks(uri, peaks);
+    m4aPlayer_fillOverview(x->overviewArray, x->numOverviewPoints, peaks);
+  } else {
+    __android_log_print(ANDROID_LOG_WARN, M4APLAYER_LOG_TAG, "Could not decode %s for an overview.", uri);
+    m4aPeaks_free(peaks);
+  }
+#endif
+}
+
+// Fills the array with points values which draw the waveform of the open file.
+// The peaks of a file are built once, while it is decoded from start to end,
+// and later overviews only read them. If they are not known yet, the codec
+// backend builds them in the background and fills the array once they are
+// done.
+static void m4aPlayer_overview(t_m4aPlayer *x, t_symbol *array, t_float points) {
+  t_track *const t = x->currentTrack;
+  if (t->uriPlayer == NULL) {
+    __android_log_print(ANDROID_LOG_WARN, M4APLAYER_LOG_TAG, "No file is open for an overview.");
+    return;
+  }
+  const char *const uri = t->uriPlayer->uri;
+  const int numPoints = (points < 2.0f) ? 2 : (int) points;
+  x->overviewArray = array;
+  x->numOverviewPoints = numPoints;
+
+  // a complete pyramid is no longer written by the producer, so it can be read while the track plays
+  if (t->peaks != NULL && t->hasProducedEnd && m4aPeaks_isComplete(t->peaks)) {
+    m4aPlayer_fillOverview(array, numPoints, t->peaks);
+    return;
+  }
+  const uint64_t identity = m4aPlayer_getIdentity(uri);
+  bool isKnown = false;
+  const m4aPeaks *const peaks = m4aPlayer_findPeaks(uri, identity, true, &isKnown);
+  if (peaks != NULL) {
+    m4aPlayer_cancelPeakJob(x);
+    m4aPlayer_fillOverview(array, numPoints, peaks);
+    return;
+  }
+#if M4APLAYER_BACKEND_CODEC
+  if (x->peakJob != NULL && strcmp(x->peakJob->uri, uri) == 0) return; // fills the array once it is done
+  m4aPlayer_cancelPeakJob(x);
+  x->peakJob = m4aPlayer_startPeakJob(uri, identity);
+  if (x->peakJob != NULL) clock_delay(x->overviewClock, 20.0);
+#else
+  __android_log_print(ANDROID_LOG_INFO, M4APLAYER_LOG_TAG,
+      "The overview of %s is available once it has been played from start to end.", uri);
+#endif
+}
+
+#if M4APLAYER_BACKEND_CODEC
+// One stretch of a file which is read into arrays, decoded by a worker with a
+// decoder of its own. The decoder's seek is sample exact, i.e. it decodes from
+// a few access units before the start of the segment and drops the frames
+// before it, so the priming of the codec does not show at the joins between
+// segments.
+typedef struct _readSegment {
+  struct _readJob *job;
+  m4aDecoder *decoder;
+  uint64_t start;      // the first frame of the segment
+  uint64_t numFrames;  // the length of the segment, or 0 to read until the end of the file
+  uint64_t numDecoded;
+  pthread_t thread;
+  bool hasThread;
+  volatile bool isDone;
+} t_readSegment;
+
+typedef struct _readJob {
+  t_symbol *arrays[2]; // the arrays of the left and right channel
+  int numChannels;     // of the decoder
+  uint64_t numFrames;  // the length of the file, or 0 if it is not known
+  int16_t *samples;    // the interleaved frames of the whole file, written by the workers
+  uint64_t maxFrames;  // frames allocated, which only grows if the length is not known
+  t_readSegment segments[MAX_READ_THREADS];
+  int numSegments;
+  volatile bool isCancelled;
+  struct timespec startTime; // for the log
+  char uri[MAX_PATH_LENGTH];
+} t_readJob;
+
+// decodes the next frames of the segment. Returns false once the segment is done.
+static bool m4aPlayer_stepReadSegment(void *worker) {
+  t_readSegment *const g = (t_readSegment *) worker;
+  t_readJob *const j = g->job;
+  if (g->isDone) return false;
+  uint64_t n = PEAK_JOB_FRAMES;
+  if (g->numFrames > 0) {
+    if (n > g->numFrames - g->numDecoded) n = g->numFrames - g->numDecoded;
+  } else if (g->start + g->numDecoded + n > j->maxFrames) {
+    // the length is not known, so there is only one segment, which grows the buffer
+    j->maxFrames = 2*j->maxFrames + n;
+    j->samples = (int16_t *) realloc(j->samples, j->maxFrames * j->numChannels * sizeof(int16_t));
+  }
+  const int numRead = (n > 0) ? m4aDecoder_read(g->decoder,
+      j->samples + (g->start + g->numDecoded) * j->numChannels, (int) n) : 0;
+  if (numRead > 0) g->numDecoded += (uint64_t) numRead;
+  if (numRead <= 0 || (g->numFrames > 0 && g->numDecoded == g->numFrames)) g->isDone = true;
+  return true;
+}
+
+#if !M4APLAYER_SIMULATION
+static void *m4aPlayer_readThread(void *userData) {
+  t_readSegment *const g = (t_readSegment *) userData;
+  while (!g->job->isCancelled && m4aPlayer_stepReadSegment(g));
+  return NULL;
+}
+#endif
+
+// waits for the workers to exit and frees the job
+static void m4aPlayer_stopReadJob(t_readJob *j) {
+  j->isCancelled = true;
+  for (int i = 0; i < j->numSegments; ++i) {
+    t_readSegment *const g = j->segments+i;
+    if (g->hasThread) {
+#if M4APLAYER_SIMULATION
+      m4aSim_removeWorker(g);
+#else
+      pthread_join(g->thread, NULL);
+#endif
+    }
+    if (g->decoder != NULL) m4aDecoder_close(g->decoder);
+  }
+  free(j->samples);
+  free(j);
+}
+
+// Splits the file into segments of at least MIN_READ_SEGMENT_FRAMES, one per
+// core, and starts a worker for each of them.
+static t_readJob *m4aPlayer_startReadJob(const char *uri) {
+  m4aDecoder *decoder = m4aPlayer_openDecoder(uri);
+  if (decoder == NULL) return NULL;
+  t_readJob *j = (t_readJob *) calloc(1, sizeof(t_readJob));
+  strncpy(j->uri, uri, MAX_PATH_LENGTH);
+  clock_gettime(CLOCK_MONOTONIC, &j->startTime);
+  j->numChannels = m4aDecoder_getNumChannels(decoder);
+  j->numFrames = m4aDecoder_getNumFrames(decoder);
+  j->maxFrames = (j->numFrames > 0) ? j->numFrames : MIN_READ_SEGMENT_FRAMES;
+  j->samples = (int16_t *) calloc(j->maxFrames * j->numChannels, sizeof(int16_t));
+
+  int numSegments = 1;
+#if !M4APLAYER_SIMULATION
+  if (j->numFrames > 0) {
+    const long numCores = sysconf(_SC_NPROCESSORS_ONLN);
+    numSegments = (int) (j->numFrames / MIN_READ_SEGMENT_FRAMES);
+    if (numSegments > numCores) numSegments = (int) numCores;
+    if (numSegments > MAX_READ_THREADS) numSegments = MAX_READ_THREADS;
+    if (numSegments < 1) numSegments = 1;
+  }
+#endif
+  j->numSegments = numSegments;
+  for (int i = 0; i < numSegments; ++i) {
+    t_readSegment *const g = j->segments+i;
+    g->job = j;
+    g->start = (j->numFrames * (uint64_t) i) / (uint64_t) numSegments;
+    g->numFrames = (j->numFrames * (uint64_t) (i+1)) / (uint64_t) numSegments - g->start;
+    g->decoder = (i == 0) ? decoder : m4aPlayer_openDecoder(uri);
+    if (g->decoder == NULL || (g->start > 0 && !m4aDecoder_seek(g->decoder, g->start))) {
+      __android_log_print(ANDROID_LOG_WARN, M4APLAYER_LOG_TAG, "Could not seek in %s to read it.", uri);
+      g->isDone = true;
+      continue;
+    }
+#if M4APLAYER_SIMULATION
+    m4aSim_addWorker(g, &m4aPlayer_stepReadSegment);
+    g->hasThread = true;
+#else
+    g->hasThread = (pthread_create(&g->thread, NULL, &m4aPlayer_readThread, g) == 0);
+    if (!g->hasThread) {
+      __android_log_print(ANDROID_LOG_ERROR, M4APLAYER_LOG_TAG, "Could not start read thread.");
+      g->isDone = true;
+    }
+#endif
+  }
+  return j;
+}
+
+// copies one channel of the decoded frames into an array, resizing it once
+static void m4aPlayer_writeArray(t_symbol *array, const int16_t *samples, int numChannels, int channel, uint64_t numFrames) {
+  t_garray *a = (t_garray *) pd_findbyclass(array, garray_class);
+  if (a == NULL) {
+    __android_log_print(ANDROID_LOG_WARN, M4APLAYER_LOG_TAG, "There is no array named %s.", array->s_name);
+    return;
+  }
+  garray_resize_long(a, (long) numFrames);
+  int n = 0;
+  t_word *vec = NULL;
+  if (!garray_getfloatwords(a, &n, &vec)) {
+    __android_log_print(ANDROID_LOG_WARN, M4APLAYER_LOG_TAG, "%s is not a float array.", array->s_name);
+    return;
+  }
+  for (int i = 0; i < n; ++i) {
+    vec[i].w_float = samples[(uint64_t) i * numChannels + channel] * CVT_SHORT_FLOAT;
+  }
+  garray_redraw(a);
+}
+#endif
+
+static void m4aPlayer_cancelReadJob(t_m4aPlayer *x) {
+  clock_unset(x->readClock);
+#if M4APLAYER_BACKEND_CODEC
+  if (x->readJob != NULL) {
+    m4aPlayer_stopReadJob(x->readJob);
+    x->readJob = NULL;
+  }
+#endif
+}
+
+// called by the read clock on the Pd thread while a file is read into arrays
+static void m4aPlayer_pollReadJob(t_m4aPlayer *x) {
+#if M4APLAYER_BACKEND_CODEC
+  t_readJob *const j = x->readJob;
+  if (j == NULL) return;
+  for (int i = 0; i < j->numSegments; ++i) {
+    if (!j->segments[i].isDone) {
+      clock_delay(x->readClock, 5.0);
+      return;
+    }
+  }
+  x->readJob = NULL;
+
+  // Every frame up to the end of the last segment is kept. A segment which
+  // ended early, e.g. on a decoding error, leaves silence up to the next one,
+  // and if it is the last one the arrays are shorter than the file. Segments of
+  // a file with an unknown length have no length to fall short of.
+  const t_readSegment *const last = j->segments + j->numSegments-1;
+  const uint64_t numFrames = last->start + last->numDecoded;
+  for (int i = 0; i < j->numSegments; ++i) {
+    if (j->segments[i].numDecoded < j->segments[i].numFrames) {
+      __android_log_print(ANDROID_LOG_WARN, M4APLAYER_LOG_TAG, "Could not decode all of %s.", j->uri);
+      break;
+    }
+  }
+  if (numFrames > 0) {
+    for (int c = 0; c < 2; ++c) {
+      if (j->arrays[c] != NULL) {
+        // mono files are read into both arrays
+        m4aPlayer_writeArray(j->arrays[c], j->samples, j->numChannels, (c < j->numChannels) ? c : 0, numFrames);
+      }
+    }
+  }
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  __android_log_print(ANDROID_LOG_INFO, M4APLAYER_LOG_TAG, "Read %llu frames of %s with %d workers in %.1fms.",
+      (unsigned long long) numFrames, j->uri, j->numSegments,
+      1000.0*(now.tv_sec - j->startTime.tv_sec) + (now.tv_nsec - j->startTime.tv_nsec)/1000000.0);
+  m4aPlayer_stopReadJob(j);
+  outlet_float(x->message_read_outlet, (float) numFrames);
+#endif
+}
+
+// Decodes a whole file into one array, or into two arrays for the left and
+// right channel, like soundfiler does for uncompressed files. The file is
+// split into segments which are decoded in the background by a worker per
+// core, and the arrays are resized and filled once all of them are done.
+// Outlet 5 then sends the number of frames which have been read.
+static void m4aPlayer_read(t_m4aPlayer *x, t_symbol *s, int argc, t_atom *argv) {
+  if (argc < 2 || argv[0].a_type != A_SYMBOL || argv[1].a_type != A_SYMBOL) {
+    __android_log_print(ANDROID_LOG_WARN, M4APLAYER_LOG_TAG, "read needs a file and an array, and optionally a second array.");
+    return;
+  }
+#if M4APLAYER_BACKEND_CODEC
+  char uri[MAX_PATH_LENGTH];
+  if (!m4aPlayer_makeUri(x->basePath, argv[0].a_w.w_symbol->s_name, uri)) return;
+  m4aPlayer_cancelReadJob(x);
+  x->readJob = m4aPlayer_startReadJob(uri);
+  if (x->readJob == NULL) {
+    __android_log_print(ANDROID_LOG_WARN, M4APLAYER_LOG_TAG, "Could not read %s.", uri);
+    return;
+  }
+  x->readJob->arrays[0] = argv[1].a_w.w_symbol;
+  x->readJob->arrays[1] = (argc > 2 && argv[2].a_type == A_SYMBOL) ? argv[2].a_w.w_symbol : NULL;
+  clock_delay(x->readClock, 5.0);
+#else
+  __android_log_print(ANDROID_LOG_WARN, M4APLAYER_LOG_TAG,
+      "Reading files into arrays needs the codec backend (ndk-build M4APLAYER_BACKEND=codec).");
+#endif
+}
+
+// A file whose header is parsed in the background
+typedef struct _probe {
+  t_symbol *file;          // as it was given, sent back with the results
+  char uri[MAX_PATH_LENGTH];
+  t_fdSource source;       // of an asset: or fd: uri, owned by the probe
+  uint64_t identity;
+  m4aProbeInfo info;
+  bool isValid;
+  struct _probe *next;
+} t_probe;
+
+// Probes files one after another on a worker, which exits once there are
+// none left and is started again by the next probe message.
+typedef struct _probeJob {
+  pthread_mutex_t lock; // guards the lists and isRunning
+  t_probe *pending;     // in the order of the probe messages
+  t_probe *lastPending;
+  t_probe *done;        // most recent first
+  bool isRunning;
+  bool hasThread;
+  pthread_t thread;
+  volatile bool isCancelled;
+} t_probeJob;
+
+// The results of earlier probes by the identity of the file, which are
+// replaced in turn. Only accessed from the Pd thread.
+typedef struct _probedFile {
+  uint64_t identity;
+  m4aProbeInfo info;
+} t_probedFile;
+
+static t_probedFile probedFiles[MAX_PROBED_FILES];
+static int numProbedFiles = 0;
+static int nextProbedFile = 0;
+
+// probes the next pending file. Returns false if there is none.
+static bool m4aPlayer_stepProbeJob(void *worker) {
+  t_probeJob *const j = (t_probeJob *) worker;
+  pthread_mutex_lock(&j->lock);
+  t_probe *const q = j->pending;
+  if (q != NULL) {
+    j->pending = q->next;
+    if (j->pending == NULL) j->lastPending = NULL;
+  } else {
+    j->isRunning = false;
+  }
+  pthread_mutex_unlock(&j->lock);
+  if (q == NULL) return false;
+
+  q->isValid = (q->source.fd >= 0)
+      ? m4aProbe_readFd(q->source.fd, q->source.offset, q->source.length, &q->info)
+      : m4aProbe_readFile(q->uri+7, &q->info);
+  pthread_mutex_lock(&j->lock);
+  q->next = j->done;
+  j->done = q;
+  pthread_mutex_unlock(&j->lock);
+  return true;
+}
+
+#if !M4APLAYER_SIMULATION
+static void *m4aPlayer_probeThread(void *userData) {
+  t_probeJob *const j = (t_probeJob *) userData;
+  while (!j->isCancelled && m4aPlayer_stepProbeJob(j));
+  return NULL;
+}
+#endif
+
+static void m4aPlayer_freeProbes(t_probe *q) {
+  while (q != NULL) {
+    t_probe *const next = q->next;
+    if (q->source.fd >= 0) close(q->source.fd);
+    free(q);
+    q = next;
+  }
+}
+
+static void m4aPlayer_cancelProbeJob(t_m4aPlayer *x) {
+  clock_unset(x->probeClock);
+  t_probeJob *const j = x->probeJob;
+  if (j == NULL) return;
+  x->probeJob = NULL;
+  j->isCancelled = true;
+#if M4APLAYER_SIMULATION
+  m4aSim_removeWorker(j);
+#else
+  if (j->hasThread) pthread_join(j->thread, NULL);
+#endif
+  m4aPlayer_freeProbes(j->pending);
+  m4aPlayer_freeProbes(j->done);
+  pthread_mutex_destroy(&j->lock);
+  free(j);
+}
+
+// Sends the file followed by its duration in ms, sample rate, number of
+// channels, whether it has a variable bitrate, its average bitrate in bits per
+// second, and its encoder delay and padding in frames. A file which cannot be
+// probed is sent alone.
+static void m4aPlayer_sendProbe(t_m4aPlayer *x, t_symbol *file, const m4aProbeInfo *info) {
+  t_atom list[8];
+  SETSYMBOL(list, file);
+  if (info == NULL) {
+    outlet_list(x->message_probe_outlet, &s_list, 1, list);
+    return;
+  }
+  SETFLOAT(list+1, (t_float) m4aProbe_getDurationMs(info));
+  SETFLOAT(list+2, (t_float) info->sampleRate);
+  SETFLOAT(list+3, (t_float) info->numChannels);
+  SETFLOAT(list+4, info->isVbr ? 1.0f : 0.0f);
+  SETFLOAT(list+5, (t_float) info->avgBitrate);
+  SETFLOAT(list+6, (t_float) info->encoderDelay);
+  SETFLOAT(list+7, (t_float) info->numPaddingFrames);
+  outlet_list(x->message_probe_outlet, &s_list, 8, list);
+}
+
+// called by the probe clock on the Pd thread while files are being probed
+static void m4aPlayer_pollProbeJob(t_m4aPlayer *x) {
+  t_probeJob *const j = x->probeJob;
+  if (j == NULL) return;
+  pthread_mutex_lock(&j->lock);
+  t_probe *done = j->done;
+  j->done = NULL;
+  const bool isBusy = j->isRunning || j->pending != NULL;
+  pthread_mutex_unlock(&j->lock);
+  if (isBusy) clock_delay(x->probeClock, 5.0);
+
+  // send the results in the order of the probe messages
+  t_probe *inOrder = NULL;
+  while (done != NULL) {
+    t_probe *const next = done->next;
+    done->next = inOrder;
+    inOrder = done;
+    done = next;
+  }
+  for (t_probe *q = inOrder; q != NULL; q = q->next) {
+    if (q->isValid && q->identity != 0) {
+      probedFiles[nextProbedFile].identity = q->identity;
+      probedFiles[nextProbedFile].info = q->info;
+      nextProbedFile = (nextProbedFile + 1) % MAX_PROBED_FILES;
+      if (numProbedFiles < MAX_PROBED_FILES) ++numProbedFiles;
+    }
+    if (!q->isValid) {
+      __android_log_print(ANDROID_LOG_WARN, M4APLAYER_LOG_TAG, "Could not probe %s.", q->uri);
+    }
+    m4aPlayer_sendProbe(x, q->file, q->isValid ? &q->info : NULL);
+  }
+  m4aPlayer_freeProbes(inOrder);
+}
+
+// Reads the properties of a file from its container header in the background,
+// without creating a player, and sends them as a list from outlet 7 (see
+// m4aPlayer_sendProbe()). Files which have been probed before are answered
+// straight away, as long as they have not changed, and so are indexed files.
+static void m4aPlayer_probe(t_m4aPlayer *x, t_symbol *s) {
+  char uri[MAX_PATH_LENGTH];
+  if (!m4aPlayer_makeUri(x->basePath, s->s_name, uri)) return;
+  const uint64_t identity = m4aPlayer_getIdentity(uri);
+  m4aProbeInfo info;
+  if (m4aPlayer_findIndexed(identity, &info)) {
+    m4aPlayer_sendProbe(x, s, &info);
+    return;
+  }
+  for (int i = 0; i < numProbedFiles && identity != 0; ++i) {
+    if (probedFiles[i].identity == identity) {
+      m4aPlayer_sendProbe(x, s, &probedFiles[i].info);
+      return;
+    }
+  }
+
+  t_probe *const q = (t_probe *) calloc(1, sizeof(t_probe));
+  q->file = s;
+  strncpy(q->uri, uri, MAX_PATH_LENGTH);
+  q->identity = identity;
+  if (!m4aPlayer_openFdSource(uri, &q->source)) {
+    free(q);
+    m4aPlayer_sendProbe(x, s, NULL);
+    return;
+  }
+
+  t_probeJob *j = x->probeJob;
+  if (j == NULL) {
+    j = x->probeJob = (t_probeJob *) calloc(1, sizeof(t_probeJob));
+    pthread_mutex_init(&j->lock, NULL);
+#if M4APLAYER_SIMULATION
+    m4aSim_addWorker(j, &m4aPlayer_stepProbeJob);
+#endif
+  }
+  pthread_mutex_lock(&j->lock);
+  if (j->lastPending != NULL) j->lastPending->next = q;
+  else j->pending = q;
+  j->lastPending = q;
+  const bool shouldStart = !j->isRunning;
+  j->isRunning = true;
+  pthread_mutex_unlock(&j->lock);
+
+  if (shouldStart) {
+#if M4APLAYER_SIMULATION
+    // the simulator steps the job
+#else
+    // the previous worker has found nothing left to do and is exiting
+    if (j->hasThread) pthread_join(j->thread, NULL);
+    j->hasThread = (pthread_create(&j->thread, NULL, &m4aPlayer_probeThread, j) == 0);
+    if (!j->hasThread) {
+      __android_log_print(ANDROID_LOG_ERROR, M4APLAYER_LOG_TAG, "Could not start probe thread. Probing on the Pd thread.");
+      while (m4aPlayer_stepProbeJob(j));
+    }
+#endif
+  }
+  clock_delay(x->probeClock, 5.0);
+}
+
+// One of the workers which probe the files of a directory which is indexed
+typedef struct _indexWorker {
+  struct _indexJob *job;
+  pthread_t thread;
+  bool hasThread;
+  volatile bool isDone;
+} t_indexWorker;
+
+// The first worker to run lists the directory, while the others probe the
+// files which it has found so far. The lock guards the lists, which grow
+// during the listing, and the cursor.
+typedef struct _indexJob {
+  char dir[MAX_PATH_LENGTH];
+  char path[MAX_PATH_LENGTH]; // of the index file
+  char (*files)[MAX_PATH_LENGTH];
+  m4aIndexEntry *entries; // one per file, with an identity of 0 if the file could not be probed
+  int numFiles;
+  int maxFiles;
+  int nextFile; // the next file which a worker takes
+  bool isListing; // a worker has started to list the directory
+  bool isListed;
+  pthread_mutex_t lock;
+  t_indexWorker workers[MAX_READ_THREADS];
+  int numWorkers;
+  volatile bool isCancelled;
+  struct timespec startTime; // for the log
+} t_indexJob;
+
+// a path relative to the patch, unless it is absolute
+static void m4aPlayer_makePath(const char *basePath, const char *path, char *fullPath) {
+  if (path[0] == '/' || path[0] == '\0') snprintf(fullPath, MAX_PATH_LENGTH, "%s", path);
+  else snprintf(fullPath, MAX_PATH_LENGTH, "%s/%s", basePath, path);
+}
+
+// opens an index, replacing an older version of it or else the index which was opened first
+static m4aIndex *m4aPlayer_openIndex(const char *path) {
+  m4aIndex *const index = m4aIndex_open(path);
+  if (index == NULL) return NULL;
+  int i = 0;
+  while (i < numIndexes && strcmp(indexPaths[i], path) != 0) ++i;
+  if (i == MAX_INDEXES) i = 0;
+  if (i < numIndexes) {
+    m4aIndex_close(indexes[i]);
+    memmove(indexes+i, indexes+i+1, (numIndexes-i-1)*sizeof(m4aIndex *));
+    memmove(indexPaths+i, indexPaths+i+1, (numIndexes-i-1)*MAX_PATH_LENGTH);
+    --numIndexes;
+  }
+  indexes[numIndexes] = index;
+  snprintf(indexPaths[numIndexes], MAX_PATH_LENGTH, "%s", path);
+  ++numIndexes;
+  return index;
+}
+
+static bool m4aPlayer_isIndexable(const char *name) {
+  const char *extension = strrchr(name, '.');
+  return extension != NULL && (strcasecmp(extension, ".m4a") == 0 || strcasecmp(extension, ".m4b") == 0 ||
+      strcasecmp(extension, ".mp4") == 0 || strcasecmp(extension, ".wav") == 0);
+}
+
+// adds a file to the job, where the workers can take it straight away
+static void m4aPlayer_addIndexFile(t_indexJob *j, const char *path) {
+  pthread_mutex_lock(&j->lock);
+  if (j->numFiles == j->maxFiles) {
+    j->maxFiles *= 2;
+    j->files = realloc(j->files, j->maxFiles * sizeof(*j->files));
+    j->entries = (m4aIndexEntry *) realloc(j->entries, j->maxFiles * sizeof(m4aIndexEntry));
+  }
+  memcpy(j->files[j->numFiles++], path, MAX_PATH_LENGTH);
+  pthread_mutex_unlock(&j->lock);
+}
+
+// adds the files in a directory and its subdirectories to the job
+static void m4aPlayer_listFiles(t_indexJob *j, const char *dir, int depth) {
+  DIR *d = opendir(dir);
+  if (d == NULL) return;
+  struct dirent *e = NULL;
+  while (!j->isCancelled && (e = readdir(d)) != NULL) {
+    if (e->d_name[0] == '.') continue; // also hidden files
+    char path[MAX_PATH_LENGTH];
+    if (snprintf(path, MAX_PATH_LENGTH, "%s/%s", dir, e->d_name) >= MAX_PATH_LENGTH) continue;
+    bool isDir = (e->d_type == DT_DIR);
+    if (e->d_type == DT_UNKNOWN) {
+      struct stat s;
+      isDir = (stat(path, &s) == 0) && S_ISDIR(s.st_mode);
+    }
+    if (isDir) {
+      if (depth < MAX_INDEX_DEPTH) m4aPlayer_listFiles(j, path, depth+1);
+    } else if (m4aPlayer_isIndexable(e->d_name)) {
+      m4aPlayer_addIndexFile(j, path);
+    }
+  }
+  closedir(d);
+}
+
+// Lists the directory if no worker has started to, or else probes the next
+// file which no worker has taken yet. Returns false if there is no file to
+// take, and sets isDone once the listing is complete and none are left.
+static bool m4aPlayer_stepIndexWorker(void *worker) {
+  t_indexWorker *const w = (t_indexWorker *) worker;
+  t_indexJob *const j = w->job;
+  if (w->isDone) return false;
+  char file[MAX_PATH_LENGTH];
+  pthread_mutex_lock(&j->lock);
+  const bool shouldList = !j->isListing;
+  j->isListing = true;
+  const int i = j->nextFile;
+  const bool hasFile = !shouldList && i < j->numFiles;
+  if (hasFile) {
+    ++j->nextFile;
+    memcpy(file, j->files[i], MAX_PATH_LENGTH);
+  }
+  const bool isListed = j->isListed;
+  pthread_mutex_unlock(&j->lock);
+
+  if (shouldList) {
+    m4aPlayer_listFiles(j, j->dir, 0);
+    pthread_mutex_lock(&j->lock);
+    j->isListed = true;
+    pthread_mutex_unlock(&j->lock);
+    return true;
+  }
+  if (!hasFile) {
+    w->isDone = isListed;
+    return false;
+  }
+  m4aIndexEntry e;
+  e.identity = m4aProbe_readFile(file, &e.info) ? m4aPeaks_getFileIdentity(file) : 0;
+  pthread_mutex_lock(&j->lock);
+  j->entries[i] = e;
+  pthread_mutex_unlock(&j->lock);
+  return true;
+}
+
+#if !M4APLAYER_SIMULATION
+static void *m4aPlayer_indexThread(void *userData) {
+  t_indexWorker *const w = (t_indexWorker *) userData;
+  while (!w->job->isCancelled && !w->isDone) {
+    // waits for the listing to find more files
+    if (!m4aPlayer_stepIndexWorker(w) && !w->isDone) m4aPlayer_sleepForBlock();
+  }
+  w->isDone = true;
+  return NULL;
+}
+#endif
+
+// waits for the workers to exit and frees the job
+static void m4aPlayer_stopIndexJob(t_indexJob *j) {
+  j->isCancelled = true;
+  for (int i = 0; i < j->numWorkers; ++i) {
+    t_indexWorker *const w = j->workers+i;
+    if (w->hasThread) {
+#if M4APLAYER_SIMULATION
+      m4aSim_removeWorker(w);
+#else
+      pthread_join(w->thread, NULL);
+#endif
+    }
+  }
+  pthread_mutex_destroy(&j->lock);
+  free(j->files);
+  free(j->entries);
+  free(j);
+}
+
+// starts a worker per core, which list the directory and probe its files in parallel
+static t_indexJob *m4aPlayer_startIndexJob(const char *dir, const char *path) {
+  t_indexJob *j = (t_indexJob *) calloc(1, sizeof(t_indexJob));
+  snprintf(j->dir, MAX_PATH_LENGTH, "%s", dir);
+  snprintf(j->path, MAX_PATH_LENGTH, "%s", path);
+  clock_gettime(CLOCK_MONOTONIC, &j->startTime);
+  pthread_mutex_init(&j->lock, NULL);
+  j->maxFiles = 64;
+  j->files = calloc((size_t) j->maxFiles, sizeof(*j->files));
+  j->entries = (m4aIndexEntry *) calloc((size_t) j->maxFiles, sizeof(m4aIndexEntry));
+
+  int numWorkers = 1;
+#if !M4APLAYER_SIMULATION
+  const long numCores = sysconf(_SC_NPROCESSORS_ONLN);
+  numWorkers = (numCores < 1) ? 1 : (numCores > MAX_READ_THREADS) ? MAX_READ_THREADS : (int) numCores;
+#endif
+  j->numWorkers = numWorkers;
+  for (int i = 0; i < numWorkers; ++i) {
+    t_indexWorker *const w = j->workers+i;
+    w->job = j;
+#if M4APLAYER_SIMULATION
+    m4aSim_addWorker(w, &m4aPlayer_stepIndexWorker);
+    w->hasThread = true;
+#else
+    w->hasThread = (pthread_create(&w->thread, NULL, &m4aPlayer_indexThread, w) == 0);
+    if (!w->hasThread) {
+      __android_log_print(ANDROID_LOG_ERROR, M4APLAYER_LOG_TAG, "Could not start index thread.");
+      w->isDone = true;
+    }
+#endif
+  }
+  return j;
+}
+
+static void m4aPlayer_cancelIndexJob(t_m4aPlayer *x) {
+  clock_unset(x->indexClock);
+  if (x->indexJob != NULL) {
+    m4aPlayer_stopIndexJob(x->indexJob);
+    x->indexJob = NULL;
+  }
+}
+
+// called by the index clock on the Pd thread while a directory is indexed
+static void m4aPlayer_pollIndexJob(t_m4aPlayer *x) {
+  t_indexJob *const j = x->indexJob;
+  if (j == NULL) return;
+  for (int i = 0; i < j->numWorkers; ++i) {
+    if (!j->workers[i].isDone) {
+      clock_delay(x->indexClock, 20.0);
+      return;
+    }
+  }
+  x->indexJob = NULL;
+
+  // the work of workers which could not be started is done here
+  t_indexWorker w = {j, 0, false, false};
+  while (!w.isDone) m4aPlayer_stepIndexWorker(&w);
+  int numEntries = 0;
+  for (int i = 0; i < j->numFiles; ++i) {
+    if (j->entries[i].identity != 0) j->entries[numEntries++] = j->entries[i];
+    else __android_log_print(ANDROID_LOG_WARN, M4APLAYER_LOG_TAG, "Could not index %s.", j->files[i]);
+  }
+  const bool isWritten = m4aIndex_write(j->path, j->entries, numEntries);
+  const m4aIndex *const index = isWritten ? m4aPlayer_openIndex(j->path) : NULL;
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  __android_log_print(ANDROID_LOG_INFO, M4APLAYER_LOG_TAG, "Indexed %d of %d files into %s with %d workers in %.1fms.",
+      numEntries, j->numFiles, j->path, j->numWorkers,
+      1000.0*(now.tv_sec - j->startTime.tv_sec) + (now.tv_nsec - j->startTime.tv_nsec)/1000000.0);
+  m4aPlayer_stopIndexJob(j);
+  if (index != NULL) outlet_float(x->message_index_outlet, (float) m4aIndex_getNumEntries(index));
+}
+
+// Scans a directory and its subdirectories for m4a, mp4 and wav files,
+// probes them in parallel in the background, and writes their properties to
+// an index file, which is then opened. With only the index file, an index
+// which was built before, e.g. in an earlier session, is opened. Open indexes
+// answer probes of their files at once, and let mono files be opened without
+// realizing a player twice. Outlet 8 sends the number of indexed files.
+static void m4aPlayer_index(t_m4aPlayer *x, t_symbol *s, int argc, t_atom *argv) {
+  if (argc < 1 || argc > 2 || argv[0].a_type != A_SYMBOL || (argc == 2 && argv[1].a_type != A_SYMBOL)) {
+    __android_log_print(ANDROID_LOG_WARN, M4APLAYER_LOG_TAG, "index needs a directory and an index file, or an index file.");
+    return;
+  }
+  char path[MAX_PATH_LENGTH];
+  m4aPlayer_makePath(x->basePath, argv[argc-1].a_w.w_symbol->s_name, path);
+  if (argc == 1) {
+    const m4aIndex *const index = m4aPlayer_openIndex(path);
+    if (index == NULL) __android_log_print(ANDROID_LOG_WARN, M4APLAYER_LOG_TAG, "Could not open index %s.", path);
+    else outlet_float(x->message_index_outlet, (float) m4aIndex_getNumEntries(index));
+    return;
+  }
+  char dir[MAX_PATH_LENGTH];
+  m4aPlayer_makePath(x->basePath, argv[0].a_w.w_symbol->s_name, dir);
+  m4aPlayer_cancelIndexJob(x);
+  x->indexJob = m4aPlayer_startIndexJob(dir, path);
+  clock_delay(x->indexClock, 20.0);
+}
+
+// Sets the directory which peaks for overviews are written to and read from.
+// Relative paths are relative to the patch.
+static void m4aPlayer_cachedir(t_m4aPlayer *x, t_symbol *s) {
+  char path[MAX_PATH_LENGTH];
+  m4aPlayer_makePath(x->basePath, s->s_name, path);
+  m4aPlayer_setCacheDir(path);
+}
+
+// called by the done clock on the Pd thread after perform has finished a track
+static void m4aPlayer_onDone(t_m4aPlayer *x) {
+  if (x->shouldCloseNextTrack) {
+    x->shouldCloseNextTrack = false;
+    m4aPlayer_closeTrack(x->nextTrack);
+    clock_delay(x->idleClock, IDLE_PIPE_MS);
+  }
+
+  // indicate that the asset is done playing, once per finished track
+  int numDone = x->numDonePending;
+  x->numDonePending = 0;
+  while (numDone-- > 0) outlet_bang(x->message_done_playing_outlet);
+}
+
+// called from perform when the last block of the current track has been read
+static void m4aPlayer_endOfTrack(t_m4aPlayer *x, uint32_t flags) {
+  if (x->hasQueuedTrack) {
+    // continue with the queued track from the very next sample
+    t_track *const t = x->currentTrack;
+    x->currentTrack = x->nextTrack;
+    x->nextTrack = t;
+    x->hasQueuedTrack = false;
+    x->shouldCloseNextTrack = true;
+    x->currentTrack->isStarted = true;
+    m4aPlayer_playUriPlayer(x); // the decoder idled after the preroll
+
+    // prime must reopen the new track, also before the old one has been closed
+    strncpy(x->fileuri, x->currentTrack->uriPlayer->uri, MAX_PATH_LENGTH);
+  } else if ((flags & BLOCK_RESTARTED) && x->shouldLoop) {
+    return; // the pipe continues seamlessly with the start of the asset
+  } else {
+    x->isPlaying = false;
+    x->currentTrack->isFinished = !(flags & BLOCK_RESTARTED);
+    x->currentTrack->isStarted = false; // a reprimed track only buffers the preroll
+    m4aPlayer_pauseUriPlayer(x);
+  }
+  ++x->numDonePending;
+  clock_delay(x->doneClock, 0.0);
+}
+
+// realizes a player for the given file and parks it in the pool, so that a
+// later open of the same file does not need to create a new player
+static void m4aPlayer_prewarmFile(t_m4aPlayer *x, t_symbol *s) {
+  char uri[MAX_PATH_LENGTH];
+  if (m4aPlayer_makeUri(x->basePath, s->s_name, uri)) m4aPlayer_prewarmUri(uri, x->useFloat);
+}
+
+// called by the ready clock on the Pd thread once the opened track has buffered its preroll
+static void m4aPlayer_onReady(t_m4aPlayer *x) {
+  outlet_bang(x->message_ready_outlet);
+}
+
+// called by the event clock on the Pd thread, at most a block after an event was posted
+static void m4aPlayer_onEvents(t_m4aPlayer *x) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  for (int i = 0; i < 2; ++i) {
+    t_track *const t = (i == 0) ? &x->trackA : &x->trackB;
+    while (hLp_hasData(&t->events)) {
+      // remove the event before sending it, as the outlet may close the track
+      uint32_t numBytes = 0;
+      const t_event e = *(const t_event *) hLp_getReadBuffer(&t->events, &numBytes);
+      hLp_consume(&t->events);
+      const double latencyMs = 1000.0*(now.tv_sec - e.postTime.tv_sec) + (now.tv_nsec - e.postTime.tv_nsec)/1000000.0;
+      if (latencyMs > maxEventLatencyMs) maxEventLatencyMs = latencyMs;
+      outlet_float(x->message_error_outlet, (t_float) e.type);
+    }
+  }
+}
+
+double m4aPlayer_takeMaxEventLatency() {
+  const double latencyMs = maxEventLatencyMs;
+  maxEventLatencyMs = 0.0;
+  return latencyMs;
+}
+
+// Sets how much is decoded after an open (or prime) before the decoder idles
+// until start, and before the ready outlet fires. Applies to files opened from
+// now on.
+static void m4aPlayer_preroll(t_m4aPlayer *x, t_float ms) {
+  const double numBlocks = ((double) ms * sys_getsr()) / (1000.0 * PD_BLOCK_SIZE);
+  x->prerollBlocks = (numBlocks < 1.0) ? 1
+      : (numBlocks > PIPE_HIGH_WATER_BLOCKS) ? PIPE_HIGH_WATER_BLOCKS : (uint32_t) (numBlocks + 0.999);
+}
+
+// Ramps the output gain to the target over the given time, linearly or, with
+// exp, exponentially, which sounds even in loudness. Replaces any ramp in
+// progress and cancels the action of a fadeout.
+static void m4aPlayer_gain(t_m4aPlayer *x, t_float target, t_float ms, t_symbol *curve) {
+  clock_unset(x->fadeClock);
+  x->fadeAction = FADE_NONE;
+  x->gainTarget = (target < 0.0f) ? 0.0f : target;
+  const double numFrames = ((double) ms * sys_getsr()) / 1000.0;
+  if (numFrames < 1.0) {
+    x->gain = x->gainTarget;
+    x->numGainRampFrames = 0;
+    return;
+  }
+  x->numGainRampFrames = (uint32_t) numFrames;
+  if (curve == gensym("exp")) {
+    if (x->gain < MIN_EXP_GAIN) x->gain = MIN_EXP_GAIN;
+    const float target = (x->gainTarget < MIN_EXP_GAIN) ? MIN_EXP_GAIN : x->gainTarget;
+    x->gainRatio = (float) pow(target / x->gain, 1.0 / x->numGainRampFrames);
+  } else {
+    x->gainRatio = 0.0f;
+    x->gainStep = (x->gainTarget - x->gain) / x->numGainRampFrames;
+  }
+}
+
+// Called by the fade clock once a fadeout has reached silence. The player has
+// already stopped reading. The gain is restored for the next start.
+static void m4aPlayer_onFadeEnd(t_m4aPlayer *x) {
+  const int action = x->fadeAction;
+  x->fadeAction = FADE_NONE;
+  x->gain = x->gainTarget = x->gainBeforeFade;
+  if (action == FADE_PAUSE) m4aPlayer_pauseTransport(x);
+  else if (action == FADE_STOP) m4aPlayer_stopAndCloseIfOpen(x);
+}
+
+// Fades out linearly over the given time. With pause or stop, the player is
+// then paused (like pause) or closed (until the next open or prime), so that
+// the decoder stops as soon as the output is silent.
+static void m4aPlayer_fadeout(t_m4aPlayer *x, t_float ms, t_symbol *action) {
+  const float gain = (x->fadeAction != FADE_NONE) ? x->gainBeforeFade : x->gain;
+  m4aPlayer_gain(x, 0.0f, ms, &s_);
+  x->gainBeforeFade = gain;
+  x->fadeAction = (action == gensym("pause")) ? FADE_PAUSE : (action == gensym("stop")) ? FADE_STOP : FADE_NONE;
+  // a player which is not playing is silent already
+  if (x->fadeAction != FADE_NONE && !x->isPlaying) m4aPlayer_onFadeEnd(x);
+}
+
+static void m4aPlayer_poolsize(t_m4aPlayer *x, t_float f) {
+  m4aPlayer_setPoolSize((int) f);
+}
+
+// sets the memory budget of every player's pipes and cached peaks, in MB
+static void m4aPlayer_budget(t_m4aPlayer *x, t_float f) {
+  m4aPlayer_setMemoryBudget((f > 0.0f) ? (size_t) (f * 1024.0f * 1024.0f) : 0);
+}
+
+// releases everything which is not in use, e.g. when the app is sent to the background
+static void m4aPlayer_flush(t_m4aPlayer *x) {
+  m4aPlayer_flushCachesNow();
+}
+
+// Decodes the files which are opened from now on in perform rather than in
+// the background, e.g. for rendering a patch faster than real time.
+static void m4aPlayer_offline(t_m4aPlayer *x, t_float f) {
+  m4aPlayer_setOffline(f != 0.0f);
+}
+
+// Selects the decoder output for files opened from now on. float avoids the
+// conversion from int16 in perform, while int16 halves the memory of the pipes.
+static void m4aPlayer_format(t_m4aPlayer *x, t_symbol *s) {
+  if (s == gensym("int16")) {
+    x->useFloat = false;
+  } else if (s == gensym("float")) {
+    x->useFloat = m4aPlayer_isFloatDecodingSupported();
+    if (!x->useFloat) {
+      __android_log_print(ANDROID_LOG_WARN, M4APLAYER_LOG_TAG,
+          "Float decoding is not supported on this platform. Using int16.");
+    }
+  } else {
+    __android_log_print(ANDROID_LOG_WARN, M4APLAYER_LOG_TAG,
+        "Unknown sample format %s. Use float or int16.", s->s_name);
+  }
+}
+
+// Advances the gain ramp by k frames, which must not pass its end, and returns
+// the gain of the first frame. Exponential ramps are interpolated linearly
+// between the ends of the k frames, which are at most a block apart.
+static float m4aPlayer_advanceGain(t_m4aPlayer *x, int k, float *gainStep) {
+  const float gain = x->gain;
+  *gainStep = 0.0f;
+  if (x->numGainRampFrames == 0 || k == 0) return gain;
+  x->numGainRampFrames -= k;
+  if (x->numGainRampFrames == 0) {
+    x->gain = x->gainTarget;
+    if (x->fadeAction != FADE_NONE) {
+      // the fadeout has reached silence, stop reading straight away
+      x->isPlaying = false;
+      clock_delay(x->fadeClock, 0.0);
+    }
+  } else if (x->gainRatio > 0.0f) {
+    x->gain *= powf(x->gainRatio, (float) k);
+  } else {
+    x->gain += k * x->gainStep;
+  }
+  *gainStep = (x->gain - gain) / k;
+  return gain;
+}
+
+// Schedules the markers which are played with the next k frames of the block,
+// which are written from the given frame of the Pd block on. The frames were
+// due during the block which perform has just reached the end of, so each id
+// is sent exactly one block after the logical time of its frame.
+static void m4aPlayer_playMarkers(t_m4aPlayer *x, const t_blockHeader *block, int k, int blockFrame) {
+  const t_track *const t = x->currentTrack;
+  const int64_t position = t->isReverse ? (int64_t) block->position - x->readFrame : (int64_t) block->position + x->readFrame;
+  for (int m = 0; m < x->numMarkers; ++m) {
+    // forwards a marker is played with its frame, backwards with the frame before it
+    const int64_t offset = t->isReverse ? position - x->markers[m].frame : x->markers[m].frame - position;
+    if (offset < 0 || offset >= k) continue;
+    if (x->numMarkerEvents == MAX_MARKERS) return; // the events are not being delivered
+
+    // keep the events in the order of their times
+    const double time = clock_getsystimeafter(((blockFrame + offset) * 1000.0) / sys_getsr());
+    int e = x->numMarkerEvents++;
+    for (; e > 0 && x->markerEvents[e-1].time > time; --e) x->markerEvents[e] = x->markerEvents[e-1];
+    x->markerEvents[e].time = time;
+    x->markerEvents[e].id = x->markers[m].id;
+    if (e == 0) clock_set(x->markerClock, time);
+  }
+}
+
+// called by the marker clock on the Pd thread at the time of the earliest marker event
+static void m4aPlayer_onMarker(t_m4aPlayer *x) {
+  const double now = clock_getlogicaltime();
+  while (x->numMarkerEvents > 0 && x->markerEvents[0].time <= now) {
+    // remove the event before sending it, as the outlet may change the markers
+    const t_float id = x->markerEvents[0].id;
+    memmove(x->markerEvents, x->markerEvents+1, (--x->numMarkerEvents)*sizeof(t_markerEvent));
+    outlet_float(x->message_marker_outlet, id);
+  }
+  if (x->numMarkerEvents > 0) clock_set(x->markerClock, x->markerEvents[0].time);
+}
+
+// Reads up to n frames from the current track, or skips them if the outlet
+// buffers are NULL, and follows the end of the track. The frames are added to
+// the buffers when mixing. Markers are played with the frames which are
+// written, from the given frame of the Pd block on. Returns the number of
+// frames read, which is less than n if the pipe runs dry.
+static int m4aPlayer_readFrames(t_m4aPlayer *x, t_sample *outL, t_sample *outR, int n, int blockFrame, bool isMixing) {
+  int i = 0;
+  while (x->isPlaying && hLp_hasData(&x->currentTrack->pipe)) {
+    t_track *const t = x->currentTrack;
+    uint32_t numBytesAvailable = 0;
+    t_blockHeader *const block = (t_blockHeader *) hLp_getReadBuffer(&t->pipe, &numBytesAvailable);
+    if (block->version != t->version) {
+      // decoded before the last seek
+      hLp_consume(&t->pipe);
+      ++t->numConsumedBlocks;
+      continue;
+    }
+    const char *const samples = ((const char *) (block+1)) +
+        x->readFrame * t->numChannels * BYTES_PER_SAMPLE(t->isFloat);
+
+    // blocks may be read across Pd block boundaries, and are split at the end of a gain ramp
+    int k = (int) (block->numFrames - x->readFrame);
+    if (k > n-i) k = n-i;
+    if (x->numGainRampFrames > 0 && k > (int) x->numGainRampFrames) k = (int) x->numGainRampFrames;
+
+    // Stop once the outlet buffers are full. Blocks without any frames left
+    // are still consumed, so that the end of a track which coincides with the
+    // end of a block is handled in this block rather than the next one.
+    if (k == 0 && x->readFrame < block->numFrames) break;
+
+    if (outL != NULL && x->numMarkers > 0) m4aPlayer_playMarkers(x, block, k, blockFrame+i);
+
+    float gainStep = 0.0f;
+    const float gain = m4aPlayer_advanceGain(x, k, &gainStep);
+    if (outL == NULL) {
+      // skipped
+    } else if (isMixing) {
+      m4aConvert_addToOutlets(samples, t->isFloat, t->numChannels, outL+i, outR+i, k, gain, gainStep);
+    } else {
+      m4aConvert_toOutlets(samples, t->isFloat, t->numChannels, outL+i, outR+i, k, gain, gainStep);
+    }
+    i += k;
+    x->readFrame += k;
+
+    if (x->readFrame == block->numFrames) {
+      const uint32_t flags = block->flags;
+      hLp_consume(&t->pipe); // done with the buffer
+      ++t->numConsumedBlocks;
+      x->readFrame = 0;
+      if (flags & BLOCK_END_OF_TRACK) m4aPlayer_endOfTrack(x, flags);
+    }
+  }
+  return i;
+}
+
+static t_int *m4aPlayer_perform(t_int *w) {
+  t_m4aPlayer *x = (t_m4aPlayer *) w[1];
+  const int n = (int) w[2]; // number of samples that Pd wants
+  t_sample *outL = (t_sample *) w[3]; // the left outlet buffer
+  t_sample *outR = (t_sample *) w[4]; // the right outlet buffer
+
+  // a player on a mix bus adds to the bus, and its outlets are silent
+  const bool isMixing = x->bus != NULL && x->bus->blockSize == n;
+  if (isMixing) {
+    memset(outL, 0, n*sizeof(float));
+    memset(outR, 0, n*sizeof(float));
+    m4aBus_sync(x->bus);
+    outL = x->bus->sumL;
+    outR = x->bus->sumR;
+  }
+
+#if M4APLAYER_BACKEND_CODEC
+  m4aPlayer_decodeOffline(x, x->currentTrack);
+  m4aPlayer_decodeOffline(x, x->nextTrack);
+#endif
+  if (hLp_hasData(&x->trackA.events) || hLp_hasData(&x->trackB.events)) clock_delay(x->eventClock, 0.0);
+  if (isFlushRequested) clock_delay(flushClock, 0.0);
+
+  // report once that the opened (or seeked) track can start instantly, or
+  // that it is shorter than the preroll and has been decoded completely
+  t_track *const c = x->currentTrack;
+  if (c->uriPlayer != NULL) m4aPlayer_discardStaleBlocks(c);
+  if (!c->isReady && c->uriPlayer != NULL && c->producedVersion == c->version &&
+      (c->numSeekBlocks >= c->prerollBlocks || c->hasProducedEnd)) {
+    c->isReady = true;
+    clock_delay(x->readyClock, 0.0);
+  }
+
+  int i = 0; // the number of frames written so far
+  if (x->isPlaying && x->hasStartTime) {
+    // Perform runs at the logical time of the end of the block, so the start
+    // time falls into this block if it is less than a block earlier.
+    const double startFrame = n - (clock_gettimesince(x->startTime) * sys_getsr()) / 1000.0;
+    if (startFrame >= n - 0.5) {
+      // not yet
+      if (!isMixing) {
+        memset(outL, 0, n*sizeof(float));
+        memset(outR, 0, n*sizeof(float));
+      }
+      return (w+5);
+    }
+    i = (startFrame < 0.5) ? 0 : (int) (startFrame + 0.5);
+    x->hasStartTime = false;
+    if (!isMixing) {
+      memset(outL, 0, i*sizeof(float));
+      memset(outR, 0, i*sizeof(float));
+    }
+  } else if (x->isPlaying && x->group != NULL && x->group->isRunning) {
+    // perform runs at the end of the block, the group's position is that of its start
+    m4aPlayer_catchUpWithGroup(x, m4aPlayer_getGroupFrames(x->group) - n);
+  }
+
+  const int numRead = m4aPlayer_readFrames(x, outL+i, outR+i, n-i, i, isMixing);
+  x->playedFrames += numRead;
+  i += numRead;
+
+  if (i < n && !isMixing) {
+    // if not playing or no data is available, output silence
+    memset(outL+i, 0, (n-i)*sizeof(float));
+    memset(outR+i, 0, (n-i)*sizeof(float));
+  }
+
+  return (w+5);
+}
+
+static void m4aPlayer_dsp(t_m4aPlayer *x, t_signal **sp) {
+  dsp_add(m4aPlayer_perform, 4, x, sp[0]->s_n, sp[0]->s_vec, sp[1]->s_vec);
+}
+
+/*
+ * m4aBus outputs the sum of the players on the named mix bus, one block late.
+ */
+
+static t_class *m4aBus_class;
+
+typedef struct _m4aBus {
+  t_object x_obj;
+  t_bus *bus;
+} t_m4aBus;
+
+static t_int *m4aBus_perform(t_int *w) {
+  t_m4aBus *x = (t_m4aBus *) w[1];
+  const int n = (int) w[2];
+  t_sample *outL = (t_sample *) w[3];
+  t_sample *outR = (t_sample *) w[4];
+  t_bus *const b = x->bus;
+  if (b->blockSize == n) {
+    m4aBus_sync(b);
+    memcpy(outL, b->readL, n*sizeof(t_sample));
+    memcpy(outR, b->readR, n*sizeof(t_sample));
+  } else {
+    memset(outL, 0, n*sizeof(t_sample));
+    memset(outR, 0, n*sizeof(t_sample));
+  }
+  return (w+5);
+}
+
+static void m4aBus_dsp(t_m4aBus *x, t_signal **sp) {
+  dsp_add(m4aBus_perform, 4, x, sp[0]->s_n, sp[0]->s_vec, sp[1]->s_vec);
+}
+
+// reads another bus
+static void m4aBus_set(t_m4aBus *x, t_symbol *s) {
+  m4aBus_release(x->bus);
+  x->bus = m4aBus_acquire(s);
+}
+
+static void *m4aBus_new(t_symbol *s) {
+  t_m4aBus *x = (t_m4aBus *) pd_new(m4aBus_class);
+  outlet_new(&x->x_obj, &s_signal);
+  outlet_new(&x->x_obj, &s_signal);
+  x->bus = m4aBus_acquire(s);
+  return x;
+}
+
+static void m4aBus_free(t_m4aBus *x) {
+  m4aBus_release(x->bus);
+}
+
+static void m4aBus_setup() {
+  m4aBus_class = class_new(gensym("m4aBus"),
+      (t_newmethod) m4aBus_new,
+      (t_method) m4aBus_free,
+      sizeof(t_m4aBus), CLASS_DEFAULT, A_DEFSYMBOL, 0);
+  class_addmethod(m4aBus_class, (t_method) m4aBus_dsp, gensym("dsp"), 0);
+  class_addmethod(m4aBus_class, (t_method) m4aBus_set, gensym("set"), A_DEFSYMBOL, 0);
+}
+
+#if M4APLAYER_BACKEND_CODEC
+/*
+ * m4aStems plays up to MAX_STEMS files, e.g. the stems of one song, in
+ * lockstep. A single worker decodes one block of every stem in turn into one
+ * pipe, so the stems are aligned by construction and there is one pipe and one
+ * thread per song rather than per stem. Each block holds the interleaved
+ * int16 frames of every stem one after another, so that perform converts each
+ * stem with the kernel which m4aPlayer uses for its blocks, and the pipe takes
+ * half the space of float samples. Mono stems are fanned out to both channels
+ * by the worker. Stems which are shorter than the longest are silent after
+ * their end.
+ *
+ * There is no OpenSLES version, as its players cannot be decoded in lockstep
+ * into one buffer.
+ *
+ * The outlets are the left and right signal of every stem, followed by the
+ * done, loaded and ready outlets of m4aPlayer.
+ */
+
+#define MAX_STEMS 8
+
+static t_class *m4aStems_class;
+
+typedef struct _m4aStems {
+  t_object x_obj;
+  t_outlet *message_done_playing_outlet; // outlet 2*numStems
+  t_outlet *message_done_loading_outlet; // outlet 2*numStems+1
+  t_outlet *message_ready_outlet;        // outlet 2*numStems+2
+  int numStems;
+  t_sample *outs[2*MAX_STEMS]; // the outlet buffers, set in dsp
+
+  // the open stems, NULL where no file is open, and their decoder
+  m4aDecoder *decoders[MAX_STEMS];
+  bool isOpen;
+  pthread_t thread;
+  volatile bool isDecoding; // the worker runs until this is cleared
+  bool isOffline;           // perform decodes instead of the worker
+  bool isAtEnd;             // the whole song has been decoded
+  int16_t *frames;          // decoded frames of one stem, owned by the worker
+
+  // the pipe and its counters, holding 2*numStems int16 channels, and the
+  // commands to the worker, like those of an m4aPlayer track
+  t_track track;
+  uint32_t readFrame;
+  uint32_t prerollBlocks;
+
+  t_clock *doneClock;
+  int numDonePending;
+  t_clock *readyClock;
+
+  char *basePath;
+  bool isPlaying;
+  bool hasStartTime;
+  double startTime; // logical time
+  bool shouldLoop;
+  bool shouldReprimeOnFinish;
+} t_m4aStems;
+
+// Decodes the next block of every stem into the pipe. Returns false without
+// doing anything if the pipe is full enough, like m4aPlayer_decodeBlock().
+static bool m4aStems_decodeBlock(t_m4aStems *x) {
+  t_track *const t = &x->track;
+  const uint32_t blockSize = (uint32_t) PD_BLOCK_SIZE;
+  const uint32_t numBlockBytes = sizeof(t_blockHeader) + t->numChannels * blockSize * sizeof(int16_t);
+
+  const uint32_t highWaterBlocks = t->isDecodingAhead ? PIPE_HIGH_WATER_BLOCKS : t->prerollBlocks;
+  if (x->isAtEnd || (t->numProducedBlocks - t->numConsumedBlocks) >= highWaterBlocks) return false;
+  char *buffer = hLp_getWriteBuffer(&t->pipe, numBlockBytes);
+  if (buffer == NULL) return false;
+  t->writeBlock = (t_blockHeader *) buffer;
+  t->writeBlock->version = t->producedVersion;
+
+  // the block is as long as the longest stem which has not yet ended
+  uint32_t numBlockFrames = 0;
+  for (int s = 0; s < x->numStems; ++s) {
+    int16_t *const out = ((int16_t *) (t->writeBlock+1)) + 2*s*blockSize;
+    uint32_t numFrames = 0;
+    if (x->decoders[s] != NULL) {
+      const int numDecodedChannels = m4aDecoder_getNumChannels(x->decoders[s]);
+      while (numFrames < blockSize) {
+        const int numRead = m4aDecoder_read(x->decoders[s],
+            x->frames + numFrames*numDecodedChannels, (int) (blockSize - numFrames));
+        if (numRead <= 0) break; // the end of the stem, or an error which ends it early
+        numFrames += (uint32_t) numRead;
+      }
+      if (numDecodedChannels == 1) {
+        for (uint32_t j = 0; j < numFrames; ++j) out[2*j] = out[2*j+1] = x->frames[j];
+      } else {
+        m4aConvert_fromDecoder(out, false, 2, x->frames, numDecodedChannels, numFrames);
+      }
+    }
+    memset(out + 2*numFrames, 0, 2*(blockSize-numFrames)*sizeof(int16_t));
+    if (numFrames > numBlockFrames) numBlockFrames = numFrames;
+  }
+
+  if (numBlockFrames == blockSize) {
+    m4aPlayer_produceBlock(t, numBlockFrames, 0);
+  } else if (x->shouldLoop || x->shouldReprimeOnFinish) {
+    // every stem continues from the start, also those which ended earlier
+    m4aPlayer_produceBlock(t, numBlockFrames, BLOCK_END_OF_TRACK | BLOCK_RESTARTED);
+    t->producedFrames = 0;
+    for (int s = 0; s < x->numStems; ++s) {
+      if (x->decoders[s] != NULL) m4aDecoder_seek(x->decoders[s], 0);
+    }
+  } else {
+    m4aPlayer_produceBlock(t, numBlockFrames, BLOCK_END_OF_TRACK);
+    x->isAtEnd = true;
+  }
+  return true;
+}
+
+// Moves every stem to the frame of the seek and decodes the blocks from then
+// on for the seek's version, like m4aPlayer_seekDecoder().
+static void m4aStems_seekDecoders(t_m4aStems *x, const t_command *c) {
+  t_track *const t = &x->track;
+  for (int s = 0; s < x->numStems; ++s) {
+    if (x->decoders[s] == NULL) continue;
+    // a stem which is shorter than the position is silent until the song restarts
+    const uint64_t numFrames = m4aDecoder_getNumFrames(x->decoders[s]);
+    if (!m4aDecoder_seek(x->decoders[s], (numFrames > 0 && c->frame > numFrames) ? numFrames : c->frame)) {
+      __android_log_print(ANDROID_LOG_WARN, M4APLAYER_LOG_TAG, "Could not set seek position of stem %i to frame %llu.",
+          s, (unsigned long long) c->frame);
+    }
+  }
+  t->producedFrames = (uint32_t) c->frame;
+  t->hasProducedEnd = false;
+  t->numSeekBlocks = 0;
+  x->isAtEnd = false;
+
+  // perform may only see the version once the state of the seek is visible
+  __sync_synchronize();
+  t->producedVersion = c->version;
+}
+
+// applies the commands which Pd has sent since the worker last looked
+static void m4aStems_applyCommands(t_m4aStems *x) {
+  HvLightPipe *const commands = &x->track.commands;
+  while (hLp_hasData(commands)) {
+    uint32_t numBytes = 0;
+    const t_command c = *(const t_command *) hLp_getReadBuffer(commands, &numBytes);
+    hLp_consume(commands);
+    switch (c.type) {
+      case COMMAND_START: x->track.isDecodingAhead = true; break;
+      case COMMAND_PAUSE: x->track.isDecodingAhead = false; break;
+      case COMMAND_SEEK: m4aStems_seekDecoders(x, &c); break;
+      default: break;
+    }
+  }
+}
+
+#if M4APLAYER_SIMULATION
+static bool m4aStems_stepWorker(void *worker) {
+  t_m4aStems *const x = (t_m4aStems *) worker;
+  m4aStems_applyCommands(x);
+  return m4aStems_decodeBlock(x);
+}
+#else
+static void *m4aStems_decodeThread(void *userData) {
+  t_m4aStems *const x = (t_m4aStems *) userData;
+  while (x->isDecoding) {
+    m4aStems_applyCommands(x);
+    if (!m4aStems_decodeBlock(x)) m4aPlayer_sleepForBlock();
+  }
+  return NULL;
+}
+#endif
+
+// Stops the worker and clears the pipe, and drops the commands which it has
+// not applied. Only called when the stems are closed.
+static void m4aStems_stopWorker(t_m4aStems *x) {
+  if (!x->isDecoding) return;
+  x->isDecoding = false;
+  if (x->isOffline) x->isOffline = false;
+  else {
+#if M4APLAYER_SIMULATION
+    m4aSim_removeWorker(x);
+#else
+    pthread_join(x->thread, NULL);
+#endif
+  }
+  if (x->track.pipe.buffer != NULL) hLp_reset(&x->track.pipe);
+  hLp_reset(&x->track.commands);
+  x->readFrame = 0;
+  x->isPlaying = false;
+  x->hasStartTime = false;
+  clock_unset(x->readyClock);
+}
+
+// moves every stem to the position and starts the worker, which buffers the preroll
+static void m4aStems_startWorker(t_m4aStems *x, float positionMs) {
+  t_track *const t = &x->track;
+  if (t->pipe.buffer == NULL) {
+    m4aPlayer_allocPipe(&t->pipe, PIPE_NUM_BLOCKS*(sizeof(t_blockHeader) + t->numChannels*PD_BLOCK_SIZE*sizeof(int16_t)));
+    m4aPlayer_enforceBudget();
+  }
+  t->isFinished = false;
+  t->isReady = false;
+  t->isDecodingAhead = false;
+  t->prerollBlocks = x->prerollBlocks;
+  t->numProducedBlocks = 0;
+  t->numConsumedBlocks = 0;
+
+  // there is no worker yet, so the first seek is applied straight away
+  const t_command c = {COMMAND_SEEK, t->version, (uint64_t) ((positionMs * sys_getsr()) / 1000.0), false};
+  m4aStems_seekDecoders(x, &c);
+  x->isDecoding = true;
+  x->isOffline = isOffline;
+  if (x->isOffline) return;
+
+#if M4APLAYER_SIMULATION
+  m4aSim_addWorker(x, &m4aStems_stepWorker);
+#else
+  if (pthread_create(&x->thread, NULL, &m4aStems_decodeThread, x) != 0) {
+    __android_log_print(ANDROID_LOG_ERROR, M4APLAYER_LOG_TAG, "Could not start decoder thread.");
+    x->isDecoding = false;
+    t->isFinished = true;
+  }
+#endif
+}
+
+static void m4aStems_close(t_m4aStems *x) {
+  m4aStems_stopWorker(x);
+  for (int s = 0; s < x->numStems; ++s) {
+    if (x->decoders[s] != NULL) m4aDecoder_close(x->decoders[s]);
+    x->decoders[s] = NULL;
+  }
+  x->isOpen = false;
+  m4aPlayer_releasePipe(&x->track.pipe);
+}
+
+// Opens one file per stem, in the order of the outlets, optionally followed by
+// the position in ms to start at. Stems without a file are silent.
+static void m4aStems_open(t_m4aStems *x, t_symbol *s, int argc, t_atom *argv) {
+  m4aStems_close(x);
+
+  uint64_t numFrames = 0;
+  int maxDecodedChannels = 1;
+  int numFiles = 0;
+  for (; numFiles < argc && argv[numFiles].a_type == A_SYMBOL; ++numFiles) {
+    if (numFiles == x->numStems) {
+      __android_log_print(ANDROID_LOG_WARN, M4APLAYER_LOG_TAG,
+          "m4aStems has %i stems. Ignoring the other files.", x->numStems);
+      break;
+    }
+    char uri[MAX_PATH_LENGTH];
+    if (!m4aPlayer_makeUri(x->basePath, argv[numFiles].a_w.w_symbol->s_name, uri)) continue;
+    x->decoders[numFiles] = m4aPlayer_openDecoder(uri);
+    if (x->decoders[numFiles] == NULL) {
+      __android_log_print(ANDROID_LOG_ERROR, M4APLAYER_LOG_TAG, "Could not open stem %s.", uri);
+      continue;
+    }
+    if (m4aDecoder_getNumFrames(x->decoders[numFiles]) > numFrames) {
+      numFrames = m4aDecoder_getNumFrames(x->decoders[numFiles]);
+    }
+    if (m4aDecoder_getNumChannels(x->decoders[numFiles]) > maxDecodedChannels) {
+      maxDecodedChannels = m4aDecoder_getNumChannels(x->decoders[numFiles]);
+    }
+    x->isOpen = true;
+  }
+  if (!x->isOpen) return;
+  const float positionMs = (argc > numFiles && argv[argc-1].a_type == A_FLOAT) ? argv[argc-1].a_w.w_float : 0.0f;
+
+  x->track.numFrames = (uint32_t) numFrames;
+  free(x->frames);
+  x->frames = (int16_t *) malloc(PD_BLOCK_SIZE*maxDecodedChannels*sizeof(int16_t));
+  m4aStems_startWorker(x, positionMs);
+  outlet_float(x->message_done_loading_outlet, (float) ((numFrames * 1000) / sys_getsr()));
+}
+
+// like m4aPlayer_playUriPlayer() and m4aPlayer_pauseUriPlayer()
+static void m4aStems_sendTransport(t_m4aStems *x, uint32_t type) {
+  const t_command c = {type, x->track.version, 0, false};
+  if (!m4aPlayer_sendCommand(&x->track, &c)) {
+    __android_log_print(ANDROID_LOG_ERROR, M4APLAYER_LOG_TAG, "Could not %s decoding, too many commands are queued.",
+        (type == COMMAND_START) ? "start" : "pause");
+  }
+}
+
+static void m4aStems_start(t_m4aStems *x) {
+  if (!x->isOpen || x->track.isFinished) {
+    __android_log_print(ANDROID_LOG_VERBOSE, M4APLAYER_LOG_TAG, "Nothing to play. Won't start playing.");
+    return;
+  }
+  m4aStems_sendTransport(x, COMMAND_START);
+  x->hasStartTime = false;
+  x->isPlaying = true;
+}
+
+// like m4aPlayer_startat()
+static void m4aStems_startat(t_m4aStems *x, t_float ms) {
+  if (x->isPlaying) return;
+  m4aStems_start(x);
+  if (x->isPlaying) {
+    x->hasStartTime = true;
+    x->startTime = clock_getsystimeafter((ms > 0.0f) ? ms : 0.0);
+  }
+}
+
+static void m4aStems_pause(t_m4aStems *x) {
+  x->isPlaying = false;
+  x->hasStartTime = false;
+  if (x->isOpen) m4aStems_sendTransport(x, COMMAND_PAUSE);
+}
+
+// Moves every stem to the position and buffers the preroll, without reopening
+// the files or waiting for the worker, like m4aPlayer_prime(). The blocks
+// which were decoded before are discarded as they reach the head of the pipe.
+static void m4aStems_prime(t_m4aStems *x, t_float f) {
+  if (!x->isOpen) return;
+  t_track *const t = &x->track;
+  x->isPlaying = false;
+  x->hasStartTime = false;
+  m4aStems_sendTransport(x, COMMAND_PAUSE);
+  const t_command c = {COMMAND_SEEK, t->version+1, (uint64_t) ((f * sys_getsr()) / 1000.0), false};
+  if (!m4aPlayer_sendCommand(t, &c)) {
+    __android_log_print(ANDROID_LOG_ERROR, M4APLAYER_LOG_TAG, "Could not seek, too many commands are queued.");
+    return;
+  }
+  ++t->version;
+  t->isFinished = false;
+  t->isReady = false;
+  t->prerollBlocks = x->prerollBlocks;
+  x->readFrame = 0;
+  m4aPlayer_discardStaleBlocks(t);
+  clock_unset(x->readyClock);
+}
+
+// Like m4aPlayer, these only take effect once the decoder reaches the end of
+// the song, which may be up to the pipe's length ahead of playback.
+static void m4aStems_loop(t_m4aStems *x, t_float f) {
+  x->shouldLoop = (f != 0.0f);
+}
+
+static void m4aStems_reprime(t_m4aStems *x, t_float f) {
+  x->shouldReprimeOnFinish = (f != 0.0f);
+}
+
+static void m4aStems_preroll(t_m4aStems *x, t_float ms) {
+  const double numBlocks = ((double) ms * sys_getsr()) / (1000.0 * PD_BLOCK_SIZE);
+  x->prerollBlocks = (numBlocks < 1.0) ? 1
+      : (numBlocks > PIPE_HIGH_WATER_BLOCKS) ? PIPE_HIGH_WATER_BLOCKS : (uint32_t) (numBlocks + 0.999);
+}
+
+static void m4aStems_onDone(t_m4aStems *x) {
+  int numDone = x->numDonePending;
+  x->numDonePending = 0;
+  while (numDone-- > 0) outlet_bang(x->message_done_playing_outlet);
+}
+
+static void m4aStems_onReady(t_m4aStems *x) {
+  outlet_bang(x->message_ready_outlet);
+}
+
+static t_int *m4aStems_perform(t_int *w) {
+  t_m4aStems *x = (t_m4aStems *) w[1];
+  const int n = (int) w[2];
+  const int numChannels = 2 * x->numStems;
+  t_track *const t = &x->track;
+
+  if (x->isOffline) {
+    m4aStems_applyCommands(x);
+    while (m4aStems_decodeBlock(x));
+  }
+  if (x->isDecoding) m4aPlayer_discardStaleBlocks(t);
+  if (!t->isReady && x->isDecoding && t->producedVersion == t->version &&
+      (t->numSeekBlocks >= t->prerollBlocks || t->hasProducedEnd)) {
+    t->isReady = true;
+    clock_delay(x->readyClock, 0.0);
+  }
+
+  int i = 0;
+  if (x->isPlaying && x->hasStartTime) {
+    const double startFrame = n - (clock_gettimesince(x->startTime) * sys_getsr()) / 1000.0;
+    if (startFrame >= n - 0.5) {
+      for (int c = 0; c < numChannels; ++c) memset(x->outs[c], 0, n*sizeof(float));
+      return (w+3);
+    }
+    i = (startFrame < 0.5) ? 0 : (int) (startFrame + 0.5);
+    x->hasStartTime = false;
+    for (int c = 0; c < numChannels; ++c) memset(x->outs[c], 0, i*sizeof(float));
+  }
+
+  while (x->isPlaying && hLp_hasData(&t->pipe)) {
+    uint32_t numBytesAvailable = 0;
+    t_blockHeader *const block = (t_blockHeader *) hLp_getReadBuffer(&t->pipe, &numBytesAvailable);
+    if (block->version != t->version) {
+      // decoded before the last prime
+      hLp_consume(&t->pipe);
+      ++t->numConsumedBlocks;
+      continue;
+    }
+    const int16_t *const samples = ((const int16_t *) (block+1)) + 2*x->readFrame;
+
+    int k = (int) (block->numFrames - x->readFrame);
+    if (k > n-i) k = n-i;
+    if (k == 0 && x->readFrame < block->numFrames) break;
+    for (int s = 0; s < x->numStems; ++s) {
+      m4aConvert_toOutlets(samples + 2*s*PD_BLOCK_SIZE, false, 2, x->outs[2*s]+i, x->outs[2*s+1]+i, k, 1.0f, 0.0f);
+    }
+    i += k;
+    x->readFrame += k;
+
+    if (x->readFrame == block->numFrames) {
+      const uint32_t flags = block->flags;
+      hLp_consume(&t->pipe);
+      ++t->numConsumedBlocks;
+      x->readFrame = 0;
+      if ((flags & BLOCK_END_OF_TRACK) && !((flags & BLOCK_RESTARTED) && x->shouldLoop)) {
+        x->isPlaying = false;
+        t->isFinished = !(flags & BLOCK_RESTARTED);
+        m4aStems_sendTransport(x, COMMAND_PAUSE); // a reprimed song only buffers the preroll
+        ++x->numDonePending;
+        clock_delay(x->doneClock, 0.0);
+      }
+    }
+  }
+
+  if (i < n) {
+    for (int c = 0; c < numChannels; ++c) memset(x->outs[c]+i, 0, (n-i)*sizeof(float));
+  }
+  return (w+3);
+}
+
+static void m4aStems_dsp(t_m4aStems *x, t_signal **sp) {
+  for (int c = 0; c < 2*x->numStems; ++c) x->outs[c] = sp[c]->s_vec;
+  dsp_add(m4aStems_perform, 2, x, sp[0]->s_n);
+}
+
+static void *m4aStems_new(t_floatarg f) {
+  t_m4aStems *x = (t_m4aStems *) pd_new(m4aStems_class);
+  x->numStems = (f < 1.0f) ? 2 : (f > MAX_STEMS) ? MAX_STEMS : (int) f;
+  for (int c = 0; c < 2*x->numStems; ++c) outlet_new(&x->x_obj, &s_signal);
+  x->message_done_playing_outlet = outlet_new(&x->x_obj, &s_bang);
+  x->message_done_loading_outlet = outlet_new(&x->x_obj, &s_float);
+  x->message_ready_outlet = outlet_new(&x->x_obj, &s_bang);
+
+  x->basePath = (char *) malloc(MAX_PATH_LENGTH*sizeof(char));
+  strncpy(x->basePath, canvas_getcurrentdir()->s_name, MAX_PATH_LENGTH);
+
+  memset(&x->track, 0, sizeof(t_track));
+  x->track.numChannels = 2*x->numStems;
+  x->track.isFloat = false;
+  x->track.isReady = true;
+  x->track.pipe.buffer = NULL; // allocated once the stems are opened
+  hLp_init(&x->track.commands, MAX_COMMANDS*(sizeof(t_command) + 2*sizeof(uint32_t)));
+  x->prerollBlocks = DEFAULT_PREROLL_BLOCKS;
+  x->shouldReprimeOnFinish = true;
+
+  x->doneClock = clock_new(x, (t_method) m4aStems_onDone);
+  x->readyClock = clock_new(x, (t_method) m4aStems_onReady);
+  return x;
+}
+
+static void m4aStems_free(t_m4aStems *x) {
+  m4aStems_close(x);
+  hLp_free(&x->track.commands);
+  clock_free(x->doneClock);
+  clock_free(x->readyClock);
+  free(x->basePath);
+  free(x->frames);
+}
+
+static void m4aStems_setup() {
+  m4aStems_class = class_new(gensym("m4aStems"),
+      (t_newmethod) m4aStems_new,
+      (t_method) m4aStems_free,
+      sizeof(t_m4aStems), CLASS_DEFAULT, A_DEFFLOAT, 0);
+  class_addmethod(m4aStems_class, (t_method) m4aStems_dsp, gensym("dsp"), 0);
+  class_addmethod(m4aStems_class, (t_method) m4aStems_open, gensym("open"), A_GIMME, 0);
+  class_addmethod(m4aStems_class, (t_method) m4aStems_start, gensym("start"), 0);
+  class_addmethod(m4aStems_class, (t_method) m4aStems_startat, gensym("startat"), A_DEFFLOAT, 0);
+  class_addmethod(m4aStems_class, (t_method) m4aStems_pause, gensym("pause"), 0);
+  class_addmethod(m4aStems_class, (t_method) m4aStems_prime, gensym("prime"), A_DEFFLOAT, 0);
+  class_addmethod(m4aStems_class, (t_method) m4aStems_loop, gensym("loop"), A_DEFFLOAT, 0);
+  class_addmethod(m4aStems_class, (t_method) m4aStems_reprime, gensym("reprime"), A_DEFFLOAT, 0);
+  class_addmethod(m4aStems_class, (t_method) m4aStems_preroll, gensym("preroll"), A_DEFFLOAT, 0);
+}
+#endif
+
 void m4aPlayer_setup() {
+  // initialise the backend (i.e. the shared engine) up front so that the first open is not delayed
+  m4aPlayer_initBackend();
+  flushClock = clock_new(NULL, (t_method) m4aPlayer_onFlushRequested);
+
   m4aPlayer_class = class_new(gensym("m4aPlayer"),
       (t_newmethod) m4aPlayer_new,
       (t_method) m4aPlayer_free,
       sizeof(t_m4aPlayer), CLASS_DEFAULT, A_GIMME, 0);
   class_addmethod(m4aPlayer_class, (t_method) m4aPlayer_dsp, gensym("dsp"), 0);
-  class_addmethod(m4aPlayer_class, (t_method) m4aPlayer_start, gensym("start"), 0);
-  class_addmethod(m4aPlayer_class, (t_method) m4aPlayer_pause, gensym("pause"), 0);
-  class_addmethod(m4aPlayer_class, (t_method) m4aPlayer_prime, gensym("prime"), A_DEFFLOAT, 0);
-  class_addmethod(m4aPlayer_class, (t_method) m4aPlayer_loop, gensym("loop"), A_DEFFLOAT, 0);
-  class_addmethod(m4aPlayer_class, (t_method) m4aPlayer_reprime, gensym("reprime"), A_DEFFLOAT, 0);
+  class_addmethod(m4aPlayer_class, (t_method) m4aPlayer_startTransport, gensym("start"), 0);
+  class_addmethod(m4aPlayer_class, (t_method) m4aPlayer_startatTransport, gensym("startat"), A_DEFFLOAT, 0);
+  class_addmethod(m4aPlayer_class, (t_method) m4aPlayer_pauseTransport, gensym("pause"), 0);
+  class_addmethod(m4aPlayer_class, (t_method) m4aPlayer_primeTransport, gensym("prime"), A_DEFFLOAT, 0);
+  class_addmethod(m4aPlayer_class, (t_method) m4aPlayer_loopTransport, gensym("loop"), A_DEFFLOAT, 0);
+  class_addmethod(m4aPlayer_class, (t_method) m4aPlayer_reprimeTransport, gensym("reprime"), A_DEFFLOAT, 0);
+  class_addmethod(m4aPlayer_class, (t_method) m4aPlayer_group, gensym("group"), A_DEFSYMBOL, 0);
   class_addmethod(m4aPlayer_class, (t_method) m4aPlayer_open, gensym("open"), A_DEFSYMBOL, A_DEFFLOAT, 0);
+  class_addmethod(m4aPlayer_class, (t_method) m4aPlayer_queue, gensym("queue"), A_DEFSYMBOL, 0);
+  class_addmethod(m4aPlayer_class, (t_method) m4aPlayer_prewarmFile, gensym("prewarm"), A_DEFSYMBOL, 0);
+  class_addmethod(m4aPlayer_class, (t_method) m4aPlayer_poolsize, gensym("poolsize"), A_DEFFLOAT, 0);
+  class_addmethod(m4aPlayer_class, (t_method) m4aPlayer_budget, gensym("budget"), A_DEFFLOAT, 0);
+  class_addmethod(m4aPlayer_class, (t_method) m4aPlayer_flush, gensym("flush"), 0);
+  class_addmethod(m4aPlayer_class, (t_method) m4aPlayer_offline, gensym("offline"), A_DEFFLOAT, 0);
+  class_addmethod(m4aPlayer_class, (t_method) m4aPlayer_format, gensym("format"), A_DEFSYMBOL, 0);
+  class_addmethod(m4aPlayer_class, (t_method) m4aPlayer_preroll, gensym("preroll"), A_DEFFLOAT, 0);
+  class_addmethod(m4aPlayer_class, (t_method) m4aPlayer_gain, gensym("gain"), A_DEFFLOAT, A_DEFFLOAT, A_DEFSYMBOL, 0);
+  class_addmethod(m4aPlayer_class, (t_method) m4aPlayer_fadeout, gensym("fadeout"), A_DEFFLOAT, A_DEFSYMBOL, 0);
+  class_addmethod(m4aPlayer_class, (t_method) m4aPlayer_bus, gensym("bus"), A_DEFSYMBOL, 0);
+  class_addmethod(m4aPlayer_class, (t_method) m4aPlayer_direction, gensym("direction"), A_DEFFLOAT, 0);
+  class_addmethod(m4aPlayer_class, (t_method) m4aPlayer_marker, gensym("marker"), A_GIMME, 0);
+  class_addmethod(m4aPlayer_class, (t_method) m4aPlayer_overview, gensym("overview"), A_SYMBOL, A_DEFFLOAT, 0);
+  class_addmethod(m4aPlayer_class, (t_method) m4aPlayer_cachedir, gensym("cachedir"), A_DEFSYMBOL, 0);
+  class_addmethod(m4aPlayer_class, (t_method) m4aPlayer_read, gensym("read"), A_GIMME, 0);
+  class_addmethod(m4aPlayer_class, (t_method) m4aPlayer_probe, gensym("probe"), A_DEFSYMBOL, 0);
+  class_addmethod(m4aPlayer_class, (t_method) m4aPlayer_index, gensym("index"), A_GIMME, 0);
+  m4aBus_setup();
+
+#if M4APLAYER_BACKEND_CODEC
+  m4aStems_setup();
+#endif
 }
@@ -14,4 +14,53 @@
  * PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <stdbool.h>
+#include <stddef.h>
+
 void m4aPlayer_setup();
+
+// Unless noted otherwise, these change state which only the Pd thread touches,
+// so call them on the Pd thread, or while holding the libpd lock.
+
+// Sets how many realized players are kept in the process-wide pool after they
+// are closed (default 4, at most 16). Zero disables pooling.
+void m4aPlayer_setPoolSize(int size);
+
+// Creates and realizes a player for the file at the given absolute path and
+// parks it in the pool, so that the first open of that file starts instantly.
+// Call after m4aPlayer_setup().
+void m4aPlayer_prewarm(const char *path);
+
+// Sets the directory where the peaks of files are kept for overviews, e.g.
+// the app's cache directory. Nothing is written to disk until it is set.
+void m4aPlayer_setCacheDir(const char *path);
+
+// Sets how much memory the pipes of all players and the cached peaks may take
+// (default 16MB). Pipes of closed players and the least recently used peaks
+// are released when it is exceeded. Playing tracks are never cut short.
+void m4aPlayer_setMemoryBudget(size_t numBytes);
+
+// Renders offline: files opened from now on are decoded synchronously in
+// perform instead of by worker threads, so that a host which runs the patch in
+// batch mode gets the same output on every run at full speed. Codec backend only.
+void m4aPlayer_setOffline(bool shouldRenderOffline);
+
+// Releases the cached peaks, the pooled players and the pipes of closed
+// players, e.g. when the app is sent to the background. May be called on any
+// thread, e.g. on a memory warning. The Pd thread releases them within a block
+// while DSP is running.
+void m4aPlayer_flushCaches();
+
+// Returns the longest time in ms which an error from a decoder thread has
+// waited to be sent from outlet 9 on the Pd thread, and starts measuring again.
+double m4aPlayer_takeMaxEventLatency();
+
+#ifdef __ANDROID__
+struct AAssetManager;
+
+// Lets files be played straight out of the APK with asset: paths, e.g.
+// "open asset:music/song.m4a". Pass the app's AAssetManager (see
+// AAssetManager_fromJava()) before any asset: path is opened. The assets must
+// be stored uncompressed, which is the default for m4a files.
+void m4aPlayer_setAssetManager(struct AAssetManager *manager);
+#endif
@@ -0,0 +1,393 @@
+/**
+ * Copyright (c) 2016 Enzien Audio Ltd.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "m4aProbe.h"
+
+#define MAX_DEPTH 8 // of nested boxes
+#define MAX_BOX_BYTES 65536 // larger leaf boxes are not read, e.g. the sample tables
+
+// a file, possibly embedded in a larger one
+typedef struct _reader {
+  int fd;
+  int64_t offset;
+  int64_t length;
+} t_reader;
+
+// what has been found in a trak box
+typedef struct _trak {
+  bool isSound;
+  uint32_t timescale;
+  uint64_t duration;     // in the timescale
+  bool hasEdit;
+  int64_t mediaTime;     // the start of the edit, in the timescale
+  uint64_t editDuration; // in the timescale of the movie
+  char codec[5];
+  uint32_t sampleRate;
+  int numChannels;
+  uint32_t avgBitrate;
+  uint32_t maxBitrate;
+} t_trak;
+
+typedef struct _movie {
+  uint32_t timescale;
+  t_trak trak;  // the trak which is being parsed
+  t_trak audio; // the first audio trak
+  bool hasAudio;
+  bool hasSmpb;
+  uint32_t smpbDelay;
+  uint32_t smpbPadding;
+  uint64_t smpbNumFrames;
+  uint64_t numMediaBytes; // of the mdat boxes
+} t_movie;
+
+static const uint32_t sampleRates[13] = {
+  96000, 88200, 64000, 48000, 44100, 32000, 24000, 22050, 16000, 12000, 11025, 8000, 7350
+};
+
+static uint16_t getU16(const uint8_t *b) { return (uint16_t) ((b[0] << 8) | b[1]); }
+static uint32_t getU32(const uint8_t *b) { return ((uint32_t) b[0] << 24) | ((uint32_t) b[1] << 16) | ((uint32_t) b[2] << 8) | b[3]; }
+static uint64_t getU64(const uint8_t *b) { return ((uint64_t) getU32(b) << 32) | getU32(b+4); }
+static uint16_t getLE16(const uint8_t *b) { return (uint16_t) (b[0] | (b[1] << 8)); }
+static uint32_t getLE32(const uint8_t *b) { return b[0] | ((uint32_t) b[1] << 8) | ((uint32_t) b[2] << 16) | ((uint32_t) b[3] << 24); }
+
+static bool m4aProbe_readAt(const t_reader *r, int64_t position, void *buffer, size_t numBytes) {
+  if (position < 0 || position + (int64_t) numBytes > r->length) return false;
+  return pread(r->fd, buffer, numBytes, (off_t) (r->offset + position)) == (ssize_t) numBytes;
+}
+
+// reads n bits from a big endian bit stream, or 0 past its end
+static uint32_t m4aProbe_getBits(const uint8_t *b, uint32_t numBytes, uint32_t *bit, int n) {
+  uint32_t value = 0;
+  for (int i = 0; i < n; ++i, ++*bit) {
+    const uint32_t v = (*bit/8 < numBytes) ? (b[*bit/8] >> (7 - *bit%8)) & 1 : 0;
+    value = (value << 1) | v;
+  }
+  return value;
+}
+
+// reads the length of a descriptor in an esds box, and moves past it
+static uint32_t m4aProbe_getDescriptorLength(const uint8_t **b, const uint8_t *end) {
+  uint32_t length = 0;
+  for (int i = 0; i < 4 && *b < end; ++i) {
+    const uint8_t c = *(*b)++;
+    length = (length << 7) | (c & 0x7F);
+    if (!(c & 0x80)) break;
+  }
+  return length;
+}
+
+// reads the bitrates and the AudioSpecificConfig from an esds box
+static void m4aProbe_parseEsds(const uint8_t *b, const uint8_t *end, t_trak *t) {
+  b += 4; // version and flags
+  if (b >= end || *b++ != 0x03) return; // ES_Descriptor
+  m4aProbe_getDescriptorLength(&b, end);
+  if (b + 3 > end) return;
+  const uint8_t flags = b[2];
+  b += 3;
+  if (flags & 0x80) b += 2;                      // dependsOn_ES_ID
+  if ((flags & 0x40) && b < end) b += 1 + b[0];  // URL
+  if (flags & 0x20) b += 2;                      // OCR_ES_Id
+  if (b >= end || *b++ != 0x04) return; // DecoderConfigDescriptor
+  m4aProbe_getDescriptorLength(&b, end);
+  if (b + 13 > end) return;
+  t->maxBitrate = getU32(b+5);
+  t->avgBitrate = getU32(b+9);
+  b += 13;
+  if (b >= end || *b++ != 0x05) return; // DecoderSpecificInfo, i.e. the AudioSpecificConfig
+  const uint32_t length = m4aProbe_getDescriptorLength(&b, end);
+  if (length < 2 || b + length > end) return;
+
+  // the audio object type, the sample rate and the channel configuration
+  uint32_t bit = 0;
+  uint32_t objectType = m4aProbe_getBits(b, length, &bit, 5);
+  if (objectType == 31) objectType = 32 + m4aProbe_getBits(b, length, &bit, 6);
+  uint32_t index = m4aProbe_getBits(b, length, &bit, 4);
+  uint32_t sampleRate = (index == 15) ? m4aProbe_getBits(b, length, &bit, 24) : (index < 13) ? sampleRates[index] : 0;
+  const uint32_t channelConfig = m4aProbe_getBits(b, length, &bit, 4);
+  if (objectType == 5 || objectType == 29) {
+    // explicitly signalled SBR, which doubles the output rate
+    index = m4aProbe_getBits(b, length, &bit, 4);
+    sampleRate = (index == 15) ? m4aProbe_getBits(b, length, &bit, 24) : (index < 13) ? sampleRates[index] : sampleRate;
+  }
+  if (sampleRate > 0) t->sampleRate = sampleRate;
+  if (channelConfig > 0 && channelConfig < 7) t->numChannels = (int) channelConfig;
+  else if (channelConfig == 7) t->numChannels = 8;
+
+  // parametric stereo is decoded to two channels from a mono core
+  if (objectType == 29 && t->numChannels == 1) t->numChannels = 2;
+}
+
+// finds a child box of the given type in a box which has been read
+static const uint8_t *m4aProbe_findChild(const uint8_t *b, const uint8_t *end, const char *type, const uint8_t **childEnd) {
+  while (b + 8 <= end) {
+    const uint32_t size = getU32(b);
+    if (size < 8 || b + size > end) return NULL;
+    if (memcmp(b+4, type, 4) == 0) {
+      *childEnd = b + size;
+      return b + 8;
+    }
+    b += size;
+  }
+  return NULL;
+}
+
+// reads the first sample entry of an stsd box
+static void m4aProbe_parseStsd(const uint8_t *b, const uint8_t *end, t_trak *t) {
+  b += 8; // version, flags and the number of entries
+  if (b + 36 > end) return;
+  memcpy(t->codec, b+4, 4);
+  t->codec[4] = '\0';
+  const uint8_t *entry = b + 8; // past the size, the type and the SampleEntry fields
+  const uint16_t version = getU16(entry+8);
+  t->numChannels = getU16(entry+16);
+  t->sampleRate = getU32(entry+24) >> 16;
+
+  // QuickTime sound descriptions of version 1 and 2 are longer
+  const uint8_t *children = entry + 28 + ((version == 1) ? 16 : (version == 2) ? 36 : 0);
+  const uint8_t *entryEnd = b + getU32(b);
+  if (entryEnd > end) entryEnd = end;
+  if (version == 2 && children <= entryEnd) {
+    uint64_t rate = getU64(entry+32);
+    double r = 0.0;
+    memcpy(&r, &rate, sizeof(double));
+    t->sampleRate = (uint32_t) r;
+    t->numChannels = (int) getU32(entry+40);
+  }
+  if (children > entryEnd) return;
+  const uint8_t *childEnd = NULL;
+  const uint8_t *esds = m4aProbe_findChild(children, entryEnd, "esds", &childEnd);
+  if (esds == NULL) {
+    // in QuickTime files the esds is wrapped in a wave box
+    const uint8_t *waveEnd = NULL;
+    const uint8_t *wave = m4aProbe_findChild(children, entryEnd, "wave", &waveEnd);
+    if (wave != NULL) esds = m4aProbe_findChild(wave, waveEnd, "esds", &childEnd);
+  }
+  if (esds != NULL) m4aProbe_parseEsds(esds, childEnd, t);
+}
+
+// reads the gapless values from an iTunSMPB item, e.g. " 00000000 00000840 000001CA 00000000000A0B76 ..."
+static void m4aProbe_parseItunesItem(const uint8_t *b, const uint8_t *end, t_movie *m) {
+  const uint8_t *nameEnd = NULL;
+  const uint8_t *name = m4aProbe_findChild(b, end, "name", &nameEnd);
+  if (name == NULL || nameEnd - name != 12 || memcmp(name+4, "iTunSMPB", 8) != 0) return;
+  const uint8_t *dataEnd = NULL;
+  const uint8_t *data = m4aProbe_findChild(b, end, "data", &dataEnd);
+  if (data == NULL || dataEnd - data <= 8) return;
+  char text[128];
+  size_t n = (size_t) (dataEnd - data - 8);
+  if (n >= sizeof(text)) n = sizeof(text)-1;
+  memcpy(text, data+8, n);
+  text[n] = '\0';
+  unsigned int zero = 0, delay = 0, padding = 0;
+  unsigned long long numFrames = 0;
+  if (sscanf(text, "%x %x %x %llx", &zero, &delay, &padding, &numFrames) == 4) {
+    m->hasSmpb = true;
+    m->smpbDelay = delay;
+    m->smpbPadding = padding;
+    m->smpbNumFrames = numFrames;
+  }
+}
+
+// reads a small leaf box into memory and parses it
+static void m4aProbe_parseLeaf(const t_reader *r, int64_t start, int64_t size, const char *type, t_movie *m) {
+  if (size > MAX_BOX_BYTES) return;
+  uint8_t *b = (uint8_t *) malloc((size_t) size);
+  if (b == NULL || !m4aProbe_readAt(r, start, b, (size_t) size)) {
+    free(b);
+    return;
+  }
+  const uint8_t *const end = b + size;
+  t_trak *const t = &m->trak;
+  if (memcmp(type, "mvhd", 4) == 0 && size >= 24) {
+    m->timescale = getU32(b + ((b[0] == 1) ? 20 : 12));
+  } else if (memcmp(type, "mdhd", 4) == 0 && size >= 24) {
+    if (b[0] == 1 && size >= 32) {
+      t->timescale = getU32(b+20);
+      t->duration = getU64(b+24);
+    } else {
+      t->timescale = getU32(b+12);
+      t->duration = getU32(b+16);
+    }
+  } else if (memcmp(type, "hdlr", 4) == 0 && size >= 12) {
+    t->isSound = (memcmp(b+8, "soun", 4) == 0);
+  } else if (memcmp(type, "elst", 4) == 0 && size >= 8) {
+    // the first edit which is not empty, i.e. which has a media time
+    const uint32_t numEntries = getU32(b+4);
+    const int entrySize = (b[0] == 1) ? 20 : 12;
+    for (uint32_t i = 0; i < numEntries && b + 8 + (i+1)*entrySize <= end; ++i) {
+      const uint8_t *e = b + 8 + i*entrySize;
+      const int64_t mediaTime = (b[0] == 1) ? (int64_t) getU64(e+8) : (int64_t) (int32_t) getU32(e+4);
+      if (mediaTime < 0) continue;
+      t->hasEdit = true;
+      t->mediaTime = mediaTime;
+      t->editDuration = (b[0] == 1) ? getU64(e) : getU32(e);
+      break;
+    }
+  } else if (memcmp(type, "stsd", 4) == 0) {
+    m4aProbe_parseStsd(b, end, t);
+  } else if (memcmp(type, "----", 4) == 0) {
+    m4aProbe_parseItunesItem(b, end, m);
+  }
+  free(b);
+}
+
+// walks the boxes between start and end, descending into those which lead to the values
+static void m4aProbe_parseBoxes(const t_reader *r, int64_t start, int64_t end, int depth, t_movie *m) {
+  int64_t position = start;
+  while (position + 8 <= end) {
+    uint8_t header[16];
+    if (!m4aProbe_readAt(r, position, header, 8)) return;
+    int64_t size = getU32(header);
+    int64_t headerSize = 8;
+    if (size == 1) {
+      if (!m4aProbe_readAt(r, position+8, header+8, 8)) return;
+      size = (int64_t) getU64(header+8);
+      headerSize = 16;
+    } else if (size == 0) {
+      size = end - position; // the box extends to the end of the file
+    }
+    if (size < headerSize || position + size > end) return;
+    const char *type = (const char *) header+4;
+    const int64_t payload = position + headerSize;
+    const int64_t payloadEnd = position + size;
+
+    if (memcmp(type, "mdat", 4) == 0) {
+      m->numMediaBytes += (uint64_t) (size - headerSize);
+    } else if (depth < MAX_DEPTH && memcmp(type, "trak", 4) == 0) {
+      memset(&m->trak, 0, sizeof(t_trak));
+      m4aProbe_parseBoxes(r, payload, payloadEnd, depth+1, m);
+      if (m->trak.isSound && !m->hasAudio) {
+        m->audio = m->trak;
+        m->hasAudio = true;
+      }
+    } else if (depth < MAX_DEPTH && (memcmp(type, "moov", 4) == 0 || memcmp(type, "mdia", 4) == 0 ||
+        memcmp(type, "minf", 4) == 0 || memcmp(type, "stbl", 4) == 0 || memcmp(type, "edts", 4) == 0 ||
+        memcmp(type, "udta", 4) == 0 || memcmp(type, "ilst", 4) == 0)) {
+      m4aProbe_parseBoxes(r, payload, payloadEnd, depth+1, m);
+    } else if (depth < MAX_DEPTH && memcmp(type, "meta", 4) == 0) {
+      // an ISO meta box has a version and flags, a QuickTime one does not
+      uint8_t next[8];
+      if (!m4aProbe_readAt(r, payload, next, 8)) return;
+      const bool isFullBox = memcmp(next+4, "hdlr", 4) != 0;
+      m4aProbe_parseBoxes(r, payload + (isFullBox ? 4 : 0), payloadEnd, depth+1, m);
+    } else if (memcmp(type, "mvhd", 4) == 0 || memcmp(type, "mdhd", 4) == 0 || memcmp(type, "hdlr", 4) == 0 ||
+        memcmp(type, "elst", 4) == 0 || memcmp(type, "stsd", 4) == 0 || memcmp(type, "----", 4) == 0) {
+      m4aProbe_parseLeaf(r, payload, size - headerSize, type, m);
+    }
+    position += size;
+  }
+}
+
+static bool m4aProbe_readMp4(const t_reader *r, m4aProbeInfo *info) {
+  t_movie m;
+  memset(&m, 0, sizeof(t_movie));
+  m4aProbe_parseBoxes(r, 0, r->length, 0, &m);
+  const t_trak *const t = &m.audio;
+  if (!m.hasAudio || t->timescale == 0) return false;
+
+  memcpy(info->codec, t->codec, 5);
+  info->sampleRate = (t->sampleRate > 0) ? t->sampleRate : t->timescale;
+  info->numChannels = t->numChannels;
+  const uint64_t numMediaFrames = (t->duration * info->sampleRate) / t->timescale;
+  if (m.hasSmpb) {
+    info->hasGapless = true;
+    info->encoderDelay = m.smpbDelay;
+    info->numPaddingFrames = m.smpbPadding;
+    info->numFrames = m.smpbNumFrames;
+  } else if (t->hasEdit && m.timescale > 0) {
+    info->hasGapless = true;
+    info->encoderDelay = (uint32_t) (((uint64_t) t->mediaTime * info->sampleRate) / t->timescale);
+    info->numFrames = (t->editDuration * info->sampleRate) / m.timescale;
+    if (info->encoderDelay > numMediaFrames) info->encoderDelay = 0;
+    if (info->numFrames == 0 || info->encoderDelay + info->numFrames > numMediaFrames) {
+      info->numFrames = numMediaFrames - info->encoderDelay;
+    }
+    info->numPaddingFrames = (uint32_t) (numMediaFrames - info->encoderDelay - info->numFrames);
+  } else {
+    info->numFrames = numMediaFrames;
+  }
+
+  info->maxBitrate = t->maxBitrate;
+  info->avgBitrate = t->avgBitrate;
+  if (info->avgBitrate == 0 && info->numFrames > 0) {
+    // estimated from the size of the media, which only holds this track in audio files
+    info->avgBitrate = (uint32_t) ((m.numMediaBytes * 8 * info->sampleRate) / info->numFrames);
+  }
+  info->isVbr = (t->avgBitrate == 0 || t->maxBitrate != t->avgBitrate);
+  return true;
+}
+
+static bool m4aProbe_readWav(const t_reader *r, m4aProbeInfo *info) {
+  int64_t position = 12;
+  bool hasFormat = false;
+  uint32_t blockAlign = 0;
+  uint8_t chunk[24];
+  while (m4aProbe_readAt(r, position, chunk, 8)) {
+    const uint32_t size = getLE32(chunk+4);
+    if (memcmp(chunk, "fmt ", 4) == 0 && size >= 16 && m4aProbe_readAt(r, position+8, chunk+8, 16)) {
+      memcpy(info->codec, "wav ", 5);
+      info->numChannels = getLE16(chunk+10);
+      info->sampleRate = getLE32(chunk+12);
+      info->avgBitrate = info->maxBitrate = getLE32(chunk+16) * 8;
+      blockAlign = getLE16(chunk+20);
+      hasFormat = true;
+    } else if (memcmp(chunk, "data", 4) == 0 && hasFormat && blockAlign > 0) {
+      // a streamed file may leave the size of the data at 0 or its maximum
+      int64_t numBytes = r->length - (position+8);
+      if (size > 0 && size != 0xFFFFFFFF && (int64_t) size < numBytes) numBytes = size;
+      info->numFrames = (uint64_t) numBytes / blockAlign;
+      return info->sampleRate > 0;
+    }
+    position += 8 + size + (size & 1);
+  }
+  return false;
+}
+
+bool m4aProbe_readFd(int fd, int64_t offset, int64_t length, m4aProbeInfo *info) {
+  memset(info, 0, sizeof(m4aProbeInfo));
+  t_reader r = {fd, offset, length};
+  if (r.length < 0) {
+    struct stat s;
+    if (fstat(fd, &s) != 0) return false;
+    r.length = (int64_t) s.st_size - offset;
+  }
+  uint8_t magic[12];
+  if (!m4aProbe_readAt(&r, 0, magic, sizeof(magic))) return false;
+  if (memcmp(magic, "RIFF", 4) == 0 && memcmp(magic+8, "WAVE", 4) == 0) return m4aProbe_readWav(&r, info);
+  return m4aProbe_readMp4(&r, info);
+}
+
+bool m4aProbe_readFile(const char *path, m4aProbeInfo *info) {
+  const int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    memset(info, 0, sizeof(m4aProbeInfo));
+    return false;
+  }
+  const bool isValid = m4aProbe_readFd(fd, 0, -1, info);
+  close(fd);
+  return isValid;
+}
+
+double m4aProbe_getDurationMs(const m4aProbeInfo *info) {
+  return (info->sampleRate > 0) ? (info->numFrames * 1000.0) / info->sampleRate : 0.0;
+}
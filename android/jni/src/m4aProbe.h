@@ -0,0 +1,58 @@
+/**
+ * Copyright (c) 2016 Enzien Audio Ltd.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _M4A_PROBE_H_
+#define _M4A_PROBE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Reads the properties of a file from its container header, without creating
+ * a decoder. MP4/M4A files are parsed down to the sample entry of the first
+ * audio track, and 16-bit PCM WAV files (which the Linux stand-in decoder
+ * plays) down to their fmt chunk. Only the boxes which are needed are read,
+ * so a probe takes a few small reads whatever the length of the file.
+ */
+typedef struct m4aProbeInfo {
+  char codec[5];           // the fourcc of the sample entry, e.g. "mp4a", or "wav "
+  uint32_t sampleRate;
+  int numChannels;
+  uint64_t numFrames;      // the playable length, without the encoder delay and padding
+  uint32_t avgBitrate;     // bits per second
+  uint32_t maxBitrate;
+  bool isVbr;
+  bool hasGapless;         // the delay and padding are known, from iTunSMPB or an edit list
+  uint32_t encoderDelay;   // frames before the first playable frame
+  uint32_t numPaddingFrames; // frames after the last playable frame
+} m4aProbeInfo;
+
+// Probes the file at the given path. Returns false if it is not a supported file.
+bool m4aProbe_readFile(const char *path, m4aProbeInfo *info);
+
+/**
+ * Probes a file which is embedded in an open file descriptor, e.g. an
+ * uncompressed asset in an APK. The descriptor is left open.
+ *
+ * @param offset  The byte offset of the file in the descriptor.
+ * @param length  The length of the file in bytes, or -1 for the rest of the descriptor.
+ */
+bool m4aProbe_readFd(int fd, int64_t offset, int64_t length, m4aProbeInfo *info);
+
+// the playable length in ms
+double m4aProbe_getDurationMs(const m4aProbeInfo *info);
+
+#endif // _M4A_PROBE_H_
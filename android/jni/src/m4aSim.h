@@ -0,0 +1,37 @@
+/**
+ * Copyright (c) 2016 Enzien Audio Ltd.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _M4A_SIM_H_
+#define _M4A_SIM_H_
+
+#include <stdbool.h>
+
+/*
+ * When m4aPlayer is built with M4APLAYER_SIMULATION=1 (which implies the codec
+ * backend), the decoder workers are not threads. They are registered with the
+ * simulator (linux/m4aSim.c) instead, which steps them in virtual time between
+ * calls to perform, so that every run of a scenario is identical.
+ */
+
+// Decodes at most one block. Returns false if there was nothing to do, i.e.
+// when a worker thread would sleep.
+typedef bool (*m4aSim_stepFn)(void *worker);
+
+void m4aSim_addWorker(void *worker, m4aSim_stepFn step);
+
+void m4aSim_removeWorker(void *worker);
+
+#endif // _M4A_SIM_H_
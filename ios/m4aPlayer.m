@@ -4,6 +4,8 @@
 #include "m4aPlayer.h"
 
 #define DEFAULT_BUFFER_DURATION_SEC 3.0
+#define MAX_EVENTS 8 // loaded events which can wait for the Pd thread
+#define EVENT_POLL_MS 5.0 // how often events are looked for while operations are outstanding and DSP is off
 #if TARGET_OS_IPHONE
 #define BYTES_PER_SAMPLE sizeof(short)
 #elif TARGET_OS_MAC
@@ -57,6 +59,12 @@ static NSOperationQueue *globalOperationQueue;
 
 static t_class *m4aPlayer_class;
 
+// An event from an operation. Operations never call outlets, which are only
+// safe on the Pd thread.
+typedef struct _event {
+  float durationMs; // the asset has been loaded
+} t_event;
+
 typedef struct _m4aPlayer {
   t_object x_obj;
   t_outlet *signal_left_outlet;          // outlet 0
@@ -83,11 +91,21 @@ typedef struct _m4aPlayer {
   BOOL isLoaded;
   BOOL shouldReprimeOnFinish;
 
+  // Events are posted to a ring by the operations, which the global queue runs
+  // one at a time, and sent by the event clock on the Pd thread. Perform sets
+  // the clock, so they are sent within a block.
+  t_event events[MAX_EVENTS];
+  volatile unsigned int numPostedEvents; // only written by operations
+  volatile unsigned int numSentEvents;   // only written by the Pd thread
+  int numDonePending;
+  t_clock *eventClock;
+
 } t_m4aPlayer;
 
 // forward declaration
 static void m4aPlayer_prime_synchronous(t_m4aPlayer *x, float f);
 static void m4aPlayer_open_synchronous(t_m4aPlayer *x, NSString *path, float position);
+static void m4aPlayer_onEvents(t_m4aPlayer *x);
 
 static void *m4aPlayer_new(t_symbol *s, int argc, t_atom *argv) {
   t_m4aPlayer *x = (t_m4aPlayer *) pd_new(m4aPlayer_class);
@@ -102,6 +120,10 @@ static void *m4aPlayer_new(t_symbol *s, int argc, t_atom *argv) {
   x->assetReader = nil;
   x->shouldLoop = NO;
   x->shouldReprimeOnFinish = YES;
+  x->numPostedEvents = 0;
+  x->numSentEvents = 0;
+  x->numDonePending = 0;
+  x->eventClock = clock_new(x, (t_method) m4aPlayer_onEvents);
 
   @autoreleasepool {
     x->basePath = [[NSString stringWithCString:canvas_getcurrentdir()->s_name encoding:NSASCIIStringEncoding] retain];
@@ -125,6 +147,7 @@ static void *m4aPlayer_new(t_symbol *s, int argc, t_atom *argv) {
 
       // load the file immediately
       m4aPlayer_open_synchronous(x, argString, 0.0f);
+      clock_delay(x->eventClock, 0.0);
     }
   }
 
@@ -141,6 +164,7 @@ static void m4aPlayer_free(t_m4aPlayer *x) {
     [operation waitUntilFinished];
   }
   [x->outstandingOperations release]; x->outstandingOperations = nil;
+  clock_free(x->eventClock);
   x->currentBuffer = nil;
   [x->basePath release]; x->basePath = nil;
   [x->songAsset release]; x->songAsset = nil;
@@ -167,6 +191,41 @@ static void m4aPlayer_add_operation_with_block(t_m4aPlayer *x, void(^b)()) {
   [globalOperationQueue addOperation:operation];
 }
 
+// Posts an event to the Pd thread. Called from operations, or from the Pd
+// thread before any operation has been added. The event is dropped if the
+// ring is full.
+static void m4aPlayer_post_event(t_m4aPlayer *x, float durationMs) {
+  const unsigned int i = x->numPostedEvents;
+  if (i - x->numSentEvents == MAX_EVENTS) {
+    NSLog(@"(m4aPlayer %p): dropping an event, the Pd thread has not sent the previous ones.", x);
+    return;
+  }
+  x->events[i % MAX_EVENTS].durationMs = durationMs;
+  __sync_synchronize(); // the event is written before it is counted
+  x->numPostedEvents = i + 1;
+}
+
+// called by the event clock on the Pd thread
+static void m4aPlayer_onEvents(t_m4aPlayer *x) {
+  // outstanding operations may still post events, so keep looking while DSP is off
+  BOOL isBusy = NO;
+  @synchronized(x->outstandingOperations) {
+    isBusy = [x->outstandingOperations count] > 0;
+  }
+  if (isBusy) clock_delay(x->eventClock, EVENT_POLL_MS);
+
+  int numDone = x->numDonePending;
+  x->numDonePending = 0;
+  while (numDone-- > 0) outlet_bang(x->message_done_playing_outlet);
+
+  while (x->numSentEvents != x->numPostedEvents) {
+    __sync_synchronize(); // the event is read after it has been counted
+    const t_event e = x->events[x->numSentEvents % MAX_EVENTS];
+    x->numSentEvents = x->numSentEvents + 1;
+    outlet_float(x->message_done_loading_outlet, e.durationMs);
+  }
+}
+
 // fills the given buffer, restarting the reader if the player should loop.
 static void m4aPlayer_load_buffer_with_loop(t_m4aPlayer *x, NSValidData *buffer) {
 //  [buffer clear]; // reset validLength to zero, zero buffer
@@ -346,8 +405,8 @@ static void m4aPlayer_open_synchronous(t_m4aPlayer *x, NSString *path, float pos
 
   float songDurationMs = 1000.0f * x->songAsset.duration.value / x->songAsset.duration.timescale;
 
-  // send a bang indicating that the object is finished loading
-  outlet_float(x->message_done_loading_outlet, songDurationMs);
+  // indicate that the object is finished loading, from the Pd thread
+  m4aPlayer_post_event(x, songDurationMs);
 }
 
 static void m4aPlayer_open(t_m4aPlayer *x, t_symbol *s, t_float position) {
@@ -367,6 +426,7 @@ static void m4aPlayer_open(t_m4aPlayer *x, t_symbol *s, t_float position) {
       m4aPlayer_open_synchronous(x, path, position);
     });
   }
+  clock_delay(x->eventClock, EVENT_POLL_MS);
 }
 
 static void m4aPlayer_switch_buffers(t_m4aPlayer *x) {
@@ -383,6 +443,9 @@ static t_int *m4aPlayer_perform(t_int *w) {
   t_sample *outL = (t_sample *) w[3]; // the left outlet buffer
   t_sample *outR = (t_sample *) w[4]; // the right outlet buffer
 
+  // send the events which operations have posted since the last block
+  if (x->numPostedEvents != x->numSentEvents) clock_delay(x->eventClock, 0.0);
+
   if (x->isPlaying && x->isLoaded) {
     // if there are NOT enough samples remaining in the current buffer to fill Pd's request
     if (x->bufferIndex + n*x->numChannels > x->currentBuffer.validLength/BYTES_PER_SAMPLE) {
@@ -414,8 +477,10 @@ static t_int *m4aPlayer_perform(t_int *w) {
           });
         }
 
-        // output a bang from the third outlet to indicate that the end of the asset has been reached
-        outlet_bang(x->message_done_playing_outlet);
+        // output a bang from the third outlet to indicate that the end of the asset has been reached,
+        // from the event clock rather than in the middle of the DSP chain
+        ++x->numDonePending;
+        clock_delay(x->eventClock, 0.0);
 
         // clear the outputs and return
         vDSP_vclr(outL, 1, n);
@@ -0,0 +1,594 @@
+/**
+ * Copyright (c) 2016 Enzien Audio Ltd.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+// Microbenchmarks of the real-time parts of m4aPlayer (codec backend), for
+// tracking regressions between releases:
+//   - pipe.throughput: hLp_getWriteBuffer()/hLp_produce() and
+//     hLp_getReadBuffer()/hLp_consume() of one block, on one thread and
+//     between a producer and a consumer thread
+//   - pipe.latency: the time from hLp_produce() on one thread until the block
+//     is seen on the other
+//   - kernel.*: the sample kernels of m4aConvert.h at each block size
+//   - churn.*: creating, opening and freeing a player, 1000 times over
+//   - stream: the CPU of 1, 8, 32 and 128 players looping a file in real time,
+//     with worker threads, through the stand-in Pd host
+//   - events: the latency from a worker posting an error until outlet 9 sends
+//     it on the Pd thread, for players whose file is cut short while they play
+//
+// Built with -DM4ABENCH_RT_CHECK=1 and the options of m4aRtCheck (see
+// README.md), the stream benchmark also counts the calls which perform makes
+// that are not real-time safe.
+//
+// Usage: m4aBench [-q] [-p] [-o results.json]
+//   -q  quick run with fewer iterations, e.g. for CI
+//   -p  adds hardware counters (cycles, instructions, cache and branch misses)
+//       per operation from perf_event_open(), if the kernel allows it. They
+//       count the benchmarking thread only, not the workers.
+// Writes the results as JSON to stdout, or to the given file.
+
+#include <linux/perf_event.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "HvLightPipe.h"
+#include "m4aConvert.h"
+#include "m4aPlayer.h"
+#include "pdhost.h"
+#if M4ABENCH_RT_CHECK
+#include "m4aRtCheck.h"
+#endif
+
+#define BENCH_SAMPLE_RATE 48000
+#define BENCH_BLOCK_SIZE 64
+#define BENCH_PIPE_BLOCKS 32
+#define BENCH_FILE_SECONDS 10
+#define BENCH_NUM_CHURN 1000
+#define BENCH_MAX_STREAMS 128
+#define BENCH_NUM_EVENT_PLAYERS 8
+#define BENCH_NUM_COUNTERS 4
+
+static FILE *out = NULL;
+static int numResults = 0;
+static bool isQuick = false;
+
+// the counters of the benchmarking thread, with the first as the group leader
+static int counterFds[BENCH_NUM_COUNTERS] = {-1, -1, -1, -1};
+static uint64_t counterValues[BENCH_NUM_COUNTERS];
+static const char *const counterNames[BENCH_NUM_COUNTERS] = {
+  "cyclesPerOp", "instructionsPerOp", "cacheMissesPerOp", "branchMissesPerOp"
+};
+
+static volatile float sink; // keeps the results of the kernels alive
+
+// messages from the players, counted per benchmark
+static int numLoaded = 0;
+static int numReady = 0;
+static int numErrors = 0;
+
+static void bench_outletHook(void *owner, int outlet, t_symbol *s, int argc, t_atom *argv) {
+  if (outlet == 3) ++numLoaded;
+  else if (outlet == 4) ++numReady;
+  else if (outlet == 9) ++numErrors;
+}
+
+static uint64_t bench_getNs(clockid_t clock) {
+  struct timespec t;
+  clock_gettime(clock, &t);
+  return (uint64_t) t.tv_sec * 1000000000ULL + (uint64_t) t.tv_nsec;
+}
+
+/* hardware counters */
+
+static bool bench_openCounters(void) {
+  const uint64_t configs[BENCH_NUM_COUNTERS] = {
+    PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES
+  };
+  for (int i = 0; i < BENCH_NUM_COUNTERS; ++i) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = configs[i];
+    attr.disabled = (i == 0);
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP;
+    counterFds[i] = (int) syscall(__NR_perf_event_open, &attr, 0, -1, (i == 0) ? -1 : counterFds[0], 0);
+    if (counterFds[i] < 0) {
+      for (int j = 0; j < i; ++j) close(counterFds[j]);
+      counterFds[0] = -1;
+      return false;
+    }
+  }
+  return true;
+}
+
+static void bench_startCounters(void) {
+  memset(counterValues, 0, sizeof(counterValues));
+  if (counterFds[0] < 0) return;
+  ioctl(counterFds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+  ioctl(counterFds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+}
+
+static void bench_stopCounters(void) {
+  if (counterFds[0] < 0) return;
+  ioctl(counterFds[0], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+  uint64_t values[1+BENCH_NUM_COUNTERS];
+  if (read(counterFds[0], values, sizeof(values)) == (ssize_t) sizeof(values) && values[0] == BENCH_NUM_COUNTERS) {
+    memcpy(counterValues, values+1, sizeof(counterValues));
+  }
+}
+
+/* results */
+
+static void bench_beginResult(const char *name) {
+  fprintf(out, "%s\n    {\"name\": \"%s\"", (numResults++ > 0) ? "," : "", name);
+}
+
+static void bench_addInt(const char *key, int64_t value) {
+  fprintf(out, ", \"%s\": %lld", key, (long long) value);
+}
+
+static void bench_addFloat(const char *key, double value) {
+  fprintf(out, ", \"%s\": %.3f", key, value);
+}
+
+static void bench_addString(const char *key, const char *value) {
+  fprintf(out, ", \"%s\": \"%s\"", key, value);
+}
+
+// adds the time and the counters of the last measurement per operation
+static void bench_endResult(uint64_t numOps, uint64_t ns) {
+  bench_addInt("iterations", (int64_t) numOps);
+  bench_addFloat("nsPerOp", (double) ns / numOps);
+  if (counterFds[0] >= 0) {
+    for (int i = 0; i < BENCH_NUM_COUNTERS; ++i) bench_addFloat(counterNames[i], (double) counterValues[i] / numOps);
+  }
+  fprintf(out, "}");
+}
+
+/* pipe */
+
+typedef struct _pipeBench {
+  HvLightPipe pipe;
+  uint32_t numBlockBytes;
+  uint64_t numBlocks;
+  volatile uint64_t numConsumed; // for the latency, the producer waits for each block to be consumed
+} t_pipeBench;
+
+static void *bench_produceThread(void *userData) {
+  t_pipeBench *const b = (t_pipeBench *) userData;
+  for (uint64_t i = 0; i < b->numBlocks; ++i) {
+    char *buffer = NULL;
+    while ((buffer = hLp_getWriteBuffer(&b->pipe, b->numBlockBytes)) == NULL) sched_yield();
+    memset(buffer, (int) i, b->numBlockBytes);
+    hLp_produce(&b->pipe, b->numBlockBytes);
+  }
+  return NULL;
+}
+
+static void *bench_pingThread(void *userData) {
+  t_pipeBench *const b = (t_pipeBench *) userData;
+  for (uint64_t i = 0; i < b->numBlocks; ++i) {
+    while (b->numConsumed < i) sched_yield();
+    char *const buffer = hLp_getWriteBuffer(&b->pipe, b->numBlockBytes);
+    const uint64_t now = bench_getNs(CLOCK_MONOTONIC);
+    memcpy(buffer, &now, sizeof(now));
+    hLp_produce(&b->pipe, b->numBlockBytes);
+  }
+  return NULL;
+}
+
+static int bench_compareUint64(const void *a, const void *b) {
+  const uint64_t x = *(const uint64_t *) a;
+  const uint64_t y = *(const uint64_t *) b;
+  return (x > y) - (x < y);
+}
+
+static void bench_pipes(void) {
+  for (int isFloat = 0; isFloat < 2; ++isFloat) {
+    t_pipeBench b;
+    memset(&b, 0, sizeof(b));
+    b.numBlockBytes = 12 + 2*BENCH_BLOCK_SIZE*(isFloat ? sizeof(float) : sizeof(int16_t));
+    hLp_init(&b.pipe, BENCH_PIPE_BLOCKS * b.numBlockBytes);
+    const char *const format = isFloat ? "float" : "int16";
+
+    // one thread, writing half the pipe ahead like a worker
+    const uint64_t numBlocks = isQuick ? 200000 : 4000000;
+    bench_startCounters();
+    uint64_t start = bench_getNs(CLOCK_MONOTONIC);
+    for (uint64_t i = 0; i < numBlocks; i += BENCH_PIPE_BLOCKS/2) {
+      for (int j = 0; j < BENCH_PIPE_BLOCKS/2; ++j) {
+        char *const buffer = hLp_getWriteBuffer(&b.pipe, b.numBlockBytes);
+        buffer[0] = (char) j;
+        hLp_produce(&b.pipe, b.numBlockBytes);
+      }
+      for (int j = 0; j < BENCH_PIPE_BLOCKS/2; ++j) {
+        uint32_t numBytes = 0;
+        hLp_hasData(&b.pipe); // moves the read head back to the start of the pipe
+        sink += (float) hLp_getReadBuffer(&b.pipe, &numBytes)[0];
+        hLp_consume(&b.pipe);
+      }
+    }
+    uint64_t ns = bench_getNs(CLOCK_MONOTONIC) - start;
+    bench_stopCounters();
+    bench_beginResult("pipe.throughput");
+    bench_addInt("threads", 1);
+    bench_addString("format", format);
+    bench_addInt("blockBytes", b.numBlockBytes);
+    bench_endResult(numBlocks, ns);
+
+    // a producer thread which fills the blocks and a consumer which reads them
+    hLp_reset(&b.pipe);
+    b.numBlocks = isQuick ? 50000 : 1000000;
+    pthread_t thread;
+    bench_startCounters();
+    start = bench_getNs(CLOCK_MONOTONIC);
+    pthread_create(&thread, NULL, &bench_produceThread, &b);
+    for (uint64_t i = 0; i < b.numBlocks; ++i) {
+      while (!hLp_hasData(&b.pipe)) sched_yield();
+      uint32_t numBytes = 0;
+      const char *const buffer = hLp_getReadBuffer(&b.pipe, &numBytes);
+      sink += (float) buffer[numBytes-1];
+      hLp_consume(&b.pipe);
+    }
+    pthread_join(thread, NULL);
+    ns = bench_getNs(CLOCK_MONOTONIC) - start;
+    bench_stopCounters();
+    bench_beginResult("pipe.throughput");
+    bench_addInt("threads", 2);
+    bench_addString("format", format);
+    bench_addInt("blockBytes", b.numBlockBytes);
+    bench_endResult(b.numBlocks, ns);
+
+    // one block at a time, timestamped by the producer
+    hLp_reset(&b.pipe);
+    b.numBlocks = isQuick ? 2000 : 20000;
+    b.numConsumed = 0;
+    uint64_t *const latencies = (uint64_t *) malloc(b.numBlocks * sizeof(uint64_t));
+    pthread_create(&thread, NULL, &bench_pingThread, &b);
+    for (uint64_t i = 0; i < b.numBlocks; ++i) {
+      while (!hLp_hasData(&b.pipe)) sched_yield();
+      uint32_t numBytes = 0;
+      uint64_t produced = 0;
+      memcpy(&produced, hLp_getReadBuffer(&b.pipe, &numBytes), sizeof(produced));
+      latencies[i] = bench_getNs(CLOCK_MONOTONIC) - produced;
+      hLp_consume(&b.pipe);
+      b.numConsumed = i+1;
+    }
+    pthread_join(thread, NULL);
+    qsort(latencies, b.numBlocks, sizeof(uint64_t), &bench_compareUint64);
+    bench_beginResult("pipe.latency");
+    bench_addString("format", format);
+    bench_addInt("iterations", (int64_t) b.numBlocks);
+    bench_addInt("medianNs", (int64_t) latencies[b.numBlocks/2]);
+    bench_addInt("p99Ns", (int64_t) latencies[b.numBlocks*99/100]);
+    bench_addInt("maxNs", (int64_t) latencies[b.numBlocks-1]);
+    fprintf(out, "}");
+    free(latencies);
+    hLp_free(&b.pipe);
+  }
+}
+
+/* kernels */
+
+typedef enum {
+  KERNEL_FROM_DECODER,
+  KERNEL_TO_OUTLETS,
+  KERNEL_TO_OUTLETS_RAMP, // with a gain ramp
+  KERNEL_ADD_TO_OUTLETS,
+  NUM_KERNELS
+} t_kernel;
+
+static const char *const kernelNames[NUM_KERNELS] = {
+  "kernel.fromDecoder", "kernel.toOutlets", "kernel.toOutletsRamp", "kernel.addToOutlets"
+};
+
+static void bench_kernels(void) {
+  static const int blockSizes[] = {64, 128, 256, 512, 1024, 2048};
+  const int maxFrames = 2048;
+  int16_t *const frames = (int16_t *) malloc(maxFrames * 2 * sizeof(int16_t));
+  float *const block = (float *) malloc(maxFrames * 2 * sizeof(float));
+  float *const outL = (float *) malloc(maxFrames * sizeof(float));
+  float *const outR = (float *) malloc(maxFrames * sizeof(float));
+  float *const decoded = (float *) malloc(maxFrames * 2 * sizeof(float)); // a block in a pipe
+  for (int j = 0; j < 2*maxFrames; ++j) frames[j] = (int16_t) ((j * 7919) % 65536 - 32768);
+  m4aConvert_fromDecoder(block, true, 2, frames, 2, (uint32_t) maxFrames);
+  memset(outL, 0, maxFrames * sizeof(float));
+  memset(outR, 0, maxFrames * sizeof(float));
+
+  const uint64_t framesPerRun = isQuick ? 2000000 : 50000000;
+  for (int kernel = 0; kernel < NUM_KERNELS; ++kernel) {
+    for (size_t s = 0; s < sizeof(blockSizes)/sizeof(blockSizes[0]); ++s) {
+      for (int isFloat = 0; isFloat < 2; ++isFloat) {
+        for (int numChannels = 1; numChannels <= 2; ++numChannels) {
+          const int n = blockSizes[s];
+          const uint64_t numCalls = framesPerRun / n;
+          const void *const samples = isFloat ? (const void *) block : (const void *) frames;
+          bench_startCounters();
+          const uint64_t start = bench_getNs(CLOCK_MONOTONIC);
+          for (uint64_t i = 0; i < numCalls; ++i) {
+            switch (kernel) {
+              case KERNEL_FROM_DECODER: m4aConvert_fromDecoder(decoded, isFloat, numChannels, frames, 2, (uint32_t) n); break;
+              case KERNEL_TO_OUTLETS: m4aConvert_toOutlets(samples, isFloat, numChannels, outL, outR, n, 1.0f, 0.0f); break;
+              case KERNEL_TO_OUTLETS_RAMP: m4aConvert_toOutlets(samples, isFloat, numChannels, outL, outR, n, 0.5f, 0.0001f); break;
+              default: m4aConvert_addToOutlets(samples, isFloat, numChannels, outL, outR, n, 0.5f, 0.0f); break;
+            }
+            sink += outL[i % n];
+          }
+          const uint64_t ns = bench_getNs(CLOCK_MONOTONIC) - start;
+          bench_stopCounters();
+          bench_beginResult(kernelNames[kernel]);
+          bench_addInt("blockSize", n);
+          bench_addString("format", isFloat ? "float" : "int16");
+          bench_addInt("channels", numChannels);
+          bench_addFloat("nsPerFrame", (double) ns / (numCalls * n));
+          bench_endResult(numCalls, ns);
+        }
+      }
+    }
+  }
+  free(frames);
+  free(block);
+  free(outL);
+  free(outR);
+  free(decoded);
+}
+
+/* players */
+
+// writes a stereo sine to a temporary WAV file which the players open
+static bool bench_writeFile(char *path) {
+  strcpy(path, "/tmp/m4aBenchXXXXXX");
+  const int fd = mkstemp(path);
+  if (fd < 0) return false;
+  FILE *f = fdopen(fd, "wb");
+  const uint32_t numFrames = BENCH_FILE_SECONDS * BENCH_SAMPLE_RATE;
+  const uint32_t header[] = {
+    0x46464952, 36 + 4*numFrames, 0x45564157, 0x20746d66, 16, 0x00020001, BENCH_SAMPLE_RATE,
+    4*BENCH_SAMPLE_RATE, 0x00100004, 0x61746164, 4*numFrames
+  };
+  fwrite(header, sizeof(header), 1, f); // little-endian, like the hosts this runs on
+  for (uint32_t i = 0; i < numFrames; ++i) {
+    const int16_t frame[2] = {(int16_t) (1 + (i % 997) * 16), (int16_t) (-1 - (i % 499) * 32)}; // never silent
+    fwrite(frame, sizeof(frame), 1, f);
+  }
+  return fclose(f) == 0;
+}
+
+static void bench_open(void *player, const char *path) {
+  t_atom a[1];
+  SETSYMBOL(a, gensym(path));
+  pdhost_send(player, "open", 1, a);
+}
+
+// Releases the pooled players, the peaks and the pipes between the benchmarks.
+// m4aPlayer_flushCaches() only requests this from perform, but the host is on
+// the Pd thread here, so the flush message releases them at once.
+static void bench_flush(void) {
+  void *const player = pdhost_new("m4aPlayer", 0, NULL);
+  pdhost_send(player, "flush", 0, NULL);
+  pdhost_free(player);
+}
+
+// Creates, opens and frees players one after the other, as when a patch is
+// rebuilt. Files are opened from the pool after the first.
+static void bench_churn(const char *path) {
+  const char *const phases[] = {"churn.new", "churn.open", "churn.free"};
+  uint64_t ns[3] = {0, 0, 0};
+  numLoaded = 0;
+  bench_startCounters();
+  for (int i = 0; i < BENCH_NUM_CHURN; ++i) {
+    const uint64_t start = bench_getNs(CLOCK_MONOTONIC);
+    void *const player = pdhost_new("m4aPlayer", 0, NULL);
+    const uint64_t opening = bench_getNs(CLOCK_MONOTONIC);
+    bench_open(player, path);
+    const uint64_t freeing = bench_getNs(CLOCK_MONOTONIC);
+    pdhost_free(player);
+    const uint64_t end = bench_getNs(CLOCK_MONOTONIC);
+    ns[0] += opening - start;
+    ns[1] += freeing - opening;
+    ns[2] += end - freeing;
+  }
+  bench_stopCounters();
+  for (int phase = 0; phase < 3; ++phase) {
+    bench_beginResult(phases[phase]);
+    if (phase == 1) bench_addInt("opened", numLoaded);
+    bench_addInt("iterations", BENCH_NUM_CHURN);
+    bench_addFloat("nsPerOp", (double) ns[phase] / BENCH_NUM_CHURN);
+    fprintf(out, "}");
+  }
+  // the counters cover the whole cycle
+  bench_beginResult("churn.cycle");
+  bench_endResult(BENCH_NUM_CHURN, ns[0] + ns[1] + ns[2]);
+  bench_flush();
+}
+
+// Plays the file in a loop on every player, pacing the blocks in real time
+// like an audio callback, and measures the CPU of the process (i.e. with the
+// workers) and of perform. A block in which a started player is silent is an
+// underrun.
+static void bench_streams(const char *path, int numStreams) {
+  static t_sample outs[BENCH_MAX_STREAMS][2][BENCH_BLOCK_SIZE];
+  void *players[BENCH_MAX_STREAMS];
+  numLoaded = 0;
+  numReady = 0;
+  for (int i = 0; i < numStreams; ++i) {
+    players[i] = pdhost_new("m4aPlayer", 0, NULL);
+    t_sample *vecs[2] = {outs[i][0], outs[i][1]};
+    pdhost_dsp(players[i], 2, vecs);
+    t_atom a[1];
+    SETFLOAT(a, 1.0f);
+    pdhost_send(players[i], "loop", 1, a);
+    bench_open(players[i], path);
+  }
+  // wait until every player has buffered its preroll
+  for (int k = 0; numReady < numStreams && k < 10000; ++k) {
+    pdhost_tick();
+    usleep(1000);
+  }
+  for (int i = 0; i < numStreams; ++i) pdhost_send(players[i], "start", 0, NULL);
+
+  const double seconds = isQuick ? 0.5 : 3.0;
+  const uint64_t numTicks = (uint64_t) (seconds * BENCH_SAMPLE_RATE / BENCH_BLOCK_SIZE);
+  const uint64_t blockNs = (1000000000ULL * BENCH_BLOCK_SIZE) / BENCH_SAMPLE_RATE;
+  int64_t numUnderruns = 0;
+  uint64_t performNs = 0;
+#if M4ABENCH_RT_CHECK
+  const int numViolations = m4aRtCheck_getNumViolations();
+  m4aRtCheck_installInPdhost();
+#endif
+  bench_startCounters();
+  const uint64_t start = bench_getNs(CLOCK_MONOTONIC);
+  const uint64_t cpuStart = bench_getNs(CLOCK_PROCESS_CPUTIME_ID);
+  for (uint64_t k = 0; k < numTicks; ++k) {
+    const uint64_t tickStart = bench_getNs(CLOCK_THREAD_CPUTIME_ID);
+    pdhost_tick();
+    performNs += bench_getNs(CLOCK_THREAD_CPUTIME_ID) - tickStart;
+    for (int i = 0; i < numStreams; ++i) {
+      bool isSilent = true;
+      for (int j = 0; j < BENCH_BLOCK_SIZE && isSilent; ++j) isSilent = (outs[i][0][j] == 0.0f);
+      if (k > 0 && isSilent) ++numUnderruns;
+    }
+    const uint64_t deadline = start + (k+1) * blockNs;
+    struct timespec t = {(time_t) (deadline / 1000000000ULL), (long) (deadline % 1000000000ULL)};
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL);
+  }
+  const uint64_t cpuNs = bench_getNs(CLOCK_PROCESS_CPUTIME_ID) - cpuStart;
+  const uint64_t ns = bench_getNs(CLOCK_MONOTONIC) - start;
+  bench_stopCounters();
+#if M4ABENCH_RT_CHECK
+  pdhost_setDspHook(NULL);
+#endif
+
+  bench_beginResult("stream");
+  bench_addInt("streams", numStreams);
+  bench_addInt("ready", numReady);
+  bench_addFloat("cpuPercentPerStream", (100.0 * cpuNs) / ((double) ns * numStreams));
+  bench_addFloat("performNsPerStreamBlock", (double) performNs / ((double) numTicks * numStreams));
+  bench_addInt("underruns", numUnderruns);
+#if M4ABENCH_RT_CHECK
+  bench_addInt("rtViolations", m4aRtCheck_getNumViolations() - numViolations);
+#endif
+  bench_endResult(numTicks, ns);
+
+  pdhost_dspStop();
+  for (int i = 0; i < numStreams; ++i) pdhost_free(players[i]);
+  bench_flush();
+}
+
+// Plays a file on several players in real time and cuts it short on disk, so
+// that each worker reports that its asset ended early. Measures how long the
+// errors wait in the players' event pipes until the event clock sends them.
+static void bench_events(void) {
+  static t_sample outs[BENCH_NUM_EVENT_PLAYERS][2][BENCH_BLOCK_SIZE];
+  void *players[BENCH_NUM_EVENT_PLAYERS];
+  char path[64];
+  if (!bench_writeFile(path)) return;
+  numReady = 0;
+  numErrors = 0;
+  for (int i = 0; i < BENCH_NUM_EVENT_PLAYERS; ++i) {
+    players[i] = pdhost_new("m4aPlayer", 0, NULL);
+    t_sample *vecs[2] = {outs[i][0], outs[i][1]};
+    pdhost_dsp(players[i], 2, vecs);
+    bench_open(players[i], path);
+  }
+  for (int k = 0; numReady < BENCH_NUM_EVENT_PLAYERS && k < 10000; ++k) {
+    pdhost_tick();
+    usleep(1000);
+  }
+  for (int i = 0; i < BENCH_NUM_EVENT_PLAYERS; ++i) pdhost_send(players[i], "start", 0, NULL);
+
+  // keep the header and half a second of frames
+  if (truncate(path, 44 + 2 * BENCH_SAMPLE_RATE) != 0) fprintf(stderr, "Could not cut %s short.\n", path);
+  m4aPlayer_takeMaxEventLatency();
+  const uint64_t numTicks = (uint64_t) (2 * BENCH_SAMPLE_RATE / BENCH_BLOCK_SIZE);
+  const uint64_t blockNs = (1000000000ULL * BENCH_BLOCK_SIZE) / BENCH_SAMPLE_RATE;
+  const uint64_t start = bench_getNs(CLOCK_MONOTONIC);
+  for (uint64_t k = 0; k < numTicks && numErrors < BENCH_NUM_EVENT_PLAYERS; ++k) {
+    pdhost_tick();
+    const uint64_t deadline = start + (k+1) * blockNs;
+    struct timespec t = {(time_t) (deadline / 1000000000ULL), (long) (deadline % 1000000000ULL)};
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL);
+  }
+
+  bench_beginResult("events");
+  bench_addInt("players", BENCH_NUM_EVENT_PLAYERS);
+  bench_addInt("errors", numErrors);
+  bench_addFloat("maxLatencyMs", m4aPlayer_takeMaxEventLatency());
+  bench_addFloat("blockMs", (1000.0 * BENCH_BLOCK_SIZE) / BENCH_SAMPLE_RATE);
+  fprintf(out, "}");
+
+  pdhost_dspStop();
+  for (int i = 0; i < BENCH_NUM_EVENT_PLAYERS; ++i) pdhost_free(players[i]);
+  bench_flush();
+  unlink(path);
+}
+
+int main(int argc, char **argv) {
+  bool shouldCount = false;
+  const char *outPath = NULL;
+  int opt;
+  while ((opt = getopt(argc, argv, "qpo:")) != -1) {
+    if (opt == 'q') isQuick = true;
+    else if (opt == 'p') shouldCount = true;
+    else if (opt == 'o') outPath = optarg;
+    else {
+      fprintf(stderr, "Usage: m4aBench [-q] [-p] [-o results.json]\n");
+      return 1;
+    }
+  }
+  out = (outPath != NULL) ? fopen(outPath, "w") : stdout;
+  if (out == NULL) {
+    fprintf(stderr, "Could not write %s.\n", outPath);
+    return 1;
+  }
+  const bool hasCounters = shouldCount && bench_openCounters();
+  if (shouldCount && !hasCounters) fprintf(stderr, "Hardware counters are not available, see perf_event_paranoid.\n");
+
+  char path[64];
+  if (!bench_writeFile(path)) {
+    fprintf(stderr, "Could not write the test file.\n");
+    return 1;
+  }
+  pdhost_init(BENCH_SAMPLE_RATE, BENCH_BLOCK_SIZE, &bench_outletHook);
+  m4aPlayer_setup();
+
+  fprintf(out, "{\n  \"benchmark\": \"m4aBench\",\n  \"version\": 1,\n  \"quick\": %s,\n  \"counters\": %s,\n"
+      "  \"sampleRate\": %d,\n  \"blockSize\": %d,\n  \"cores\": %ld,\n  \"results\": [",
+      isQuick ? "true" : "false", hasCounters ? "true" : "false",
+      BENCH_SAMPLE_RATE, BENCH_BLOCK_SIZE, sysconf(_SC_NPROCESSORS_ONLN));
+  bench_pipes();
+  bench_kernels();
+  bench_churn(path);
+  static const int numStreams[] = {1, 8, 32, 128};
+  for (size_t i = 0; i < sizeof(numStreams)/sizeof(numStreams[0]); ++i) bench_streams(path, numStreams[i]);
+  bench_events();
+  fprintf(out, "\n  ]\n}\n");
+
+  unlink(path);
+  if (out != stdout) fclose(out);
+  return 0;
+}
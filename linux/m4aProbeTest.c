@@ -0,0 +1,679 @@
+/**
+ * Copyright (c) 2016 Enzien Audio Ltd.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+// Checks m4aProbe against MP4 files which are crafted box by box: the sample
+// entries of stsd versions 0, 1 and 2, esds boxes with every optional field and
+// AudioSpecificConfig variant, edit lists of both versions, iTunSMPB items in
+// ISO and QuickTime meta boxes, and 64-bit and open ended box sizes. The
+// lengths and gapless values which are read are compared with the expected
+// ones. Every file is then probed again cut short at every byte, and with each
+// leaf box cut short at every byte, which must neither crash nor read past the
+// boxes (build with -fsanitize=address to check the latter).
+//
+// Usage: m4aProbeTest
+// Exits with 1 if any check fails, after reporting each failure.
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "m4aProbe.h"
+
+#define PROBETEST_MAX_BYTES 4096
+#define PROBETEST_MAX_DEPTH 12
+
+/* building files */
+
+typedef struct _buffer {
+  uint8_t b[PROBETEST_MAX_BYTES];
+  size_t n;
+  size_t boxes[PROBETEST_MAX_DEPTH]; // the starts of the boxes which are open
+  int depth;
+  const char *cutType; // the leaf box whose payload is cut short, or NULL
+  size_t cutBytes;
+  uint32_t bits; // of the byte which is being written bit by bit
+  int numBits;
+} t_buffer;
+
+static void put8(t_buffer *f, uint32_t v) { if (f->n < PROBETEST_MAX_BYTES) f->b[f->n++] = (uint8_t) v; }
+static void put16(t_buffer *f, uint32_t v) { put8(f, v >> 8); put8(f, v); }
+static void put32(t_buffer *f, uint32_t v) { put16(f, v >> 16); put16(f, v); }
+static void put64(t_buffer *f, uint64_t v) { put32(f, (uint32_t) (v >> 32)); put32(f, (uint32_t) v); }
+static void putZeros(t_buffer *f, int n) { for (int i = 0; i < n; ++i) put8(f, 0); }
+static void putText(t_buffer *f, const char *s) { while (*s != '\0') put8(f, (uint8_t) *s++); }
+
+// writes the most significant n bits of v, for an AudioSpecificConfig
+static void putBits(t_buffer *f, uint32_t v, int n) {
+  for (int i = n-1; i >= 0; --i) {
+    f->bits = (f->bits << 1) | ((v >> i) & 1);
+    if (++f->numBits == 8) {
+      put8(f, f->bits);
+      f->bits = 0;
+      f->numBits = 0;
+    }
+  }
+}
+
+// pads the bits which have been written to a whole byte
+static void flushBits(t_buffer *f) {
+  if (f->numBits > 0) putBits(f, 0, 8 - f->numBits);
+}
+
+static void beginBox(t_buffer *f, const char *type) {
+  f->boxes[f->depth++] = f->n;
+  put32(f, 0);
+  putText(f, type);
+}
+
+// writes the size of the box, after cutting its payload short if it is the one to cut
+static void endBox(t_buffer *f) {
+  const size_t start = f->boxes[--f->depth];
+  if (f->cutType != NULL && memcmp(f->b + start + 4, f->cutType, 4) == 0 && f->n > start + 8 + f->cutBytes) {
+    f->n = start + 8 + f->cutBytes;
+  }
+  const uint32_t size = (uint32_t) (f->n - start);
+  f->b[start] = (uint8_t) (size >> 24);
+  f->b[start+1] = (uint8_t) (size >> 16);
+  f->b[start+2] = (uint8_t) (size >> 8);
+  f->b[start+3] = (uint8_t) size;
+}
+
+// a descriptor of an esds box, with its length in the given number of bytes
+static void putDescriptor(t_buffer *f, uint32_t tag, uint32_t length, int numLengthBytes) {
+  put8(f, tag);
+  for (int i = numLengthBytes-1; i >= 0; --i) put8(f, ((length >> (7*i)) & 0x7F) | ((i > 0) ? 0x80 : 0));
+}
+
+/* the files */
+
+// An AudioSpecificConfig. Rate indexes of 15 are followed by the explicit rate.
+typedef struct _asc {
+  uint32_t objectType; // 31 and up are written with the escape
+  uint32_t rateIndex;
+  uint32_t rate;
+  uint32_t channelConfig;
+  uint32_t extRateIndex; // SBR and PS (object types 5 and 29)
+  uint32_t extRate;
+  int numBytes; // cuts the config short, 0 for all of it
+} t_asc;
+
+typedef struct _spec {
+  const char *name;
+
+  // the file
+  int stsdVersion;       // of the QuickTime sound description
+  uint32_t entryRate;    // of the sample entry
+  int entryChannels;
+  bool isInWave;         // the esds is wrapped in a wave box
+  bool hasEsds;
+  bool hasBadChild;      // a child box with a size of 0 comes before the esds
+  uint8_t esTag;         // of the ES_Descriptor, normally 3
+  uint8_t esFlags;       // of the ES_Descriptor: 0x80 dependsOn, 0x40 URL, 0x20 OCR
+  int numLengthBytes;    // of each descriptor length, 1 to 4, or 5 for one which is too long
+  uint8_t decoderTag;    // of the DecoderConfigDescriptor, normally 4
+  uint8_t specificTag;   // of the DecoderSpecificInfo, normally 5
+  uint32_t maxBitrate;
+  uint32_t avgBitrate;
+  t_asc asc;
+  int mvhdVersion;
+  uint32_t movieTimescale;
+  int mdhdVersion;
+  uint32_t timescale;
+  uint64_t duration;     // in the timescale
+  int elstVersion;       // -1 for no edit list
+  int numEdits;          // the first edit is empty
+  int64_t mediaTime;
+  uint64_t editDuration; // in the movie timescale
+  const char *smpb;      // the text of an iTunSMPB item, or NULL
+  const char *itemName;  // of the item, normally iTunSMPB
+  bool isIsoMeta;        // the meta box has a version and flags
+  bool hasVideoFirst;    // a video trak comes before the audio trak
+  bool isLargeMdat;      // the mdat has a 64-bit size
+  bool isOpenMdat;       // the mdat has a size of 0, i.e. extends to the end of the file
+  uint32_t numMediaBytes;
+
+  // the expected values
+  const char *codec;
+  uint32_t sampleRate;
+  int numChannels;
+  uint64_t numFrames;
+  bool hasGapless;
+  uint32_t encoderDelay;
+  uint32_t numPaddingFrames;
+  uint32_t expectedMaxBitrate;
+  uint32_t expectedAvgBitrate; // 0 to skip the check, for estimated bitrates
+  bool isVbr;
+} t_spec;
+
+static void probetest_putAsc(t_buffer *f, const t_asc *a) {
+  t_buffer config;
+  memset(&config, 0, sizeof(config));
+  if (a->objectType >= 32) {
+    putBits(&config, 31, 5);
+    putBits(&config, a->objectType - 32, 6);
+  } else {
+    putBits(&config, a->objectType, 5);
+  }
+  putBits(&config, a->rateIndex, 4);
+  if (a->rateIndex == 15) putBits(&config, a->rate, 24);
+  putBits(&config, a->channelConfig, 4);
+  if (a->objectType == 5 || a->objectType == 29) {
+    putBits(&config, a->extRateIndex, 4);
+    if (a->extRateIndex == 15) putBits(&config, a->extRate, 24);
+    putBits(&config, 2, 5); // the object type of the core
+  }
+  putBits(&config, 0, 3); // GASpecificConfig
+  flushBits(&config);
+  const size_t n = (a->numBytes > 0 && (size_t) a->numBytes < config.n) ? (size_t) a->numBytes : config.n;
+  for (size_t i = 0; i < n; ++i) put8(f, config.b[i]);
+}
+
+static void probetest_putEsds(t_buffer *f, const t_spec *s) {
+  t_buffer asc;
+  memset(&asc, 0, sizeof(asc));
+  probetest_putAsc(&asc, &s->asc);
+  const uint32_t specificLength = (uint32_t) asc.n;
+  const uint32_t decoderLength = 13 + 1 + s->numLengthBytes + specificLength;
+  const uint32_t optionalLength = ((s->esFlags & 0x80) ? 2 : 0) + ((s->esFlags & 0x40) ? 4 : 0) + ((s->esFlags & 0x20) ? 2 : 0);
+  const uint32_t esLength = 3 + optionalLength + 1 + s->numLengthBytes + decoderLength;
+
+  beginBox(f, "esds");
+  put32(f, 0); // version and flags
+  putDescriptor(f, s->esTag, esLength, s->numLengthBytes);
+  put16(f, 1); // ES_ID
+  put8(f, s->esFlags);
+  if (s->esFlags & 0x80) put16(f, 2);
+  if (s->esFlags & 0x40) { put8(f, 3); putText(f, "abc"); }
+  if (s->esFlags & 0x20) put16(f, 3);
+  putDescriptor(f, s->decoderTag, decoderLength, s->numLengthBytes);
+  put8(f, 0x40); // MPEG-4 audio
+  put8(f, 0x15); // audio stream
+  put8(f, 0); put16(f, 0); // buffer size
+  put32(f, s->maxBitrate);
+  put32(f, s->avgBitrate);
+  putDescriptor(f, s->specificTag, specificLength, s->numLengthBytes);
+  for (size_t i = 0; i < asc.n; ++i) put8(f, asc.b[i]);
+  endBox(f);
+}
+
+static void probetest_putStsd(t_buffer *f, const t_spec *s) {
+  beginBox(f, "stsd");
+  put32(f, 0); // version and flags
+  put32(f, 1); // one entry
+  beginBox(f, "mp4a");
+  putZeros(f, 6);
+  put16(f, 1); // data reference index
+  put16(f, (uint32_t) s->stsdVersion);
+  put16(f, 0); // revision
+  put32(f, 0); // vendor
+  put16(f, (s->stsdVersion == 2) ? 3 : (uint32_t) s->entryChannels);
+  put16(f, 16); // sample size
+  put16(f, (s->stsdVersion == 2) ? 0xFFFE : 0); // compression id
+  put16(f, 0); // packet size
+  put32(f, (s->stsdVersion == 2) ? 0x00010000 : s->entryRate << 16);
+  if (s->stsdVersion == 1) {
+    put32(f, 1024); // samples per packet
+    putZeros(f, 12);
+  } else if (s->stsdVersion == 2) {
+    put32(f, 72); // size of the struct
+    double rate = (double) s->entryRate;
+    uint64_t rateBits = 0;
+    memcpy(&rateBits, &rate, sizeof(rateBits));
+    put64(f, rateBits);
+    put32(f, (uint32_t) s->entryChannels);
+    put32(f, 0x7F000000);
+    putZeros(f, 16);
+  }
+  if (s->hasBadChild) put32(f, 0);
+  if (s->hasEsds) {
+    if (s->isInWave) {
+      beginBox(f, "wave");
+      beginBox(f, "frma");
+      putText(f, "mp4a");
+      endBox(f);
+      probetest_putEsds(f, s);
+      endBox(f);
+    } else {
+      probetest_putEsds(f, s);
+    }
+  }
+  endBox(f);
+  endBox(f);
+}
+
+static void probetest_putTrak(t_buffer *f, const t_spec *s, bool isVideo) {
+  beginBox(f, "trak");
+  beginBox(f, "tkhd");
+  putZeros(f, 84);
+  endBox(f);
+  if (!isVideo && s->elstVersion >= 0) {
+    beginBox(f, "edts");
+    beginBox(f, "elst");
+    put8(f, (uint32_t) s->elstVersion);
+    putZeros(f, 3);
+    put32(f, (uint32_t) s->numEdits);
+    for (int i = 0; i < s->numEdits; ++i) {
+      // an empty edit first, then the one with the media
+      const int64_t mediaTime = (i == 0 && s->numEdits > 1) ? -1 : s->mediaTime;
+      const uint64_t duration = (i == 0 && s->numEdits > 1) ? 100 : s->editDuration;
+      if (s->elstVersion == 1) {
+        put64(f, duration);
+        put64(f, (uint64_t) mediaTime);
+      } else {
+        put32(f, (uint32_t) duration);
+        put32(f, (uint32_t) mediaTime);
+      }
+      put32(f, 0x00010000); // media rate
+    }
+    endBox(f);
+    endBox(f);
+  }
+  beginBox(f, "mdia");
+  beginBox(f, "mdhd");
+  put8(f, (uint32_t) s->mdhdVersion);
+  putZeros(f, 3);
+  if (s->mdhdVersion == 1) {
+    put64(f, 0);
+    put64(f, 0);
+    put32(f, s->timescale);
+    put64(f, s->duration);
+  } else {
+    put32(f, 0);
+    put32(f, 0);
+    put32(f, s->timescale);
+    put32(f, (uint32_t) s->duration);
+  }
+  put32(f, 0); // language and pre-defined
+  endBox(f);
+  beginBox(f, "hdlr");
+  put32(f, 0);
+  put32(f, 0);
+  putText(f, isVideo ? "vide" : "soun");
+  putZeros(f, 13);
+  endBox(f);
+  beginBox(f, "minf");
+  beginBox(f, "stbl");
+  if (isVideo) {
+    beginBox(f, "stsd");
+    put32(f, 0);
+    put32(f, 0);
+    endBox(f);
+  } else {
+    probetest_putStsd(f, s);
+  }
+  beginBox(f, "stts");
+  putZeros(f, 8);
+  endBox(f);
+  endBox(f);
+  endBox(f);
+  endBox(f);
+  endBox(f);
+}
+
+static void probetest_putMeta(t_buffer *f, const t_spec *s) {
+  beginBox(f, "udta");
+  beginBox(f, "meta");
+  if (s->isIsoMeta) put32(f, 0);
+  beginBox(f, "hdlr");
+  put32(f, 0);
+  put32(f, 0);
+  putText(f, "mdir");
+  putText(f, "appl");
+  putZeros(f, 9);
+  endBox(f);
+  beginBox(f, "ilst");
+  beginBox(f, "----");
+  beginBox(f, "mean");
+  put32(f, 0);
+  putText(f, "com.apple.iTunes");
+  endBox(f);
+  beginBox(f, "name");
+  put32(f, 0);
+  putText(f, (s->itemName != NULL) ? s->itemName : "iTunSMPB");
+  endBox(f);
+  beginBox(f, "data");
+  put32(f, 1); // text
+  put32(f, 0); // locale
+  putText(f, s->smpb);
+  endBox(f);
+  endBox(f);
+  endBox(f);
+  endBox(f);
+  endBox(f);
+}
+
+static void probetest_build(t_buffer *f, const t_spec *s, const char *cutType, size_t cutBytes) {
+  memset(f, 0, sizeof(t_buffer));
+  f->cutType = cutType;
+  f->cutBytes = cutBytes;
+  beginBox(f, "ftyp");
+  putText(f, "M4A ");
+  put32(f, 0);
+  endBox(f);
+  beginBox(f, "moov");
+  beginBox(f, "mvhd");
+  put8(f, (uint32_t) s->mvhdVersion);
+  putZeros(f, 3);
+  if (s->mvhdVersion == 1) {
+    put64(f, 0);
+    put64(f, 0);
+    put32(f, s->movieTimescale);
+    put64(f, 0);
+    putZeros(f, 80);
+  } else {
+    put32(f, 0);
+    put32(f, 0);
+    put32(f, s->movieTimescale);
+    put32(f, 0);
+    putZeros(f, 80);
+  }
+  endBox(f);
+  if (s->hasVideoFirst) probetest_putTrak(f, s, true);
+  probetest_putTrak(f, s, false);
+  if (s->smpb != NULL) probetest_putMeta(f, s);
+  endBox(f);
+  if (s->isLargeMdat) {
+    put32(f, 1);
+    putText(f, "mdat");
+    put64(f, 16 + s->numMediaBytes);
+  } else {
+    put32(f, s->isOpenMdat ? 0 : 8 + s->numMediaBytes);
+    putText(f, "mdat");
+  }
+  putZeros(f, (int) s->numMediaBytes);
+}
+
+/* the checks */
+
+static int numFailures = 0;
+
+static void probetest_fail(const char *name, const char *field, unsigned long long expected, unsigned long long actual) {
+  printf("  FAIL %s: %s is %llu, expected %llu\n", name, field, actual, expected);
+  ++numFailures;
+}
+
+#define PROBETEST_CHECK(name, field, expected, actual) \
+  if ((unsigned long long) (expected) != (unsigned long long) (actual)) probetest_fail(name, field, expected, actual)
+
+// probes the bytes, embedded in a larger file at an offset
+static bool probetest_probe(const uint8_t *b, size_t n, m4aProbeInfo *info) {
+  static const uint8_t junk[37] = {0};
+  char path[] = "/tmp/m4aProbeTestXXXXXX";
+  const int fd = mkstemp(path);
+  if (fd < 0) {
+    fprintf(stderr, "Could not write a test file.\n");
+    exit(1);
+  }
+  unlink(path);
+  if (write(fd, junk, sizeof(junk)) != (ssize_t) sizeof(junk) || write(fd, b, n) != (ssize_t) n ||
+      write(fd, junk, sizeof(junk)) != (ssize_t) sizeof(junk)) {
+    fprintf(stderr, "Could not write a test file.\n");
+    exit(1);
+  }
+  const bool isValid = m4aProbe_readFd(fd, sizeof(junk), (int64_t) n, info);
+  close(fd);
+  return isValid;
+}
+
+static void probetest_check(const t_spec *s) {
+  t_buffer f;
+  probetest_build(&f, s, NULL, 0);
+  m4aProbeInfo info;
+  if (!probetest_probe(f.b, f.n, &info)) {
+    printf("  FAIL %s: could not be probed\n", s->name);
+    ++numFailures;
+    return;
+  }
+  if (strcmp(info.codec, s->codec) != 0) {
+    printf("  FAIL %s: codec is %s, expected %s\n", s->name, info.codec, s->codec);
+    ++numFailures;
+  }
+  PROBETEST_CHECK(s->name, "sampleRate", s->sampleRate, info.sampleRate);
+  PROBETEST_CHECK(s->name, "numChannels", s->numChannels, info.numChannels);
+  PROBETEST_CHECK(s->name, "numFrames", s->numFrames, info.numFrames);
+  PROBETEST_CHECK(s->name, "hasGapless", s->hasGapless, info.hasGapless);
+  PROBETEST_CHECK(s->name, "encoderDelay", s->encoderDelay, info.encoderDelay);
+  PROBETEST_CHECK(s->name, "numPaddingFrames", s->numPaddingFrames, info.numPaddingFrames);
+  PROBETEST_CHECK(s->name, "maxBitrate", s->expectedMaxBitrate, info.maxBitrate);
+  if (s->expectedAvgBitrate > 0) PROBETEST_CHECK(s->name, "avgBitrate", s->expectedAvgBitrate, info.avgBitrate);
+  PROBETEST_CHECK(s->name, "isVbr", s->isVbr, info.isVbr);
+  const double durationMs = (s->sampleRate > 0) ? (s->numFrames * 1000.0) / s->sampleRate : 0.0;
+  if (m4aProbe_getDurationMs(&info) != durationMs) {
+    printf("  FAIL %s: duration is %gms, expected %gms\n", s->name, m4aProbe_getDurationMs(&info), durationMs);
+    ++numFailures;
+  }
+}
+
+// Probes the file cut short at every byte, and with each leaf box cut short at
+// every byte. Nothing is expected of the values, only that the probe returns.
+static int probetest_truncate(const t_spec *s) {
+  static const char *const leaves[] = {"mvhd", "mdhd", "hdlr", "elst", "stsd", "mp4a", "wave", "esds", "----", "name", "data"};
+  int numProbes = 0;
+  t_buffer f;
+  probetest_build(&f, s, NULL, 0);
+  m4aProbeInfo info;
+  for (size_t n = 0; n < f.n; ++n, ++numProbes) probetest_probe(f.b, n, &info);
+  for (size_t i = 0; i < sizeof(leaves)/sizeof(leaves[0]); ++i) {
+    for (size_t k = 0; k < 256; ++k, ++numProbes) {
+      t_buffer g;
+      probetest_build(&g, s, leaves[i], k);
+      probetest_probe(g.b, g.n, &info);
+      if (g.n == f.n) break; // the box is not cut any more
+    }
+  }
+  return numProbes;
+}
+
+// the base of the specs: AAC-LC at 44.1kHz in stereo, without gapless values
+static const t_spec lcSpec = {
+  .stsdVersion = 0, .entryRate = 44100, .entryChannels = 2, .hasEsds = true, .esTag = 0x03, .numLengthBytes = 1,
+  .decoderTag = 0x04, .specificTag = 0x05, .maxBitrate = 160000, .avgBitrate = 128000,
+  .asc = {2, 4, 0, 2, 0, 0, 0}, .movieTimescale = 600, .timescale = 44100, .duration = 441000,
+  .elstVersion = -1, .numMediaBytes = 100, .codec = "mp4a", .sampleRate = 44100, .numChannels = 2,
+  .numFrames = 441000, .expectedMaxBitrate = 160000, .expectedAvgBitrate = 128000, .isVbr = true
+};
+
+#define PROBETEST_SMPB " 00000000 00000840 000001CA 00000000000A0B76 00000000 00000000 00000000"
+#define PROBETEST_MAX_SPECS 64
+
+static t_spec specs[PROBETEST_MAX_SPECS];
+static int numSpecs = 0;
+
+// adds a spec which starts out as the base, for the caller to change
+static t_spec *probetest_addSpec(const char *name) {
+  assert(numSpecs < PROBETEST_MAX_SPECS);
+  t_spec *const s = specs + numSpecs++;
+  *s = lcSpec;
+  s->name = name;
+  return s;
+}
+
+// Each spec only sets the fields in which it differs from the base, after it
+// has been copied, so that no field is initialized twice.
+static void probetest_addSpecs() {
+  t_spec *s = NULL;
+  s = probetest_addSpec("lc");
+  s = probetest_addSpec("cbr");
+  s->maxBitrate = 128000; s->expectedMaxBitrate = 128000; s->isVbr = false;
+  s = probetest_addSpec("es-optional-fields");
+  s->esFlags = 0xE0;
+  s = probetest_addSpec("long-descriptor-lengths");
+  s->numLengthBytes = 4;
+  s = probetest_addSpec("overlong-descriptor-lengths");
+  s->numLengthBytes = 5; s->expectedMaxBitrate = 0; s->expectedAvgBitrate = 0;
+  s = probetest_addSpec("he-aac-v2-stereo-core");
+  s->asc = (t_asc) {29, 6, 0, 2, 3, 0, 0}; s->entryRate = 24000; s->timescale = 48000; s->duration = 480000;
+  s->sampleRate = 48000; s->numFrames = 480000;
+  s = probetest_addSpec("wrong-es-tag");
+  s->esTag = 0x07; s->entryRate = 22050; s->entryChannels = 1; s->sampleRate = 22050; s->numChannels = 1;
+  s->numFrames = 220500; s->expectedMaxBitrate = 0; s->expectedAvgBitrate = 0; s->isVbr = true;
+  s = probetest_addSpec("object-type-escape");
+  s->asc = (t_asc) {39, 3, 0, 1, 0, 0, 0}; s->entryRate = 48000; s->timescale = 48000; s->duration = 480000;
+  s->sampleRate = 48000; s->numChannels = 1; s->numFrames = 480000;
+  s = probetest_addSpec("escape-past-config");
+  s->asc = (t_asc) {39, 3, 0, 0, 0, 0, 2}; s->entryChannels = 2; s->sampleRate = 48000; s->numFrames = 480000;
+  s = probetest_addSpec("explicit-rate");
+  s->asc = (t_asc) {2, 15, 37800, 1, 0, 0, 0}; s->timescale = 37800; s->duration = 378000;
+  s->sampleRate = 37800; s->numChannels = 1; s->numFrames = 378000;
+  s = probetest_addSpec("invalid-rate-index");
+  s->asc = (t_asc) {2, 13, 0, 0, 0, 0, 0}; s->entryRate = 32000; s->timescale = 32000; s->duration = 320000;
+  s->sampleRate = 32000; s->numFrames = 320000;
+  s = probetest_addSpec("eight-channels");
+  s->asc = (t_asc) {2, 4, 0, 7, 0, 0, 0}; s->numChannels = 8;
+  s = probetest_addSpec("six-channels");
+  s->asc = (t_asc) {2, 4, 0, 6, 0, 0, 0}; s->numChannels = 6;
+  s = probetest_addSpec("short-config");
+  s->asc = (t_asc) {2, 3, 0, 1, 0, 0, 1};
+  s = probetest_addSpec("he-aac");
+  s->asc = (t_asc) {5, 6, 0, 2, 3, 0, 0}; s->entryRate = 24000; s->timescale = 48000; s->duration = 480000;
+  s->sampleRate = 48000; s->numFrames = 480000;
+  s = probetest_addSpec("he-aac-explicit-rate");
+  s->asc = (t_asc) {5, 8, 0, 2, 15, 32000, 0}; s->entryRate = 16000; s->timescale = 32000;
+  s->duration = 320000; s->sampleRate = 32000; s->numFrames = 320000;
+  s = probetest_addSpec("he-aac-invalid-rate");
+  s->asc = (t_asc) {5, 6, 0, 2, 14, 0, 0}; s->entryRate = 24000; s->timescale = 24000; s->duration = 240000;
+  s->sampleRate = 24000; s->numFrames = 240000;
+  s = probetest_addSpec("he-aac-v2");
+  s->asc = (t_asc) {29, 6, 0, 1, 3, 0, 0}; s->entryRate = 24000; s->entryChannels = 1; s->timescale = 48000;
+  s->duration = 480000; s->sampleRate = 48000; s->numChannels = 2; s->numFrames = 480000;
+  s = probetest_addSpec("wrong-decoder-tag");
+  s->decoderTag = 0x06; s->entryRate = 22050; s->entryChannels = 1; s->sampleRate = 22050; s->numChannels = 1;
+  s->numFrames = 220500; s->expectedMaxBitrate = 0; s->expectedAvgBitrate = 0; s->isVbr = true;
+  s = probetest_addSpec("wrong-specific-tag");
+  s->specificTag = 0x06; s->entryRate = 22050; s->entryChannels = 1; s->sampleRate = 22050; s->numChannels = 1;
+  s->numFrames = 220500;
+  s = probetest_addSpec("bad-child-size");
+  s->hasBadChild = true; s->entryRate = 22050; s->entryChannels = 1; s->sampleRate = 22050; s->numChannels = 1;
+  s->numFrames = 220500; s->expectedMaxBitrate = 0; s->expectedAvgBitrate = 0;
+  s = probetest_addSpec("no-esds");
+  s->hasEsds = false; s->expectedMaxBitrate = 0; s->expectedAvgBitrate = 0;
+  s = probetest_addSpec("stsd-v1");
+  s->stsdVersion = 1;
+  s = probetest_addSpec("stsd-v1-wave");
+  s->stsdVersion = 1; s->isInWave = true;
+  s = probetest_addSpec("stsd-v2");
+  s->stsdVersion = 2; s->entryRate = 96000; s->entryChannels = 1; s->asc = (t_asc) {2, 0, 0, 0, 0, 0, 0};
+  s->timescale = 96000; s->duration = 960000; s->sampleRate = 96000; s->numChannels = 1; s->numFrames = 960000;
+  s = probetest_addSpec("stsd-v2-no-esds");
+  s->stsdVersion = 2; s->hasEsds = false; s->entryRate = 88200; s->entryChannels = 6; s->timescale = 88200;
+  s->duration = 882000; s->sampleRate = 88200; s->numChannels = 6; s->numFrames = 882000;
+  s->expectedMaxBitrate = 0; s->expectedAvgBitrate = 0;
+  s = probetest_addSpec("mdhd-v1");
+  s->mdhdVersion = 1; s->duration = 0x100000000ULL; s->numFrames = 0x100000000ULL;
+  s = probetest_addSpec("video-first");
+  s->hasVideoFirst = true;
+  s = probetest_addSpec("large-mdat");
+  s->isLargeMdat = true;
+  s = probetest_addSpec("open-mdat");
+  s->isOpenMdat = true;
+  s = probetest_addSpec("estimated-bitrate");
+  s->avgBitrate = 0; s->numMediaBytes = 1000; s->expectedAvgBitrate = 800; s->isVbr = true;
+  s = probetest_addSpec("elst-v0");
+  s->elstVersion = 0; s->numEdits = 1; s->mediaTime = 2112; s->editDuration = 5940; s->numFrames = 436590;
+  s->hasGapless = true; s->encoderDelay = 2112; s->numPaddingFrames = 441000 - 2112 - 436590;
+  s = probetest_addSpec("elst-v1-empty-first");
+  s->elstVersion = 1; s->numEdits = 2; s->mediaTime = 1024; s->editDuration = 5940; s->mvhdVersion = 1;
+  s->numFrames = 436590; s->hasGapless = true; s->encoderDelay = 1024;
+  s->numPaddingFrames = 441000 - 1024 - 436590;
+  s = probetest_addSpec("elst-past-end");
+  s->elstVersion = 0; s->numEdits = 1; s->mediaTime = 2112; s->editDuration = 5994;
+  s->numFrames = 441000 - 2112; s->hasGapless = true; s->encoderDelay = 2112;
+  s = probetest_addSpec("elst-whole-media");
+  s->elstVersion = 0; s->numEdits = 1; s->mediaTime = 2112; s->editDuration = 0; s->numFrames = 441000 - 2112;
+  s->hasGapless = true; s->encoderDelay = 2112;
+  s = probetest_addSpec("elst-past-media");
+  s->elstVersion = 0; s->numEdits = 1; s->mediaTime = 500000; s->editDuration = 6000; s->numFrames = 441000;
+  s->hasGapless = true;
+  s = probetest_addSpec("elst-only-empty");
+  s->elstVersion = 0; s->numEdits = 1; s->mediaTime = -1; s->editDuration = 6000;
+  s = probetest_addSpec("elst-no-movie-timescale");
+  s->elstVersion = 0; s->numEdits = 1; s->mediaTime = 2112; s->editDuration = 5994; s->movieTimescale = 0;
+  s = probetest_addSpec("smpb-iso-meta");
+  s->smpb = PROBETEST_SMPB; s->isIsoMeta = true; s->numFrames = 0xA0B76; s->hasGapless = true;
+  s->encoderDelay = 0x840; s->numPaddingFrames = 0x1CA;
+  s = probetest_addSpec("smpb-quicktime-meta");
+  s->smpb = PROBETEST_SMPB; s->numFrames = 0xA0B76; s->hasGapless = true; s->encoderDelay = 0x840;
+  s->numPaddingFrames = 0x1CA;
+  s = probetest_addSpec("smpb-over-elst");
+  s->smpb = PROBETEST_SMPB; s->elstVersion = 0; s->numEdits = 1; s->mediaTime = 2112; s->editDuration = 5994;
+  s->numFrames = 0xA0B76; s->hasGapless = true; s->encoderDelay = 0x840; s->numPaddingFrames = 0x1CA;
+  s = probetest_addSpec("smpb-long");
+  s->smpb = PROBETEST_SMPB PROBETEST_SMPB PROBETEST_SMPB; s->numFrames = 0xA0B76; s->hasGapless = true;
+  s->encoderDelay = 0x840; s->numPaddingFrames = 0x1CA;
+  s = probetest_addSpec("smpb-unparsable");
+  s->smpb = " 00000000 zz";
+  s = probetest_addSpec("smpb-empty");
+  s->smpb = "";
+  s = probetest_addSpec("other-item");
+  s->smpb = PROBETEST_SMPB; s->itemName = "iTunNORM";
+}
+
+// a 16-bit PCM WAV file, which the stand-in decoder plays
+static void probetest_checkWav() {
+  static const uint8_t wav[] = {
+    'R', 'I', 'F', 'F', 48, 0, 0, 0, 'W', 'A', 'V', 'E',
+    'L', 'I', 'S', 'T', 3, 0, 0, 0, 'a', 'b', 'c', 0, // an odd chunk, which is padded
+    'f', 'm', 't', ' ', 16, 0, 0, 0, 1, 0, 2, 0, 0x80, 0xBB, 0, 0, 0, 0xEE, 2, 0, 4, 0, 16, 0,
+    'd', 'a', 't', 'a', 0xFF, 0xFF, 0xFF, 0xFF, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12
+  };
+  m4aProbeInfo info;
+  if (!probetest_probe(wav, sizeof(wav), &info)) {
+    printf("  FAIL wav: could not be probed\n");
+    ++numFailures;
+    return;
+  }
+  PROBETEST_CHECK("wav", "sampleRate", 48000, info.sampleRate);
+  PROBETEST_CHECK("wav", "numChannels", 2, info.numChannels);
+  PROBETEST_CHECK("wav", "numFrames", 3, info.numFrames); // the rest of the file, as the size is unknown
+  for (size_t n = 0; n < sizeof(wav); ++n) probetest_probe(wav, n, &info);
+}
+
+int main() {
+  probetest_addSpecs();
+  int numProbes = 0;
+  for (int i = 0; i < numSpecs; ++i) {
+    probetest_check(specs+i);
+    numProbes += probetest_truncate(specs+i);
+  }
+  probetest_checkWav();
+
+  // a whole file, by its path
+  t_buffer f;
+  probetest_build(&f, specs, NULL, 0);
+  char path[] = "/tmp/m4aProbeTestXXXXXX";
+  const int fd = mkstemp(path);
+  const bool isWritten = (fd >= 0) && write(fd, f.b, f.n) == (ssize_t) f.n;
+  if (fd >= 0) close(fd);
+  m4aProbeInfo info;
+  if (!isWritten || !m4aProbe_readFile(path, &info) || info.numFrames != specs[0].numFrames) {
+    printf("  FAIL file: could not be probed by its path\n");
+    ++numFailures;
+  }
+  unlink(path);
+
+  // files which are not MP4 or WAV
+  static const uint8_t text[] = "not a media file at all";
+  if (probetest_probe(text, sizeof(text), &info) || m4aProbe_readFile("/nonexistent.m4a", &info)) {
+    printf("  FAIL other: a file which is not media was probed\n");
+    ++numFailures;
+  }
+
+  printf("m4aProbeTest: %d files, %d truncated probes, %d failures\n",
+      numSpecs + 1, numProbes, numFailures);
+  return (numFailures > 0) ? 1 : 0;
+}
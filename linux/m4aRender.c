@@ -0,0 +1,164 @@
+/**
+ * Copyright (c) 2016 Enzien Audio Ltd.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+// Renders m4aPlayer (codec backend) offline, faster than real time. Every file
+// is played by its own player, all starting on the first sample, and their sum
+// is written to a 32-bit float WAV file. pdhost stands in for a libpd host
+// running in batch mode: there is no audio device, pdhost_tick() runs one block
+// after the other as fast as it can, and the players decode in perform (see
+// m4aPlayer_setOffline()), so they never underrun and the output is bit
+// identical on every run. Loop, queue, group etc. can be tested by sending the
+// players other messages before rendering.
+//
+// Usage: m4aRender [-r samplerate] [-t seconds] OUT.wav FILE [FILE ...]
+// Renders until every file has been played to its end, or for the given time.
+// Prints the rendered duration, the real-time factor which was achieved and a
+// checksum of the output.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "m4aPlayer.h"
+#include "pdhost.h"
+
+#define RENDER_BLOCK_SIZE 64
+#define RENDER_MAX_FILES 64
+
+static int numLoaded = 0;
+static int numDone = 0;
+
+static void render_outletHook(void *owner, int outlet, t_symbol *s, int argc, t_atom *argv) {
+  if (outlet == 2) ++numDone;
+  else if (outlet == 3) ++numLoaded;
+}
+
+static void render_writeUint32(FILE *f, uint32_t v) {
+  const uint8_t b[4] = {v & 0xFF, (v >> 8) & 0xFF, (v >> 16) & 0xFF, (v >> 24) & 0xFF};
+  fwrite(b, 1, 4, f);
+}
+
+static void render_writeUint16(FILE *f, uint16_t v) {
+  const uint8_t b[2] = {v & 0xFF, (v >> 8) & 0xFF};
+  fwrite(b, 1, 2, f);
+}
+
+// the header of a stereo float WAV file with numFrames frames
+static void render_writeHeader(FILE *f, int sampleRate, uint32_t numFrames) {
+  const uint32_t numDataBytes = numFrames * 2 * sizeof(float);
+  fwrite("RIFF", 1, 4, f);
+  render_writeUint32(f, 36 + numDataBytes);
+  fwrite("WAVEfmt ", 1, 8, f);
+  render_writeUint32(f, 16);
+  render_writeUint16(f, 3); // IEEE float
+  render_writeUint16(f, 2);
+  render_writeUint32(f, (uint32_t) sampleRate);
+  render_writeUint32(f, (uint32_t) sampleRate * 2 * sizeof(float));
+  render_writeUint16(f, 2 * sizeof(float));
+  render_writeUint16(f, 32);
+  fwrite("data", 1, 4, f);
+  render_writeUint32(f, numDataBytes);
+}
+
+static double render_getSeconds(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec / 1000000000.0;
+}
+
+int main(int argc, char **argv) {
+  int sampleRate = 48000;
+  double maxSeconds = 0.0;
+  int opt;
+  while ((opt = getopt(argc, argv, "r:t:")) != -1) {
+    if (opt == 'r') sampleRate = atoi(optarg);
+    else if (opt == 't') maxSeconds = atof(optarg);
+    else break;
+  }
+  const int numFiles = argc - optind - 1;
+  if (numFiles < 1 || numFiles > RENDER_MAX_FILES || sampleRate <= 0) {
+    fprintf(stderr, "Usage: m4aRender [-r samplerate] [-t seconds] OUT.wav FILE [FILE ...]\n");
+    return 1;
+  }
+
+  char directory[512];
+  if (getcwd(directory, sizeof(directory)) == NULL) strcpy(directory, ".");
+  pdhost_init(sampleRate, RENDER_BLOCK_SIZE, &render_outletHook);
+  pdhost_setDirectory(directory);
+  m4aPlayer_setup();
+  m4aPlayer_setOffline(true);
+
+  static t_sample outs[RENDER_MAX_FILES][2][RENDER_BLOCK_SIZE];
+  void *players[RENDER_MAX_FILES];
+  for (int i = 0; i < numFiles; ++i) {
+    players[i] = pdhost_new("m4aPlayer", 0, NULL);
+    t_sample *vecs[2] = {outs[i][0], outs[i][1]};
+    pdhost_dsp(players[i], 2, vecs);
+    t_atom a[1];
+    SETSYMBOL(a, gensym(argv[optind+1+i]));
+    pdhost_send(players[i], "open", 1, a);
+    pdhost_send(players[i], "start", 0, NULL);
+  }
+  if (numLoaded < numFiles) {
+    fprintf(stderr, "Could not open %d of the files.\n", numFiles - numLoaded);
+    return 1;
+  }
+
+  FILE *f = fopen(argv[optind], "wb");
+  if (f == NULL) {
+    fprintf(stderr, "Could not write %s.\n", argv[optind]);
+    return 1;
+  }
+  render_writeHeader(f, sampleRate, 0);
+
+  // render until the done outlet of every player has fired
+  const uint64_t maxFrames = (uint64_t) (maxSeconds * sampleRate);
+  uint64_t numFrames = 0;
+  uint64_t checksum = 14695981039346656037ULL; // FNV-1a of the samples
+  const double startTime = render_getSeconds();
+  while (numDone < numFiles && (maxFrames == 0 || numFrames < maxFrames)) {
+    pdhost_tick();
+    float frames[2*RENDER_BLOCK_SIZE];
+    for (int j = 0; j < RENDER_BLOCK_SIZE; ++j) {
+      float l = 0.0f;
+      float r = 0.0f;
+      for (int i = 0; i < numFiles; ++i) {
+        l += outs[i][0][j];
+        r += outs[i][1][j];
+      }
+      frames[2*j] = l;
+      frames[2*j+1] = r;
+    }
+    const uint8_t *bytes = (const uint8_t *) frames;
+    for (size_t k = 0; k < sizeof(frames); ++k) checksum = (checksum ^ bytes[k]) * 1099511628211ULL;
+    fwrite(frames, sizeof(float), 2*RENDER_BLOCK_SIZE, f);
+    numFrames += RENDER_BLOCK_SIZE;
+  }
+  const double elapsed = render_getSeconds() - startTime;
+
+  fseek(f, 0, SEEK_SET);
+  render_writeHeader(f, sampleRate, (uint32_t) numFrames);
+  fclose(f);
+  for (int i = 0; i < numFiles; ++i) pdhost_free(players[i]);
+
+  const double seconds = (double) numFrames / sampleRate;
+  printf("rendered %.3fs of %d files in %.3fs, %.1fx real time, checksum %016llx\n",
+      seconds, numFiles, elapsed, (elapsed > 0.0) ? seconds / elapsed : 0.0, (unsigned long long) checksum);
+  return 0;
+}
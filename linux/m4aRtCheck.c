@@ -0,0 +1,209 @@
+/**
+ * Copyright (c) 2016 Enzien Audio Ltd.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <dirent.h>
+#include <execinfo.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "m4aRtCheck.h"
+#include "pdhost.h"
+
+#define RTCHECK_MAX_FRAMES 24
+#define RTCHECK_MAX_SITES 64 // call sites which are reported
+#define RTCHECK_MAX_MESSAGE 1024
+
+typedef enum {
+  RTCHECK_MEMORY,
+  RTCHECK_LOCK,
+  RTCHECK_SYSCALL,
+  RTCHECK_LOG
+} t_violation;
+
+static const char *const violationNames[] = {"memory", "lock", "syscall", "log"};
+
+static __thread int depth = 0;
+static __thread bool isReporting = false; // the report itself allocates and writes
+static volatile int numViolations = 0;
+
+// Only the thread which runs perform reports, so the sites need no lock.
+static void *sites[RTCHECK_MAX_SITES];
+static int numSites = 0;
+
+void m4aRtCheck_enter(void) {
+  ++depth;
+}
+
+void m4aRtCheck_leave(void) {
+  --depth;
+}
+
+static void m4aRtCheck_onDsp(bool isEntering) {
+  if (isEntering) m4aRtCheck_enter();
+  else m4aRtCheck_leave();
+}
+
+void m4aRtCheck_installInPdhost(void) {
+  pdhost_setDspHook(&m4aRtCheck_onDsp);
+}
+
+int m4aRtCheck_getNumViolations(void) {
+  return numViolations;
+}
+
+// Counts a violation if the thread is in perform, and reports it with a
+// backtrace the first time that it is made from its call site. The frames are
+// this function, the wrapper and the call site, so it must not be inlined.
+__attribute__((noinline))
+static void m4aRtCheck_violate(t_violation violation, const char *name) {
+  if (depth == 0 || isReporting) return;
+  isReporting = true;
+  __sync_fetch_and_add(&numViolations, 1);
+  void *frames[RTCHECK_MAX_FRAMES];
+  const int numFrames = backtrace(frames, RTCHECK_MAX_FRAMES);
+  void *const site = (numFrames > 2) ? frames[2] : NULL;
+  bool isKnown = false;
+  for (int i = 0; i < numSites && !isKnown; ++i) isKnown = (sites[i] == site);
+  if (!isKnown && numSites < RTCHECK_MAX_SITES) {
+    sites[numSites++] = site;
+    fprintf(stderr, "m4aRtCheck: %s violation, %s() called in perform:\n", violationNames[violation], name);
+    backtrace_symbols_fd(frames+2, numFrames-2, STDERR_FILENO);
+  }
+  isReporting = false;
+}
+
+/*
+ * The wrappers. Each is linked in place of the function with
+ * -Wl,--wrap=NAME, and calls the real function through __real_NAME.
+ */
+
+#define RTCHECK_WRAP(violation, ret, name, params, args) \
+  ret __real_##name params; \
+  ret __wrap_##name params { \
+    m4aRtCheck_violate(violation, #name); \
+    return __real_##name args; \
+  }
+
+RTCHECK_WRAP(RTCHECK_MEMORY, void *, malloc, (size_t size), (size))
+RTCHECK_WRAP(RTCHECK_MEMORY, void *, calloc, (size_t n, size_t size), (n, size))
+RTCHECK_WRAP(RTCHECK_MEMORY, void *, realloc, (void *p, size_t size), (p, size))
+RTCHECK_WRAP(RTCHECK_MEMORY, void, free, (void *p), (p))
+RTCHECK_WRAP(RTCHECK_MEMORY, int, posix_memalign, (void **p, size_t alignment, size_t size), (p, alignment, size))
+RTCHECK_WRAP(RTCHECK_MEMORY, void *, aligned_alloc, (size_t alignment, size_t size), (alignment, size))
+
+RTCHECK_WRAP(RTCHECK_LOCK, int, pthread_mutex_lock, (pthread_mutex_t *m), (m))
+RTCHECK_WRAP(RTCHECK_LOCK, int, pthread_rwlock_rdlock, (pthread_rwlock_t *l), (l))
+RTCHECK_WRAP(RTCHECK_LOCK, int, pthread_rwlock_wrlock, (pthread_rwlock_t *l), (l))
+RTCHECK_WRAP(RTCHECK_LOCK, int, pthread_cond_wait, (pthread_cond_t *c, pthread_mutex_t *m), (c, m))
+RTCHECK_WRAP(RTCHECK_LOCK, int, pthread_cond_timedwait,
+    (pthread_cond_t *c, pthread_mutex_t *m, const struct timespec *t), (c, m, t))
+RTCHECK_WRAP(RTCHECK_LOCK, int, pthread_join, (pthread_t t, void **result), (t, result))
+RTCHECK_WRAP(RTCHECK_LOCK, int, sem_wait, (sem_t *s), (s))
+
+RTCHECK_WRAP(RTCHECK_SYSCALL, int, pthread_create,
+    (pthread_t *t, const pthread_attr_t *a, void *(*f)(void *), void *arg), (t, a, f, arg))
+RTCHECK_WRAP(RTCHECK_SYSCALL, int, pthread_cond_signal, (pthread_cond_t *c), (c))
+RTCHECK_WRAP(RTCHECK_SYSCALL, int, pthread_cond_broadcast, (pthread_cond_t *c), (c))
+RTCHECK_WRAP(RTCHECK_SYSCALL, int, close, (int fd), (fd))
+RTCHECK_WRAP(RTCHECK_SYSCALL, ssize_t, read, (int fd, void *b, size_t n), (fd, b, n))
+RTCHECK_WRAP(RTCHECK_SYSCALL, ssize_t, write, (int fd, const void *b, size_t n), (fd, b, n))
+RTCHECK_WRAP(RTCHECK_SYSCALL, ssize_t, pread, (int fd, void *b, size_t n, off_t offset), (fd, b, n, offset))
+RTCHECK_WRAP(RTCHECK_SYSCALL, off_t, lseek, (int fd, off_t offset, int whence), (fd, offset, whence))
+RTCHECK_WRAP(RTCHECK_SYSCALL, FILE *, fopen, (const char *path, const char *mode), (path, mode))
+RTCHECK_WRAP(RTCHECK_SYSCALL, FILE *, fdopen, (int fd, const char *mode), (fd, mode))
+RTCHECK_WRAP(RTCHECK_SYSCALL, int, fclose, (FILE *f), (f))
+RTCHECK_WRAP(RTCHECK_SYSCALL, size_t, fread, (void *b, size_t size, size_t n, FILE *f), (b, size, n, f))
+RTCHECK_WRAP(RTCHECK_SYSCALL, size_t, fwrite, (const void *b, size_t size, size_t n, FILE *f), (b, size, n, f))
+RTCHECK_WRAP(RTCHECK_SYSCALL, int, fseek, (FILE *f, long offset, int whence), (f, offset, whence))
+RTCHECK_WRAP(RTCHECK_SYSCALL, int, fflush, (FILE *f), (f))
+RTCHECK_WRAP(RTCHECK_SYSCALL, int, stat, (const char *path, struct stat *s), (path, s))
+RTCHECK_WRAP(RTCHECK_SYSCALL, DIR *, opendir, (const char *path), (path))
+RTCHECK_WRAP(RTCHECK_SYSCALL, void *, mmap,
+    (void *a, size_t n, int prot, int flags, int fd, off_t offset), (a, n, prot, flags, fd, offset))
+RTCHECK_WRAP(RTCHECK_SYSCALL, int, munmap, (void *a, size_t n), (a, n))
+RTCHECK_WRAP(RTCHECK_SYSCALL, int, nanosleep, (const struct timespec *t, struct timespec *r), (t, r))
+RTCHECK_WRAP(RTCHECK_SYSCALL, int, usleep, (useconds_t us), (us))
+RTCHECK_WRAP(RTCHECK_SYSCALL, int, sched_yield, (void), ())
+
+RTCHECK_WRAP(RTCHECK_LOG, int, vfprintf, (FILE *f, const char *format, va_list args), (f, format, args))
+RTCHECK_WRAP(RTCHECK_LOG, int, puts, (const char *s), (s))
+RTCHECK_WRAP(RTCHECK_LOG, int, fputs, (const char *s, FILE *f), (s, f))
+RTCHECK_WRAP(RTCHECK_LOG, int, fputc, (int c, FILE *f), (c, f))
+
+// the variadic functions, which are forwarded to the real functions with a va_list
+
+int __real_open(const char *path, int flags, ...);
+int __wrap_open(const char *path, int flags, ...) {
+  m4aRtCheck_violate(RTCHECK_SYSCALL, "open");
+  mode_t mode = 0;
+  if (flags & O_CREAT) {
+    va_list args;
+    va_start(args, flags);
+    mode = va_arg(args, mode_t);
+    va_end(args);
+  }
+  return __real_open(path, flags, mode);
+}
+
+int __wrap_printf(const char *format, ...) {
+  m4aRtCheck_violate(RTCHECK_LOG, "printf");
+  va_list args;
+  va_start(args, format);
+  const int n = __real_vfprintf(stdout, format, args);
+  va_end(args);
+  return n;
+}
+
+int __wrap_fprintf(FILE *f, const char *format, ...) {
+  m4aRtCheck_violate(RTCHECK_LOG, "fprintf");
+  va_list args;
+  va_start(args, format);
+  const int n = __real_vfprintf(f, format, args);
+  va_end(args);
+  return n;
+}
+
+// Pd's console, which is written to from the Pd thread
+void __real_post(const char *format, ...);
+void __wrap_post(const char *format, ...) {
+  m4aRtCheck_violate(RTCHECK_LOG, "post");
+  char message[RTCHECK_MAX_MESSAGE];
+  va_list args;
+  va_start(args, format);
+  vsnprintf(message, sizeof(message), format, args);
+  va_end(args);
+  __real_post("%s", message);
+}
+
+void __real_error(const char *format, ...);
+void __wrap_error(const char *format, ...) {
+  m4aRtCheck_violate(RTCHECK_LOG, "error");
+  char message[RTCHECK_MAX_MESSAGE];
+  va_list args;
+  va_start(args, format);
+  vsnprintf(message, sizeof(message), format, args);
+  va_end(args);
+  __real_error("%s", message);
+}
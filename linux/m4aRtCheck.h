@@ -0,0 +1,45 @@
+/**
+ * Copyright (c) 2016 Enzien Audio Ltd.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _M4A_RT_CHECK_H_
+#define _M4A_RT_CHECK_H_
+
+#include <stdbool.h>
+
+/*
+ * Checks that the perform routines are real-time safe, i.e. that they do not
+ * allocate or free memory, take locks, make blocking system calls or log. The
+ * calls are intercepted with the linker's --wrap option, so the checker sees
+ * every call which the object files of the program make to these functions,
+ * but not the calls which libc makes internally. Link with the --wrap options
+ * listed in README.md, and with -rdynamic for named backtraces.
+ *
+ * Each call which is made on a thread while it is inside a checked region is
+ * a violation. The first violation at every call site is reported on stderr
+ * with a backtrace.
+ */
+
+// marks the calling thread as being inside perform, or no longer inside it
+void m4aRtCheck_enter(void);
+void m4aRtCheck_leave(void);
+
+// checks the DSP chain of pdhost from now on
+void m4aRtCheck_installInPdhost(void);
+
+// the number of violations since the start of the program
+int m4aRtCheck_getNumViolations(void);
+
+#endif // _M4A_RT_CHECK_H_
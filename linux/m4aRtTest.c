@@ -0,0 +1,168 @@
+/**
+ * Copyright (c) 2016 Enzien Audio Ltd.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+// Checks that the perform routines of m4aPlayer, m4aBus and m4aStems (codec
+// backend, with worker threads) are real-time safe. A scripted session plays
+// WAV files through the stand-in Pd host, using loops, queues, gain ramps,
+// fades, markers, reverse playback, groups, a mix bus and stems, while
+// m4aRtCheck watches the DSP chain for allocations, locks, system calls and
+// logging. Offline rendering is not checked, as it reads files in perform by
+// design.
+//
+// Usage: m4aRtTest
+// Exits with 1 if perform made any such call, after reporting each call site.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "m4aRtCheck.h"
+#include "pdhost.h"
+
+#define RTTEST_SAMPLE_RATE 48000
+#define RTTEST_BLOCK_SIZE 64
+#define RTTEST_NUM_BLOCKS 6000 // 8 seconds
+#define RTTEST_MAX_SIGNALS 8
+
+extern void m4aPlayer_setup(void);
+
+// a message which is sent to an object before the given block
+typedef struct _step {
+  int block;
+  int object;
+  const char *selector;
+  const char *args; // floats, and symbols where they are not numbers. "$S" and "$M" are the files.
+} t_step;
+
+enum { PLAYER_A, PLAYER_B, PLAYER_C, PLAYER_D, BUS, STEMS, NUM_OBJECTS };
+
+static const t_step steps[] = {
+  {0,    PLAYER_A, "marker", "100 1"},
+  {0,    PLAYER_A, "marker", "2500 2"},
+  {0,    PLAYER_A, "open",   "$S"},
+  {0,    PLAYER_B, "bus",    "mix"},
+  {0,    PLAYER_B, "format", "int16"},
+  {0,    PLAYER_B, "open",   "$M"},
+  {0,    PLAYER_C, "group",  "g"},
+  {0,    PLAYER_D, "group",  "g"},
+  {0,    PLAYER_C, "open",   "$S"},
+  {0,    PLAYER_D, "open",   "$M"},
+  {0,    STEMS,    "open",   "$S $M"},
+  {20,   PLAYER_A, "gain",   "0.5 200 exp"},
+  {20,   PLAYER_A, "start",  ""},
+  {20,   PLAYER_B, "queue",  "$S"},
+  {20,   PLAYER_B, "startat", "10"},
+  {20,   PLAYER_C, "start",  ""},
+  {20,   STEMS,    "loop",   "1"},
+  {20,   STEMS,    "start",  ""},
+  {600,  PLAYER_A, "loop",   "1"},
+  {900,  PLAYER_A, "direction", "-1"},
+  {1500, PLAYER_A, "pause",  ""},
+  {1600, PLAYER_A, "start",  ""},
+  {1800, PLAYER_C, "pause",  ""},
+  {1900, PLAYER_C, "start",  ""},
+  {2200, PLAYER_A, "direction", "1"},
+  {2500, STEMS,    "pause",  ""},
+  {2520, STEMS,    "startat", "5"},
+  {3000, PLAYER_B, "open",   "$S"},
+  {3000, PLAYER_B, "start",  ""},
+  {3600, PLAYER_A, "fadeout", "300 stop"},
+  {4000, PLAYER_C, "reprime", "1"},
+  {4500, PLAYER_A, "open",   "$M 500"},
+  {4500, PLAYER_A, "start",  ""},
+};
+
+// writes a WAV file of a sine which is never silent to a temporary file
+static bool rttest_writeFile(char *path, int numChannels, int numFrames) {
+  strcpy(path, "/tmp/m4aRtTestXXXXXX");
+  const int fd = mkstemp(path);
+  if (fd < 0) return false;
+  FILE *f = fdopen(fd, "wb");
+  const uint32_t numBytes = (uint32_t) (numFrames * numChannels * 2);
+  const uint32_t header[] = {
+    0x46464952, 36 + numBytes, 0x45564157, 0x20746d66, 16, 0x00000001 | (numChannels << 16), RTTEST_SAMPLE_RATE,
+    RTTEST_SAMPLE_RATE * numChannels * 2, 0x00100000 | (numChannels * 2), 0x61746164, numBytes
+  };
+  fwrite(header, sizeof(header), 1, f); // little-endian, like the hosts this runs on
+  for (int i = 0; i < numFrames * numChannels; ++i) {
+    const int16_t sample = (int16_t) (1 + (i % 1000) * 20);
+    fwrite(&sample, sizeof(sample), 1, f);
+  }
+  return fclose(f) == 0;
+}
+
+// sends a step, replacing $S and $M with the stereo and the mono file
+static void rttest_send(void *x, const t_step *s, const char *stereoPath, const char *monoPath) {
+  t_atom argv[4];
+  int argc = 0;
+  char args[256];
+  strncpy(args, s->args, sizeof(args)-1);
+  args[sizeof(args)-1] = '\0';
+  for (char *arg = strtok(args, " "); arg != NULL && argc < 4; arg = strtok(NULL, " ")) {
+    char *end = NULL;
+    const float f = strtof(arg, &end);
+    if (end != arg && *end == '\0') SETFLOAT(argv+argc, f);
+    else if (strcmp(arg, "$S") == 0) SETSYMBOL(argv+argc, gensym(stereoPath));
+    else if (strcmp(arg, "$M") == 0) SETSYMBOL(argv+argc, gensym(monoPath));
+    else SETSYMBOL(argv+argc, gensym(arg));
+    ++argc;
+  }
+  pdhost_send(x, s->selector, argc, argv);
+}
+
+int main(int argc, char **argv) {
+  char stereoPath[64];
+  char monoPath[64];
+  if (!rttest_writeFile(stereoPath, 2, 3*RTTEST_SAMPLE_RATE) || !rttest_writeFile(monoPath, 1, 2*RTTEST_SAMPLE_RATE)) {
+    fprintf(stderr, "Could not write the test files.\n");
+    return 1;
+  }
+  pdhost_init(RTTEST_SAMPLE_RATE, RTTEST_BLOCK_SIZE, NULL);
+  m4aPlayer_setup();
+
+  static t_sample signals[NUM_OBJECTS][RTTEST_MAX_SIGNALS][RTTEST_BLOCK_SIZE];
+  void *objects[NUM_OBJECTS];
+  t_atom a[1];
+  for (int i = PLAYER_A; i <= PLAYER_D; ++i) objects[i] = pdhost_new("m4aPlayer", 0, NULL);
+  SETSYMBOL(a, gensym("mix"));
+  objects[BUS] = pdhost_new("m4aBus", 1, a);
+  SETFLOAT(a, 2.0f);
+  objects[STEMS] = pdhost_new("m4aStems", 1, a);
+  for (int i = 0; i < NUM_OBJECTS; ++i) {
+    t_sample *vecs[RTTEST_MAX_SIGNALS];
+    for (int c = 0; c < RTTEST_MAX_SIGNALS; ++c) vecs[c] = signals[i][c];
+    pdhost_dsp(objects[i], (i == STEMS) ? 4 : 2, vecs);
+  }
+
+  m4aRtCheck_installInPdhost();
+  size_t nextStep = 0;
+  for (int k = 0; k < RTTEST_NUM_BLOCKS; ++k) {
+    for (; nextStep < sizeof(steps)/sizeof(steps[0]) && steps[nextStep].block == k; ++nextStep) {
+      rttest_send(objects[steps[nextStep].object], steps+nextStep, stereoPath, monoPath);
+    }
+    pdhost_tick();
+    usleep(100); // lets the workers keep up, also on a single core
+  }
+  pdhost_setDspHook(NULL);
+
+  for (int i = 0; i < NUM_OBJECTS; ++i) pdhost_free(objects[i]);
+  unlink(stereoPath);
+  unlink(monoPath);
+  const int numViolations = m4aRtCheck_getNumViolations();
+  printf("m4aRtTest: %d blocks, %d violations\n", RTTEST_NUM_BLOCKS, numViolations);
+  return (numViolations > 0) ? 1 : 0;
+}
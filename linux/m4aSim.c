@@ -0,0 +1,997 @@
+/**
+ * Copyright (c) 2016 Enzien Audio Ltd.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+// A deterministic simulation of m4aPlayer (codec backend) for finding timing
+// bugs and evaluating pipe sizes. Everything runs on one thread in virtual
+// time: the Pd thread (messages, clocks and perform) is driven through pdhost,
+// and the decoder workers are stepped by a scheduler which injects decode
+// costs, slow decode bursts and scheduling delays from a seeded random script.
+// A scripted decoder stands in for m4aDecoder, producing samples which encode
+// the file and frame that they belong to, so that every output sample can be
+// checked against a model of the player.
+//
+// Checked invariants:
+//   - every sample played is the next frame of the expected file, i.e. nothing
+//     is read past the write head, and no block is lost or played twice
+//   - nothing is played while the player is stopped
+//   - every track which plays to its end is reported on the done outlet exactly
+//     once, never before its last frame has been played
+//   - a player which is started after its ready outlet has fired plays from
+//     the very next block
+//   - startat starts on the exact sample, and is silent before it
+//   - the members of a group start on the same sample, not before the
+//     requested time, and stay on the group's timeline after underruns
+//   - the stems of an m4aStems object are always on the same frame, and are
+//     silent past their end
+//   - every marker arrives exactly one block after the logical time at which
+//     its frame is played, across queued tracks and in either direction, and
+//     no marker arrives without its frame having been played
+//
+// Usage: m4aSim [seed]
+// Prints one report line per scenario, and exits with 1 if any invariant was violated.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "m4aDecoder.h"
+#include "m4aSim.h"
+#include "pdhost.h"
+
+#define SIM_SAMPLE_RATE 48000
+#define SIM_BLOCK_SIZE 64
+#define SIM_MAX_PLAYERS 16
+#define SIM_MAX_STEMS 8
+#define SIM_MAX_WORKERS 64
+#define SIM_MAX_FILES 30
+#define SIM_MAX_REPORTED_VIOLATIONS 8
+#define SIM_NUM_MARKERS 8
+#define SIM_MAX_PENDING_MARKERS 64
+
+extern void m4aPlayer_setup(void);
+
+typedef struct _scenario {
+  const char *name;
+  int numPlayers;
+  double durationMs;
+  double decodeSpeed;       // how much faster than real time the decoder runs
+  double burstPeriodMs;     // every period, decoding slows down...
+  double burstLengthMs;     // ...for this long...
+  double burstSpeed;        // ...to this speed. 0 for no bursts.
+  double audioDelayChance;  // chance that a Pd tick is delayed...
+  double audioDelayMaxMs;   // ...by up to this long
+  double workerDelayChance; // chance that a worker is preempted after a block...
+  double workerDelayMaxMs;  // ...for up to this long
+  double stormPeriodMs;     // mean time between random open/prime/queue/pause/start messages, 0 for none
+  bool isGroup;             // the players are stems in one transport group
+  int numStems;             // instead of players, one m4aStems object with this many stems
+  bool isTurning;           // the storm also turns the players around
+} t_scenario;
+
+static const t_scenario scenarios[] = {
+  // name           players  ms     speed  burst period/length/speed  audio delays  worker delays  storm  group  stems  turns
+  {"steady",        1,       10000, 20.0,  0.0,    0.0,   0.0,        0.00, 0.0,    0.00, 0.0,     0.0,   false, 0,     false},
+  {"slow-bursts",   4,       10000, 8.0,   1000.0, 150.0, 0.5,        0.00, 0.0,    0.00, 0.0,     0.0,   false, 0,     false},
+  {"sched-delays",  4,       10000, 10.0,  0.0,    0.0,   0.0,        0.05, 3.0,    0.02, 30.0,    0.0,   false, 0,     false},
+  {"open-storm",    4,       5000,  10.0,  500.0,  50.0,  0.8,        0.02, 2.0,    0.01, 10.0,    3.0,   false, 0,     false},
+  {"group-stems",   12,      10000, 4.0,   700.0,  100.0, 0.4,        0.02, 2.0,    0.01, 10.0,    400.0, true,  0,     false},
+  {"lockstep-stems", 0,      10000, 2.0,   700.0,  100.0, 0.4,        0.02, 2.0,    0.01, 10.0,    300.0, false, 8,     false},
+  {"reverse-storm", 4,       10000, 10.0,  500.0,  50.0,  0.8,        0.02, 2.0,    0.01, 10.0,    20.0,  false, 0,     true},
+};
+
+/* the scripted decoder */
+
+// Files are named ID-NUMFRAMES.sim. Samples encode the file id and the frame,
+// and are never zero, so silence is always distinguishable from audio.
+struct m4aDecoder {
+  int id;
+  uint64_t numFrames;
+  uint64_t position;
+};
+
+static uint64_t numDecodedFrames = 0; // for charging decode costs to the workers
+
+static int16_t sim_encodeLeft(uint64_t frame) {
+  return (int16_t) (1 + (frame % 16384));
+}
+
+static int16_t sim_encodeRight(int id, uint64_t frame) {
+  return (int16_t) (1 + id*1024 + (frame / 16384) % 1024);
+}
+
+m4aDecoder *m4aDecoder_open(const char *path) {
+  const char *name = strrchr(path, '/');
+  name = (name != NULL) ? name+1 : path;
+  int id = 0;
+  unsigned long long numFrames = 0;
+  if (sscanf(name, "%d-%llu.sim", &id, &numFrames) != 2 || id < 0 || id > SIM_MAX_FILES) return NULL;
+  m4aDecoder *d = (m4aDecoder *) calloc(1, sizeof(m4aDecoder));
+  d->id = id;
+  d->numFrames = numFrames;
+  return d;
+}
+
+m4aDecoder *m4aDecoder_openFd(int fd, int64_t offset, int64_t length) {
+  return NULL;
+}
+
+void m4aDecoder_close(m4aDecoder *d) {
+  free(d);
+}
+
+uint32_t m4aDecoder_getSampleRate(m4aDecoder *d) {
+  return SIM_SAMPLE_RATE;
+}
+
+int m4aDecoder_getNumChannels(m4aDecoder *d) {
+  return 2;
+}
+
+uint64_t m4aDecoder_getNumFrames(m4aDecoder *d) {
+  return d->numFrames;
+}
+
+bool m4aDecoder_seek(m4aDecoder *d, uint64_t frame) {
+  if (frame > d->numFrames) return false;
+  d->position = frame;
+  return true;
+}
+
+int m4aDecoder_read(m4aDecoder *d, int16_t *buffer, int numFrames) {
+  int n = 0;
+  for (; n < numFrames && d->position < d->numFrames; ++n, ++d->position) {
+    buffer[2*n] = sim_encodeLeft(d->position);
+    buffer[2*n+1] = sim_encodeRight(d->id, d->position);
+  }
+  numDecodedFrames += n;
+  return n;
+}
+
+/* random numbers */
+
+static uint64_t randomState = 1;
+
+static double sim_random() {
+  // xorshift64*
+  randomState ^= randomState >> 12;
+  randomState ^= randomState << 25;
+  randomState ^= randomState >> 27;
+  return (double) ((randomState * 2685821657736338717ULL) >> 11) / 9007199254740992.0;
+}
+
+static int sim_randomInt(int n) {
+  return (int) (sim_random() * n);
+}
+
+/* the workers */
+
+typedef struct _worker {
+  void *worker;
+  m4aSim_stepFn step;
+  double dueMs; // when the block being decoded is finished
+} t_worker;
+
+static const t_scenario *scenario = NULL;
+static double nowMs = 0.0;
+static t_worker workers[SIM_MAX_WORKERS];
+static int numWorkers = 0;
+
+// the time that the worker spends decoding a block which starts now, including any preemption
+static double sim_blockCostMs() {
+  double speed = scenario->decodeSpeed;
+  if (scenario->burstSpeed > 0.0 && fmod(nowMs, scenario->burstPeriodMs) < scenario->burstLengthMs) {
+    speed = scenario->burstSpeed;
+  }
+  double costMs = (1000.0 * SIM_BLOCK_SIZE) / (SIM_SAMPLE_RATE * speed);
+  if (sim_random() < scenario->workerDelayChance) costMs += sim_random() * scenario->workerDelayMaxMs;
+  return costMs;
+}
+
+void m4aSim_addWorker(void *worker, m4aSim_stepFn step) {
+  if (numWorkers == SIM_MAX_WORKERS) {
+    fprintf(stderr, "m4aSim: too many workers\n");
+    exit(2);
+  }
+  workers[numWorkers].worker = worker;
+  workers[numWorkers].step = step;
+  workers[numWorkers].dueMs = nowMs + sim_blockCostMs();
+  ++numWorkers;
+}
+
+void m4aSim_removeWorker(void *worker) {
+  for (int i = 0; i < numWorkers; ++i) {
+    if (workers[i].worker == worker) {
+      workers[i] = workers[--numWorkers];
+      return;
+    }
+  }
+}
+
+// runs the workers in time order until the given time
+static void sim_runWorkers(double untilMs) {
+  for (;;) {
+    t_worker *next = NULL;
+    for (int i = 0; i < numWorkers; ++i) {
+      if (workers[i].dueMs <= untilMs && (next == NULL || workers[i].dueMs < next->dueMs)) next = workers+i;
+    }
+    if (next == NULL) break;
+    nowMs = next->dueMs;
+    if (next->step(next->worker)) {
+      next->dueMs = nowMs + sim_blockCostMs();
+    } else {
+      // the worker found nothing to do and sleeps for a block
+      next->dueMs = nowMs + (1000.0 * SIM_BLOCK_SIZE) / SIM_SAMPLE_RATE + sim_blockCostMs();
+    }
+  }
+  nowMs = untilMs;
+}
+
+/* the players and their models */
+
+// a marker whose frame has been played, which is due on the marker outlet
+typedef struct _pendingMarker {
+  int id;
+  double timeMs; // logical time
+} t_pendingMarker;
+
+typedef struct _player {
+  void *object;
+  t_sample outL[SIM_BLOCK_SIZE];
+  t_sample outR[SIM_BLOCK_SIZE];
+
+  // the model of the player
+  int file;   // the current file, or -1
+  uint64_t frame; // the next frame expected from the current file
+  int queued; // the queued file, or -1
+  int loading; // the file which replaces the queued one once done-loading arrives, or -1
+  bool isReverse; // the frames count down, and files start from their end
+  bool isPlaying;
+  bool isReady;        // the ready outlet has fired since the file was opened
+  bool hasStarted;     // start has been sent since the file was opened
+  bool isWaiting;      // startat has been sent, and output starts at startSample
+  uint64_t startSample;
+  bool mustPlay;       // the sample at mustPlaySample must not be an underrun
+  uint64_t mustPlaySample;
+  bool isAtBarrier;    // a group start has been sent, and output starts once every member is buffered
+
+  // statistics
+  int numFinished;   // tracks which have been played to the end
+  int numFinishedBeforeTick;
+  int numDone;       // bangs on the done outlet
+
+  // A group member which falls behind reaches the end of its track in the
+  // model during the underrun, but only reports it once it has caught up,
+  // which is after the group has started again if it was paused meanwhile.
+  // The group is not primed or reopened until then, as the model cannot
+  // tell whether the track will be reported.
+  bool hasSilentEnd;
+  bool isSilentEndPaused;
+  int numUnderrunBlocks;
+  uint64_t numUnderrunFrames;
+
+  t_pendingMarker pendingMarkers[SIM_MAX_PENDING_MARKERS];
+  int numPendingMarkers;
+  int numMarkers; // markers which have arrived
+} t_player;
+
+static t_player players[SIM_MAX_PLAYERS];
+static uint64_t fileLengths[SIM_MAX_FILES+1];
+static bool isDraining = false; // the script has ended, and the players play out
+static int numViolations = 0;
+static uint64_t outputHash = 1469598103934665603ULL;
+static uint64_t sampleTime = 0; // the first sample of the next block
+static uint64_t markerFrames[SIM_NUM_MARKERS]; // the frame of the marker with id i+1, in every file
+
+// the pending start of the group, in group scenarios
+static uint64_t groupNotBeforeSample = 0;
+static bool hasGroupStartSample = false;
+static uint64_t groupStartSample = 0;
+
+static void sim_violation(const t_player *p, const char *message, int file, uint64_t frame) {
+  if (numViolations++ < SIM_MAX_REPORTED_VIOLATIONS) {
+    printf("  VIOLATION %s player %d at %.3fms: %s (expected file %d frame %llu, got file %d frame %llu)\n",
+        scenario->name, (int) (p - players), pdhost_getTimeMs(), message,
+        p->file, (unsigned long long) p->frame, file, (unsigned long long) frame);
+  }
+}
+
+static void sim_send(t_player *p, const char *selector, int argc, t_atom *argv) {
+  pdhost_send(p->object, selector, argc, argv);
+}
+
+// the first frame played from the position in the current file. Backwards, it
+// is the frame before the position, and a position of 0 is the end.
+static uint64_t sim_getFirstFrame(const t_player *p, int positionMs) {
+  const uint64_t frame = (uint64_t) positionMs * SIM_SAMPLE_RATE / 1000;
+  if (!p->isReverse) return frame;
+  return (frame == 0) ? fileLengths[p->file] - 1 : frame - 1;
+}
+
+static void sim_open(t_player *p, int file, int positionMs) {
+  char name[32];
+  snprintf(name, sizeof(name), "%d-%llu.sim", file, (unsigned long long) fileLengths[file]);
+  t_atom args[2];
+  SETSYMBOL(args, gensym(name));
+  SETFLOAT(args+1, (t_float) positionMs);
+  p->loading = -1;
+  sim_send(p, "open", 2, args);
+  p->file = file;
+  p->frame = sim_getFirstFrame(p, positionMs);
+  p->queued = -1;
+  p->isPlaying = false;
+  p->isReady = false;
+  p->hasStarted = false;
+  p->isWaiting = false;
+  p->isAtBarrier = false;
+  p->mustPlay = false;
+}
+
+static void sim_queue(t_player *p, int file) {
+  if (p->file < 0) {
+    sim_open(p, file, 0);
+    return;
+  }
+  char name[32];
+  snprintf(name, sizeof(name), "%d-%llu.sim", file, (unsigned long long) fileLengths[file]);
+  t_atom arg;
+  SETSYMBOL(&arg, gensym(name));
+
+  // the file is only queued once its player has been created, which may be
+  // before queue returns
+  p->loading = file;
+  sim_send(p, "queue", 1, &arg);
+}
+
+static void sim_prime(t_player *p, int positionMs) {
+  if (p->file < 0) return;
+  t_atom arg;
+  SETFLOAT(&arg, (t_float) positionMs);
+  sim_send(p, "prime", 1, &arg);
+  p->frame = sim_getFirstFrame(p, positionMs);
+  p->queued = -1;
+  p->loading = -1;
+  p->isPlaying = false;
+  p->isReady = false;
+  p->hasStarted = false;
+  p->isWaiting = false;
+  p->isAtBarrier = false;
+  p->mustPlay = false;
+}
+
+static void sim_start(t_player *p) {
+  sim_send(p, "start", 0, NULL);
+  if (p->file < 0) return;
+  p->mustPlay = p->isReady && !p->hasStarted;
+  p->mustPlaySample = sampleTime;
+  p->isWaiting = false;
+  p->isPlaying = true;
+  p->hasStarted = true;
+}
+
+static void sim_startat(t_player *p, int delayMs) {
+  if (p->file < 0 || p->isPlaying || p->isWaiting) return;
+  t_atom arg;
+  SETFLOAT(&arg, (t_float) delayMs);
+  sim_send(p, "startat", 1, &arg);
+  p->isWaiting = true;
+  p->startSample = sampleTime + (uint64_t) delayMs * SIM_SAMPLE_RATE / 1000;
+  p->mustPlay = p->isReady && !p->hasStarted;
+  p->mustPlaySample = p->startSample;
+  p->hasStarted = true;
+}
+
+static void sim_pause(t_player *p) {
+  sim_send(p, "pause", 0, NULL);
+  p->isPlaying = false;
+  p->isWaiting = false;
+  p->isAtBarrier = false;
+  p->mustPlay = false;
+}
+
+// Turns the player around at the playhead, which is between two frames. Turns
+// where the playhead may be at the end of a track are left out, as the model
+// does not know whether the player has reported it yet.
+static void sim_turn(t_player *p) {
+  if (p->file >= 0 && (p->isReverse ? p->frame+1 == fileLengths[p->file] : p->frame == 0)) return;
+  p->isReverse = !p->isReverse;
+  t_atom arg;
+  SETFLOAT(&arg, p->isReverse ? -1.0f : 1.0f);
+  sim_send(p, "direction", 1, &arg);
+  if (p->file < 0) return;
+  if (p->isReverse) --p->frame;
+  else ++p->frame;
+  p->mustPlay = false; // the pipe is refilled from the playhead
+  if (!p->hasStarted) p->isReady = false;
+}
+
+// Sends a start to the group, which any member passes on to all of them. The
+// start is only sent when the model knows whether every member is playing,
+// i.e. when every finished track has been reported.
+static void sim_groupStart(int delayMs) {
+  for (int i = 0; i < scenario->numPlayers; ++i) {
+    const t_player *p = players+i;
+    if (p->isPlaying || p->isAtBarrier) return; // the group is already started
+    if (p->numDone != p->numFinished && !p->isSilentEndPaused) return;
+  }
+  t_player *p = players + sim_randomInt(scenario->numPlayers);
+  if (delayMs > 0) {
+    t_atom arg;
+    SETFLOAT(&arg, (t_float) delayMs);
+    sim_send(p, "startat", 1, &arg);
+  } else {
+    sim_send(p, "start", 0, NULL);
+  }
+  groupNotBeforeSample = sampleTime + (uint64_t) delayMs * SIM_SAMPLE_RATE / 1000;
+  hasGroupStartSample = false;
+  for (int i = 0; i < scenario->numPlayers; ++i) {
+    if (players[i].file >= 0) players[i].isAtBarrier = true;
+  }
+}
+
+// pause and prime are passed on to every member of the group
+static void sim_groupTransport(int which) {
+  t_player *p = players + sim_randomInt(scenario->numPlayers);
+  if (which == 0) {
+    sim_send(p, "pause", 0, NULL);
+    for (int i = 0; i < scenario->numPlayers; ++i) {
+      players[i].isPlaying = false;
+      players[i].isAtBarrier = false;
+      players[i].isSilentEndPaused = players[i].hasSilentEnd;
+    }
+  } else {
+    uint64_t shortest = UINT64_MAX;
+    for (int i = 0; i < scenario->numPlayers; ++i) {
+      if (players[i].file >= 0 && fileLengths[players[i].file] < shortest) shortest = fileLengths[players[i].file];
+    }
+    const int positionMs = sim_randomInt((int) (shortest * 1000 / SIM_SAMPLE_RATE));
+    t_atom arg;
+    SETFLOAT(&arg, (t_float) positionMs);
+    sim_send(p, "prime", 1, &arg);
+    for (int i = 0; i < scenario->numPlayers; ++i) {
+      players[i].frame = (uint64_t) positionMs * SIM_SAMPLE_RATE / 1000;
+      players[i].queued = -1;
+      players[i].loading = -1;
+      players[i].isPlaying = false;
+      players[i].isAtBarrier = false;
+      players[i].isReady = false;
+    }
+  }
+}
+
+/* the m4aStems object and its model */
+
+typedef struct _stemsModel {
+  void *object;
+  t_sample outs[2*SIM_MAX_STEMS][SIM_BLOCK_SIZE];
+  int files[SIM_MAX_STEMS]; // the file of each stem, or -1
+  bool isOpen;
+  uint64_t numFrames; // the length of the longest stem
+  uint64_t frame;     // the next frame expected from every stem
+  bool isPlaying;
+  bool isReady;
+  bool hasStarted;
+  bool isWaiting;
+  uint64_t startSample;
+  bool mustPlay;
+  uint64_t mustPlaySample;
+  int numFinished;
+  int numFinishedBeforeTick;
+  int numDone;
+  int numUnderrunBlocks;
+  uint64_t numUnderrunFrames;
+} t_stemsModel;
+
+static t_stemsModel stems;
+
+static void sim_stemsViolation(const char *message, int stem, uint64_t frame) {
+  if (numViolations++ < SIM_MAX_REPORTED_VIOLATIONS) {
+    printf("  VIOLATION %s stem %d at %.3fms: %s (expected frame %llu, got frame %llu)\n",
+        scenario->name, stem, pdhost_getTimeMs(), message,
+        (unsigned long long) stems.frame, (unsigned long long) frame);
+  }
+}
+
+// opens between one and all stems with random files, at a random position
+static void sim_stemsOpen() {
+  const int numFiles = 1 + sim_randomInt(scenario->numStems);
+  t_atom args[SIM_MAX_STEMS+1];
+  char names[SIM_MAX_STEMS][32];
+  stems.numFrames = 0;
+  for (int i = 0; i < scenario->numStems; ++i) {
+    stems.files[i] = (i < numFiles) ? 1 + sim_randomInt(SIM_MAX_FILES) : -1;
+    if (stems.files[i] < 0) continue;
+    snprintf(names[i], sizeof(names[i]), "%d-%llu.sim", stems.files[i], (unsigned long long) fileLengths[stems.files[i]]);
+    SETSYMBOL(args+i, gensym(names[i]));
+    if (fileLengths[stems.files[i]] > stems.numFrames) stems.numFrames = fileLengths[stems.files[i]];
+  }
+  const int positionMs = sim_randomInt((int) (stems.numFrames * 1000 / SIM_SAMPLE_RATE));
+  SETFLOAT(args+numFiles, (t_float) positionMs);
+  pdhost_send(stems.object, "open", numFiles+1, args);
+  stems.isOpen = true;
+  stems.frame = (uint64_t) positionMs * SIM_SAMPLE_RATE / 1000;
+  stems.isPlaying = false;
+  stems.isReady = false;
+  stems.hasStarted = false;
+  stems.isWaiting = false;
+  stems.mustPlay = false;
+}
+
+static void sim_stemsTransport(int which) {
+  t_atom arg;
+  switch (which) {
+    case 0: {
+      pdhost_send(stems.object, "pause", 0, NULL);
+      stems.isPlaying = false;
+      stems.isWaiting = false;
+      stems.mustPlay = false;
+      break;
+    }
+    case 1: {
+      const int positionMs = sim_randomInt((int) (stems.numFrames * 1000 / SIM_SAMPLE_RATE));
+      SETFLOAT(&arg, (t_float) positionMs);
+      pdhost_send(stems.object, "prime", 1, &arg);
+      stems.frame = (uint64_t) positionMs * SIM_SAMPLE_RATE / 1000;
+      stems.isPlaying = false;
+      stems.isReady = false;
+      stems.hasStarted = false;
+      stems.isWaiting = false;
+      stems.mustPlay = false;
+      break;
+    }
+    case 2: {
+      if (stems.isPlaying || stems.isWaiting) break;
+      const int delayMs = sim_randomInt(100);
+      SETFLOAT(&arg, (t_float) delayMs);
+      pdhost_send(stems.object, "startat", 1, &arg);
+      stems.isWaiting = true;
+      stems.startSample = sampleTime + (uint64_t) delayMs * SIM_SAMPLE_RATE / 1000;
+      stems.mustPlay = stems.isReady && !stems.hasStarted;
+      stems.mustPlaySample = stems.startSample;
+      stems.hasStarted = true;
+      break;
+    }
+    default: {
+      pdhost_send(stems.object, "start", 0, NULL);
+      stems.mustPlay = stems.isReady && !stems.hasStarted;
+      stems.mustPlaySample = sampleTime;
+      stems.isWaiting = false;
+      stems.isPlaying = true;
+      stems.hasStarted = true;
+      break;
+    }
+  }
+}
+
+// checks one block of output of every stem against the model
+static void sim_stemsCheckOutput() {
+  bool isUnderrun = false;
+  for (int j = 0; j < SIM_BLOCK_SIZE; ++j) {
+    if (stems.isWaiting && sampleTime + j == stems.startSample) {
+      stems.isWaiting = false;
+      stems.isPlaying = true;
+    }
+    const bool mustPlay = stems.mustPlay && sampleTime + j == stems.mustPlaySample;
+    if (mustPlay) stems.mustPlay = false;
+
+    int l[SIM_MAX_STEMS];
+    int r[SIM_MAX_STEMS];
+    int numAudible = 0;
+    for (int i = 0; i < scenario->numStems; ++i) {
+      l[i] = (int) lrintf(stems.outs[2*i][j] * 32768.0f);
+      r[i] = (int) lrintf(stems.outs[2*i+1][j] * 32768.0f);
+      outputHash = (outputHash ^ (uint64_t) (l[i] * 65536 + r[i])) * 1099511628211ULL;
+      if (l[i] != 0 || r[i] != 0) ++numAudible;
+    }
+    if (numAudible == 0) {
+      if (mustPlay) sim_stemsViolation("silent after ready and start", -1, 0);
+      if (stems.isPlaying) {
+        isUnderrun = true;
+        ++stems.numUnderrunFrames;
+      }
+      continue;
+    }
+    if (!stems.isPlaying) {
+      sim_stemsViolation("played while stopped", -1, 0);
+      continue;
+    }
+    uint64_t frame = stems.frame;
+    for (int i = 0; i < scenario->numStems; ++i) {
+      const int file = stems.files[i];
+      const bool isAudible = file >= 0 && stems.frame < fileLengths[file];
+      const int expectedL = isAudible ? sim_encodeLeft(stems.frame) : 0;
+      const int expectedR = isAudible ? sim_encodeRight(file, stems.frame) : 0;
+      if (l[i] != expectedL || r[i] != expectedR) {
+        const uint64_t got = (l[i] == 0) ? 0 : (uint64_t) (l[i] - 1) + (uint64_t) ((r[i] - 1) % 1024) * 16384;
+        sim_stemsViolation("stem out of step", i, got);
+        if (l[i] != 0) frame = got; // resynchronise, to report each problem once
+      }
+    }
+    stems.frame = frame;
+    if (++stems.frame == stems.numFrames) {
+      ++stems.numFinished;
+      stems.frame = 0;
+      stems.isPlaying = false; // reprimed
+    }
+  }
+  if (isUnderrun) ++stems.numUnderrunBlocks;
+}
+
+static bool sim_runStemsScenario(const t_scenario *s) {
+  memset(&stems, 0, sizeof(stems));
+  stems.object = pdhost_new("m4aStems", 1, (t_atom []) {{A_FLOAT, {.w_float = (t_float) s->numStems}}});
+  t_sample *vecs[2*SIM_MAX_STEMS];
+  for (int c = 0; c < 2*s->numStems; ++c) vecs[c] = stems.outs[c];
+  pdhost_dsp(stems.object, 2*s->numStems, vecs);
+  sim_stemsOpen();
+
+  const double blockMs = (1000.0 * SIM_BLOCK_SIZE) / SIM_SAMPLE_RATE;
+  const int numBlocks = (int) (s->durationMs / blockMs);
+  double nextStormMs = 0.0;
+  double tickMs = 0.0;
+  for (int b = 0; b < numBlocks + (int) (1000.0 / blockMs); ++b) {
+    double dueMs = b * blockMs;
+    if (sim_random() < s->audioDelayChance) dueMs += sim_random() * s->audioDelayMaxMs;
+    if (dueMs > tickMs) tickMs = dueMs;
+    sim_runWorkers(tickMs);
+
+    if (b == (int) (50.0 / blockMs)) sim_stemsTransport(3);
+    while (b < numBlocks && nextStormMs <= b * blockMs) {
+      if (sim_randomInt(5) == 0) sim_stemsOpen();
+      else sim_stemsTransport(sim_randomInt(4));
+      nextStormMs += 2.0 * s->stormPeriodMs * sim_random();
+    }
+    // afterwards, play out until every finished song has been reported
+    if (b >= numBlocks && stems.numDone == stems.numFinished) break;
+
+    stems.numFinishedBeforeTick = stems.numFinished;
+    pdhost_tick();
+    if (stems.numDone > stems.numFinishedBeforeTick) {
+      sim_stemsViolation("more done events than finished songs", -1, (uint64_t) stems.numDone);
+      stems.numDone = stems.numFinishedBeforeTick;
+    }
+    sim_stemsCheckOutput();
+    sampleTime += SIM_BLOCK_SIZE;
+  }
+  if (stems.numDone != stems.numFinished) {
+    sim_stemsViolation("songs finished without a done event", -1, (uint64_t) stems.numDone);
+  }
+
+  pdhost_free(stems.object);
+  stems.object = NULL;
+  pdhost_dspStop();
+  printf("%-14s stems   %2d  blocks %6d  songs finished  %4d  underrun blocks %5d  underrun frames %7llu  violations %d  hash %016llx\n",
+      s->name, s->numStems, numBlocks, stems.numFinished, stems.numUnderrunBlocks,
+      (unsigned long long) stems.numUnderrunFrames, numViolations, (unsigned long long) outputHash);
+  return numViolations == 0;
+}
+
+// expects the markers of the frame, which is played at the sample, one block later
+static void sim_playMarkers(t_player *p, uint64_t frame, uint64_t sample) {
+  for (int m = 0; m < SIM_NUM_MARKERS; ++m) {
+    // forwards a marker is played with its frame, backwards with the frame before it
+    if (frame != (p->isReverse ? markerFrames[m] - 1 : markerFrames[m])) continue;
+    if (p->numPendingMarkers == SIM_MAX_PENDING_MARKERS) {
+      sim_violation(p, "markers are not being delivered", -1, frame);
+      return;
+    }
+    t_pendingMarker *const e = p->pendingMarkers + p->numPendingMarkers++;
+    e->id = m+1;
+    e->timeMs = ((sample + SIM_BLOCK_SIZE) * 1000.0) / SIM_SAMPLE_RATE;
+  }
+}
+
+// checks a marker which has arrived against the earliest one expected with its id
+static void sim_receiveMarker(t_player *p, int id) {
+  ++p->numMarkers;
+  int k = -1;
+  for (int i = 0; i < p->numPendingMarkers; ++i) {
+    if (p->pendingMarkers[i].id == id && (k < 0 || p->pendingMarkers[i].timeMs < p->pendingMarkers[k].timeMs)) k = i;
+  }
+  if (k < 0) {
+    sim_violation(p, "marker arrived without its frame being played", -1, (uint64_t) id);
+    return;
+  }
+  if (fabs(p->pendingMarkers[k].timeMs - pdhost_getTimeMs()) > 1e-6) {
+    sim_violation(p, "marker arrived at the wrong time", -1, (uint64_t) id);
+  }
+  p->pendingMarkers[k] = p->pendingMarkers[--p->numPendingMarkers];
+}
+
+// reports the markers which were due before the end of the tick which has just run
+static void sim_checkMarkers(t_player *p) {
+  const double nowMs = pdhost_getTimeMs();
+  for (int i = 0; i < p->numPendingMarkers;) {
+    if (p->pendingMarkers[i].timeMs < nowMs - 1e-6) {
+      sim_violation(p, "marker did not arrive", -1, (uint64_t) p->pendingMarkers[i].id);
+      p->pendingMarkers[i] = p->pendingMarkers[--p->numPendingMarkers];
+    } else {
+      ++i;
+    }
+  }
+}
+
+static void sim_outletHook(void *owner, int outlet, t_symbol *s, int argc, t_atom *argv) {
+  if (owner == stems.object && owner != NULL) {
+    if (outlet == 2*scenario->numStems) ++stems.numDone;
+    if (outlet == 2*scenario->numStems+2) stems.isReady = true;
+    return;
+  }
+  for (int i = 0; i < scenario->numPlayers; ++i) {
+    t_player *p = players+i;
+    if (p->object != owner) continue;
+    if (outlet == 3 && p->loading >= 0) {
+      p->queued = p->loading;
+      p->loading = -1;
+    }
+    if (outlet == 4) p->isReady = true;
+    if (outlet == 6) sim_receiveMarker(p, (int) argv[0].a_w.w_float);
+    if (outlet != 2) continue;
+    ++p->numDone;
+    p->hasSilentEnd = false;
+    p->isSilentEndPaused = false;
+    if (scenario->stormPeriodMs == 0.0 && !isDraining) {
+      // keep the player going with another file, like a playlist would
+      sim_queue(p, 1 + sim_randomInt(SIM_MAX_FILES));
+      if (!p->isPlaying) sim_start(p);
+    }
+  }
+}
+
+// moves the model on by one frame
+static void sim_advance(t_player *p) {
+  const bool isAtEnd = p->isReverse ? (p->frame-- == 0) : (++p->frame == fileLengths[p->file]);
+  if (isAtEnd) {
+    ++p->numFinished;
+    if (p->queued >= 0) {
+      p->file = p->queued;
+      p->queued = -1;
+    } else {
+      p->isPlaying = false; // reprimed
+    }
+    p->frame = p->isReverse ? fileLengths[p->file] - 1 : 0;
+  }
+}
+
+// checks one block of output against the model
+static void sim_checkOutput(t_player *p) {
+  bool isUnderrun = false;
+  for (int j = 0; j < SIM_BLOCK_SIZE; ++j) {
+    const int l = (int) lrintf(p->outL[j] * 32768.0f);
+    const int r = (int) lrintf(p->outR[j] * 32768.0f);
+    outputHash = (outputHash ^ (uint64_t) (l * 65536 + r)) * 1099511628211ULL;
+
+    if (p->isWaiting && sampleTime + j == p->startSample) {
+      p->isWaiting = false;
+      p->isPlaying = true;
+    }
+    if (p->isAtBarrier && (l != 0 || r != 0)) {
+      // the first sample of a group member, which must be that of every member
+      if (!hasGroupStartSample) {
+        hasGroupStartSample = true;
+        groupStartSample = sampleTime + j;
+        if (groupStartSample < groupNotBeforeSample) sim_violation(p, "group started early", -1, groupNotBeforeSample);
+      } else if (sampleTime + j != groupStartSample) {
+        sim_violation(p, "group members started on different samples", -1, groupStartSample);
+      }
+      p->isAtBarrier = false;
+      p->isPlaying = true;
+    }
+    const bool mustPlay = p->mustPlay && sampleTime + j == p->mustPlaySample;
+    if (mustPlay) p->mustPlay = false;
+
+    if (l == 0 && r == 0) {
+      if (mustPlay) sim_violation(p, "silent after ready and start", -1, 0);
+      if (p->isPlaying) {
+        isUnderrun = true;
+        ++p->numUnderrunFrames;
+        // a group member skips the frames which it misses, to stay on the timeline
+        if (scenario->isGroup) {
+          const int numFinished = p->numFinished;
+          sim_advance(p);
+          if (p->numFinished != numFinished) p->hasSilentEnd = true;
+        }
+      }
+      continue;
+    }
+    const int file = (r - 1) / 1024;
+    const uint64_t frame = (uint64_t) (l - 1) + (uint64_t) ((r - 1) % 1024) * 16384;
+    if (!p->isPlaying) {
+      sim_violation(p, "played while stopped", file, frame);
+      continue;
+    }
+    if (file != p->file || frame != p->frame) {
+      sim_violation(p, "unexpected frame", file, frame);
+      p->file = file; // resynchronise, to report each problem once
+      p->frame = frame;
+    }
+    sim_playMarkers(p, frame, sampleTime + j);
+    sim_advance(p);
+  }
+  if (isUnderrun) ++p->numUnderrunBlocks;
+}
+
+// sends a random transport message to a random player
+static void sim_storm() {
+  if (scenario->isGroup) {
+    bool hasSilentEnd = false;
+    for (int i = 0; i < scenario->numPlayers; ++i) hasSilentEnd |= players[i].hasSilentEnd;
+    switch (sim_randomInt(5)) {
+      case 0: sim_groupTransport(0); break; // pause
+      case 1: if (!hasSilentEnd) sim_groupTransport(1); break; // prime
+      case 2: {
+        if (hasSilentEnd) break;
+        // every member opens a new stem
+        for (int i = 0; i < scenario->numPlayers; ++i) {
+          sim_open(players+i, 1 + sim_randomInt(SIM_MAX_FILES), 0);
+        }
+        break;
+      }
+      case 3: sim_groupStart(sim_randomInt(100)); break;
+      default: sim_groupStart(0); break;
+    }
+    return;
+  }
+  t_player *p = players + sim_randomInt(scenario->numPlayers);
+  const int file = 1 + sim_randomInt(SIM_MAX_FILES);
+  if (scenario->isTurning && sim_randomInt(4) == 0) {
+    sim_turn(p);
+    return;
+  }
+  switch (sim_randomInt(7)) {
+    case 0: sim_open(p, file, sim_randomInt((int) (fileLengths[file] * 1000 / SIM_SAMPLE_RATE))); break;
+    case 1: if (p->file >= 0) sim_prime(p, sim_randomInt((int) (fileLengths[p->file] * 1000 / SIM_SAMPLE_RATE))); break;
+    case 2: sim_queue(p, file); break;
+    case 3: sim_pause(p); break;
+    case 4: sim_startat(p, sim_randomInt(100)); break;
+    default: sim_start(p); break;
+  }
+}
+
+// runs one Pd tick and checks the players
+static void sim_tick() {
+  for (int i = 0; i < scenario->numPlayers; ++i) players[i].numFinishedBeforeTick = players[i].numFinished;
+  pdhost_tick();
+  for (int i = 0; i < scenario->numPlayers; ++i) {
+    t_player *p = players+i;
+    // done events are sent by a clock, i.e. at the earliest in the tick after the track has finished
+    if (p->numDone > p->numFinishedBeforeTick) {
+      sim_violation(p, "more done events than finished tracks", p->numDone, (uint64_t) p->numFinishedBeforeTick);
+      p->numDone = p->numFinishedBeforeTick;
+    }
+    sim_checkMarkers(p);
+    sim_checkOutput(p);
+  }
+  sampleTime += SIM_BLOCK_SIZE;
+}
+
+static bool sim_runScenario(const t_scenario *s, uint64_t seed) {
+  scenario = s;
+  randomState = seed;
+  nowMs = 0.0;
+  numWorkers = 0;
+  numViolations = 0;
+  outputHash = 1469598103934665603ULL;
+  isDraining = false;
+  sampleTime = 0;
+  pdhost_init(SIM_SAMPLE_RATE, SIM_BLOCK_SIZE, &sim_outletHook);
+
+  // files of between 0.2 and 4 seconds, not aligned to blocks
+  for (int i = 1; i <= SIM_MAX_FILES; ++i) {
+    fileLengths[i] = (uint64_t) (SIM_SAMPLE_RATE/5 + sim_randomInt(SIM_SAMPLE_RATE*19/5));
+  }
+  if (s->numStems > 0) return sim_runStemsScenario(s);
+
+  // markers anywhere in the files, sent to every player
+  for (int m = 0; m < SIM_NUM_MARKERS; ++m) {
+    markerFrames[m] = (uint64_t) sim_randomInt(4000) * SIM_SAMPLE_RATE / 1000;
+  }
+
+  memset(players, 0, sizeof(players));
+  for (int i = 0; i < s->numPlayers; ++i) {
+    t_player *p = players+i;
+    p->object = pdhost_new("m4aPlayer", 0, NULL);
+    p->file = -1;
+    p->queued = -1;
+    p->loading = -1;
+    pdhost_dsp(p->object, 2, (t_sample *[]) {p->outL, p->outR});
+    if (s->isGroup) {
+      t_atom arg;
+      SETSYMBOL(&arg, gensym("stems"));
+      sim_send(p, "group", 1, &arg);
+    }
+    for (int m = 0; m < SIM_NUM_MARKERS; ++m) {
+      t_atom args[2];
+      SETFLOAT(args, (t_float) (markerFrames[m] * 1000 / SIM_SAMPLE_RATE));
+      SETFLOAT(args+1, (t_float) (m+1));
+      sim_send(p, "marker", 2, args);
+    }
+    sim_open(p, 1 + sim_randomInt(SIM_MAX_FILES), 0);
+  }
+
+  const double blockMs = (1000.0 * SIM_BLOCK_SIZE) / SIM_SAMPLE_RATE;
+  const int numBlocks = (int) (s->durationMs / blockMs);
+  double nextStormMs = (s->stormPeriodMs > 0.0) ? 0.0 : s->durationMs;
+  double tickMs = 0.0;
+  for (int b = 0; b < numBlocks; ++b) {
+    // the Pd thread runs each block at its nominal time, unless it is delayed
+    double dueMs = b * blockMs;
+    if (sim_random() < s->audioDelayChance) dueMs += sim_random() * s->audioDelayMaxMs;
+    if (dueMs > tickMs) tickMs = dueMs;
+    sim_runWorkers(tickMs);
+
+    // start the players shortly after they have been opened
+    if (b == (int) (50.0 / blockMs)) {
+      if (s->isGroup) sim_groupStart(0);
+      else for (int i = 0; i < s->numPlayers; ++i) sim_start(players+i);
+    }
+    while (nextStormMs <= b * blockMs) {
+      sim_storm();
+      nextStormMs += 2.0 * s->stormPeriodMs * sim_random();
+    }
+
+    sim_tick();
+  }
+
+  // Let the players run without new messages until every track which has
+  // finished has been reported. A done event can only be late if the decoder
+  // had not yet produced the end of the track when its last frame was played.
+  isDraining = true;
+  bool isDrained = false;
+  for (int b = numBlocks; b < numBlocks + (int) (1000.0 / blockMs) && !isDrained; ++b) {
+    sim_runWorkers(b * blockMs);
+    sim_tick();
+    isDrained = true;
+    for (int i = 0; i < s->numPlayers; ++i) {
+      isDrained &= (players[i].numDone + (players[i].isSilentEndPaused ? 1 : 0) == players[i].numFinished);
+    }
+  }
+  for (int i = 0; i < s->numPlayers; ++i) {
+    t_player *p = players+i;
+    if (p->numDone + (p->isSilentEndPaused ? 1 : 0) != p->numFinished) {
+      sim_violation(p, "tracks finished without a done event", p->numDone, (uint64_t) p->numFinished);
+    }
+  }
+
+  int numUnderrunBlocks = 0;
+  uint64_t numUnderrunFrames = 0;
+  int numFinished = 0;
+  int numMarkers = 0;
+  for (int i = 0; i < s->numPlayers; ++i) {
+    numUnderrunBlocks += players[i].numUnderrunBlocks;
+    numUnderrunFrames += players[i].numUnderrunFrames;
+    numFinished += players[i].numFinished;
+    numMarkers += players[i].numMarkers;
+    pdhost_free(players[i].object);
+  }
+  pdhost_dspStop();
+  printf("%-14s players %2d  blocks %6d  tracks finished %4d  underrun blocks %5d  underrun frames %7llu  markers %5d  violations %d  hash %016llx\n",
+      s->name, s->numPlayers, numBlocks * s->numPlayers, numFinished, numUnderrunBlocks,
+      (unsigned long long) numUnderrunFrames, numMarkers, numViolations, (unsigned long long) outputHash);
+  return numViolations == 0;
+}
+
+int main(int argc, char **argv) {
+  const uint64_t seed = (argc > 1) ? strtoull(argv[1], NULL, 10) : 1;
+  pdhost_init(SIM_SAMPLE_RATE, SIM_BLOCK_SIZE, &sim_outletHook);
+  m4aPlayer_setup();
+
+  bool isOk = true;
+  for (size_t i = 0; i < sizeof(scenarios)/sizeof(scenarios[0]); ++i) {
+    isOk &= sim_runScenario(scenarios+i, seed + i);
+  }
+  return isOk ? 0 : 1;
+}
@@ -0,0 +1,504 @@
+/**
+ * Copyright (c) 2016 Enzien Audio Ltd.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#define PD_CLASS_DEF
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pdhost.h"
+
+#define PDHOST_TIMEUNITPERMSEC (32.0 * 441.0)
+#define PDHOST_MAX_METHODS 64
+#define PDHOST_MAX_CLASSES 16
+#define PDHOST_MAX_ARRAYS 64
+#define PDHOST_MAX_DSP 1024
+
+struct _class {
+  t_symbol *c_name;
+  size_t c_size;
+  t_newmethod c_new;
+  t_method c_free;
+  t_atomtype c_newArgs[MAXPDARG+1];
+  int c_numMethods;
+  t_symbol *c_selectors[PDHOST_MAX_METHODS];
+  t_method c_methods[PDHOST_MAX_METHODS];
+  t_atomtype c_args[PDHOST_MAX_METHODS][MAXPDARG+1];
+};
+
+struct _clock {
+  void *c_owner;
+  t_method c_fn;
+  double c_setTime; // in logical time units, or -1 if unset
+  struct _clock *c_next;
+};
+
+struct _outlet {
+  void *o_owner;
+  int o_index;
+  struct _outlet *o_next;
+};
+
+struct _garray {
+  t_symbol *a_name;
+  int a_size;
+  t_word *a_vec;
+};
+
+t_symbol s_pointer = {"pointer", 0, 0};
+t_symbol s_float = {"float", 0, 0};
+t_symbol s_symbol = {"symbol", 0, 0};
+t_symbol s_bang = {"bang", 0, 0};
+t_symbol s_list = {"list", 0, 0};
+t_symbol s_anything = {"anything", 0, 0};
+t_symbol s_signal = {"signal", 0, 0};
+t_symbol s__N = {"#N", 0, 0};
+t_symbol s__X = {"#X", 0, 0};
+t_symbol s_x = {"x", 0, 0};
+t_symbol s_y = {"y", 0, 0};
+t_symbol s_ = {"", 0, 0};
+
+t_class *garray_class = NULL;
+
+static int sampleRate = 48000;
+static int blockSize = 64;
+static double logicalTime = 0.0;
+static char directory[512] = ".";
+static pdhost_outletHook outletHook = NULL;
+static pdhost_dspHook dspHook = NULL;
+
+static t_symbol *symbols = NULL;
+static t_class *classes[PDHOST_MAX_CLASSES];
+static int numClasses = 0;
+static t_clock *clocks = NULL;
+static t_outlet *outlets = NULL;
+static struct _garray arrays[PDHOST_MAX_ARRAYS];
+static int numArrays = 0;
+static t_int dspChain[PDHOST_MAX_DSP];
+static int dspChainLength = 0;
+
+void pdhost_init(int sr, int bs, pdhost_outletHook hook) {
+  sampleRate = sr;
+  blockSize = bs;
+  outletHook = hook;
+  logicalTime = 0.0;
+  dspChainLength = 0;
+}
+
+void pdhost_setDirectory(const char *path) {
+  snprintf(directory, sizeof(directory), "%s", path);
+}
+
+double pdhost_getTimeMs(void) {
+  return logicalTime / PDHOST_TIMEUNITPERMSEC;
+}
+
+t_symbol *gensym(const char *s) {
+  for (t_symbol *sym = symbols; sym != NULL; sym = sym->s_next) {
+    if (strcmp(sym->s_name, s) == 0) return sym;
+  }
+  t_symbol *sym = (t_symbol *) calloc(1, sizeof(t_symbol));
+  sym->s_name = strdup(s);
+  sym->s_next = symbols;
+  symbols = sym;
+  return sym;
+}
+
+t_symbol *canvas_getcurrentdir(void) {
+  return gensym(directory);
+}
+
+t_float sys_getsr(void) {
+  return (t_float) sampleRate;
+}
+
+int sys_getblksize(void) {
+  return blockSize;
+}
+
+void sys_lock(void) {}
+void sys_unlock(void) {}
+
+void post(const char *fmt, ...) {
+  va_list args;
+  va_start(args, fmt);
+  vfprintf(stderr, fmt, args);
+  fputc('\n', stderr);
+  va_end(args);
+}
+
+void error(const char *fmt, ...) {
+  va_list args;
+  va_start(args, fmt);
+  fprintf(stderr, "error: ");
+  vfprintf(stderr, fmt, args);
+  fputc('\n', stderr);
+  va_end(args);
+}
+
+void pd_error(void *object, const char *fmt, ...) {
+  va_list args;
+  va_start(args, fmt);
+  fprintf(stderr, "error: ");
+  vfprintf(stderr, fmt, args);
+  fputc('\n', stderr);
+  va_end(args);
+}
+
+/* classes */
+
+static void pdhost_readArgs(t_atomtype *types, t_atomtype first, va_list args) {
+  int n = 0;
+  for (t_atomtype type = first; type != A_NULL && n < MAXPDARG; type = (t_atomtype) va_arg(args, int)) {
+    types[n++] = type;
+  }
+  types[n] = A_NULL;
+}
+
+t_class *class_new(t_symbol *name, t_newmethod newmethod, t_method freemethod,
+    size_t size, int flags, t_atomtype arg1, ...) {
+  t_class *c = (t_class *) calloc(1, sizeof(t_class));
+  c->c_name = name;
+  c->c_size = size;
+  c->c_new = newmethod;
+  c->c_free = freemethod;
+  va_list args;
+  va_start(args, arg1);
+  pdhost_readArgs(c->c_newArgs, arg1, args);
+  va_end(args);
+  if (numClasses < PDHOST_MAX_CLASSES) classes[numClasses++] = c;
+  return c;
+}
+
+void class_addmethod(t_class *c, t_method fn, t_symbol *sel, t_atomtype arg1, ...) {
+  if (c->c_numMethods == PDHOST_MAX_METHODS) return;
+  const int i = c->c_numMethods++;
+  c->c_selectors[i] = sel;
+  c->c_methods[i] = fn;
+  va_list args;
+  va_start(args, arg1);
+  pdhost_readArgs(c->c_args[i], arg1, args);
+  va_end(args);
+}
+
+void class_addbang(t_class *c, t_method fn) {
+  class_addmethod(c, fn, &s_bang, A_NULL);
+}
+
+void class_doaddfloat(t_class *c, t_method fn) {
+  class_addmethod(c, fn, &s_float, A_FLOAT, A_NULL);
+}
+
+void class_addsymbol(t_class *c, t_method fn) {
+  class_addmethod(c, fn, &s_symbol, A_SYMBOL, A_NULL);
+}
+
+void class_addlist(t_class *c, t_method fn) {
+  class_addmethod(c, fn, &s_list, A_GIMME, A_NULL);
+}
+
+void class_addanything(t_class *c, t_method fn) {
+  class_addmethod(c, fn, &s_anything, A_GIMME, A_NULL);
+}
+
+void class_addcreator(t_newmethod newmethod, t_symbol *s, t_atomtype type1, ...) {}
+
+void class_sethelpsymbol(t_class *c, t_symbol *s) {}
+
+typedef void *(*t_newgimme)(t_symbol *s, int argc, t_atom *argv);
+typedef void (*t_methodgimme)(void *x, t_symbol *s, int argc, t_atom *argv);
+typedef void *(*t_fun)(t_int i1, t_int i2, t_int i3, t_int i4, t_int i5, t_int i6,
+    t_floatarg d1, t_floatarg d2, t_floatarg d3, t_floatarg d4, t_floatarg d5);
+
+// Calls a method with typed arguments in the same way as Pd does, passing the
+// pointer arguments and the float arguments separately.
+static void *pdhost_call(t_method fn, void *x, const t_atomtype *types, int argc, t_atom *argv) {
+  t_int ai[6] = {0};
+  t_floatarg ad[MAXPDARG] = {0};
+  int numInts = 0;
+  int numFloats = 0;
+  if (x != NULL) ai[numInts++] = (t_int) x;
+  for (int i = 0; types[i] != A_NULL; ++i) {
+    const t_atom *a = (i < argc) ? argv+i : NULL;
+    switch (types[i]) {
+      case A_FLOAT:
+      case A_DEFFLOAT: ad[numFloats++] = (a != NULL && a->a_type == A_FLOAT) ? a->a_w.w_float : 0.0f; break;
+      case A_SYMBOL:
+      case A_DEFSYM: ai[numInts++] = (t_int) ((a != NULL && a->a_type == A_SYMBOL) ? a->a_w.w_symbol : &s_); break;
+      default: break;
+    }
+  }
+  return ((t_fun) fn)(ai[0], ai[1], ai[2], ai[3], ai[4], ai[5], ad[0], ad[1], ad[2], ad[3], ad[4]);
+}
+
+void *pdhost_new(const char *className, int argc, t_atom *argv) {
+  t_symbol *name = gensym(className);
+  for (int i = 0; i < numClasses; ++i) {
+    t_class *c = classes[i];
+    if (c->c_name != name) continue;
+    if (c->c_newArgs[0] == A_GIMME) return ((t_newgimme) c->c_new)(name, argc, argv);
+    return pdhost_call((t_method) c->c_new, NULL, c->c_newArgs, argc, argv);
+  }
+  error("pdhost: no class %s", className);
+  return NULL;
+}
+
+void pdhost_free(void *x) {
+  t_class *c = *((t_class **) x);
+  if (c->c_free != NULL) ((void (*)(void *)) c->c_free)(x);
+  for (t_outlet **o = &outlets; *o != NULL;) {
+    if ((*o)->o_owner == x) {
+      t_outlet *d = *o;
+      *o = d->o_next;
+      free(d);
+    } else {
+      o = &(*o)->o_next;
+    }
+  }
+  free(x);
+}
+
+void pdhost_send(void *x, const char *selector, int argc, t_atom *argv) {
+  t_class *c = *((t_class **) x);
+  t_symbol *sel = gensym(selector);
+  for (int i = 0; i < c->c_numMethods; ++i) {
+    if (c->c_selectors[i] != sel) continue;
+    if (c->c_args[i][0] == A_GIMME) ((t_methodgimme) c->c_methods[i])(x, sel, argc, argv);
+    else pdhost_call(c->c_methods[i], x, c->c_args[i], argc, argv);
+    return;
+  }
+  error("pdhost: %s has no method for %s", c->c_name->s_name, selector);
+}
+
+t_pd *pd_new(t_class *c) {
+  t_pd *x = (t_pd *) calloc(1, c->c_size);
+  *x = c;
+  return x;
+}
+
+/* outlets */
+
+t_outlet *outlet_new(t_object *owner, t_symbol *s) {
+  t_outlet *o = (t_outlet *) calloc(1, sizeof(t_outlet));
+  o->o_owner = owner;
+  for (t_outlet *p = outlets; p != NULL; p = p->o_next) {
+    if (p->o_owner == owner) ++o->o_index;
+  }
+  o->o_next = outlets;
+  outlets = o;
+  return o;
+}
+
+void outlet_free(t_outlet *o) {
+  for (t_outlet **p = &outlets; *p != NULL; p = &(*p)->o_next) {
+    if (*p == o) {
+      *p = o->o_next;
+      break;
+    }
+  }
+  free(o);
+}
+
+static void pdhost_output(t_outlet *o, t_symbol *s, int argc, t_atom *argv) {
+  if (outletHook != NULL) outletHook(o->o_owner, o->o_index, s, argc, argv);
+}
+
+void outlet_bang(t_outlet *o) {
+  pdhost_output(o, &s_bang, 0, NULL);
+}
+
+void outlet_float(t_outlet *o, t_float f) {
+  t_atom a;
+  SETFLOAT(&a, f);
+  pdhost_output(o, &s_float, 1, &a);
+}
+
+void outlet_symbol(t_outlet *o, t_symbol *s) {
+  t_atom a;
+  SETSYMBOL(&a, s);
+  pdhost_output(o, &s_symbol, 1, &a);
+}
+
+void outlet_list(t_outlet *o, t_symbol *s, int argc, t_atom *argv) {
+  pdhost_output(o, &s_list, argc, argv);
+}
+
+void outlet_anything(t_outlet *o, t_symbol *s, int argc, t_atom *argv) {
+  pdhost_output(o, s, argc, argv);
+}
+
+/* clocks */
+
+t_clock *clock_new(void *owner, t_method fn) {
+  t_clock *c = (t_clock *) calloc(1, sizeof(t_clock));
+  c->c_owner = owner;
+  c->c_fn = fn;
+  c->c_setTime = -1.0;
+  c->c_next = clocks;
+  clocks = c;
+  return c;
+}
+
+void clock_unset(t_clock *c) {
+  c->c_setTime = -1.0;
+}
+
+void clock_set(t_clock *c, double setTime) {
+  c->c_setTime = (setTime < logicalTime) ? logicalTime : setTime;
+}
+
+void clock_delay(t_clock *c, double delayTime) {
+  clock_set(c, logicalTime + ((delayTime > 0.0) ? delayTime : 0.0) * PDHOST_TIMEUNITPERMSEC);
+}
+
+void clock_free(t_clock *c) {
+  for (t_clock **p = &clocks; *p != NULL; p = &(*p)->c_next) {
+    if (*p == c) {
+      *p = c->c_next;
+      break;
+    }
+  }
+  free(c);
+}
+
+double clock_getlogicaltime(void) {
+  return logicalTime;
+}
+
+double clock_getsystime(void) {
+  return logicalTime;
+}
+
+double clock_gettimesince(double prevTime) {
+  return (logicalTime - prevTime) / PDHOST_TIMEUNITPERMSEC;
+}
+
+double clock_getsystimeafter(double delayTime) {
+  return logicalTime + delayTime * PDHOST_TIMEUNITPERMSEC;
+}
+
+/* dsp */
+
+void dsp_add(t_perfroutine f, int n, ...) {
+  if (dspChainLength + n + 1 > PDHOST_MAX_DSP) return;
+  va_list args;
+  va_start(args, n);
+  dspChain[dspChainLength++] = (t_int) f;
+  for (int i = 0; i < n; ++i) dspChain[dspChainLength++] = va_arg(args, t_int);
+  va_end(args);
+}
+
+void pdhost_dsp(void *x, int numSignals, t_sample **vecs) {
+  t_signal *signals = (t_signal *) calloc(numSignals, sizeof(t_signal));
+  t_signal **sp = (t_signal **) calloc(numSignals, sizeof(t_signal *));
+  for (int i = 0; i < numSignals; ++i) {
+    signals[i].s_n = blockSize;
+    signals[i].s_vec = vecs[i];
+    signals[i].s_sr = (t_float) sampleRate;
+    sp[i] = signals+i;
+  }
+  // like Pd, call the dsp method directly with the signals
+  t_class *c = *((t_class **) x);
+  for (int i = 0; i < c->c_numMethods; ++i) {
+    if (c->c_selectors[i] == gensym("dsp")) ((void (*)(void *, t_signal **)) c->c_methods[i])(x, sp);
+  }
+  free(sp);
+  free(signals);
+}
+
+void pdhost_dspStop(void) {
+  dspChainLength = 0;
+}
+
+void pdhost_setDspHook(pdhost_dspHook hook) {
+  dspHook = hook;
+}
+
+void pdhost_tick(void) {
+  const double endTime = logicalTime + (PDHOST_TIMEUNITPERMSEC * 1000.0 * blockSize) / sampleRate;
+
+  // fire the clocks which are due in this block, in order
+  for (;;) {
+    t_clock *next = NULL;
+    for (t_clock *c = clocks; c != NULL; c = c->c_next) {
+      if (c->c_setTime >= 0.0 && c->c_setTime < endTime && (next == NULL || c->c_setTime < next->c_setTime)) next = c;
+    }
+    if (next == NULL) break;
+    logicalTime = next->c_setTime;
+    next->c_setTime = -1.0;
+    ((void (*)(void *)) next->c_fn)(next->c_owner);
+  }
+  logicalTime = endTime;
+
+  if (dspHook != NULL) dspHook(true);
+  for (int i = 0; i < dspChainLength;) {
+    t_int *w = ((t_perfroutine) dspChain[i])(dspChain+i);
+    i = (int) (w - dspChain);
+  }
+  if (dspHook != NULL) dspHook(false);
+}
+
+/* arrays */
+
+void pdhost_newArray(const char *name, int size) {
+  if (numArrays == PDHOST_MAX_ARRAYS) return;
+  struct _garray *a = arrays + numArrays++;
+  a->a_name = gensym(name);
+  a->a_size = size;
+  a->a_vec = (t_word *) calloc(size > 0 ? size : 1, sizeof(t_word));
+}
+
+t_word *pdhost_getArray(const char *name, int *size) {
+  t_symbol *s = gensym(name);
+  for (int i = 0; i < numArrays; ++i) {
+    if (arrays[i].a_name == s) {
+      *size = arrays[i].a_size;
+      return arrays[i].a_vec;
+    }
+  }
+  return NULL;
+}
+
+t_pd *pd_findbyclass(t_symbol *s, t_class *c) {
+  for (int i = 0; i < numArrays; ++i) {
+    if (arrays[i].a_name == s) return (t_pd *) (arrays+i);
+  }
+  return NULL;
+}
+
+int garray_getfloatwords(t_garray *x, int *size, t_word **vec) {
+  *size = x->a_size;
+  *vec = x->a_vec;
+  return 1;
+}
+
+int garray_npoints(t_garray *x) {
+  return x->a_size;
+}
+
+void garray_resize_long(t_garray *x, long n) {
+  x->a_vec = (t_word *) realloc(x->a_vec, (n > 0 ? n : 1) * sizeof(t_word));
+  for (long i = x->a_size; i < n; ++i) x->a_vec[i].w_float = 0.0f;
+  x->a_size = (int) n;
+}
+
+void garray_resize(t_garray *x, t_floatarg n) {
+  garray_resize_long(x, (long) n);
+}
+
+void garray_redraw(t_garray *x) {}
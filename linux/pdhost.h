@@ -0,0 +1,73 @@
+/**
+ * Copyright (c) 2016 Enzien Audio Ltd.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _PDHOST_H_
+#define _PDHOST_H_
+
+#include <stdbool.h>
+
+#include "m_pd.h"
+
+/*
+ * A minimal single-threaded stand-in for Pd, for running m4aPlayer on Linux
+ * without Pd or libpd, e.g. in the simulator. It implements the parts of the Pd
+ * API which m4aPlayer uses. Logical time only advances in pdhost_tick(), so
+ * runs are deterministic.
+ */
+
+// called for every message sent to an outlet of any object
+typedef void (*pdhost_outletHook)(void *owner, int outlet, t_symbol *s, int argc, t_atom *argv);
+
+void pdhost_init(int sampleRate, int blockSize, pdhost_outletHook hook);
+
+// the directory which objects are created in, i.e. canvas_getcurrentdir()
+void pdhost_setDirectory(const char *path);
+
+// creates an object of a class registered with class_new(). Returns NULL on failure.
+void *pdhost_new(const char *className, int argc, t_atom *argv);
+
+void pdhost_free(void *x);
+
+// sends a message to an object, like pd_typedmess()
+void pdhost_send(void *x, const char *selector, int argc, t_atom *argv);
+
+// adds the object's perform routine to the DSP chain, with numSignals signal
+// vectors of the block size. The vectors can be read after each pdhost_tick().
+void pdhost_dsp(void *x, int numSignals, t_sample **vecs);
+
+// clears the DSP chain
+void pdhost_dspStop(void);
+
+// called with true before the DSP chain runs in pdhost_tick(), and with false
+// after it, e.g. to check what the perform routines do
+typedef void (*pdhost_dspHook)(bool isEntering);
+
+void pdhost_setDspHook(pdhost_dspHook hook);
+
+// Runs one block like Pd's scheduler: clocks which are due before the end of
+// the block are fired at their logical times, then the DSP chain runs.
+void pdhost_tick(void);
+
+// the current logical time in ms
+double pdhost_getTimeMs(void);
+
+// creates a float array (i.e. a garray) with the given name
+void pdhost_newArray(const char *name, int size);
+
+// returns the contents of an array, or NULL if it does not exist
+t_word *pdhost_getArray(const char *name, int *size);
+
+#endif // _PDHOST_H_